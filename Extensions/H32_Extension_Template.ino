@@ -39,12 +39,17 @@ public:
    */
   bool read(H32_Measurements &measurements);
   /*
-   * The collect() method is used to collect your sensor data into the map
-   * that is provides as a reference parameter. Data you add here will be
-   * added to the JSON that is sent via MQTT and to IOTPLotter.
+   * The collect() method is used to add your sensor data to the measurements
+   * that are provided as a reference parameter. Intern your quantities once
+   * (e.g. in init()) and keep their ids:
+   *   id = H32_Measurements::intern("My Value", "V", 1000);
+   *   measurements.set(id, value);
+   * The values are stored as value * scale (here 1000) in 32 bits, choose a
+   * smaller scale for large values.
+   * Data you add here is sent to all services, i.e. MQTT, IOTPlotter and the backlog.
    * @return true if successful
    */
-  bool collect(unordered_map<char *, double> &data);
+  bool collect(H32_Measurements &measurements);
   /*
    * the api_call() method allows to implement your own method of sending data
    * using WiFi connectivity. The method is only called when a WiFi connection
@@ -55,7 +60,7 @@ public:
    * @return true if successful
    */
   bool api_call(char* api_key, char *api_additional,
-       H32_Measurements &measurements, unordered_map<char *, double> &additional_data);
+       H32_Measurements &measurements);
   /*
    * the api_call_no_wifi() method allows to implement your own method of
    * sending data without WiFi connectivity. The method is only called when
@@ -65,7 +70,7 @@ public:
    * @return true if successful
    */
   bool api_call_no_wifi(char* api_key, char *api_additional,
-       H32_Measurements &measurements, unordered_map<char *, double> &additional_data);
+       H32_Measurements &measurements);
   /*
    * This method allows a user extension to veto the incremental backup functionality.
    * This means that if no WiFi is available, still the normal interval for the sleep
@@ -73,7 +78,13 @@ public:
    * transfer the data (e.g. by using a LoRa communication if available).
    * @return true if the interval should not be changed i.e., the configuration value will be used
    */
-  bool veto_backup();
+  bool veto_backoff();
+  /*
+   * The before_shutdown() method is called right before the H32 powers off.
+   * Use it to finish what is still running and to put your devices to sleep.
+   * @return true if successful
+   */
+  bool before_shutdown();
 
 };
 namespace {
@@ -89,6 +100,25 @@ namespace {
   Extension *userExtension = new UserExtension();
 }
 
+/*
+ * If your extension needs settings, keep them in a struct of your own and
+ * register a table of its fields (see H32_Schema.h). They are shown in the
+ * portal after the ones of the H32 and saved together with them. Use a
+ * nested struct so that your fields get their own object in the json file:
+ *
+ * typedef struct UserConfig {
+ *   struct {
+ *     uint16_t interval = 60;
+ *   } user;
+ * } UserConfig;
+ * UserConfig user_config;
+ * const H32_Field user_config_fields[] = {
+ *   H32_HTML("<h2>User Extension</h2>"),
+ *   H32_FIELD_3(UserConfig, user, interval, "user_interval", "User Interval in seconds", "pattern='\\d{0,5}'"),
+ * };
+ * H32_Schema_Registration user_config_registration(user_config_fields, H32_FIELD_NUM(user_config_fields), &user_config);
+ */
+
 bool UserExtension::init(H32_Measurements &measurements) { 
   debug_println("UserExtension Init");
   return true;
@@ -101,20 +131,24 @@ bool UserExtension::read(H32_Measurements &measurements) {
   debug_println("UserExtension Read");
   return true;
 };
-bool UserExtension::collect(unordered_map<char *, double> &data) {
+bool UserExtension::collect(H32_Measurements &measurements) {
   debug_println("UserExtension Collect");
   return true;
 };
 bool UserExtension::api_call(char* api_key, char *api_additional,
-        H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
+        H32_Measurements &measurements) {
   debug_println("UserExtension: Default API Call");
   return true;
 };
 bool UserExtension::api_call_no_wifi(char* api_key, char *api_additional,
-        H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
+        H32_Measurements &measurements) {
   debug_println("UserExtension: Default API Call without WiFi");
   return true;
 };
-bool UserExtension::veto_backup() {
+bool UserExtension::veto_backoff() {
   return false;
 }
+bool UserExtension::before_shutdown() {
+  debug_println("UserExtension Before Shutdown");
+  return true;
+}
@@ -0,0 +1,284 @@
+/*
+ * This extension sends the measurements with a LoRa module (SX127x, e.g.
+ * the RFM95) as a compact binary packet in the format of H32_Codec.h: the
+ * core values, the named values of the extensions and a sequence number
+ * that allows the receiver to detect lost packets.
+ *
+ * The packet is sent asynchronously, the H32 continues with its uploads in
+ * the meantime. Before the H32 powers off, the end of the transmission is
+ * polled (an interrupt handler must not use the SPI bus) and the radio is
+ * put to sleep.
+ * In the EU868 band the duty cycle of the sub-band is tracked across wake
+ * cycles (see H32_LoRa.h), a packet that would exceed it is not sent.
+ *
+ * Copy this file and H32_LoRa.h into the sketch folder to use it.
+ */
+#include <LoRa.h>
+#include <Preferences.h>
+#include <SPI.h>
+
+#include "H32_LoRa.h"
+
+const uint16_t lora_payload_max = 222;    // the smallest maximum of all data rates
+const uint16_t lora_tx_margin = 200;      // ms beyond the time on air
+const char *lora_prefs = "h32_lora";
+const char *lora_prefs_key = "state";
+const uint8_t lora_reg_irq_flags = 0x12;  // SX127x register
+const uint8_t lora_irq_tx_done = 0x08;
+const uint32_t lora_spi_frequency = 8000000;  // as used by the LoRa library
+
+/*
+ * The settings of the radio, the defaults fit the H32 with an RFM95
+ */
+typedef struct LoRaConfig {
+  struct {
+    uint32_t frequency = 868100000;   // Hz
+    uint8_t sf = 9;                   // spreading factor 7 - 12
+    uint32_t bandwidth = 125000;      // Hz
+    uint8_t coding_rate = 5;          // denominator of 4/5 - 4/8
+    uint8_t power = 14;               // dBm, 2 - 20
+    uint8_t sync_word = 0x12;
+    uint8_t names = 1;                // 0 sends only the core values
+    int8_t pin_ss = 16;
+    int8_t pin_reset = 17;
+    int8_t pin_dio0 = 26;
+  } lora;
+} LoRaConfig;
+LoRaConfig lora_config;
+const H32_Field lora_config_fields[] = {
+  H32_HTML("<h2>LoRa</h2>"),
+  H32_FIELD_3(LoRaConfig, lora, frequency, "lora_frequency", "Frequency in Hz", "pattern='\\d{9}'"),
+  H32_FIELD_3(LoRaConfig, lora, sf, "lora_sf", "Spreading Factor (7 - 12)", "pattern='[7-9]|1[012]'"),
+  H32_FIELD_3(LoRaConfig, lora, bandwidth, "lora_bandwidth", "Bandwidth in Hz", "pattern='\\d{4,6}'"),
+  H32_FIELD_3(LoRaConfig, lora, coding_rate, "lora_coding_rate", "Coding Rate 4/x (5 - 8)", "pattern='[5-8]'"),
+  H32_FIELD_3(LoRaConfig, lora, power, "lora_power", "Transmit Power in dBm (2 - 20)", "pattern='\\d{1,2}'"),
+  H32_FIELD_3(LoRaConfig, lora, sync_word, "lora_sync_word", "Sync Word", "pattern='\\d{1,3}'"),
+  H32_FIELD_3(LoRaConfig, lora, names, "lora_names", "Send the Named Values<br/>(0 only the core values)", "pattern='[01]'"),
+  H32_FIELD_3(LoRaConfig, lora, pin_ss, "lora_pin_ss", "SS Pin", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(LoRaConfig, lora, pin_reset, "lora_pin_reset", "Reset Pin", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(LoRaConfig, lora, pin_dio0, "lora_pin_dio0", "DIO0 Pin", "pattern='\\d{0,2}'"),
+};
+H32_Schema_Registration lora_config_registration(lora_config_fields, H32_FIELD_NUM(lora_config_fields), &lora_config);
+
+/*
+ * What has to survive the power-off, kept in NVS
+ */
+typedef struct H32_LoRa_State {
+  uint32_t seq;
+  H32_Duty_Cycle_State duty;
+} H32_LoRa_State;
+
+/*
+ * Access a register of the radio. The LoRa library only offers this to its
+ * interrupt handler, which must not use the SPI bus.
+ */
+uint8_t lora_transfer(uint8_t address, uint8_t value) {
+  SPI.beginTransaction(SPISettings(lora_spi_frequency, MSBFIRST, SPI_MODE0));
+  digitalWrite(lora_config.lora.pin_ss, LOW);
+  SPI.transfer(address);
+  uint8_t result = SPI.transfer(value);
+  digitalWrite(lora_config.lora.pin_ss, HIGH);
+  SPI.endTransaction();
+  return result;
+}
+
+uint8_t lora_read_register(uint8_t address) {
+  return lora_transfer(address & 0x7F, 0);
+}
+
+void lora_write_register(uint8_t address, uint8_t value) {
+  lora_transfer(address | 0x80, value);
+}
+
+bool lora_tx_done() {
+  if (lora_read_register(lora_reg_irq_flags) & lora_irq_tx_done) {
+    // clear the flag for the next packet
+    lora_write_register(lora_reg_irq_flags, lora_irq_tx_done);
+    return true;
+  }
+  return false;
+}
+
+class LoRa_Extension : public Extension {
+private:
+  bool lora_init_successful = false;
+  bool sending = false;
+  uint32_t tx_start = 0;
+  uint32_t tx_airtime = 0;
+  H32_LoRa_State state = {};
+  H32_LoRa_State saved_state = {};    // as in NVS
+
+  bool loadState();
+  bool saveState();
+  bool send(H32_Measurements &measurements);
+public:
+  bool init(H32_Measurements &measurements);
+  bool api_call(char* api_key, char *api_additional,
+       H32_Measurements &measurements);
+  bool api_call_no_wifi(char* api_key, char *api_additional,
+       H32_Measurements &measurements);
+  /*
+   * The sleep time is not increased without WiFi if the packet went out
+   */
+  bool veto_backoff();
+  /*
+   * Wait for the packet and put the radio to sleep
+   */
+  bool before_shutdown();
+};
+namespace {
+  Extension *loraExtension = new LoRa_Extension();
+}
+
+bool LoRa_Extension::loadState() {
+  Preferences lora_state_prefs;
+  bool result = false;
+  if (lora_state_prefs.begin(lora_prefs, true)) {
+    result = lora_state_prefs.getBytes(lora_prefs_key, &state, sizeof(state)) == sizeof(state);
+    lora_state_prefs.end();
+  }
+  if (!result) {
+    memset(&state, 0, sizeof(state));
+  }
+  saved_state = state;
+  return result;
+}
+
+/*
+ * Write the state to NVS, unless it is unchanged
+ */
+bool LoRa_Extension::saveState() {
+  if (memcmp(&state, &saved_state, sizeof(state)) == 0) {
+    return true;
+  }
+  Preferences lora_state_prefs;
+  bool result = false;
+  if (lora_state_prefs.begin(lora_prefs, false)) {
+    result = lora_state_prefs.putBytes(lora_prefs_key, &state, sizeof(state)) == sizeof(state);
+    lora_state_prefs.end();
+  }
+  if (result) {
+    saved_state = state;
+  }
+  return result;
+}
+
+bool LoRa_Extension::init(H32_Measurements &measurements) {
+  debug_println("LoRa_Extension Init");
+
+  LoRa.setPins(lora_config.lora.pin_ss, lora_config.lora.pin_reset, lora_config.lora.pin_dio0);
+  if (!LoRa.begin(lora_config.lora.frequency)) {
+    debug_println("Starting LoRa failed!");
+    return false;
+  }
+  LoRa.setSpreadingFactor(lora_config.lora.sf);
+  LoRa.setSignalBandwidth(lora_config.lora.bandwidth);
+  LoRa.setCodingRate4(lora_config.lora.coding_rate);
+  LoRa.setTxPower(lora_config.lora.power);
+  LoRa.setSyncWord(lora_config.lora.sync_word);
+  LoRa.enableCrc();
+  // Sleep until there is something to send
+  LoRa.sleep();
+  loadState();
+  lora_init_successful = true;
+  debug_println("LoRa Started!");
+  return true;
+};
+
+/*
+ * Start sending the measurements, the packet is on the air when this returns
+ * @return true if the packet has been started
+ */
+bool LoRa_Extension::send(H32_Measurements &measurements) {
+  if (!lora_init_successful || sending || power_survival_mode()) {
+    return false;
+  }
+
+  // The named values, in the order of the header. A message takes all
+  // quantities of the registry.
+  static_assert(codec_names_max >= measurement_capacity - measurement_core_num,
+                "a packet has to hold every named value");
+  const char *names[codec_names_max];
+  float named[codec_names_max];
+  uint8_t names_num = 0;
+  for (H32_Measurement_Id id = measurement_core_num;
+       lora_config.lora.names && id < H32_Measurements::count(); id++) {
+    if (measurements.has(id)) {
+      names[names_num] = H32_Measurements::quantity(id).name;
+      named[names_num++] = measurements.get(id);
+    }
+  }
+  float core[codec_core_num];
+  for (H32_Measurement_Id id = 0; id < codec_core_num; id++) {
+    core[id] = measurements.has(id) ? measurements.get(id) : NAN;
+  }
+
+  uint8_t payload[lora_payload_max];
+  H32_Encoder encoder(payload, sizeof(payload));
+  uint32_t epoch = measurements.getEpoch() != 0 ? measurements.getEpoch() : RTC_get_epoch();
+  if (!encoder.begin(names, names_num) || !encoder.add(state.seq + 1, epoch, core, named)) {
+    // without the names it always fits
+    debug_print("LoRa: the named values do not fit into the packet: ");
+    debug_println(names_num);
+    encoder.begin(names, 0);
+    encoder.add(state.seq + 1, epoch, core, named);
+  }
+
+  uint32_t airtime = lora_airtime(encoder.length(), lora_config.lora.sf,
+                                  lora_config.lora.bandwidth, lora_config.lora.coding_rate);
+  // spend() brings state.duty up to date even if it vetoes the packet, but
+  // only a sent packet saves the state. A vetoed packet leaves the stored
+  // state as it was, the next wake adds the same credit from its epoch.
+  H32_Duty_Cycle duty(state.duty, lora_duty_cycle(lora_config.lora.frequency));
+  if (!duty.spend(airtime, RTC_get_epoch())) {
+    debug_print("LoRa: duty cycle exceeded, next packet in s: ");
+    debug_println(duty.wait(airtime, RTC_get_epoch()));
+    return false;
+  }
+  state.seq++;
+  saveState();
+
+  debug_print("LoRa: sending packet ");
+  debug_print(state.seq);
+  debug_print(", bytes ");
+  debug_print(encoder.length());
+  debug_print(", ms on air ");
+  debug_println(airtime);
+
+  LoRa.beginPacket();
+  LoRa.write(payload, encoder.length());
+  LoRa.endPacket(true);
+  tx_start = millis();
+  tx_airtime = airtime;
+  sending = true;
+  return true;
+}
+
+bool LoRa_Extension::api_call(char* api_key, char *api_additional,
+        H32_Measurements &measurements) {
+  return send(measurements);
+};
+bool LoRa_Extension::api_call_no_wifi(char* api_key, char *api_additional,
+        H32_Measurements &measurements) {
+  return send(measurements);
+};
+bool LoRa_Extension::veto_backoff() {
+  return sending;
+}
+
+bool LoRa_Extension::before_shutdown() {
+  if (!lora_init_successful) {
+    return true;
+  }
+  bool result = true;
+  if (sending) {
+    while (!(result = lora_tx_done()) && millis() - tx_start < tx_airtime + lora_tx_margin) {
+      delay(5);
+    }
+    debug_println(result ? "LoRa: packet sent" : "LoRa: packet timed out");
+    sending = false;
+  }
+  LoRa.sleep();
+  LoRa.end();
+  return result;
+}
@@ -29,27 +29,36 @@ public:
     debug_println("Extension: Default wiFiInitialized");
     return true;
   };
-  virtual bool read(H32_Measurements measurements) {
+  virtual bool read(H32_Measurements &measurements) {
     debug_println("Extension: Default Read");
     return true;
   };
-  virtual bool collect(unordered_map<char *, double> &data) {
+  /*
+   * Add the values of the extension to the measurements, with ids
+   * obtained from H32_Measurements::intern()
+   */
+  virtual bool collect(H32_Measurements &measurements) {
     debug_println("Extension: Default Collect");
     return true;
   };
-  virtual bool api_call(char* api_key, char *api_additional, 
-          H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
+  virtual bool api_call(char* api_key, char *api_additional, H32_Measurements &measurements) {
      debug_println("Extension: Default API Call");
      return true;
   };
-  virtual bool api_call_no_wifi(char* api_key, char *api_additional,
-          H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
+  virtual bool api_call_no_wifi(char* api_key, char *api_additional, H32_Measurements &measurements) {
      debug_println("Extension: Default API Call without WiFi");
      return true;
   };
   virtual bool veto_backoff() {
     return false;
   }
+  /*
+   * Called right before the H32 powers off, e.g. to finish a transmission
+   * and put a radio to sleep
+   */
+  virtual bool before_shutdown() {
+    return true;
+  };
 };
 // Out-of-line initialization for non-const static members
 vector<Extension *>  *Extension::userFunctions = NULL;
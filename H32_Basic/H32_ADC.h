@@ -0,0 +1,201 @@
+#ifndef H32_ADC_H
+#define H32_ADC_H
+
+/*
+ * The ADC engine samples all configured channels in one burst and filters
+ * the samples of each channel. Sampling is done by an H32_ADC_Source, the
+ * sketch implements it with the continuous (DMA) mode of the ESP32 and with
+ * single reads as a fallback (see H32_Read_Voltage.ino). The filters and the
+ * calibration only use integer arithmetic and don't depend on the hardware.
+ */
+
+const uint8_t adc_channel_max = 6;    // bat_v, ext_v and up to 4 voltage dividers
+const uint16_t adc_samples_max = 64;  // per channel and burst
+
+enum H32_ADC_Filter : uint8_t {
+  adc_filter_mean = 0,
+  adc_filter_median = 1,
+  adc_filter_trimmed_mean = 2,  // drops a quarter of the samples at each end
+};
+
+/*
+ * Sort the samples in place. Insertion sort is fast for the few samples we take.
+ */
+inline void adc_sort(uint16_t *samples, uint16_t count) {
+  for(uint16_t i = 1; i < count; i++) {
+    uint16_t value = samples[i];
+    uint16_t j = i;
+    for(; j > 0 && samples[j - 1] > value; j--) {
+      samples[j] = samples[j - 1];
+    }
+    samples[j] = value;
+  }
+}
+
+/*
+ * The rounded mean of the samples
+ */
+inline uint16_t adc_mean(const uint16_t *samples, uint16_t count) {
+  if(count == 0) {
+    return 0;
+  }
+  uint32_t sum = 0;
+  for(uint16_t i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+  return (sum + count / 2) / count;
+}
+
+/*
+ * The median of the samples (the rounded mean of the middle two for an even count).
+ * The samples are sorted in place.
+ */
+inline uint16_t adc_median(uint16_t *samples, uint16_t count) {
+  if(count == 0) {
+    return 0;
+  }
+  adc_sort(samples, count);
+  if(count % 2 == 1) {
+    return samples[count / 2];
+  }
+  return adc_mean(samples + count / 2 - 1, 2);
+}
+
+/*
+ * The mean of the samples without the trim lowest and trim highest ones.
+ * The samples are sorted in place.
+ */
+inline uint16_t adc_trimmed_mean(uint16_t *samples, uint16_t count, uint16_t trim) {
+  if(2 * trim >= count) {
+    return adc_median(samples, count);
+  }
+  adc_sort(samples, count);
+  return adc_mean(samples + trim, count - 2 * trim);
+}
+
+inline uint16_t adc_filter(H32_ADC_Filter filter, uint16_t *samples, uint16_t count) {
+  switch(filter) {
+    case adc_filter_median:       return adc_median(samples, count);
+    case adc_filter_trimmed_mean: return adc_trimmed_mean(samples, count, count / 4);
+    default:                      return adc_mean(samples, count);
+  }
+}
+
+/*
+ * A channel and its calibration, a polynomial of up to third order:
+ *
+ *   volts = c0 + c1 * x + c2 * x^2 + c3 * x^3   with x the measured volts
+ *
+ * It is evaluated with Horner's method in fixed point. The polynomial is
+ * rewritten for millivolts and x is scaled to u = x / adc_poly_scale (0 <= u < 1
+ * for all readings of the ADC), the coefficients are kept as millivolts in
+ * 56.8 fixed point. Every step of Horner's method then is a multiplication
+ * with u in 16.16 fixed point, which keeps the precision of all coefficients
+ * and doesn't overflow for |c3| < 8.
+ */
+const uint8_t adc_poly_num = 4;
+const uint32_t adc_poly_scale = 4096;   // millivolts
+
+typedef struct H32_ADC_Channel {
+  int8_t pin;
+  int8_t activation;            // pin powering the divider, 0 if none
+  int64_t poly[adc_poly_num];   // coefficients for u in 56.8 fixed point millivolts
+
+  void setCalibration(double c0, double c1, double c2 = 0, double c3 = 0) {
+    double c[adc_poly_num] = {c0 * 1000, c1, c2 / 1000, c3 / 1000000};
+    double scale = 256;
+    for(uint8_t k = 0; k < adc_poly_num; k++) {
+      double value = c[k] * scale;
+      poly[k] = (int64_t)(value + (value < 0 ? -0.5 : 0.5));
+      scale *= adc_poly_scale;
+    }
+  }
+  int32_t calibrate(uint16_t millivolts) const {
+    int64_t u = ((int64_t)millivolts << 16) / adc_poly_scale;
+    int64_t result = poly[adc_poly_num - 1];
+    for(int8_t k = adc_poly_num - 2; k >= 0; k--) {
+      result = ((result * u) >> 16) + poly[k];
+    }
+    return (int32_t)((result + 128) >> 8);
+  }
+} H32_ADC_Channel;
+
+/*
+ * Samples the ADC
+ */
+class H32_ADC_Source {
+public:
+  /*
+   * Sample each of the num pins count times in one burst. The samples
+   * are interleaved: samples[i * num + c] is the i-th sample of pins[c],
+   * in millivolts.
+   * @return false if the pins could not be sampled
+   */
+  virtual bool sample(const int8_t *pins, uint8_t num, uint16_t *samples, uint16_t count) = 0;
+};
+
+class H32_ADC_Engine {
+private:
+  uint8_t num = 0;
+  H32_ADC_Channel channels[adc_channel_max];
+  int8_t pins[adc_channel_max];
+  int32_t results[adc_channel_max];
+  uint16_t samples[adc_channel_max * adc_samples_max];
+  uint16_t scratch[adc_samples_max];
+public:
+  void clear() { num = 0; };
+  uint8_t getNum() const { return num; };
+  const H32_ADC_Channel &getChannel(uint8_t index) const { return channels[index]; };
+
+  /*
+   * Add a channel
+   * @return the index of the channel, -1 if there are too many
+   */
+  int8_t add(int8_t pin, int8_t activation, double c0, double c1, double c2 = 0, double c3 = 0) {
+    if(num >= adc_channel_max) {
+      return -1;
+    }
+    channels[num].pin = pin;
+    channels[num].activation = activation;
+    channels[num].setCalibration(c0, c1, c2, c3);
+    pins[num] = pin;
+    results[num] = 0;
+    return num++;
+  };
+
+  /*
+   * Sample all channels with the source and filter and calibrate the samples
+   * @return false if the source failed
+   */
+  bool acquire(H32_ADC_Source &source, uint16_t count, H32_ADC_Filter filter) {
+    if(count == 0 || count > adc_samples_max) {
+      count = adc_samples_max;
+    }
+    if(num == 0) {
+      return true;
+    }
+    if(!source.sample(pins, num, samples, count)) {
+      return false;
+    }
+    for(uint8_t c = 0; c < num; c++) {
+      for(uint16_t i = 0; i < count; i++) {
+        scratch[i] = samples[i * num + c];
+      }
+      results[c] = channels[c].calibrate(adc_filter(filter, scratch, count));
+    }
+    return true;
+  };
+
+  int32_t getMillivolts(int8_t index) const {
+    return index >= 0 && index < num ? results[index] : 0;
+  };
+  /*
+   * The voltage rounded to two decimal places
+   */
+  double getVolts(int8_t index) const {
+    int32_t millivolts = getMillivolts(index);
+    return (millivolts >= 0 ? (millivolts + 5) / 10 : (millivolts - 5) / 10) / 100.0;
+  };
+};
+
+#endif // H32_ADC_H
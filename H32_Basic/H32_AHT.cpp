@@ -0,0 +1,192 @@
+#include "H32_AHT.h"
+
+#define AHT1X_CMD_INIT                  0xE1
+#define AHT2X_CMD_INIT                  0xBE
+#define AHT_CMD_TRIGGER                 0xAC
+#define AHT_STATUS_BUSY                 0x80
+#define AHT_STATUS_CALIBRATED           0x08
+
+#define AHT_CONVERSION_MS               80
+#define AHT_BUSY_TIMEOUT_MS             200
+#define AHT_MAX_ATTEMPTS                3
+
+/* CRC-8 with polynomial 0x31 and initial value 0xFF */
+static uint8_t crc8(const uint8_t *data, uint8_t length)
+{
+  uint8_t crc = 0xFF;
+
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+  }
+
+  return crc;
+}
+
+H32_AHT::H32_AHT(uint8_t address, Type type, TwoWire &wire)
+  : wire(wire), address(address), type(type), state(AHT_IDLE),
+    started(0), samples(0), done(0), attempts(0), errors(0),
+    humidity_sum(0), temperature_sum(0)
+{
+}
+
+bool
+H32_AHT::command(uint8_t cmd, uint8_t arg1, uint8_t arg2)
+{
+  wire.beginTransmission(address);
+
+  size_t wret = wire.write(cmd);
+  wret += wire.write(arg1);
+  wret += wire.write(arg2);
+
+  return wire.endTransmission() == 0 && wret == 3;
+}
+
+bool
+H32_AHT::read_status(uint8_t *status)
+{
+  if (wire.requestFrom(address, (uint8_t)1) != 1)
+    return false;
+
+  *status = wire.read();
+  return true;
+}
+
+bool
+H32_AHT::begin()
+{
+  uint8_t status;
+
+  state = AHT_IDLE;
+  if (!read_status(&status))
+    return false;
+
+  if (status & AHT_STATUS_CALIBRATED)
+    return true;
+
+  return command(type == AHT2X ? AHT2X_CMD_INIT : AHT1X_CMD_INIT, 0x08, 0x00);
+}
+
+bool
+H32_AHT::trigger()
+{
+  if (!command(AHT_CMD_TRIGGER, 0x33, 0x00))
+    return false;
+
+  started = millis();
+  attempts++;
+  return true;
+}
+
+bool
+H32_AHT::start(uint8_t samples)
+{
+  this->samples = samples == 0 ? 1 : samples;
+  done = 0;
+  attempts = 0;
+  errors = 0;
+  humidity_sum = 0;
+  temperature_sum = 0;
+
+  state = trigger() ? AHT_CONVERTING : AHT_ERROR;
+  return state == AHT_CONVERTING;
+}
+
+/* Read the result of a conversion. Returns 1 if the result has
+ * been added, 0 if the sensor is still busy and -1 if the result
+ * is incomplete or the CRC does not match. */
+int8_t
+H32_AHT::read_result()
+{
+  uint8_t buf[7];
+  uint8_t bytes = type == AHT2X ? 7 : 6;
+  uint8_t nread = 0;
+
+  wire.requestFrom(address, bytes);
+  while (wire.available() && nread < bytes)
+    buf[nread++] = wire.read();
+
+  if (nread != bytes)
+    return -1;
+
+  if (buf[0] & AHT_STATUS_BUSY)
+    return 0;
+
+  if (type == AHT2X && crc8(buf, 6) != buf[6])
+  {
+    errors++;
+    return -1;
+  }
+
+  humidity_sum += ((uint32_t)buf[1] << 12) | ((uint32_t)buf[2] << 4) | (buf[3] >> 4);
+  temperature_sum += ((uint32_t)(buf[3] & 0x0F) << 16) | ((uint32_t)buf[4] << 8) | buf[5];
+  done++;
+  return 1;
+}
+
+H32_AHT::State
+H32_AHT::poll()
+{
+  if (state != AHT_CONVERTING)
+    return state;
+
+  uint32_t elapsed = millis() - started;
+  if (elapsed < AHT_CONVERSION_MS)
+    return state;
+
+  int8_t result = read_result();
+  if (result > 0)
+  {
+    attempts = 0;
+    if (done >= samples)
+      state = AHT_READY;
+    else if (!trigger())
+      state = AHT_ERROR;
+  }
+  else if (result < 0 || elapsed > AHT_BUSY_TIMEOUT_MS)
+  {
+    /* Repeat an invalid measurement, give up if it fails
+     * too often or the sensor stays busy */
+    if (attempts >= AHT_MAX_ATTEMPTS || !trigger())
+      state = AHT_ERROR;
+  }
+
+  return state;
+}
+
+bool
+H32_AHT::wait()
+{
+  while (poll() == AHT_CONVERTING)
+    delay(1);
+
+  return state == AHT_READY;
+}
+
+float
+H32_AHT::humidity()
+{
+  if (done == 0)
+    return NAN;
+
+  /* 20 bit value, relative humidity = value / 2^20 * 100 */
+  return (float)humidity_sum / done / 1048576.0f * 100.0f;
+}
+
+float
+H32_AHT::temperature()
+{
+  if (done == 0)
+    return NAN;
+
+  /* 20 bit value, temperature = value / 2^20 * 200 - 50 */
+  return (float)temperature_sum / done / 1048576.0f * 200.0f - 50.0f;
+}
+
+uint8_t
+H32_AHT::crc_errors()
+{
+  return errors;
+}
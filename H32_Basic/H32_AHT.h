@@ -0,0 +1,97 @@
+#ifndef __H32_AHT_H__
+#define __H32_AHT_H__
+
+#include <Wire.h>
+
+/* A non-blocking driver for the AHT10 (H32 revision 1 and 2) and the
+ * AHT20 (revision 3). A single command measures temperature and humidity
+ * at once. The measurement is started and then polled (or awaited), so
+ * that other work can be done during the conversion of about 80 ms.
+ *
+ * The result can be the mean of several measurements (oversampling).
+ * With the AHT2x every measurement is checked with its CRC and repeated
+ * if the check fails. */
+
+#define H32_AHT1X_ADDR                  0x39
+#define H32_AHT2X_ADDR                  0x38
+
+class H32_AHT
+{
+  public:
+    enum Type { AHT1X = 0,
+                AHT2X = 1 };
+
+    enum State { AHT_IDLE       = 0,
+                 AHT_CONVERTING = 1,
+                 AHT_READY      = 2,
+                 AHT_ERROR      = 3 };
+
+    H32_AHT(uint8_t address, Type type, TwoWire &wire = Wire);
+
+    /**
+     * Check that the sensor is present and calibrated. If the
+     * calibration bit is not set, the sensor is initialized.
+     * This function does not wait.
+     *
+     * @return  True if the sensor is available
+     */
+    bool begin();
+
+    /**
+     * Start a measurement and return immediately.
+     *
+     * @param   samples   The number of measurements the result
+     *                    is averaged over
+     *
+     * @return  True if the measurement has been started
+     */
+    bool start(uint8_t samples);
+
+    /**
+     * Advance the measurement without blocking. A finished
+     * conversion is read and, if more samples are needed,
+     * the next one is started.
+     *
+     * @return  The current state, AHT_READY once the result
+     *          is available
+     */
+    State poll();
+
+    /**
+     * Wait until the measurement has finished.
+     *
+     * @return  True if a result is available
+     */
+    bool wait();
+
+    /**
+     * The results of the last measurement
+     */
+    float temperature();
+    float humidity();
+
+    /**
+     * The number of measurements with a CRC mismatch (AHT2x only)
+     */
+    uint8_t crc_errors();
+
+  private:
+    TwoWire &wire;
+    uint8_t address;
+    Type type;
+    State state;
+    uint32_t started;
+    uint8_t samples;
+    uint8_t done;
+    uint8_t attempts;
+    uint8_t errors;
+    uint32_t humidity_sum;
+    uint32_t temperature_sum;
+
+    bool command(uint8_t cmd, uint8_t arg1, uint8_t arg2);
+    bool trigger();
+    bool read_status(uint8_t *status);
+    int8_t read_result();
+};
+
+#endif // __H32_AHT_H__
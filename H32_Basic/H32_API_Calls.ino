@@ -1,131 +1,578 @@
-#include <ThingSpeak.h>
 #include <WiFiClient.h>
-#include <WiFiClientSecure.h>
-#include <HTTPClient.h>
+#include <Preferences.h>
 
 /*
- * This function implements the communication with the Thingspeak service
+ * The TLS sessions are kept in NVS, so that the connections of the next wake
+ * cycle can resume them. The sinks run in tasks of their own, so every call
+ * uses its own Preferences.
+ */
+class H32_TLS_NVS : public H32_TLS_Session_Store {
+private:
+  static void key(const char *host, uint16_t port, char *key) {
+    uint16_t crc = crc16(host, strlen(host));
+    sprintf(key, "s%04x", crc16(&port, sizeof(port), crc));
+  };
+public:
+  bool load(const char *host, uint16_t port, uint8_t *data, size_t &length) {
+    Preferences tls_prefs;
+    char name[8];
+    key(host, port, name);
+    bool result = false;
+    if (tls_prefs.begin(h32_tls_prefs, true)) {
+      size_t stored = tls_prefs.getBytesLength(name);
+      result = stored > 0 && stored <= length && tls_prefs.getBytes(name, data, stored) == stored;
+      length = stored;
+      tls_prefs.end();
+    }
+    return result;
+  };
+  bool save(const char *host, uint16_t port, const uint8_t *data, size_t length) {
+    Preferences tls_prefs;
+    char name[8];
+    key(host, port, name);
+    bool result = false;
+    if (tls_prefs.begin(h32_tls_prefs, false)) {
+      result = tls_prefs.putBytes(name, data, length) == length;
+      tls_prefs.end();
+    }
+    debug_println(result ? "TLS session stored" : "Couldn't store the TLS session");
+    return result;
+  };
+};
+
+H32_TLS_NVS tls_sessions;
+
+/*
+ * Every service gets a connection of its own that is kept open for all
+ * requests of the wake cycle (see H32_HTTP.h)
+ */
+const char *thingspeak_host = "api.thingspeak.com";
+const char *iotplotter_host = "iotplotter.com";
+const uint16_t http_port = 80;
+const uint16_t https_port = 443;
+WiFiClient thingspeak_tcp;
+WiFiClient iotplotter_tcp;
+H32_TLS_Client thingspeak_client(thingspeak_tcp);
+H32_TLS_Client iotplotter_client(iotplotter_tcp);
+H32_HTTP thingspeak_http(thingspeak_client, thingspeak_host);
+H32_HTTP iotplotter_http(iotplotter_client, iotplotter_host);
+
+void api_tls_begin(H32_API_Config &api) {
+  H32_TLS_Client *client = api.type == thingspeak ? &thingspeak_client
+                         : api.type == iotplotter ? &iotplotter_client : NULL;
+  if(client != NULL) {
+    if(!client->setTLS(api.tls, api.fingerprint, &tls_sessions)) {
+      debug_println("TLS needs the SHA-256 fingerprint of the server");
+    }
+    (api.type == thingspeak ? thingspeak_http : iotplotter_http).setPort(api.tls ? https_port : http_port);
+  }
+}
+
+void api_print_handshake(const char *name, H32_TLS_Client &client) {
+  if(client.isTLS() && client.getHandshakeReceived() > 0) {
+    debug_print(name);
+    debug_print(" TLS handshake: sent ");
+    debug_print(client.getHandshakeSent());
+    debug_print(", received ");
+    debug_print(client.getHandshakeReceived());
+    debug_print(" bytes in ");
+    debug_print(client.getHandshakeTime());
+    debug_println(" ms");
+  }
+}
+
+/*
+ * Close the connections to the services
+ */
+void api_end() {
+  api_print_handshake("ThingSpeak", thingspeak_client);
+  api_print_handshake("IOTPlotter", iotplotter_client);
+  thingspeak_http.end();
+  iotplotter_http.end();
+}
+
+/*
+ * Small helper function that writes the core values of a record or of the
+ * measurements as a Thingspeak update, field n is the core value with id n - 1.
+ * Without an epoch (0) Thingspeak stamps the update with the time it arrives.
+ */
+void write_update_json(H32_Json_Writer &json, uint32_t epoch, const float *values) {
+  json.beginObject();
+  if(epoch != 0) {
+    char created_at[32];
+    time_t time = epoch;
+    strftime(created_at, sizeof(created_at), "%Y-%m-%d %H:%M:%S +0000", gmtime(&time));
+    json.key("created_at");
+    json.value(created_at);
+  } else {
+    json.key("delta_t");
+    json.value((uint32_t)0);
+  }
+  for(H32_Measurement_Id id = 0; id < measurement_core_num; id++) {
+    if(isnan(values[id])) {
+      continue;
+    }
+    char field[8];
+    snprintf(field, sizeof(field), "field%u", id + 1);
+    json.key(field);
+    json.value(round(values[id] * 100) / 100.0);
+  }
+  json.endObject();
+}
+
+/*
+ * The records of a batch, as the context of the json functions
+ */
+typedef struct H32_Json_Records {
+  const H32_Log_Record *records;
+  uint16_t num;
+} H32_Json_Records;
+
+/*
+ * The key and the updates of a Thingspeak bulk update
  */
-bool thingspeak_call(char* api_key, char *api_additional, H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
-  WiFiClient  client;
+typedef struct H32_Thingspeak_Bulk {
+  const char *api_key;
+  H32_Json_Function write_updates;
+} H32_Thingspeak_Bulk;
+
+void write_bulk_json(H32_Json_Writer &json, const void *context) {
+  const H32_Thingspeak_Bulk *bulk = (const H32_Thingspeak_Bulk *)context;
+  json.beginObject();
+  json.key("write_api_key");
+  json.value(bulk->api_key);
+  json.key("updates");
+  json.beginArray();
+  bulk->write_updates(json);
+  json.endArray();
+  json.endObject();
+}
 
+/*
+ * Send updates to the Thingspeak bulk update, which accepts many
+ * measurements with their time in a single request
+ */
+bool thingspeak_post(char *api_key, char *api_additional, H32_Json_Function write_updates) {
   int myChannelNumber = atoi(api_additional);
   myChannelNumber = myChannelNumber == 0 ? 1 : myChannelNumber;
 
-  debug_println("Thingspeak API call");
+  char path[48];
+  snprintf(path, sizeof(path), "/channels/%d/bulk_update.json", myChannelNumber);
+  H32_Thingspeak_Bulk bulk = {api_key, write_updates};
+  int http_response_code = thingspeak_http.post(path, "", "application/json", {write_bulk_json, &bulk});
 
-  ThingSpeak.begin(client);  // Initialize ThingSpeak
+  debug_print("Thingspeak bulk update: ");
+  debug_println(http_response_code);
 
-  // set the fields with the values
-  ThingSpeak.setField(1, (float)measurements.getTemperature());
-  ThingSpeak.setField(2, (float)measurements.getHumidity());
-  ThingSpeak.setField(3, (float)measurements.getBatV());
-  ThingSpeak.setField(4, (float)measurements.getExtV());
-#ifdef H32_REV_3
-  ThingSpeak.setField(5, (float)measurements.getBatPercentage());
-  ThingSpeak.setField(6, (float)measurements.getBatChargeRate());
-#endif // H32_REV_3
+  return http_response_code == 202;
+}
 
-  int x = ThingSpeak.writeFields(myChannelNumber, api_key);
-  if(x == 200){
-    debug_println("Channel update successful.");
-    return true;
-  } else{
-    debug_println("Problem updating channel. HTTP error code " + String(x));
-    return false;
+/*
+ * This function implements the communication with the Thingspeak service
+ */
+bool thingspeak_call(char* api_key, char *api_additional, H32_Measurements &measurements) {
+  debug_println("Thingspeak API call");
+
+  float values[measurement_core_num];
+  for(H32_Measurement_Id id = 0; id < measurement_core_num; id++) {
+    values[id] = measurements.get(id);
   }
+  // The RTC may not have been set, the live update gets the time of its arrival
+  return thingspeak_post(api_key, api_additional, {[](H32_Json_Writer &json, const void *context) {
+    write_update_json(json, 0, (const float *)context);
+  }, values});
 }
 
 /*
- * Small helper function that creates a json from the data
+ * The json is written twice, first only to determine its length, then
+ * directly to the connection. The json is not printed with H32_DEBUG: the
+ * sinks run at the same time, and their payloads would be mixed up.
  */
-void create_json(JsonObject &doc, H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
+size_t json_length(H32_Json_Function write_json) {
+  H32_Json_Writer json(NULL);
+  write_json(json);
+  return json.length();
+}
 
-  doc["Temperature"][0]["value"] = measurements.getTemperature();
-  doc["Humidity"][0]["value"] = measurements.getHumidity();
-  doc["Battery Voltage"][0]["value"] = measurements.getBatV();
-  doc["External Voltage"][0]["value"] = measurements.getExtV();
-#ifdef H32_REV_3
-  doc["Battery Percentage"][0]["value"] = measurements.getBatPercentage();
-  doc["Battery Charge Rate"][0]["value"] = measurements.getBatChargeRate();
-#endif // H32_REV_3
+/*
+ * Small helper function that writes a single value as IOTPlotter expects it
+ */
+void write_value_json(H32_Json_Writer &json, const char *name, double value) {
+  json.key(name);
+  json.beginArray();
+  json.beginObject();
+  json.key("value");
+  json.value(value);
+  json.endObject();
+  json.endArray();
+}
 
-  for(const auto & res: additional_data) {
-     debug_print("Additional: ");
-     debug_print(res.first);
-     debug_print(" - ");
-     debug_println(res.second);
-    doc[res.first][0]["value"] = res.second;
+/*
+ * Small helper function that writes the measurements as the members of a json object
+ */
+void write_measurements_json(H32_Json_Writer &json, const H32_Measurements &measurements) {
+  for(H32_Measurement_Id id = 0; id < H32_Measurements::count(); id++) {
+    if(measurements.has(id)) {
+      write_value_json(json, H32_Measurements::quantity(id).name, measurements.get(id));
+    }
   }
 }
 
+/*
+ * Post a json to IOTPlotter on the kept-alive connection
+ */
+int iotplotter_post(const char *api_key, const char *feed, H32_Json_Function write_json) {
+  char path[NAME_LENGTH + 16];
+  char headers[NAME_LENGTH + 12];
+  snprintf(path, sizeof(path), "/api/v2/feed/%s", feed);
+  snprintf(headers, sizeof(headers), "api-key: %s\r\n", api_key);
+  return iotplotter_http.post(path, headers, "application/x-www-form-urlencoded", write_json);
+}
+
 /*
  * This function implements the communication with the IOTPlotter service
  */
-bool iotplotter_call(char* api_key, char *api_additional, H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
-  WiFiClient client;
-  HTTPClient httpClient;
+bool iotplotter_call(char* api_key, char *api_additional, H32_Measurements &measurements) {
+
+  debug_println("IOTPlotter JSON");
 
-  // Create the json needed for the service
-  StaticJsonDocument<json_doc_size> doc;
-  JsonObject object = doc.createNestedObject("data");
-  create_json(object, measurements, additional_data);
+  int http_response_code = iotplotter_post(api_key, api_additional,
+    {[](H32_Json_Writer &json, const void *context) {
+      json.beginObject();
+      json.key("data");
+      json.beginObject();
+      write_measurements_json(json, *(const H32_Measurements *)context);
+      json.endObject();
+      json.endObject();
+    }, &measurements});
 
-  char json[json_doc_size];
-  serializeJson(doc, json);
+  debug_println(http_response_code);
 
-  debug_println("IOTPlotter JSON");
-  debug_println(json);
-
-  // Send the data with the needed header settings
-  String serviceURL = "http://iotplotter.com/api/v2/feed/" + String(h32_config.api.additional);
-  httpClient.begin(serviceURL);
-  httpClient.addHeader("Content-Type", "application/x-www-form-urlencoded");
-  httpClient.addHeader("api-key", h32_config.api.key);
-  int http_response_code = httpClient.POST(json);
-
-  debug_print(http_response_code);
-  debug_print(" ");
-  debug_println(httpClient.getString());
-
-  // Disconnect
-  httpClient.end();
-   
   return http_response_code == 200;
 }
 
 /*
- * This function implements the communication with the IOTPlotter service
+ * A single connection to the MQTT broker is used for all messages of a
+ * wake cycle. It is opened by the first message and closed by mqtt_end().
  */
 const uint8_t mqtt_retries = 3;
-bool mqtt_call(H32_Measurements &measurements, unordered_map<char *, double> &additional_data) {
-  WiFiClient  client;
-  PubSubClient mqttClient(client);
+WiFiClient mqtt_tcp;
+H32_TLS_Client mqtt_client(mqtt_tcp);
+H32_MQTT mqtt(mqtt_client);
+
+/*
+ * Set up the connections of the configured services and of MQTT
+ */
+void api_begin() {
+  api_tls_begin(h32_config.api);
+  api_tls_begin(h32_config.api2);
+  if(!mqtt_client.setTLS(h32_config.mqtt.tls, h32_config.mqtt.fingerprint, &tls_sessions)) {
+    debug_println("MQTT TLS needs the SHA-256 fingerprint of the server");
+  }
+}
+
+bool mqtt_begin() {
+  if(mqtt.connected()) {
+    return true;
+  }
+  // Try to connect for "mqtt_retries" times
+  for(int i = 0; i < mqtt_retries; i++) {
+    if(mqtt.connect(h32_config.mqtt.server, h32_config.mqtt.port, h32_config.name,
+                    h32_config.mqtt.user, h32_config.mqtt.passwd)) {
+      debug_println("Connected to MQTT");
+      return true;
+    }
+    delay(100);
+  }
+  return false;
+}
+
+/*
+ * Wait until the broker has acknowledged everything and close the connection.
+ * This has to be called before the H32 powers off.
+ */
+bool mqtt_end() {
+  if(!mqtt.connected()) {
+    return true;
+  }
+  api_print_handshake("MQTT", mqtt_client);
+  bool result = mqtt.disconnect();
+  debug_println(result ? "MQTT disconnected" : "MQTT disconnected with messages not acknowledged");
+  return result;
+}
+
+/*
+ * Publish a json without copying it into a buffer
+ */
+bool mqtt_publish_json(const char *topic, H32_Json_Function write_json) {
+  size_t length = json_length(write_json);
+  if(!mqtt.beginPublish(topic, length, h32_config.mqtt.qos)) {
+    return false;
+  }
+  H32_Json_Writer json(&mqtt);
+  write_json(json);
+  json.flush();
+  return mqtt.endPublish();
+}
+
+/*
+ * The topic of a single value is <topic>/<name>, with the name in lower case
+ * and all characters other than letters and digits replaced by '_'.
+ */
+void mqtt_value_topic(char *topic, size_t size, const char *name) {
+  size_t length = snprintf(topic, size, "%s/", h32_config.mqtt.topic);
+  for(; *name && length < size - 1; name++) {
+    topic[length++] = isalnum(*name) ? tolower(*name) : '_';
+  }
+  topic[length] = 0;
+}
+
+/*
+ * Publish a single value to its own topic. Values that could not be measured are skipped.
+ */
+bool mqtt_publish_value(const char *name, double value) {
+  if(isnan(value)) {
+    return true;
+  }
+  char topic[TOPIC_LENGTH + log_name_length + 2];
+  mqtt_value_topic(topic, sizeof(topic), name);
+  return mqtt_publish_json(topic, {[](H32_Json_Writer &json, const void *context) {
+    json.value(*(const double *)context);
+  }, &value});
+}
+
+/*
+ * This function implements the communication with the MQTT broker
+ */
+bool mqtt_call(H32_Measurements &measurements) {
 
   debug_println("MQTT");
 
-  mqttClient.setServer(h32_config.mqtt.server, h32_config.mqtt.port);
+  if(!mqtt_begin()) {
+    return false;
+  }
 
-  StaticJsonDocument<json_doc_size> doc;
+  if(h32_config.mqtt.format == mqtt_binary) {
+    H32_Log_Record record;
+    create_record(record, measurements);
+    uint8_t payload[json_doc_size];
+    H32_Encoder encoder(payload, sizeof(payload));
+    if(!encoder.begin(&record, 1, H32_Measurements::name) || !encoder.add(record)) {
+      return false;
+    }
+    return mqtt.publish(h32_config.mqtt.topic, payload, encoder.length(), h32_config.mqtt.qos);
+  }
 
-  // Try to connect for "mqtt_retries" times. If successful, publish data as json
-  for(int i = 0; i < mqtt_retries; i++) {
-    if(mqttClient.connect(h32_config.name, h32_config.mqtt.user, h32_config.mqtt.passwd)) {
+  if(h32_config.mqtt.format == mqtt_fields) {
+    bool result = true;
+    for(H32_Measurement_Id id = 0; id < H32_Measurements::count() && result; id++) {
+      result = mqtt_publish_value(H32_Measurements::quantity(id).name, measurements.get(id));
+    }
+    return result;
+  }
 
-      debug_println("Connected to MQTT");
-      JsonObject object = doc.to<JsonObject>();
-      create_json(object, measurements, additional_data);
+  debug_println("MQTT JSON");
+
+  return mqtt_publish_json(h32_config.mqtt.topic, {[](H32_Json_Writer &json, const void *context) {
+    json.beginObject();
+    write_measurements_json(json, *(const H32_Measurements *)context);
+    json.endObject();
+  }, &measurements});
+}
+
+/*
+ * Small helper function that writes the values of a field of the records with
+ * their time of measurement. Values that could not be measured are skipped,
+ * and the field is left out completely if none of the records has a value.
+ */
+void write_field_json(H32_Json_Writer &json, const char *name, const H32_Log_Record *records, uint16_t num, float H32_Log_Record::*field) {
+  bool first = true;
+  for(int i = 0; i < num; i++) {
+    if(isnan(records[i].*field)) {
+      continue;
+    }
+    if(first) {
+      json.key(name);
+      json.beginArray();
+      first = false;
+    }
+    json.beginObject();
+    json.key("value");
+    json.value(round(records[i].*field * 100) / 100.0);
+    json.key("epoch");
+    json.value(records[i].epoch);
+    json.endObject();
+  }
+  if(!first) {
+    json.endArray();
+  }
+}
+
+/*
+ * Small helper function that writes the values of an additional field of the
+ * records, starting with the record in which the quantity appears for the first time.
+ */
+void write_additional_json(H32_Json_Writer &json, H32_Measurement_Id id, const H32_Log_Record *records, uint16_t num) {
+  bool first = true;
+  for(int i = 0; i < num; i++) {
+    for(int j = 0; j < records[i].additional_num; j++) {
+      H32_Log_Entry &entry = records[i].additional[j];
+      if(isnan(entry.value) || entry.id != id) {
+        continue;
+      }
+      if(first) {
+        json.key(H32_Measurements::name(id));
+        json.beginArray();
+        first = false;
+      }
+      json.beginObject();
+      json.key("value");
+      json.value(round(entry.value * 100) / 100.0);
+      json.key("epoch");
+      json.value(records[i].epoch);
+      json.endObject();
+    }
+  }
+  if(!first) {
+    json.endArray();
+  }
+}
 
-      char json[json_doc_size];
-      serializeJson(doc, json);
+/*
+ * Small helper function that writes logged records as the members of a json
+ * object. The values are grouped by their name, every value carries its epoch.
+ */
+void write_records_json(H32_Json_Writer &json, const H32_Log_Record *records, uint16_t num) {
+  write_field_json(json, "Temperature", records, num, &H32_Log_Record::temperature);
+  write_field_json(json, "Humidity", records, num, &H32_Log_Record::humidity);
+  write_field_json(json, "Battery Voltage", records, num, &H32_Log_Record::batV);
+  write_field_json(json, "External Voltage", records, num, &H32_Log_Record::extV);
+#ifdef H32_REV_3
+  write_field_json(json, "Battery Percentage", records, num, &H32_Log_Record::batPercentage);
+  write_field_json(json, "Battery Charge Rate", records, num, &H32_Log_Record::batChargeRate);
+#endif // H32_REV_3
+  for(int i = 0; i < num; i++) {
+    for(int j = 0; j < records[i].additional_num; j++) {
+      H32_Measurement_Id id = records[i].additional[j].id;
+      // every quantity is written only once, at its first appearance
+      bool seen = false;
+      for(int k = 0; k <= i && !seen; k++) {
+        for(int l = 0; l < (k == i ? j : records[k].additional_num) && !seen; l++) {
+          seen = records[k].additional[l].id == id;
+        }
+      }
+      if(!seen) {
+        write_additional_json(json, id, records, num);
+      }
+    }
+  }
+}
 
-      debug_println("MQTT JSON");
-      debug_println(json);
+/*
+ * This function sends a batch of records to Thingspeak using the bulk update
+ */
+bool thingspeak_batch(char *api_key, char *api_additional, const H32_Log_Record *records, uint16_t num) {
+  debug_println("Thingspeak bulk update");
 
-      return mqttClient.publish (h32_config.mqtt.topic, json);
+  H32_Json_Records batch = {records, num};
+  return thingspeak_post(api_key, api_additional, {[](H32_Json_Writer &json, const void *context) {
+    const H32_Json_Records *batch = (const H32_Json_Records *)context;
+    for(int i = 0; i < batch->num; i++) {
+      // in the order of the core measurements
+      const H32_Log_Record &record = batch->records[i];
+      float values[measurement_core_num] = {record.temperature, record.humidity, record.batV,
+                                            record.extV, record.batPercentage, record.batChargeRate};
+      write_update_json(json, record.epoch, values);
     }
-    delay(100);
+  }, &batch});
+}
+
+/*
+ * This function sends a batch of records to IOTPlotter. Every value carries
+ * its epoch so that IOTPlotter can sort in the older measurements.
+ */
+bool iotplotter_batch(char *api_key, char *api_additional, const H32_Log_Record *records, uint16_t num) {
+
+  debug_println("IOTPlotter batch JSON");
+
+  H32_Json_Records batch = {records, num};
+  int http_response_code = iotplotter_post(api_key, api_additional,
+    {[](H32_Json_Writer &json, const void *context) {
+      const H32_Json_Records *batch = (const H32_Json_Records *)context;
+      json.beginObject();
+      json.key("data");
+      json.beginObject();
+      write_records_json(json, batch->records, batch->num);
+      json.endObject();
+      json.endObject();
+    }, &batch});
+
+  debug_print("IOTPlotter batch: ");
+  debug_println(http_response_code);
+
+  return http_response_code == 200;
+}
+
+/*
+ * This function publishes a batch of records to MQTT, pipelined on the
+ * connection of the wake cycle. The batch has been sent successfully only
+ * once all messages with QoS 1 have been acknowledged.
+ */
+bool mqtt_batch(const H32_Log_Record *records, uint16_t num) {
+
+  debug_println("MQTT batch");
+
+  if(!mqtt_begin()) {
+    return false;
   }
 
-  return false;
+  bool result = true;
+  if(h32_config.mqtt.format == mqtt_binary) {
+    // All records in as few messages as possible
+    uint8_t payload[json_doc_size];
+    for(int i = 0; i < num && result; ) {
+      H32_Encoder encoder(payload, sizeof(payload));
+      encoder.begin(records + i, num - i, H32_Measurements::name);
+      int first = i;
+      while(i < num && encoder.add(records[i])) {
+        i++;
+      }
+      if(i == first) {
+        // a single record does not fit, this cannot be sent
+        result = false;
+        break;
+      }
+      result = mqtt.publish(h32_config.mqtt.topic, payload, encoder.length(), h32_config.mqtt.qos);
+    }
+  } else if(h32_config.mqtt.format == mqtt_fields) {
+    // oldest first, so that every topic ends with the newest value
+    for(int i = 0; i < num && result; i++) {
+      const H32_Log_Record &record = records[i];
+      char topic[TOPIC_LENGTH + log_name_length + 2];
+      mqtt_value_topic(topic, sizeof(topic), "Epoch");
+      result = mqtt_publish_json(topic, {[](H32_Json_Writer &json, const void *context) {
+                 json.value(*(const uint32_t *)context);
+               }, &record.epoch})
+            && mqtt_publish_value("Temperature", record.temperature)
+            && mqtt_publish_value("Humidity", record.humidity)
+            && mqtt_publish_value("Battery Voltage", record.batV)
+            && mqtt_publish_value("External Voltage", record.extV)
+            && mqtt_publish_value("Battery Percentage", record.batPercentage)
+            && mqtt_publish_value("Battery Charge Rate", record.batChargeRate);
+      for(int j = 0; j < record.additional_num && result; j++) {
+        result = mqtt_publish_value(H32_Measurements::name(record.additional[j].id), record.additional[j].value);
+      }
+    }
+  } else {
+    for(int i = 0; i < num && result; i++) {
+      H32_Json_Records single = {records + i, 1};
+      result = mqtt_publish_json(h32_config.mqtt.topic, {[](H32_Json_Writer &json, const void *context) {
+        const H32_Json_Records *single = (const H32_Json_Records *)context;
+        json.beginObject();
+        write_records_json(json, single->records, single->num);
+        json.endObject();
+      }, &single});
+    }
+  }
+  return result && mqtt.drain();
 }
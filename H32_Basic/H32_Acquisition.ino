@@ -0,0 +1,93 @@
+/*
+ * The measurements are acquired by a FreeRTOS task while the WiFi connection
+ * is established (see H32_Executor.h). The WiFi stack runs on core 0, the
+ * task runs on the same core as setup().
+ */
+
+const uint32_t acquisition_stack_size = 4096;
+const UBaseType_t acquisition_priority = 1;
+
+/*
+ * A one-shot event implemented with a binary semaphore
+ */
+class H32_RTOS_Event : public H32_Event {
+private:
+  StaticSemaphore_t buffer;
+  SemaphoreHandle_t semaphore;
+public:
+  H32_RTOS_Event() {
+    semaphore = xSemaphoreCreateBinaryStatic(&buffer);
+  };
+  void set() {
+    xSemaphoreGive(semaphore);
+  };
+  void wait() {
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+  };
+  bool waitFor(uint32_t milliseconds) {
+    return xSemaphoreTake(semaphore, pdMS_TO_TICKS(milliseconds)) == pdTRUE;
+  };
+};
+
+/*
+ * Runs the function as a task of its own, deleting the task afterwards
+ */
+class H32_RTOS_Executor : public H32_Executor {
+private:
+  const char *name;
+  uint32_t stack_size;
+  UBaseType_t priority;
+  void (*function)(void *);
+  void *arg;
+
+  static void task(void *self) {
+    H32_RTOS_Executor *executor = (H32_RTOS_Executor *)self;
+    executor->function(executor->arg);
+    vTaskDelete(NULL);
+  };
+public:
+  H32_RTOS_Executor(const char *name = "acquisition", uint32_t stack_size = acquisition_stack_size,
+                    UBaseType_t priority = acquisition_priority)
+    : name(name), stack_size(stack_size), priority(priority) {};
+
+  bool run(void (*function)(void *), void *arg) {
+    this->function = function;
+    this->arg = arg;
+    return xTaskCreatePinnedToCore(task, name, stack_size, this,
+                                   priority, NULL, xPortGetCoreID()) == pdPASS;
+  };
+};
+
+void acquisition_read_adc(void *measurements) {
+  ((H32_Measurements *)measurements)->readVoltages();
+}
+
+void acquisition_read_i2c(void *measurements) {
+  ((H32_Measurements *)measurements)->readSensors();
+}
+
+H32_RTOS_Executor acquisition_executor;
+H32_RTOS_Event acquisition_adc_done;
+H32_RTOS_Event acquisition_done;
+H32_Acquisition acquisition(acquisition_executor, acquisition_adc_done, acquisition_done,
+                            acquisition_read_adc, acquisition_read_i2c);
+
+/*
+ * Start acquiring the measurements. Returns once the ADC has been read,
+ * so that the radio can be turned on afterwards.
+ */
+void acquisition_start(H32_Measurements &measurements) {
+  if(measurements.isValid()) {
+    return;
+  }
+  if(!acquisition.start(&measurements)) {
+    debug_println("Acquisition task not started, measured sequentially");
+  }
+}
+
+/*
+ * Wait until all measurements have been acquired
+ */
+void acquisition_join() {
+  acquisition.join();
+}
@@ -0,0 +1,217 @@
+/*
+ * The backlog stores every measurement in the measurement log (see H32_Log.h)
+ * and sends the stored measurements in batches once a connection is available.
+ * It is enabled if h32_config.backlog.every is not 0.
+ */
+#include <FS.h>
+#include <LittleFS.h>
+
+/*
+ * The log is stored in a preallocated file in LittleFS
+ */
+class H32_Log_File : public H32_Log_Storage {
+private:
+  File file;
+public:
+  /*
+   * Mount LittleFS and open the file, creating it if necessary
+   */
+  bool begin() {
+    if(!mount_LittleFS()) {
+      return false;
+    }
+    uint32_t length = H32_Log::storageSize();
+    if(LittleFS.exists(log_path)) {
+      File old_file = LittleFS.open(log_path, "r");
+      bool outdated = old_file && old_file.size() != length;
+      old_file.close();
+      // the records have changed their size with an update of the firmware
+      if(outdated) {
+        debug_println("Removing the outdated backlog file");
+        LittleFS.remove(log_path);
+      }
+    }
+    if(!LittleFS.exists(log_path)) {
+      debug_println("Creating the backlog file");
+      File new_file = LittleFS.open(log_path, "w");
+      if(!new_file) {
+        LittleFS.end();
+        return false;
+      }
+      uint8_t empty[64];
+      memset(empty, log_uncommitted, sizeof(empty));
+      for(uint32_t size = length;
+          size > 0; size -= min(size, (uint32_t)sizeof(empty))) {
+        new_file.write(empty, min(size, (uint32_t)sizeof(empty)));
+      }
+      new_file.close();
+    }
+    file = LittleFS.open(log_path, "r+");
+    if(!file) {
+      LittleFS.end();
+      return false;
+    }
+    return true;
+  };
+  void end() {
+    file.close();
+    LittleFS.end();
+  };
+  bool read(uint32_t offset, void *data, size_t length) {
+    return file.seek(offset) && file.read((uint8_t *)data, length) == length;
+  };
+  bool write(uint32_t offset, const void *data, size_t length) {
+    return file.seek(offset) && file.write((const uint8_t *)data, length) == length;
+  };
+  bool sync() {
+    file.flush();
+    return true;
+  };
+};
+
+H32_Log_File backlog_file;
+H32_Log backlog(backlog_file);
+bool backlog_opened = false;
+
+/*
+ * Open the backlog. Head and tail are only recovered on the first call,
+ * afterwards they are kept in memory. The head of the last wake cycle
+ * saves scanning the log.
+ */
+bool backlog_begin() {
+  if(!backlog_file.begin()) {
+    debug_println("Cannot open the backlog");
+    return false;
+  }
+  if(!backlog_opened) {
+    if(wake_state_log_known()) {
+      backlog_opened = backlog.resume(wake_state_log_head());
+    } else {
+      backlog_opened = backlog.open();
+    }
+    debug_print("Backlog pending: ");
+    debug_println(backlog.pending());
+  }
+  return backlog_opened;
+}
+
+inline bool backlog_enabled() {
+  return h32_config.backlog.every != 0;
+}
+
+/*
+ * With the backlog enabled we only connect if at least "every" measurements
+ * (including the current one) are waiting to be sent.
+ */
+bool backlog_connect_due() {
+  if(!backlog_enabled() || h32_config.backlog.every == 1) {
+    return true;
+  }
+  bool result = true;
+  if(backlog_begin()) {
+    result = backlog.pending() + 1 >= h32_config.backlog.every;
+  }
+  backlog_file.end();
+  return result;
+}
+
+static_assert(log_additional_num >= measurement_capacity - measurement_core_num,
+              "a log record has to hold every quantity of the registry");
+
+/*
+ * Fill a record with the current measurements. The core values have fields
+ * of their own, all the others are stored with the id of their quantity.
+ */
+void create_record(H32_Log_Record &record, H32_Measurements &measurements) {
+  memset(&record, 0, sizeof(record));
+
+  record.epoch = measurements.getEpoch() != 0 ? measurements.getEpoch() : RTC_get_epoch();
+  record.temperature = measurements.get(measurement_temperature);
+  record.humidity = measurements.get(measurement_humidity);
+  record.batV = measurements.get(measurement_bat_v);
+  record.extV = measurements.get(measurement_ext_v);
+  record.batPercentage = measurements.get(measurement_bat_percentage);
+  record.batChargeRate = measurements.get(measurement_bat_charge_rate);
+
+  for(H32_Measurement_Id id = measurement_core_num; id < H32_Measurements::count(); id++) {
+    if(!measurements.has(id)) {
+      continue;
+    }
+    H32_Log_Entry &entry = record.additional[record.additional_num++];
+    entry.id = id;
+    entry.value = measurements.get(id);
+  }
+}
+
+/*
+ * The ids of the quantities change with the configuration and the firmware,
+ * so the log refers to the names by ids of its own (see H32_Log.h). These
+ * functions translate between the two.
+ */
+void backlog_to_log_ids(H32_Log_Record &record) {
+  uint8_t num = 0;
+  for(uint8_t i = 0; i < record.additional_num; i++) {
+    const char *name = H32_Measurements::name(record.additional[i].id);
+    uint8_t id = backlog.nameId(name);
+    if(id == log_name_none) {
+      debug_print("Backlog: no room for the name ");
+      debug_println(name);
+      continue;
+    }
+    record.additional[num].id = id;
+    record.additional[num++].value = record.additional[i].value;
+  }
+  record.additional_num = num;
+}
+
+/*
+ * The quantities of older records that are not measured anymore are interned
+ * with the name in the log. It stays valid for the wake cycle since records
+ * are only stored before the backlog is sent.
+ */
+void backlog_to_measurement_ids(H32_Log_Record &record) {
+  uint8_t num = 0;
+  for(uint8_t i = 0; i < record.additional_num; i++) {
+    const char *name = backlog.name(record.additional[i].id);
+    H32_Measurement_Id id = name != NULL ? H32_Measurements::intern(name) : measurement_none;
+    if(id == measurement_none) {
+      continue;
+    }
+    record.additional[num].id = id;
+    record.additional[num++].value = record.additional[i].value;
+  }
+  record.additional_num = num;
+}
+
+/*
+ * Store the current measurements in the log.
+ */
+bool backlog_record(H32_Measurements &measurements) {
+  H32_Log_Record record;
+  create_record(record, measurements);
+
+  bool result = false;
+  if(backlog_begin()) {
+    backlog_to_log_ids(record);
+    result = backlog.append(record);
+    wake_state_set_log_head(backlog.getHead());
+  }
+  backlog_file.end();
+
+  debug_print("Backlog record ");
+  debug_print(record.seq);
+  debug_println(result ? " stored" : " failed");
+  return result;
+}
+
+/*
+ * Read up to max_num records that have not been acknowledged, starting with from
+ * @return the number of records read
+ */
+uint16_t backlog_peek(uint32_t from, H32_Log_Record *records, uint16_t max_num) {
+  uint16_t num = backlog.peek(from, records, max_num);
+  for(uint16_t i = 0; i < num; i++) {
+    backlog_to_measurement_ids(records[i]);
+  }
+  return num;
+}
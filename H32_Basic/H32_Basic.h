@@ -13,6 +13,19 @@
 #pragma message "Compiling for H32 revision 1 or 2"
 #endif
 
+/*
+ * The RTC of the board. Without any of the following definitions the PCF85063A is used.
+ * H32_RTC_RX8010SJ selects the Epson RX8010SJ, H32_RTC_SIM an RTC that is simulated in memory.
+ */
+//#define H32_RTC_RX8010SJ
+//#define H32_RTC_SIM
+
+/*
+ * The ADC is sampled in continuous (DMA) mode if the core is based on ESP-IDF 5.
+ * Without the following definition the channels are sampled with single reads.
+ */
+#define H32_ADC_CONTINUOUS
+
 /*
  * The following macros allow us to enable/disable debugging without runtime overhead
  */
@@ -27,81 +40,94 @@
 #define debug_println(...)
 #endif
 
-#include <unordered_map>
-
 using namespace std;
 
 #include <WiFiManager.h>
 #include <ESPmDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
-#include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include <soc/soc.h>
 #include <soc/rtc_cntl_reg.h>
+#include <deque>
 
 #ifdef H32_REV_3
 #include <SparkFun_MAX1704x_Fuel_Gauge_Arduino_Library.h>
 #endif //H32_REV_3
 
-#include "PCF85063A.h"
+#include "H32_RTC.h"
+#include "H32_Schema.h"
+#include "H32_ADC.h"
+#include "H32_Power.h"
 
+#include "H32_Profiler.h"
+#include "H32_Executor.h"
+#include "H32_Budget.h"
 #include "H32_Measurements.h"
 
 const uint8_t SSID_LENGTH = 33;
 const uint8_t NAME_LENGTH = 50;
 const uint8_t TOPIC_LENGTH = 100;  // in theory 32.767 characters
 const uint8_t IP_ADDR_LENGTH = 16;
+const uint8_t FINGERPRINT_LENGTH = 95;  // SHA-256 in hex, with separators
 const uint8_t U32_LENGTH = 10;
 const uint8_t U16_LENGTH = 5;
 const uint8_t U8_LENGTH = 3;
 const uint8_t DOUBLE_LENGTH = 10;
 
-/*
- * One of the Parameter entries in the WiFiManager is a combination of dropdown and
- * normal input field. This has to be handwritten and the following info is used
- * for that. The APIType is also used in the function table that contains the 
- * communication with external services (API Calls)
- */
-enum APIType : int8_t {
-  none = 0,
-  thingspeak = 1,
-  iotplotter = 2,
-};
-const char *apitype_names[] = {
-  "---",
-  "Thingspeak",
-  "IOT Plotter",
-};
-const int apitype_num = sizeof(apitype_names)/sizeof(char *);
+#include "H32_FastConnect.h"
+#include "H32_Log.h"
+#include "H32_Codec.h"
+#include "H32_Json.h"
+#include "H32_TLS.h"
+#include "H32_HTTP.h"
+#include "H32_MQTT.h"
+#include "H32_WakeState.h"
+#include "H32_Report.h"
 
 /*
  * This table contains the functions for communication with external APIs.
  * The function signature is 
- * bool f(char*, char*, H32_Measurements &, unordered_map<char *, double> &)
+ * bool f(char*, char*, H32_Measurements &)
  */
-bool thingspeak_call(char *api_key, char *api_additional, H32_Measurements &measurements, unordered_map<char *, double> &additional_data);
-bool iotplotter_call(char *api_key, char *api_additional, H32_Measurements &measurements, unordered_map<char *, double> &additional_data);
-bool (*api_calls[]) (char *, char *, H32_Measurements &, unordered_map<char *, double> &) = {
+bool thingspeak_call(char *api_key, char *api_additional, H32_Measurements &measurements);
+bool iotplotter_call(char *api_key, char *api_additional, H32_Measurements &measurements);
+bool (*api_calls[]) (char *, char *, H32_Measurements &) = {
   thingspeak_call,
   iotplotter_call,
 };
 
 /*
- * The size of json document buffers
+ * A second table contains the functions sending a batch of logged records
+ * to the same external APIs. The function signature is
+ * bool f(char*, char*, const H32_Log_Record *, uint16_t)
+ */
+bool thingspeak_batch(char *api_key, char *api_additional, const H32_Log_Record *records, uint16_t num);
+bool iotplotter_batch(char *api_key, char *api_additional, const H32_Log_Record *records, uint16_t num);
+bool (*api_batch_calls[]) (char *, char *, const H32_Log_Record *, uint16_t) = {
+  thingspeak_batch,
+  iotplotter_batch,
+};
+
+/*
+ * The size of json document buffers. The config document is sized from
+ * the schema (see config_doc_size()), the extensions add their tables.
  */
 const uint16_t json_doc_size = 1024;
 
 /*
- * the signature of our interrupt function
+ * The measurement log (backlog) is stored in LittleFS. At most
+ * log_batch_max records are sent at once and at most backlog_max_batches
+ * batches are sent in a single wake cycle.
  */
-void IRAM_ATTR button_interrupt_function();
+const char *log_path = "/h32_config/backlog.bin";
+const uint8_t log_batch_max = 8;
+const uint8_t backlog_max_batches = 8;
 
 /*
- * This version value is stored in the config data and can be used to
- * determine whether the config data is valid
+ * the signature of our interrupt function
  */
-const uint16_t h32_major_minor = H32_MAJOR << 8 | H32_MINOR;
+void IRAM_ATTR button_interrupt_function();
 
 /*
  * The Configuration data is saved to LittleFS as a json file whenever
@@ -112,51 +138,23 @@ const char *h32_prefs_key = "h32_config";
 const char *h32_prefs_dir = "/h32_config";
 const char *h32_prefs_path = "/h32_config/h32_config.json";
 
-typedef struct H32_Config {
-  uint16_t version = h32_major_minor;
-  uint16_t timeout = 20;
-  char name[SSID_LENGTH+1];
-  int8_t led_pin = 2;
-  int8_t trigger_pin = 0;
-  struct {
-    uint32_t sleeptime = 10;
-    double factor = 1;
-    double limit = 1;
-  } rtc;
-  struct {
-    APIType type;
-    char key[NAME_LENGTH+1];
-    char additional[NAME_LENGTH+1];
-  } api;
-  struct {
-    double coefficient = 1.0;
-    double constant = 0.0;
-    int8_t pin = 33;
-    int8_t activation = 0;
-  } bat_v;
-  struct {
-    double coefficient = 1.0;
-    double constant = 0.0;
-    int8_t pin = 34;
-  } ext_v;
-  struct {
-    char server[NAME_LENGTH+1];
-    uint16_t port = 1883;
-    char topic[TOPIC_LENGTH+1];
-    char user[NAME_LENGTH+1];
-    char passwd[NAME_LENGTH+1];
-  } mqtt;
-  struct {
-    char server[NAME_LENGTH+1] {"pool.ntp.org"};
-    int8_t daylightOffset_h = 1;
-    int8_t gmtOffset_h = 1;
-  } ntp;
-  struct {
-    char ip_address[IP_ADDR_LENGTH+1] {""};
-    char gateway[IP_ADDR_LENGTH+1] {""};
-    char subnet[IP_ADDR_LENGTH+1] {""};
-    char dns[IP_ADDR_LENGTH+1] {"8.8.8.8"};
-  } static_conf;
-} H32_Config;
+/*
+ * The data of the last WiFi connection is kept in NVS
+ */
+const char *h32_wifi_prefs = "h32_wifi";
+const char *h32_wifi_prefs_key = "cache";
+
+/*
+ * The shadow of the wake state is kept in NVS as well (see H32_WakeState.h)
+ */
+const char *h32_wake_prefs = "h32_wake";
+const char *h32_wake_prefs_key = "state";
+
+/*
+ * The TLS sessions, one key per server (see H32_TLS.h)
+ */
+const char *h32_tls_prefs = "h32_tls";
+
+#include "H32_Config.h"
 
 #endif // H32_BASIC_H
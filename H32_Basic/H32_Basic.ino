@@ -12,18 +12,23 @@
  * Page showing the current measurements
  * Thingspeak communication
  * IOTPlotter Communication
+ * Uploads to all configured services at once, with retries and a deadline
+ * Time budget per wake cycle, backed up by the watchdog
  * Reading the sensor
  * Portal allows to set the RTC to NTP time
  * Failed Connection Counter stored in RTC memory
  * Dynamic, configurable increase of sleep time when WiFi is not reachable
- * MQTT
+ * Sleep time adapted to the state of charge and charge rate of the battery
+ * Fast WiFi reconnect using the cached access point and lease
+ * Backlog of measurements that are sent in batches
+ * Measurements acquired in parallel to the WiFi connection
+ * Report by exception, connecting only when a reading changes beyond its deadband
+ * MQTT with QoS 0 or 1, JSON, binary or one topic per value
  * Extension mechanism for easy addition of user-specific code
+ * Optional profiling of the time spent in each phase of the wake cycle
  *
  * The following third-party libraries are used in this sketch:
- *   Adafruit_AHTX0 by Adafruit
  *   WiFiManager by tzapu
- *   Thingspeak by Mathworks
- *   PubSubClient by Nick O’Leary
  *   ArduinoJson by Benoit Blanchon (https://arduinojson.org/)
  *
  * These can be installed using the library manager of the Arduino IDE (or downloaded from Github)
@@ -47,6 +52,10 @@ const uint8_t H32_PATCH = 3;
 // H32_DEBUG has to be set to allow debug messages over serial. If not needed, simply comment it.
 #define H32_DEBUG
 
+// H32_PROFILE enables the wake cycle profiler that records the time spent in each phase
+// and stores the last profiles in LittleFS. To enable it, simply uncomment it.
+//#define H32_PROFILE
+
 // This is the password for the captive portal created when no WiFi credentials are stored
 const char* ap_passwd = "sokrates";
 
@@ -82,6 +91,8 @@ const int button_press_length = 500;
  * The following struct contains all configuration information.
  */
 H32_Config h32_config;
+// Its fields are the first table of the schema, extensions register theirs after it
+H32_Schema_Registration h32_config_registration(h32_config_fields, H32_FIELD_NUM(h32_config_fields), &h32_config);
 
 /*
  * The WiFiManager is used for all communication with the user via the web portal
@@ -90,10 +101,10 @@ WiFiManager wm;
 
 void setup() {
   // Turn off any alarm in RTC
-  uint16_t rtc_results = RTC_stop_and_check();
+  uint8_t rtc_results = RTC_stop_and_check();
 
   // Set the alarm, in case we are in a low power situation
-  RTC_set_alarm(SLEEPTIME_FALLBACK); // parameters
+  RTC_set_alarm(SLEEPTIME_FALLBACK, 0); // parameters
 
   // Init debug printing and print a first newline
   debug_init();
@@ -105,7 +116,15 @@ void setup() {
   debug_println(h32_config.name);
 
   // Read the configuration from NVS
+  phase_next(phase_config);
   read_config();
+  phase_next(phase_other);
+
+  // From now on the cycle has to end within its time budget
+  budget_begin();
+
+  // Load the state of the previous wake cycles
+  wake_state_begin();
 
   H32_Measurements measurements;
 
@@ -132,8 +151,8 @@ void setup() {
 
   // The rtc_results allow to differentiate between a "normal" reset and an RTC-triggered reset
   if(rtc_results != 0) {
-    debug_print("Countdown or Alarm has been triggered: ");
-    debug_println(rtc_results);
+    if(rtc_results & rtc_wake_alarm) debug_println("Alarm has been triggered");
+    if(rtc_results & rtc_wake_countdown) debug_println("Countdown has been triggered");
   }
 
   // Check whether an Extension vetoes the WiFi connection
@@ -147,10 +166,48 @@ void setup() {
     }
   }
 
+  // In survival mode the radio stays off (see H32_Power.h),
+  // with the backlog enabled we connect only every n-th wake
+  bool skip_WiFi = power_survival_mode() || (!report_enabled() && !backlog_connect_due());
+
+  // If the watchdog ended the last cycle, this one stays off the network
+  if(budget_watchdog_reset()) {
+    debug_println("Reset by the watchdog, skipping WiFi");
+    skip_WiFi = true;
+  }
+
+  // Acquire the measurements in parallel to the WiFi connection. This returns
+  // once the ADC has been read, since the ADC is disturbed by the radio.
+  {
+    phase_begin(phase_sensor);
+    acquisition_start(measurements);
+    phase_end();
+  }
+
+  // With report by exception we only connect if a reading has changed or the
+  // heartbeat is due. This replaces connecting every n-th wake of the backlog.
+  // The decision needs all measurements, so they are no longer acquired in
+  // parallel to the connection.
+  if(report_enabled() && !skip_WiFi) {
+    phase_begin(phase_sensor);
+    acquisition_join();
+    phase_end();
+    skip_WiFi = !report_due(measurements);
+  }
+
   // We initialize the WiFiManager that checks for stored credentials. If none are available,
   // a captive portal is opened. Otherwise it tries to connect to the network.
-  if(!veto_Wifi) {
+  if(!veto_Wifi && !skip_WiFi) {
+    phase_next(phase_wifi);
     init_WiFiManager();
+    phase_next(phase_other);
+  }
+
+  // The join point, only the time not hidden by the connection is added to the sensor phase
+  {
+    phase_begin(phase_sensor);
+    acquisition_join();
+    phase_end();
   }
 
   // Execute the wiFiInitialized operation of the user extensions
@@ -178,12 +235,23 @@ void setup() {
     }
   }
   // doing this in two distinct steps ensures that all data is read
-  unordered_map<char *, double> additional_data;
+  measurements.stamp(RTC_get_epoch());
   if (Extension::hasEntries()) {
     for (Extension *extension : *Extension::getContainer()) {
-      extension->collect(additional_data);
+      extension->collect(measurements);
     }
   }
+  // Add the profile of the last wake cycle
+  phase_collect(measurements);
+  // Decide on the sleep time, the decision is sent with the measurements
+  power_collect(measurements);
+
+  // Store the measurements in the backlog, they are sent from there
+  bool backlog_used = backlog_active();
+  if(backlog_used) {
+    backlog_record(measurements);
+  }
+  bool sent = false;
 
 
   // If the WiFiManager was able to connect us to the network, then we send our data
@@ -204,26 +272,39 @@ void setup() {
 
     // Reset failed connections counter
     RTC_set_RAM(0);
-    // Send data to the chosen channels
-    read_and_send_data(measurements, additional_data);
+    // Send data to the chosen channels, if there is time left
+    phase_next(phase_upload);
+    if(!budget_expired() && read_and_send_data(measurements)) {
+      wake_state_uploaded(measurements);
+      sent = true;
+    }
+    phase_next(phase_other);
   } else {
     // call user extensions if existing
     bool veto_backup = false;
     if (Extension::hasEntries()) {
       for (Extension *extension : *Extension::getContainer()) {
-        extension->api_call_no_wifi(h32_config.api.key, h32_config.api.additional, measurements, additional_data);
+        extension->api_call_no_wifi(h32_config.api.key, h32_config.api.additional, measurements);
         if (extension->veto_backoff()) {
           veto_backup = true;
         }
       }
     }
+    // Skipping the connection because of the backlog is no failure
     if (veto_backup) {
       RTC_set_RAM(0);
-    } else {
+    } else if (!skip_WiFi) {
       RTC_increment_RAM();
     }
   }
 
+  // Measurements that ran out of the time budget are kept in the log,
+  // they are sent with the next connection
+  if(budget_spill(sent, backlog_used)) {
+    debug_println("Time budget exceeded");
+    backlog_record(measurements);
+  }
+
   // If the button has been pressed for longer than a second, we jump to the configuration portal
   if(button_is_pressed()){
     return; // jump to loop()
@@ -240,10 +321,18 @@ void setup() {
     factor = h32_config.rtc.limit;
   }
   sleeptime *= factor;
+  // and adapt it to the state of charge
+  sleeptime = power_adapt_sleeptime(sleeptime);
+
+  // Store the wake state, the RTC part is written with the alarm
+  wake_state_end();
 
   // Set the alarm and shut down the whole system.
-  bool success = RTC_set_alarm(sleeptime);
+  phase_next(phase_alarm);
+  bool success = RTC_set_alarm(sleeptime, h32_config.rtc.align);
   if(success) {
+    // Store the time spent in each phase of this wake cycle
+    phase_finish();
     shutdown();
   } else {
     debug_println("Setting the alarm did not work. Resetting");
@@ -251,23 +340,32 @@ void setup() {
   }
 }
 
-void read_and_send_data(H32_Measurements &measurements, unordered_map<char *, double> additional_data) {
-  // send data if needed
-  if(h32_config.api.type != 0) {
-    api_calls[h32_config.api.type - 1](h32_config.api.key, h32_config.api.additional, measurements, additional_data);
+/*
+ * Send the data to the configured services (see H32_Dispatch.ino)
+ * @return true if everything has been sent
+ */
+bool read_and_send_data(H32_Measurements &measurements) {
+  // Start sending to all sinks at once, either the backlog (containing
+  // the current measurements) or only the current measurements
+  bool backlog_started = false;
+  if(backlog_active()) {
+    backlog_started = backlog_send_begin();
+  } else {
+    dispatch_measurements(measurements);
   }
-  // call user extensions if existing
+  // call user extensions if existing, while the sinks are busy
+  bool result = true;
   if (Extension::hasEntries()) {
     for (Extension *extension : *Extension::getContainer()) {
-      extension->api_call(h32_config.api.key, h32_config.api.additional, measurements, additional_data);
+      result = extension->api_call(h32_config.api.key, h32_config.api.additional, measurements) && result;
     }
   }
 
-
-  // MQTT if needed
-  if(strlen(h32_config.mqtt.server) != 0 && strlen(h32_config.mqtt.topic) != 0) {
-    mqtt_call(measurements, additional_data);
+  // Wait for the sinks, we power off afterwards
+  if(backlog_active()) {
+    return backlog_started && backlog_send_end() && result;
   }
+  return dispatch_end() && result;
 }
 
 /*
@@ -316,9 +414,10 @@ bool button_is_pressed() {
  */
 void loop() {
   // If we arrive here the button has been pressed
+  budget_watchdog_stop();
 
   // Turn off any alarm in RTC
-  PCF85063A_Regs rtc_results = RTC_stop_and_check();
+  uint8_t rtc_results = RTC_stop_and_check();
 
   static bool portal_started = false;
   static uint8_t dot_count = 0;
@@ -328,6 +427,7 @@ void loop() {
 
   // Reset failed connections counter
   RTC_set_RAM(0);
+  RTC_commit();
 
   // this part simply adds a newline every 20 dots
   if (++dot_count >= 20) {
@@ -358,7 +458,14 @@ void loop() {
  * that happens.
  */
 void shutdown() {
+  // Execute the before_shutdown operation of the user extensions
+  if (Extension::hasEntries()) {
+    for (Extension *extension : *Extension::getContainer()) {
+      extension->before_shutdown();
+    }
+  }
   debug_println("Shutdown");
+  budget_watchdog_stop();
   pinMode(DONE, OUTPUT);
   digitalWrite(DONE, HIGH);
 
@@ -0,0 +1,87 @@
+#ifndef H32_BUDGET_H
+#define H32_BUDGET_H
+
+#include <stdint.h>
+
+/*
+ * The time budget of a wake cycle. The board stays powered while it is
+ * awake, so a slow access point or a hung service must not keep it on until
+ * the fallback alarm. Every phase that waits for the network gets a share
+ * of the total budget, counted from the start of the phase, but never beyond
+ * the end of the cycle. Time a phase does not use is left to the later ones.
+ *
+ * The budget only depends on a clock (in milliseconds), so it can be run
+ * with fake clocks and sinks. The hardware watchdog that backs it up is set
+ * in H32_Budget.ino.
+ */
+
+enum H32_Budget_Phase : uint8_t {
+  budget_wifi = 0,
+  budget_upload,
+  budget_phase_num
+};
+
+class H32_Budget {
+private:
+  uint32_t (*clock)();
+  uint32_t start = 0;
+  uint32_t total = 0;       // 0 = no budget
+  uint8_t shares[budget_phase_num] = {100, 100};
+public:
+  H32_Budget(uint32_t (*clock)()) : clock(clock) {};
+
+  /*
+   * Start the budget of the cycle
+   * @param start the time the cycle started, e.g. 0 for the boot
+   */
+  void begin(uint32_t total, uint32_t start) {
+    this->total = total;
+    this->start = start;
+  };
+  /*
+   * The share of the budget a phase may take, in percent
+   */
+  void setShare(H32_Budget_Phase phase, uint8_t percent) {
+    shares[phase] = percent > 100 ? 100 : percent;
+  };
+  bool isLimited() const { return total != 0; };
+
+  /*
+   * The end of the cycle (of the clock)
+   */
+  uint32_t end() const { return start + total; };
+  uint32_t remaining() const {
+    int32_t remaining = (int32_t)(end() - clock());
+    return !isLimited() ? UINT32_MAX : remaining > 0 ? remaining : 0;
+  };
+  bool expired() const {
+    return isLimited() && remaining() == 0;
+  };
+
+  /*
+   * The time a phase starting now may take
+   */
+  uint32_t allow(H32_Budget_Phase phase) const {
+    if(!isLimited()) {
+      return UINT32_MAX;
+    }
+    uint32_t share = (uint64_t)total * shares[phase] / 100;
+    uint32_t left = remaining();
+    return share < left ? share : left;
+  };
+  /*
+   * The end (of the clock) of a phase starting now, only with a budget
+   */
+  uint32_t deadline(H32_Budget_Phase phase) const {
+    return clock() + allow(phase);
+  };
+  /*
+   * Measurements that could not be sent because the budget ran out are
+   * kept in the log, unless they are in it already
+   */
+  bool spill(bool sent, bool logged) const {
+    return !sent && !logged && expired();
+  };
+};
+
+#endif // H32_BUDGET_H
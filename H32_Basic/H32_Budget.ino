@@ -0,0 +1,90 @@
+/*
+ * The time budget of the wake cycle (see H32_Budget.h) starts with the boot.
+ * It is backed up by the task watchdog: if the main task is still running
+ * budget_watchdog_margin seconds after the end of the budget, e.g. because
+ * an extension or the I2C bus hangs, the ESP32 resets. The next cycle then
+ * only measures and powers off again, without WiFi.
+ */
+#include <esp_task_wdt.h>
+
+const uint32_t budget_watchdog_margin = 20;   // seconds
+
+uint32_t budget_clock() {
+  return millis();
+}
+
+H32_Budget cycle_budget(budget_clock);
+bool budget_watchdog_running = false;
+
+/*
+ * Start the budget once the config has been read
+ */
+void budget_begin() {
+  cycle_budget.begin(h32_config.deadline * 1000UL, 0);
+  cycle_budget.setShare(budget_wifi, h32_config.budget.wifi);
+  cycle_budget.setShare(budget_upload, h32_config.budget.upload);
+  if(!cycle_budget.isLimited()) {
+    return;
+  }
+
+  uint32_t timeout = h32_config.deadline + budget_watchdog_margin;
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_task_wdt_config_t config = {
+    .timeout_ms = timeout * 1000,
+    .idle_core_mask = 0,
+    .trigger_panic = true,
+  };
+  // The core may have started the watchdog already
+  if(esp_task_wdt_reconfigure(&config) != ESP_OK && esp_task_wdt_init(&config) != ESP_OK) {
+    return;
+  }
+#else
+  if(esp_task_wdt_init(timeout, true) != ESP_OK) {
+    return;
+  }
+#endif
+  budget_watchdog_running = esp_task_wdt_add(NULL) == ESP_OK;
+}
+
+/*
+ * Stop the watchdog, e.g. before the configuration portal is opened
+ */
+void budget_watchdog_stop() {
+  if(budget_watchdog_running) {
+    esp_task_wdt_delete(NULL);
+    budget_watchdog_running = false;
+  }
+}
+
+/*
+ * @return true if the last cycle has been ended by a watchdog
+ */
+bool budget_watchdog_reset() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  return reason == ESP_RST_TASK_WDT || reason == ESP_RST_INT_WDT || reason == ESP_RST_WDT;
+}
+
+bool budget_expired() {
+  return cycle_budget.expired();
+}
+
+bool budget_spill(bool sent, bool logged) {
+  return cycle_budget.spill(sent, logged);
+}
+
+/*
+ * The timeout of the WiFi connection in seconds, the configured one or less
+ */
+uint16_t budget_wifi_timeout(uint16_t timeout) {
+  uint32_t allowed = cycle_budget.allow(budget_wifi) / 1000;
+  return allowed < timeout ? max(allowed, (uint32_t)1) : timeout;
+}
+
+/*
+ * Limit the uploads to their share of the budget
+ */
+void budget_upload_deadline(H32_Dispatcher &dispatcher) {
+  if(cycle_budget.isLimited()) {
+    dispatcher.setDeadline(cycle_budget.deadline(budget_upload));
+  }
+}
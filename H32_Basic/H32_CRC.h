@@ -0,0 +1,19 @@
+#ifndef H32_CRC_H
+#define H32_CRC_H
+
+/*
+ * CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) used to
+ * protect the binary data we persist between wake cycles.
+ */
+inline uint16_t crc16(const void *data, size_t length, uint16_t crc = 0xFFFF) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for(size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for(int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+#endif // H32_CRC_H
@@ -0,0 +1,346 @@
+#ifndef H32_CODEC_H
+#define H32_CODEC_H
+
+#include <math.h>
+
+/*
+ * A compact binary format for measurement records, used wherever bytes
+ * count (MQTT, LoRa). All values are sent as fixed-point integers
+ * (temperature and humidity in centi-units, voltages in mV) and every
+ * value is delta encoded against the previous record of the same message.
+ * Integers are written as zigzag varints, so small deltas take one byte.
+ *
+ * Format (version 1):
+ *   u8      version
+ *   u8      number of names n (at most codec_names_max)
+ *   n times u8 length, followed by the name (without terminating zero)
+ *   then for every record until the end of the message:
+ *     varint  sequence number (delta to the previous record)
+ *     varint  epoch (delta to the previous record)
+ *     varint  mask of the values present, bit 0-5 are the core values
+ *             (see codec_scale), bit 6 and above the named values
+ *     varint  for every value present the delta to the last value of
+ *             the same field
+ *
+ * A message can carry every named value of a record (codec_names_max is
+ * log_additional_num), the mask then takes up to 32 bits. An encoder that
+ * gets more names fails instead of leaving values out.
+ *
+ * Encoder and decoder work on buffers provided by the caller and do not
+ * allocate any memory.
+ */
+
+const uint8_t codec_version = 1;
+const uint8_t codec_core_num = 6;
+const uint8_t codec_names_max = log_additional_num;
+const uint8_t codec_fields_num = codec_core_num + codec_names_max;
+static_assert(codec_fields_num <= 32, "the mask of the values present has 32 bits");
+
+/*
+ * The fixed-point scale of the core values in the order of the mask bits:
+ * temperature, humidity, battery voltage, external voltage, battery
+ * percentage and battery charge rate. Named values use codec_named_scale.
+ */
+const int16_t codec_scale[codec_core_num] = {100, 100, 1000, 1000, 100, 100};
+const int16_t codec_named_scale = 100;
+
+/*
+ * The name of the id of a named value of a record
+ */
+typedef const char *(*H32_Name_Function)(uint8_t id);
+
+class H32_Encoder {
+private:
+  uint8_t *buffer;
+  size_t size;
+  size_t pos = 0;
+  uint8_t names_num = 0;
+  const char *names[codec_names_max];
+  uint8_t ids[codec_names_max];
+  uint32_t last_seq = 0;
+  uint32_t last_epoch = 0;
+  int32_t last_values[codec_fields_num] = {0};
+
+  bool putByte(uint8_t byte) {
+    if(pos >= size) {
+      return false;
+    }
+    buffer[pos++] = byte;
+    return true;
+  };
+  bool putVarint(uint32_t value) {
+    while(value >= 0x80) {
+      if(!putByte((value & 0x7F) | 0x80)) {
+        return false;
+      }
+      value >>= 7;
+    }
+    return putByte(value);
+  };
+  bool putSigned(int32_t value) {
+    return putVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+  };
+  bool writeHeader() {
+    pos = 0;
+    if(!putByte(codec_version) || !putByte(names_num)) {
+      return false;
+    }
+    for(int i = 0; i < names_num; i++) {
+      uint8_t length = strnlen(names[i], log_name_length);
+      if(!putByte(length)) {
+        return false;
+      }
+      for(int c = 0; c < length; c++) {
+        if(!putByte(names[i][c])) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+  int8_t nameIndex(uint8_t id) {
+    for(int i = 0; i < names_num; i++) {
+      if(ids[i] == id) {
+        return i;
+      }
+    }
+    return -1;
+  };
+public:
+  H32_Encoder(uint8_t *buffer, size_t size) : buffer(buffer), size(size) {};
+
+  /*
+   * Write the header. The name table is the union of the names of
+   * the additional values of all records that will be added.
+   * @param name gives the names of the ids of the records
+   * @return false if the header does not fit or there are too many names
+   */
+  bool begin(const H32_Log_Record *records, uint16_t num, H32_Name_Function name) {
+    names_num = 0;
+    for(int r = 0; r < num; r++) {
+      for(int i = 0; i < records[r].additional_num; i++) {
+        uint8_t id = records[r].additional[i].id;
+        if(nameIndex(id) >= 0) {
+          continue;
+        }
+        if(names_num >= codec_names_max) {
+          pos = 0;
+          return false;
+        }
+        ids[names_num] = id;
+        names[names_num++] = name(id);
+      }
+    }
+    return writeHeader();
+  };
+  /*
+   * Write the header for values that are not kept in records, e.g. the
+   * measurements. The names have to outlive the encoder.
+   * @return false if the header does not fit or there are too many names
+   */
+  bool begin(const char *const *names, uint8_t num) {
+    if(num > codec_names_max) {
+      names_num = 0;
+      pos = 0;
+      return false;
+    }
+    names_num = num;
+    for(int i = 0; i < names_num; i++) {
+      this->names[i] = names[i];
+      ids[i] = i;
+    }
+    return writeHeader();
+  };
+
+  /*
+   * Add a record. If it does not fit anymore, the buffer is left unchanged.
+   * @return true if the record has been added
+   */
+  bool add(const H32_Log_Record &record) {
+    const float core[codec_core_num] = {
+      record.temperature, record.humidity, record.batV,
+      record.extV, record.batPercentage, record.batChargeRate
+    };
+    float named[codec_names_max];
+    for(int i = 0; i < codec_names_max; i++) {
+      named[i] = NAN;
+    }
+    for(int i = 0; i < record.additional_num; i++) {
+      int8_t index = nameIndex(record.additional[i].id);
+      if(index >= 0) {
+        named[index] = record.additional[i].value;
+      }
+    }
+    return add(record.seq, record.epoch, core, named);
+  };
+  /*
+   * Add the core values and the values of the names of the header, in
+   * the same order. Missing values are NAN.
+   * @return true if the record has been added
+   */
+  bool add(uint32_t seq, uint32_t epoch, const float *core, const float *named) {
+    size_t start = pos;
+    int32_t values[codec_fields_num];
+    uint32_t mask = 0;
+    for(int i = 0; i < codec_core_num; i++) {
+      if(!isnan(core[i])) {
+        mask |= 1UL << i;
+        values[i] = lroundf(core[i] * codec_scale[i]);
+      }
+    }
+    for(int i = 0; i < names_num; i++) {
+      if(!isnan(named[i])) {
+        mask |= 1UL << (codec_core_num + i);
+        values[codec_core_num + i] = lroundf(named[i] * codec_named_scale);
+      }
+    }
+
+    bool fits = putSigned(seq - last_seq)
+             && putSigned(epoch - last_epoch)
+             && putVarint(mask);
+    for(int i = 0; i < codec_fields_num && fits; i++) {
+      if(mask & (1UL << i)) {
+        fits = putSigned(values[i] - last_values[i]);
+      }
+    }
+    if(!fits) {
+      pos = start;
+      return false;
+    }
+    last_seq = seq;
+    last_epoch = epoch;
+    for(int i = 0; i < codec_fields_num; i++) {
+      if(mask & (1UL << i)) {
+        last_values[i] = values[i];
+      }
+    }
+    return true;
+  };
+
+  size_t length() const { return pos; };
+};
+
+class H32_Decoder {
+private:
+  const uint8_t *buffer;
+  size_t size;
+  size_t pos = 0;
+  uint8_t names_num = 0;
+  char names[codec_names_max][log_name_length+1];
+  uint32_t last_seq = 0;
+  uint32_t last_epoch = 0;
+  int32_t last_values[codec_fields_num] = {0};
+
+  bool getByte(uint8_t &byte) {
+    if(pos >= size) {
+      return false;
+    }
+    byte = buffer[pos++];
+    return true;
+  };
+  bool getVarint(uint32_t &value) {
+    value = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+      uint8_t byte;
+      if(!getByte(byte)) {
+        return false;
+      }
+      value |= (uint32_t)(byte & 0x7F) << shift;
+      if(!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  bool getSigned(int32_t &value) {
+    uint32_t raw;
+    if(!getVarint(raw)) {
+      return false;
+    }
+    value = (int32_t)(raw >> 1) ^ -(int32_t)(raw & 1);
+    return true;
+  };
+public:
+  H32_Decoder(const uint8_t *buffer, size_t size) : buffer(buffer), size(size) {};
+
+  /*
+   * Read the header
+   * @return false if the message is invalid or of an unknown version
+   */
+  bool begin() {
+    uint8_t version;
+    pos = 0;
+    if(!getByte(version) || version != codec_version || !getByte(names_num)
+       || names_num > codec_names_max) {
+      return false;
+    }
+    for(int i = 0; i < names_num; i++) {
+      uint8_t length;
+      if(!getByte(length)) {
+        return false;
+      }
+      for(int c = 0; c < length; c++) {
+        uint8_t byte;
+        if(!getByte(byte)) {
+          return false;
+        }
+        if(c < log_name_length) {
+          names[i][c] = byte;
+        }
+      }
+      names[i][length < log_name_length ? length : log_name_length] = 0;
+    }
+    return true;
+  };
+
+  /*
+   * The name of the id of a named value of the decoded records
+   */
+  const char *name(uint8_t id) const {
+    return id < names_num ? names[id] : NULL;
+  };
+
+  /*
+   * Decode the next record. Missing values are set to NAN, the ids of the
+   * named values are their index in the header (see name()).
+   * @return false at the end of the message or if it is truncated
+   */
+  bool next(H32_Log_Record &record) {
+    int32_t seq_delta, epoch_delta;
+    uint32_t mask;
+    if(pos >= size || !getSigned(seq_delta) || !getSigned(epoch_delta) || !getVarint(mask)) {
+      return false;
+    }
+    memset(&record, 0, sizeof(record));
+    last_seq += seq_delta;
+    last_epoch += epoch_delta;
+    record.seq = last_seq;
+    record.epoch = last_epoch;
+    for(int i = 0; i < codec_fields_num; i++) {
+      if(mask & (1UL << i)) {
+        int32_t delta;
+        if(!getSigned(delta)) {
+          return false;
+        }
+        last_values[i] += delta;
+      }
+    }
+    float *core[codec_core_num] = {
+      &record.temperature, &record.humidity, &record.batV,
+      &record.extV, &record.batPercentage, &record.batChargeRate
+    };
+    for(int i = 0; i < codec_core_num; i++) {
+      *core[i] = mask & (1UL << i) ? (float)last_values[i] / codec_scale[i] : NAN;
+    }
+    for(int i = 0; i < names_num && record.additional_num < log_additional_num; i++) {
+      if(mask & (1UL << (codec_core_num + i))) {
+        H32_Log_Entry &entry = record.additional[record.additional_num++];
+        entry.id = i;
+        entry.value = (float)last_values[codec_core_num + i] / codec_named_scale;
+      }
+    }
+    return true;
+  };
+};
+
+#endif // H32_CODEC_H
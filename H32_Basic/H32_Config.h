@@ -0,0 +1,321 @@
+#ifndef H32_CONFIG_H
+#define H32_CONFIG_H
+
+#include "H32_CRC.h"
+#include "H32_Schema.h"
+#include "H32_ADC.h"
+#include "H32_Power.h"
+#include "H32_Log.h"
+
+/*
+ * The configuration of the H32, its fields for the json file, the binary
+ * image and the portal (see H32_Schema.h), and the header of the image.
+ * The version (H32_MAJOR, H32_MINOR) and the lengths of the strings and
+ * input fields (SSID_LENGTH, NAME_LENGTH, ...) are defined by the sketch.
+ */
+
+/*
+ * This version value is stored in the config data and can be used to
+ * determine whether the config data is valid
+ */
+const uint16_t h32_major_minor = H32_MAJOR << 8 | H32_MINOR;
+
+/*
+ * One of the Parameter entries in the WiFiManager is a combination of dropdown and
+ * normal input field. This has to be handwritten and the following info is used
+ * for that. The APIType is also used in the function table that contains the 
+ * communication with external services (API Calls)
+ */
+enum APIType : int8_t {
+  none = 0,
+  thingspeak = 1,
+  iotplotter = 2,
+};
+const char *apitype_names[] = {
+  "---",
+  "Thingspeak",
+  "IOT Plotter",
+};
+const int apitype_num = sizeof(apitype_names)/sizeof(char *);
+
+/*
+ * The payload format used for MQTT messages
+ */
+enum MQTTFormat : uint8_t {
+  mqtt_json = 0,
+  mqtt_binary = 1,
+  mqtt_fields = 2,    // one topic per value, e.g. <topic>/temperature
+};
+
+/*
+ * Additional analog channels, e.g. voltage dividers. A channel is read if it
+ * has a pin and a name, and is reported under that name.
+ */
+const uint8_t analog_channel_num = 4;
+
+typedef struct H32_Analog_Config {
+  char name[log_name_length+1] {""};
+  int8_t pin = 0;
+  int8_t activation = 0;
+  double constant = 0.0;    // the calibration polynomial, see H32_ADC.h
+  double linear = 1.0;
+  double quadratic = 0.0;
+  double cubic = 0.0;
+  double deadband = 0.0;    // for report by exception, 0 ignores the channel
+  double hysteresis = 0.0;
+} H32_Analog_Config;
+
+/*
+ * A service the measurements are sent to (see H32_Dispatch.ino)
+ */
+typedef struct H32_API_Config {
+  APIType type;
+  char key[NAME_LENGTH+1];
+  char additional[NAME_LENGTH+1];
+  uint8_t retries = 1;
+  uint8_t tls = 0;
+  char fingerprint[FINGERPRINT_LENGTH+1];
+} H32_API_Config;
+
+typedef struct H32_Config {
+  uint16_t version = h32_major_minor;
+  uint16_t timeout = 20;
+  int8_t fast_connect = 1;
+  uint16_t deadline = 60;     // seconds awake per wake cycle, 0 = no budget (see H32_Budget.h)
+  char name[SSID_LENGTH+1];
+  int8_t led_pin = 2;
+  int8_t trigger_pin = 0;
+  struct {
+    uint8_t wifi = 50;        // percent of the deadline
+    uint8_t upload = 100;
+  } budget;
+  struct {
+    uint32_t sleeptime = 10;
+    double factor = 1;
+    double limit = 1;
+    uint32_t align = 0;
+  } rtc;
+  struct {
+    uint8_t every = 0;
+    uint8_t batch = 8;
+  } backlog;
+  struct {
+    uint16_t heartbeat = 0;   // minutes, 0 turns report by exception off
+    double temperature = 0.2;
+    double temperature_hysteresis = 0.1;
+    double humidity = 2.0;
+    double humidity_hysteresis = 1.0;
+    double bat_v = 0.05;
+    double bat_v_hysteresis = 0.0;
+    double ext_v = 0.1;
+    double ext_v_hysteresis = 0.0;
+    double bat_percentage = 5.0;
+    double bat_percentage_hysteresis = 0.0;
+  } report;
+  struct {
+    uint8_t survival = 0;
+    uint32_t survival_sleeptime = 3600;
+    uint8_t survival_hysteresis = 5;
+    double charge_rate = 0.0;
+    double charge_factor = 1.0;
+  } power;
+  H32_Power_Level power_level[power_level_num];
+  H32_API_Config api;
+  H32_API_Config api2;
+  struct {
+    double coefficient = 1.0;
+    double constant = 0.0;
+    int8_t pin = 33;
+    int8_t activation = 0;
+  } bat_v;
+  struct {
+    double coefficient = 1.0;
+    double constant = 0.0;
+    int8_t pin = 34;
+  } ext_v;
+  H32_Analog_Config analog[analog_channel_num];
+  struct {
+    uint8_t samples = 7;
+    H32_ADC_Filter filter = adc_filter_trimmed_mean;
+  } adc;
+  struct {
+    uint8_t samples = 1;
+  } sensor;
+  struct {
+    char server[NAME_LENGTH+1];
+    uint16_t port = 1883;
+    char topic[TOPIC_LENGTH+1];
+    char user[NAME_LENGTH+1];
+    char passwd[NAME_LENGTH+1];
+    MQTTFormat format = mqtt_json;
+    uint8_t qos = 0;
+    uint8_t retries = 1;
+    uint8_t tls = 0;
+    char fingerprint[FINGERPRINT_LENGTH+1];
+  } mqtt;
+  struct {
+    char server[NAME_LENGTH+1] {"pool.ntp.org"};
+    int8_t daylightOffset_h = 1;
+    int8_t gmtOffset_h = 1;
+  } ntp;
+  struct {
+    char ip_address[IP_ADDR_LENGTH+1] {""};
+    char gateway[IP_ADDR_LENGTH+1] {""};
+    char subnet[IP_ADDR_LENGTH+1] {""};
+    char dns[IP_ADDR_LENGTH+1] {"8.8.8.8"};
+  } static_conf;
+} H32_Config;
+
+/*
+ * The fields of the configuration in the order they are shown in the portal
+ * (see H32_Schema.h). Fields without an id are only persisted.
+ */
+#define H32_ANALOG_FIELDS(n) \
+  H32_HTML("<h3>Channel " #n "</h3>"), \
+  H32_FIELD_N(H32_Config, analog, n, name, "analog" #n "_name", "Name (empty turns off)", NULL), \
+  H32_FIELD_N(H32_Config, analog, n, pin, "analog" #n "_pin", "Pin (0 turns off)", "pattern='\\d{0,2}'"), \
+  H32_FIELD_N(H32_Config, analog, n, activation, "analog" #n "_activation", "Activation Pin<br/>(0 turns off, - is active low, + is active high)", "pattern='-?\\d{0,2}'"), \
+  H32_FIELD_N(H32_Config, analog, n, constant, "analog" #n "_constant", "Constant", NULL), \
+  H32_FIELD_N(H32_Config, analog, n, linear, "analog" #n "_linear", "Linear Coefficient", NULL), \
+  H32_FIELD_N(H32_Config, analog, n, quadratic, "analog" #n "_quadratic", "Quadratic Coefficient", NULL), \
+  H32_FIELD_N(H32_Config, analog, n, cubic, "analog" #n "_cubic", "Cubic Coefficient", NULL), \
+  H32_FIELD_N(H32_Config, analog, n, deadband, "analog" #n "_deadband", "Report Deadband (0 ignores the channel)", NULL), \
+  H32_FIELD_N(H32_Config, analog, n, hysteresis, "analog" #n "_hyst", "Report Hysteresis", NULL)
+#define H32_POWER_LEVEL_FIELDS(n) \
+  H32_FIELD_N(H32_Config, power_level, n, soc, "power_level" #n "_soc", "Level " #n ": below % (0 turns off)", "pattern='\\d{0,3}'"), \
+  H32_FIELD_N(H32_Config, power_level, n, factor, "power_level" #n "_factor", "Level " #n ": Sleep Time Factor", NULL)
+#define IP_ADDR_PATTERN "pattern='^((25[0-5]|(2[0-4]|1\\d|[1-9]|)\\d)\\.?\\b){4}$'"
+const H32_Field h32_config_fields[] = {
+  H32_FIELD_2(H32_Config, version, NULL, NULL, NULL),
+  // Basic Settings ----------
+  H32_HTML("<h2>Basic</h2>"),
+  H32_FIELD_2(H32_Config, name, "basic_name", "Device Name", NULL),
+  H32_FIELD_2(H32_Config, led_pin, "basic_led_pin", "LED Pin<br/>(0 turns off, - is active low, + is active high)", "pattern='-?\\d{0,2}'"),
+  H32_FIELD_2(H32_Config, trigger_pin, "basic_trigger_pin", "Additional Trigger Pin<br/>(0 turns off)", "pattern='-?\\d{0,2}'"),
+  H32_FIELD_2(H32_Config, timeout, "basic_timeout", "WiFi Connection Timeout", NULL),
+  H32_FIELD_2(H32_Config, fast_connect, "basic_fast_connect", "WiFi Fast Reconnect<br/>(1 uses the last access point directly, 0 always scans)", "pattern='[01]'"),
+  H32_FIELD_2(H32_Config, deadline, "basic_deadline", "Time Budget per Wake Cycle in seconds<br/>(0 turns off)", "pattern='\\d{0,5}'"),
+  H32_FIELD_3(H32_Config, budget, wifi, "basic_budget_wifi", "Share of the Budget for WiFi in %", "pattern='\\d{0,3}'"),
+  H32_FIELD_3(H32_Config, budget, upload, "basic_budget_upload", "Share of the Budget for the Uploads in %", "pattern='\\d{0,3}'"),
+  // RTC Settings ------------
+  H32_HTML("<h2>RTC</h2>"),
+  H32_FIELD_3(H32_Config, rtc, sleeptime, "rtc_sleeptime", "RTC Sleep Time in seconds", NULL),
+  H32_FIELD_3(H32_Config, rtc, factor, "rtc_factor", "RTC Backoff Factor", NULL),
+  H32_FIELD_3(H32_Config, rtc, limit, "rtc_limit", "RTC Backoff Limit", NULL),
+  H32_FIELD_3(H32_Config, rtc, align, "rtc_align", "RTC Wake Alignment in seconds (0 = off)", NULL),
+  // Power Policy ------------
+  H32_HTML("<h2>Power Policy</h2><p>Adapts the sleep time to the state of charge of the fuel gauge (Rev 3)</p>"),
+  H32_POWER_LEVEL_FIELDS(1),
+  H32_POWER_LEVEL_FIELDS(2),
+  H32_POWER_LEVEL_FIELDS(3),
+  H32_POWER_LEVEL_FIELDS(4),
+  H32_FIELD_3(H32_Config, power, charge_rate, "power_charge_rate", "Charging from Charge Rate in %/h (0 turns off)", NULL),
+  H32_FIELD_3(H32_Config, power, charge_factor, "power_charge_factor", "Sleep Time Factor while Charging", NULL),
+  H32_FIELD_3(H32_Config, power, survival, "power_survival", "Survival Mode below % (0 turns off)<br/>(the radio stays off)", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, power, survival_sleeptime, "power_survival_sleeptime", "Survival Sleep Time in seconds", NULL),
+  H32_FIELD_3(H32_Config, power, survival_hysteresis, "power_survival_hyst", "Survival Mode Hysteresis in %<br/>(left above Survival + Hysteresis)", "pattern='\\d{0,2}'"),
+  // Backlog Settings --------
+  H32_HTML("<h2>Backlog</h2>"),
+  H32_FIELD_3(H32_Config, backlog, every, "backlog_every", "Connect every n-th Wake<br/>(0 disables the backlog)", "pattern='\\d{0,3}'"),
+  H32_FIELD_3(H32_Config, backlog, batch, "backlog_batch", "Measurements per Upload", "pattern='\\d{0,2}'"),
+  // Report by Exception -----
+  H32_HTML("<h2>Report by Exception</h2><p>Connect only if a value has changed by its deadband (0 ignores the value). While it changes, the deadband is reduced by the hysteresis.</p>"),
+  H32_FIELD_3(H32_Config, report, heartbeat, "report_heartbeat", "Heartbeat in minutes, the longest time without a report<br/>(0 connects on every wake)", "pattern='\\d{0,5}'"),
+  H32_FIELD_3(H32_Config, report, temperature, "report_temperature", "Temperature Deadband", NULL),
+  H32_FIELD_3(H32_Config, report, temperature_hysteresis, "report_temperature_hyst", "Temperature Hysteresis", NULL),
+  H32_FIELD_3(H32_Config, report, humidity, "report_humidity", "Humidity Deadband", NULL),
+  H32_FIELD_3(H32_Config, report, humidity_hysteresis, "report_humidity_hyst", "Humidity Hysteresis", NULL),
+  H32_FIELD_3(H32_Config, report, bat_v, "report_bat_v", "Battery Voltage Deadband", NULL),
+  H32_FIELD_3(H32_Config, report, bat_v_hysteresis, "report_bat_v_hyst", "Battery Voltage Hysteresis", NULL),
+  H32_FIELD_3(H32_Config, report, ext_v, "report_ext_v", "Ext Voltage Deadband", NULL),
+  H32_FIELD_3(H32_Config, report, ext_v_hysteresis, "report_ext_v_hyst", "Ext Voltage Hysteresis", NULL),
+  H32_FIELD_3(H32_Config, report, bat_percentage, "report_bat_percentage", "Battery Percentage Deadband", NULL),
+  H32_FIELD_3(H32_Config, report, bat_percentage_hysteresis, "report_bat_percentage_hyst", "Battery Percentage Hysteresis", NULL),
+  // Measurements ------------
+  H32_HTML("<h2>Measurements</h2>"),
+  H32_FIELD_3(H32_Config, bat_v, activation, "measurement_bat_activation", "Battery Measurement Activation Pin<br/>(0 turns off, - is active low, + is active high)", "pattern='-?\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, bat_v, coefficient, "measurement_bat_coefficient", "Battery Voltage Compensation Coefficient", NULL),
+  H32_FIELD_3(H32_Config, bat_v, constant, "measurement_bat_constant", "Battery Voltage Compensation Constant", NULL),
+  H32_FIELD_3(H32_Config, bat_v, pin, "measurement_bat_pin", "Battery Voltage Pin", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, ext_v, coefficient, "measurement_ext_coefficient", "Ext Voltage Compensation Coefficient", NULL),
+  H32_FIELD_3(H32_Config, ext_v, constant, "measurement_ext_constant", "Ext Voltage Compensation Constant", "pattern='[+-]?[.\\d]{0,6}'"),
+  H32_FIELD_3(H32_Config, ext_v, pin, "measurement_ext_pin", "Ext Voltage Pin", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, adc, samples, "measurement_adc_samples", "ADC Samples per Channel", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, adc, filter, "measurement_adc_filter", "ADC Filter<br/>(0 mean, 1 median, 2 trimmed mean)", "pattern='[012]'"),
+  H32_FIELD_3(H32_Config, sensor, samples, "measurement_sensor_samples", "Sensor Oversampling", "pattern='\\d{0,2}'"),
+  // Analog Channels ---------
+  H32_HTML("<h2>Analog Channels</h2><p>Calibration: V = constant + linear * x + quadratic * x<sup>2</sup> + cubic * x<sup>3</sup></p>"),
+  H32_ANALOG_FIELDS(1),
+  H32_ANALOG_FIELDS(2),
+  H32_ANALOG_FIELDS(3),
+  H32_ANALOG_FIELDS(4),
+  // API Keys ----------------
+  H32_HTML("<h2>Service API Keys</h2>"),
+  H32_CHOICE_3(H32_Config, api, type, "api_type", "Service Type (Choose from Dropdown, current value below)", apitype_names, apitype_num),
+  H32_FIELD_3(H32_Config, api, key, "api_key", "API Key", NULL),
+  H32_FIELD_3(H32_Config, api, additional, "api_additional", "API Additional Value", NULL),
+  H32_FIELD_3(H32_Config, api, retries, "api_retries", "API Retries", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, api, tls, "api_tls", "TLS (0 off, 1 on)", "pattern='[01]'"),
+  H32_FIELD_3(H32_Config, api, fingerprint, "api_fingerprint", "Server Certificate SHA-256 Fingerprint<br/>(required with TLS)", NULL),
+  H32_HTML("<h3>Second Service</h3><p>Sent to at the same time as the first one, it has to be a different service</p>"),
+  H32_CHOICE_3(H32_Config, api2, type, "api2_type", "Service Type (Choose from Dropdown, current value below)", apitype_names, apitype_num),
+  H32_FIELD_3(H32_Config, api2, key, "api2_key", "API Key", NULL),
+  H32_FIELD_3(H32_Config, api2, additional, "api2_additional", "API Additional Value", NULL),
+  H32_FIELD_3(H32_Config, api2, retries, "api2_retries", "API Retries", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, api2, tls, "api2_tls", "TLS (0 off, 1 on)", "pattern='[01]'"),
+  H32_FIELD_3(H32_Config, api2, fingerprint, "api2_fingerprint", "Server Certificate SHA-256 Fingerprint<br/>(required with TLS)", NULL),
+  // MQTT Settings -----------
+  H32_HTML("<h2>MQTT</h2>"),
+  H32_FIELD_3(H32_Config, mqtt, server, "mqtt_server", "MQTT Server", NULL),
+  H32_FIELD_3(H32_Config, mqtt, port, "mqtt_port", "MQTT Port", "pattern='\\d{0,5}'"),
+  H32_FIELD_3(H32_Config, mqtt, topic, "mqtt_topic", "MQTT Topic", NULL),
+  H32_FIELD_3(H32_Config, mqtt, user, "mqtt_user", "MQTT User", NULL),
+  H32_FIELD_3(H32_Config, mqtt, passwd, "mqtt_password", "MQTT Password", NULL),
+  H32_FIELD_3(H32_Config, mqtt, format, "mqtt_format", "MQTT Payload Format<br/>(0 JSON, 1 binary, 2 topic per value)", "pattern='[012]'"),
+  H32_FIELD_3(H32_Config, mqtt, qos, "mqtt_qos", "MQTT QoS (0 or 1)", "pattern='[01]'"),
+  H32_FIELD_3(H32_Config, mqtt, retries, "mqtt_retries", "MQTT Retries", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, mqtt, tls, "mqtt_tls", "MQTT TLS (0 off, 1 on)", "pattern='[01]'"),
+  H32_FIELD_3(H32_Config, mqtt, fingerprint, "mqtt_fingerprint", "MQTT Server Certificate SHA-256 Fingerprint<br/>(required with TLS)", NULL),
+  // NTP Settings ------------
+  H32_HTML("<h2>NTP</h2>"),
+  H32_FIELD_3(H32_Config, ntp, server, "ntp_server", "NTP Server", NULL),
+  H32_FIELD_3(H32_Config, ntp, gmtOffset_h, "ntp_timezone_offset", "NTP Timezone Offset", "pattern='\\d{0,2}'"),
+  H32_FIELD_3(H32_Config, ntp, daylightOffset_h, "ntp_daylight_offset", "NTP Daylight Offset", "pattern='\\d{0,2}'"),
+  // Static IP Settings ------
+  H32_HTML("<h2>Static IP Settings</h2>"),
+  H32_FIELD_3(H32_Config, static_conf, ip_address, "static_ip_address", "IP Address", IP_ADDR_PATTERN),
+  H32_FIELD_3(H32_Config, static_conf, gateway, "static_gateway", "Gateway", IP_ADDR_PATTERN),
+  H32_FIELD_3(H32_Config, static_conf, subnet, "static_subnet", "Subnet", IP_ADDR_PATTERN),
+  H32_FIELD_3(H32_Config, static_conf, dns, "static_dns", "DNS Server", IP_ADDR_PATTERN),
+};
+
+/*
+ * A binary image of the configuration is kept in NVS in addition to the json
+ * file. It is read with a single access on every wake. The json file is only
+ * parsed if the image is missing, damaged or from another firmware. The build
+ * time identifies the firmware, since the layout of the fields can change
+ * without a change of the version.
+ *
+ * The image is this header followed by the fields of all registered tables
+ * (see H32_Schema::pack()), so it includes the fields of the extensions.
+ */
+const char *h32_config_image_key = "image";
+const uint16_t h32_build_id = crc16(__DATE__ " " __TIME__, sizeof(__DATE__ " " __TIME__));
+
+typedef struct H32_Config_Image {
+  uint16_t version = h32_major_minor;
+  uint16_t build = h32_build_id;
+  uint16_t size = 0;    // of the packed fields following the header
+  uint16_t crc = 0;     // of the packed fields
+
+  bool isValid(const uint8_t *fields, size_t length) const {
+    return version == h32_major_minor && build == h32_build_id
+        && size == length && crc == crc16(fields, length);
+  }
+  void seal(const uint8_t *fields, size_t length) {
+    size = length;
+    crc = crc16(fields, length);
+  }
+} H32_Config_Image;
+
+#endif // H32_CONFIG_H
@@ -0,0 +1,184 @@
+#ifndef H32_DISPATCH_H
+#define H32_DISPATCH_H
+
+#include "H32_Executor.h"
+
+/*
+ * The uploads of a wake cycle are sent to all configured sinks (services)
+ * at once, each sink in a task of its own. The upload then takes as long as
+ * the slowest sink instead of the sum of all of them.
+ *
+ * Every sink has a retry budget, the number of attempts after a failed
+ * first one. All attempts have to start before a common deadline, at which
+ * the dispatcher stops waiting. A sink that is still busy then is abandoned
+ * and counts as failed, it cannot be started again.
+ *
+ * The sinks only read their jobs, so the jobs of a round can share their
+ * data. It must not be changed until the dispatcher is idle() again.
+ *
+ * Like the acquisition, the dispatcher only depends on H32_Executor and
+ * H32_Event (and a clock), so it can be run with std::thread as well.
+ */
+
+const uint8_t sink_max = 3;
+
+/*
+ * A destination of the uploads
+ */
+class H32_Sink {
+public:
+  /*
+   * Make one attempt to send the job
+   * @return true if the job has been sent
+   */
+  virtual bool send(void *job) = 0;
+};
+
+enum H32_Sink_State : uint8_t {
+  sink_idle = 0,
+  sink_busy,
+  sink_sent,
+  sink_failed,
+};
+
+class H32_Dispatcher {
+private:
+  typedef struct Slot {
+    H32_Dispatcher *dispatcher;
+    H32_Sink *sink;
+    H32_Executor *executor;
+    H32_Event *done;
+    void *job;
+    uint8_t budget;
+    uint8_t attempts;
+    bool started;
+    volatile H32_Sink_State state;
+  } Slot;
+
+  uint32_t (*clock)();      // in milliseconds
+  uint32_t deadline = 0;
+  bool has_deadline = false;
+  Slot slots[sink_max];
+  uint8_t num = 0;
+  bool abandoned = false;
+
+  static void attempt(Slot *slot) {
+    bool success = false;
+    do {
+      success = slot->sink->send(slot->job);
+      slot->attempts++;
+    } while(!success && slot->attempts <= slot->budget && !slot->dispatcher->expired());
+    slot->state = success ? sink_sent : sink_failed;
+  };
+  static void task(void *arg) {
+    Slot *slot = (Slot *)arg;
+    attempt(slot);
+    slot->done->set();
+  };
+public:
+  H32_Dispatcher(uint32_t (*clock)()) : clock(clock) {};
+
+  /*
+   * Add a sink with the executor running it and the event signalling its end
+   * @return the index of the sink, -1 if there are too many
+   */
+  int8_t add(H32_Sink &sink, H32_Executor &executor, H32_Event &done, uint8_t budget) {
+    if(num >= sink_max) {
+      return -1;
+    }
+    slots[num] = {this, &sink, &executor, &done, NULL, budget, 0, false, sink_idle};
+    return num++;
+  };
+  uint8_t getNum() const { return num; };
+
+  /*
+   * The time (of the clock) until which attempts may start
+   */
+  void setDeadline(uint32_t deadline) {
+    this->deadline = deadline;
+    has_deadline = true;
+  };
+  bool expired() const {
+    return has_deadline && (int32_t)(clock() - deadline) >= 0;
+  };
+
+  /*
+   * Start sending the job to the sink. If the executor cannot run the sink,
+   * it is run right away.
+   * @return false if the sink is still busy or the deadline has passed
+   */
+  bool start(uint8_t index, void *job) {
+    if(index >= num || slots[index].state == sink_busy || expired()) {
+      return false;
+    }
+    Slot &slot = slots[index];
+    slot.job = job;
+    slot.attempts = 0;
+    slot.state = sink_busy;
+    slot.started = true;
+    if(!slot.executor->run(task, &slot)) {
+      attempt(&slot);
+      slot.started = false;
+    }
+    return true;
+  };
+
+  /*
+   * Wait until all started sinks are done or the deadline has passed
+   * @return true if all sinks that have been started sent their job
+   */
+  bool join() {
+    bool result = true;
+    for(uint8_t index = 0; index < num; index++) {
+      Slot &slot = slots[index];
+      // Every started task sets its event once, even if it has already
+      // finished. Otherwise the event would end the wait of the next round.
+      if(slot.started) {
+        if(!has_deadline) {
+          slot.done->wait();
+        } else {
+          int32_t remaining = (int32_t)(deadline - clock());
+          if(!slot.done->waitFor(remaining > 0 ? remaining : 0)) {
+            // abandoned, the state stays busy
+            abandoned = true;
+            result = false;
+            continue;
+          }
+        }
+        slot.started = false;
+      }
+      result = result && slot.state != sink_failed;
+    }
+    return result;
+  };
+
+  H32_Sink_State getState(uint8_t index) const { return slots[index].state; };
+  /*
+   * A sink has been abandoned, its task may still be using its job
+   */
+  bool hasAbandoned() const { return abandoned; };
+  /*
+   * No sink is busy, so the jobs (which the sinks may share) can be changed
+   */
+  bool idle() const {
+    for(uint8_t index = 0; index < num; index++) {
+      if(slots[index].state == sink_busy) {
+        return false;
+      }
+    }
+    return true;
+  };
+  uint8_t getAttempts(uint8_t index) const { return slots[index].attempts; };
+  /*
+   * Forget the results of the last round, abandoned sinks stay busy
+   */
+  void reset() {
+    for(uint8_t index = 0; index < num; index++) {
+      if(slots[index].state != sink_busy) {
+        slots[index].state = sink_idle;
+      }
+    }
+  };
+};
+
+#endif // H32_DISPATCH_H
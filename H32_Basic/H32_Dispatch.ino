@@ -0,0 +1,303 @@
+/*
+ * The uploads are sent to all configured sinks at once (see H32_Dispatch.h):
+ * the two API services and MQTT, each in a task of its own. The extensions
+ * are called in the meantime.
+ *
+ * With the backlog, every sink has its own position in the log. A sink that
+ * fails keeps its records for the next wake while the others continue with
+ * new ones, the log is acknowledged up to the sink that is furthest behind.
+ *
+ * All sinks share a single copy of the measurements and of the batch of
+ * records, which they only read. A sink gets the part of the batch it has
+ * not sent yet by its offset into it. A sink that is abandoned at the
+ * deadline keeps running on its job, so the shared data is only refilled
+ * while no sink is busy, and no further rounds are started.
+ *
+ * The task of a sink, with its stack, is created when the sink is started
+ * and ends with its job. Only the configured sinks are started, so there
+ * is no stack for the others.
+ */
+
+const uint32_t dispatch_stack_size = 12288;   // the TLS handshake needs about 10 KB
+const UBaseType_t dispatch_priority = 1;
+
+enum H32_Sink_Index : uint8_t {
+  sink_api = 0,
+  sink_api2,
+  sink_mqtt,
+};
+
+/*
+ * The job of a sink: either the current measurements or its part of the
+ * batch of records of the backlog. Both are shared and read-only.
+ */
+typedef struct H32_Upload {
+  H32_Measurements *measurements;   // NULL for records
+  const H32_Log_Record *records;
+  uint16_t num;
+} H32_Upload;
+
+class H32_API_Sink : public H32_Sink {
+private:
+  H32_API_Config &api;
+public:
+  H32_API_Sink(H32_API_Config &api) : api(api) {};
+  bool send(void *job) {
+    H32_Upload *upload = (H32_Upload *)job;
+    if(upload->measurements == NULL) {
+      return api_batch_calls[api.type - 1](api.key, api.additional, upload->records, upload->num);
+    }
+    return api_calls[api.type - 1](api.key, api.additional, *upload->measurements);
+  };
+};
+
+/*
+ * The messages have been sent once the broker has acknowledged them
+ */
+class H32_MQTT_Sink : public H32_Sink {
+public:
+  bool send(void *job) {
+    H32_Upload *upload = (H32_Upload *)job;
+    if(upload->measurements == NULL) {
+      return mqtt_batch(upload->records, upload->num);
+    }
+    return mqtt_call(*upload->measurements) && mqtt.drain();
+  };
+};
+
+uint32_t dispatch_clock() {
+  return millis();
+}
+
+H32_API_Sink dispatch_api(h32_config.api);
+H32_API_Sink dispatch_api2(h32_config.api2);
+H32_MQTT_Sink dispatch_mqtt;
+H32_RTOS_Executor dispatch_executors[sink_max] = {
+  H32_RTOS_Executor("sink_api", dispatch_stack_size, dispatch_priority),
+  H32_RTOS_Executor("sink_api2", dispatch_stack_size, dispatch_priority),
+  H32_RTOS_Executor("sink_mqtt", dispatch_stack_size, dispatch_priority),
+};
+H32_RTOS_Event dispatch_events[sink_max];
+H32_Dispatcher dispatcher(dispatch_clock);
+H32_Upload dispatch_uploads[sink_max];
+H32_Measurements dispatch_live;
+H32_Log_Record dispatch_records[log_batch_max];
+bool dispatch_configured[sink_max];
+
+/*
+ * Check which sinks are configured
+ */
+void dispatch_check_sinks() {
+  dispatch_configured[sink_api] = h32_config.api.type != none;
+  // Two sinks of the same service would share its connection
+  dispatch_configured[sink_api2] = h32_config.api2.type != none && h32_config.api2.type != h32_config.api.type;
+  dispatch_configured[sink_mqtt] = strlen(h32_config.mqtt.server) != 0 && strlen(h32_config.mqtt.topic) != 0;
+}
+
+/*
+ * Set up the sinks, the uploads get their share of the time budget from now on
+ */
+void dispatch_begin() {
+  if(dispatcher.getNum() == 0) {
+    dispatcher.add(dispatch_api, dispatch_executors[sink_api], dispatch_events[sink_api], h32_config.api.retries);
+    dispatcher.add(dispatch_api2, dispatch_executors[sink_api2], dispatch_events[sink_api2], h32_config.api2.retries);
+    dispatcher.add(dispatch_mqtt, dispatch_executors[sink_mqtt], dispatch_events[sink_mqtt], h32_config.mqtt.retries);
+  }
+  api_begin();
+  budget_upload_deadline(dispatcher);
+  dispatch_check_sinks();
+}
+
+/*
+ * Start sending the current measurements to all configured sinks
+ */
+void dispatch_measurements(H32_Measurements &measurements) {
+  dispatch_begin();
+  if(!dispatcher.idle()) {
+    return;
+  }
+  dispatch_live = measurements;
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    if(dispatch_configured[sink]) {
+      dispatch_uploads[sink] = {&dispatch_live, NULL, 0};
+      dispatcher.start(sink, &dispatch_uploads[sink]);
+    }
+  }
+}
+
+/*
+ * Close the connections, unless their sink has been abandoned
+ * @return false if MQTT messages have not been acknowledged
+ */
+bool dispatch_close() {
+  if(dispatcher.getState(sink_api) != sink_busy && dispatcher.getState(sink_api2) != sink_busy) {
+    api_end();
+  }
+  return dispatcher.getState(sink_mqtt) == sink_busy || mqtt_end();
+}
+
+/*
+ * Wait for the sinks and close the connections
+ * @return true if all sinks sent the measurements
+ */
+bool dispatch_end() {
+  bool result = dispatcher.join();
+  result = dispatch_close() && result;
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    if(!dispatch_configured[sink]) {
+      continue;
+    }
+    debug_print("Sink ");
+    debug_print(sink);
+    debug_print(": state ");
+    debug_print(dispatcher.getState(sink));
+    debug_print(", attempts ");
+    debug_println(dispatcher.getAttempts(sink));
+  }
+  return result;
+}
+
+/*
+ * The backlog is sent in rounds. Every round reads the next batch for the
+ * sink that is furthest behind and sends every sink the part it has not got
+ * yet, starting at its own offset into the batch.
+ */
+bool dispatch_given_up[sink_max];
+
+uint32_t backlog_sink_tail(uint8_t sink) {
+  uint32_t tail = wake_state_sink_tail(sink);
+  return tail > backlog.getTail() && tail <= backlog.getHead() ? tail : backlog.getTail();
+}
+
+/*
+ * Start the next round
+ * @return false if there is nothing left to send
+ */
+bool backlog_round_start() {
+  // the batch is still read by an abandoned sink
+  if(dispatcher.hasAbandoned() || !dispatcher.idle()) {
+    return false;
+  }
+  uint32_t from = 0;
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    uint32_t tail = backlog_sink_tail(sink);
+    if(dispatch_configured[sink] && !dispatch_given_up[sink] && tail < backlog.getHead()
+       && (from == 0 || tail + 1 < from)) {
+      from = tail + 1;
+    }
+  }
+  if(from == 0) {
+    return false;
+  }
+  uint16_t num = backlog_peek(from, dispatch_records, constrain(h32_config.backlog.batch, 1, log_batch_max));
+  if(num == 0) {
+    // nothing readable left, skip the rest
+    for(uint8_t sink = 0; sink < sink_max; sink++) {
+      wake_state_set_sink_tail(sink, backlog.getHead());
+    }
+    return false;
+  }
+  debug_print("Sending backlog records: ");
+  debug_println(num);
+
+  dispatcher.reset();
+  bool started = false;
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    if(!dispatch_configured[sink] || dispatch_given_up[sink]) {
+      continue;
+    }
+    uint16_t offset = 0;
+    while(offset < num && dispatch_records[offset].seq <= backlog_sink_tail(sink)) {
+      offset++;
+    }
+    if(offset < num) {
+      dispatch_uploads[sink] = {NULL, dispatch_records + offset, (uint16_t)(num - offset)};
+      started = dispatcher.start(sink, &dispatch_uploads[sink]) || started;
+    }
+  }
+  return started;
+}
+
+/*
+ * Wait for the round and advance the sinks that sent their part
+ */
+void backlog_round_end() {
+  dispatcher.join();
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    H32_Sink_State state = dispatcher.getState(sink);
+    if(state == sink_sent) {
+      H32_Upload &upload = dispatch_uploads[sink];
+      wake_state_set_sink_tail(sink, upload.records[upload.num - 1].seq);
+    } else if(state != sink_idle) {
+      dispatch_given_up[sink] = true;
+    }
+  }
+}
+
+/*
+ * Start sending the backlog, the first round runs while the extensions are called
+ */
+bool backlog_send_begin() {
+  dispatch_begin();
+  memset(dispatch_given_up, 0, sizeof(dispatch_given_up));
+  if(!backlog_begin()) {
+    backlog_file.end();
+    return false;
+  }
+  backlog_round_start();
+  return true;
+}
+
+/*
+ * Send the remaining rounds and acknowledge what all sinks have got
+ * @return true if all pending records have been sent
+ */
+bool backlog_send_end() {
+  backlog_round_end();
+  for(int i = 1; i < backlog_max_batches && backlog_round_start(); i++) {
+    backlog_round_end();
+  }
+
+  bool result = true;
+  uint32_t tail = backlog.getHead();
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    if(dispatch_configured[sink]) {
+      uint32_t sink_tail = backlog_sink_tail(sink);
+      tail = min(tail, sink_tail);
+      result = result && sink_tail == backlog.getHead();
+    } else {
+      // a sink configured later starts with the new records
+      wake_state_set_sink_tail(sink, backlog.getHead());
+    }
+  }
+  backlog.acknowledge(tail);
+  backlog_file.end();
+
+  return dispatch_close() && result;
+}
+
+/*
+ * Without the backlog, measurements that ran out of the time budget are
+ * stored in the log as well (see setup()). They are sent from there, like
+ * with the backlog, until every configured sink has got them.
+ */
+bool backlog_spilled() {
+  if(backlog_enabled() || !wake_state_log_known()) {
+    return false;
+  }
+  dispatch_check_sinks();
+  for(uint8_t sink = 0; sink < sink_max; sink++) {
+    if(dispatch_configured[sink] && wake_state_sink_tail(sink) < wake_state_log_head()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * The measurements go through the log, either with the backlog or to send
+ * the spilled ones first
+ */
+bool backlog_active() {
+  return backlog_enabled() || backlog_spilled();
+}
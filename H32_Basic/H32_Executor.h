@@ -0,0 +1,101 @@
+#ifndef H32_EXECUTOR_H
+#define H32_EXECUTOR_H
+
+/*
+ * The measurements are acquired in a task of their own while the WiFi
+ * connection is established. The orchestration only depends on the
+ * following two interfaces. The sketch implements them with FreeRTOS
+ * (see H32_Acquisition.ino), but they can as well be implemented with
+ * std::thread and a condition variable. The uploads use them as well
+ * (see H32_Dispatch.h).
+ */
+
+/*
+ * A one-shot event that is set by one task and waited for by another
+ */
+class H32_Event {
+public:
+  virtual void set() = 0;
+  /*
+   * Wait until the event has been set
+   */
+  virtual void wait() = 0;
+  /*
+   * Wait at most the given time
+   * @return false if the event has not been set in time
+   */
+  virtual bool waitFor(uint32_t milliseconds) = 0;
+};
+
+/*
+ * Runs a function concurrently to the caller
+ */
+class H32_Executor {
+public:
+  /*
+   * @return false if the function could not be started
+   */
+  virtual bool run(void (*function)(void *), void *arg) = 0;
+};
+
+/*
+ * The acquisition consists of two parts. The first part (reading the ADC)
+ * has to be finished before the radio is turned on, since the ADC2 cannot
+ * be used and the ADC1 is considerably noisier while WiFi is active. The
+ * second part (the I2C devices) overlaps with the WiFi connection.
+ *
+ * If the executor cannot start the task, both parts are run sequentially
+ * by start().
+ */
+class H32_Acquisition {
+private:
+  H32_Executor &executor;
+  H32_Event &adc_done;
+  H32_Event &done;
+  void (*read_adc)(void *);
+  void (*read_i2c)(void *);
+  void *arg = NULL;
+  bool running = false;
+
+  static void task(void *self) {
+    H32_Acquisition *acquisition = (H32_Acquisition *)self;
+    acquisition->read_adc(acquisition->arg);
+    acquisition->adc_done.set();
+    acquisition->read_i2c(acquisition->arg);
+    acquisition->done.set();
+  };
+public:
+  H32_Acquisition(H32_Executor &executor, H32_Event &adc_done, H32_Event &done,
+                  void (*read_adc)(void *), void (*read_i2c)(void *))
+    : executor(executor), adc_done(adc_done), done(done),
+      read_adc(read_adc), read_i2c(read_i2c) {};
+
+  /*
+   * Start the acquisition and return once the ADC has been read. The
+   * argument is passed to both parts.
+   * @return true if the rest runs concurrently
+   */
+  bool start(void *arg) {
+    this->arg = arg;
+    running = executor.run(task, this);
+    if(!running) {
+      read_adc(arg);
+      read_i2c(arg);
+      return false;
+    }
+    adc_done.wait();
+    return true;
+  };
+
+  /*
+   * The join point. All measurements are available afterwards.
+   */
+  void join() {
+    if(running) {
+      done.wait();
+      running = false;
+    }
+  };
+};
+
+#endif // H32_EXECUTOR_H
@@ -0,0 +1,166 @@
+#ifndef H32_FASTCONNECT_H
+#define H32_FASTCONNECT_H
+
+/*
+ * Scanning for the access point is the most expensive part of a wake cycle.
+ * We therefore remember the BSSID and channel of the last successful
+ * connection together with the IP lease and use them to associate directly
+ * on the next wake. Only if this fails within a short time we fall back to
+ * the normal WiFiManager connection. After repeated misses the fast connection
+ * is not tried anymore: if the normal connection failed as well, the cache is
+ * invalidated, since the access point may come back later. If it succeeded,
+ * the fast connection does not work with this access point and stays off
+ * until the access point changes.
+ *
+ * The lease is only reused for fast_connect_lease seconds after the DHCP
+ * exchange it came from (by the epoch of the RTC), since the DHCP server
+ * does not see it being renewed. After that the fast connection runs DHCP
+ * again and only the access point is taken from the cache.
+ *
+ * The decision logic is plain C++ without any dependency to the WiFi stack.
+ */
+
+const uint16_t fast_connect_magic = 0x4643;
+const uint8_t fast_connect_max_misses = 3;
+const uint16_t fast_connect_timeout_ms = 2000;
+const uint32_t fast_connect_lease = 1800;   // seconds, shorter than common leases
+
+/*
+ * The data persisted between wake cycles. IP addresses are stored in
+ * network order as returned by IPAddress. An ip of 0 means that no
+ * lease is cached (e.g., when a static IP is configured).
+ */
+typedef struct H32_WiFi_Cache {
+  uint16_t magic = 0;
+  uint8_t misses = 0;
+  uint8_t channel = 0;
+  uint8_t bssid[6] = {0};
+  char ssid[SSID_LENGTH+1] = {0};
+  uint32_t ip = 0;
+  uint32_t gateway = 0;
+  uint32_t subnet = 0;
+  uint32_t dns = 0;
+  uint32_t lease_start = 0;   // RTC epoch of the DHCP exchange
+
+  bool isValid() const { return magic == fast_connect_magic && channel != 0; };
+  void invalidate() { magic = 0; channel = 0; };
+} H32_WiFi_Cache;
+
+class H32_FastConnect {
+public:
+  enum State : uint8_t {
+    fc_start,       // nothing decided yet
+    fc_fast,        // trying to associate with the cached access point
+    fc_full,        // the normal WiFiManager connection has to be used
+    fc_connected,
+    fc_failed,
+  };
+private:
+  H32_WiFi_Cache &cache;
+  State state = fc_start;
+  bool changed = false;
+  bool lease_used = false;
+public:
+  H32_FastConnect(H32_WiFi_Cache &cache) : cache(cache) {};
+
+  State getState() const { return state; };
+  /*
+   * @return true if the cache has to be persisted
+   */
+  bool cacheChanged() const { return changed; };
+
+  /*
+   * Decide whether the fast connection can be tried for the given SSID
+   */
+  State begin(const char *ssid) {
+    if(cache.isValid() && cache.misses < fast_connect_max_misses
+       && strncmp(cache.ssid, ssid, SSID_LENGTH) == 0) {
+      state = fc_fast;
+    } else {
+      state = fc_full;
+    }
+    return state;
+  };
+
+  /*
+   * Decide whether the cached lease can be applied as the IP configuration
+   * of the fast connection
+   * @param now the epoch of the RTC
+   */
+  bool useLease(uint32_t now) {
+    lease_used = state == fc_fast && cache.ip != 0 && cache.lease_start != 0
+                 && now >= cache.lease_start && now - cache.lease_start < fast_connect_lease;
+    return lease_used;
+  };
+
+  /*
+   * Called repeatedly while the fast connection is tried.
+   * A timeout counts as a miss and leads to the full connection.
+   */
+  State poll(bool is_connected, uint32_t elapsed_ms) {
+    if(state != fc_fast) {
+      return state;
+    }
+    if(is_connected) {
+      if(cache.misses != 0) {
+        cache.misses = 0;
+        changed = true;
+      }
+      state = fc_connected;
+    } else if(elapsed_ms >= fast_connect_timeout_ms) {
+      cache.misses++;
+      changed = true;
+      state = fc_full;
+      lease_used = false;
+    }
+    return state;
+  };
+
+  /*
+   * The result of the full connection
+   */
+  State fullResult(bool is_connected) {
+    if(state == fc_full) {
+      state = is_connected ? fc_connected : fc_failed;
+      if(!is_connected && cache.isValid() && cache.misses >= fast_connect_max_misses) {
+        cache.invalidate();
+        changed = true;
+      }
+    }
+    return state;
+  };
+
+  /*
+   * Remember the access point and lease of the current connection. The miss
+   * counter is only reset when the access point changes, not with a new
+   * lease, so that the misses of an access point add up. A lease that has
+   * been obtained by DHCP starts now, a reused one keeps its start.
+   */
+  void remember(const char *ssid, const uint8_t *bssid, uint8_t channel,
+                uint32_t ip, uint32_t gateway, uint32_t subnet, uint32_t dns, uint32_t now) {
+    uint32_t lease_start = ip == 0 ? 0 : lease_used ? cache.lease_start : now;
+    bool same_access_point = cache.isValid() && cache.channel == channel
+                          && memcmp(cache.bssid, bssid, sizeof(cache.bssid)) == 0
+                          && strncmp(cache.ssid, ssid, SSID_LENGTH) == 0;
+    if(same_access_point && cache.ip == ip && cache.gateway == gateway
+       && cache.subnet == subnet && cache.dns == dns && cache.lease_start == lease_start) {
+      return;
+    }
+    if(!same_access_point) {
+      cache.magic = fast_connect_magic;
+      cache.misses = 0;
+      cache.channel = channel;
+      memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+      strncpy(cache.ssid, ssid, SSID_LENGTH);
+      cache.ssid[SSID_LENGTH] = 0;
+    }
+    cache.ip = ip;
+    cache.gateway = gateway;
+    cache.subnet = subnet;
+    cache.dns = dns;
+    cache.lease_start = lease_start;
+    changed = true;
+  };
+};
+
+#endif // H32_FASTCONNECT_H
@@ -0,0 +1,196 @@
+#ifndef H32_HTTP_H
+#define H32_HTTP_H
+
+#include "H32_Json.h"
+
+/*
+ * A minimal HTTP/1.1 client that keeps its connection open, so that all
+ * requests of a wake cycle to a service (e.g., the batches of the backlog)
+ * share a single TCP connection instead of one handshake each.
+ *
+ * The json body is streamed with the H32_Json_Writer, its length is taken
+ * from a first pass that only counts. Of the response only the status line
+ * and the headers needed to find the end of the body are read. The body is
+ * not stored: it is skipped right before the next request on the connection,
+ * and not at all after the last one. If the server closes the connection, it
+ * is opened again.
+ *
+ * The server may close an idle connection at any time, so a request on a
+ * reused connection is repeated once on a new one, but only if the server
+ * cannot have processed it: if the request could not be written completely,
+ * or if the connection was closed before any byte of the response. After a
+ * timeout the request may have been processed, and repeating it could
+ * duplicate the data.
+ */
+
+const uint16_t http_timeout = 5000;
+const uint8_t http_line_length = 64;
+const int http_no_response = -1;    // e.g. a timeout
+const int http_closed = -2;         // closed before any byte of the response
+const int http_not_sent = -3;       // the request could not be written
+
+class H32_HTTP {
+private:
+  Client &client;
+  const char *host;
+  uint16_t port;
+  int32_t body = 0;       // bytes of the body not read yet
+  bool chunked = false;   // the body is chunked and has not been read yet
+  uint16_t requests = 0;  // on the current connection
+
+  /*
+   * Read a line without the line end, longer lines are cut
+   * @return false on timeout
+   */
+  bool readLine(char *line, size_t size) {
+    size_t length = client.readBytesUntil('\n', line, size - 1);
+    line[length] = 0;
+    if(length > 0 && line[length - 1] == '\r') {
+      line[--length] = 0;
+    }
+    return length > 0 || client.connected();
+  };
+  bool skip(uint32_t length) {
+    uint8_t buffer[http_line_length];
+    while(length > 0) {
+      size_t read = client.readBytes(buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+      if(read == 0) {
+        return false;
+      }
+      length -= read;
+    }
+    return true;
+  };
+  /*
+   * Skip the body of the last response
+   */
+  bool drain() {
+    if(chunked) {
+      char line[http_line_length];
+      chunked = false;
+      uint32_t size;
+      do {
+        if(!readLine(line, sizeof(line))) {
+          return false;
+        }
+        size = strtoul(line, NULL, 16);
+        // the chunk and its line end
+        if(!skip(size + 2)) {
+          return false;
+        }
+      } while(size > 0);
+      return true;
+    }
+    bool result = body <= 0 || skip(body);
+    body = 0;
+    return result;
+  };
+  static bool startsWith(const char *line, const char *prefix) {
+    return strncasecmp(line, prefix, strlen(prefix)) == 0;
+  };
+  /*
+   * Read the status line and the headers. A connection closed before the
+   * response is noticed right away instead of after the timeout.
+   * @return the status, http_closed or http_no_response if there is none
+   */
+  int readResponse() {
+    uint32_t start = millis();
+    while(client.available() == 0) {
+      if(!client.connected()) {
+        return http_closed;
+      }
+      if(millis() - start >= http_timeout) {
+        return http_no_response;
+      }
+      delay(1);
+    }
+    char line[http_line_length];
+    int status = http_no_response;
+    if(!readLine(line, sizeof(line)) || sscanf(line, "HTTP/%*s %d", &status) != 1) {
+      return http_no_response;
+    }
+    bool close = false;
+    body = 0;
+    chunked = false;
+    while(readLine(line, sizeof(line)) && line[0] != 0) {
+      if(startsWith(line, "Content-Length:")) {
+        body = atol(line + 15);
+      } else if(startsWith(line, "Transfer-Encoding:") && strstr(line, "chunked") != NULL) {
+        chunked = true;
+      } else if(startsWith(line, "Connection:") && strstr(line, "close") != NULL) {
+        close = true;
+      }
+    }
+    if(close) {
+      end();
+    }
+    return status;
+  };
+public:
+  H32_HTTP(Client &client, const char *host, uint16_t port = 80) : client(client), host(host), port(port) {};
+
+  /*
+   * Takes effect with the next connection, e.g. 443 for a TLS client
+   */
+  void setPort(uint16_t port) { this->port = port; };
+
+  /*
+   * Post the json written by write_json
+   * @param headers additional header lines, each ending with \r\n
+   * @return the status of the response, -1 if there is none
+   */
+  int post(const char *path, const char *headers, const char *content_type, H32_Json_Function write_json) {
+    H32_Json_Writer counter(NULL);
+    write_json(counter);
+    counter.flush();
+
+    for(uint8_t attempt = 0; attempt < 2; attempt++) {
+      bool reused = client.connected() && requests > 0 && drain();
+      if(!reused) {
+        end();
+        if(!client.connect(host, port)) {
+          return -1;
+        }
+        client.setTimeout(http_timeout);
+      }
+      requests++;
+      const char *format = "POST %s HTTP/1.1\r\n"
+                           "Host: %s\r\n"
+                           "Connection: keep-alive\r\n"
+                           "Content-Type: %s\r\n"
+                           "%s"
+                           "Content-Length: %u\r\n\r\n";
+      unsigned length = counter.length();
+      int header = snprintf(NULL, 0, format, path, host, content_type, headers, length);
+      bool sent = client.printf(format, path, host, content_type, headers, length) == (size_t)header;
+      H32_Json_Writer json(&client);
+      if(sent) {
+        write_json(json);
+        json.flush();
+      }
+      int status = sent && !json.hasFailed() ? readResponse() : http_not_sent;
+      if(status >= 0) {
+        return status;
+      }
+      if(!reused || (status != http_not_sent && status != http_closed)) {
+        break;
+      }
+      debug_println("HTTP: connection closed by the server, repeating the request");
+    }
+    end();
+    return -1;
+  };
+  uint16_t getRequests() const { return requests; };
+
+  /*
+   * Close the connection, the rest of the response is not read
+   */
+  void end() {
+    client.stop();
+    body = 0;
+    chunked = false;
+    requests = 0;
+  };
+};
+
+#endif // H32_HTTP_H
@@ -0,0 +1,185 @@
+#ifndef H32_JSON_H
+#define H32_JSON_H
+
+#include <math.h>
+
+/*
+ * A streaming JSON writer that writes directly to a Print (a WiFiClient,
+ * the MQTT client or Serial) in chunks of json_chunk_size bytes. The
+ * memory needed is bounded by the chunk, independent of the amount of
+ * data written, and nothing is ever truncated.
+ *
+ * Without a Print the writer only counts the bytes, which allows to
+ * determine the content length before the actual write.
+ *
+ * Numbers and strings are formatted like ArduinoJson does, so that the
+ * output is identical to the one of serializeJson().
+ */
+
+const uint8_t json_chunk_size = 64;
+
+class H32_Json_Writer {
+private:
+  Print *out;
+  uint8_t chunk[json_chunk_size];
+  uint8_t used = 0;
+  size_t total = 0;
+  bool comma = false;   // the current level already contains a value
+  bool failed = false;  // the Print did not take everything
+
+  void separator() {
+    if(comma) {
+      write(',');
+    }
+  };
+  void writeInteger(uint32_t value) {
+    char digits[10];
+    int num = 0;
+    do {
+      digits[num++] = '0' + value % 10;
+      value /= 10;
+    } while(value != 0);
+    while(num > 0) {
+      write(digits[--num]);
+    }
+  };
+  void writeNumber(double value) {
+    if(isnan(value) || isinf(value)) {
+      write("null");
+      return;
+    }
+    if(value < 0) {
+      write('-');
+      value = -value;
+    }
+    // same split into integral, decimal and exponent as ArduinoJson
+    int16_t exponent = 0;
+    if(value >= 1e7) {
+      while(value >= 10) { value /= 10; exponent++; }
+    } else if(value > 0 && value <= 1e-5) {
+      while(value < 1) { value *= 10; exponent--; }
+    }
+    uint32_t integral = (uint32_t)value;
+    uint32_t max_decimal = 1000000000;
+    uint8_t places = 9;
+    for(uint32_t tmp = integral; tmp >= 10; tmp /= 10) {
+      max_decimal /= 10;
+      places--;
+    }
+    double remainder = (value - integral) * max_decimal;
+    uint32_t decimal = (uint32_t)remainder;
+    remainder -= decimal;
+    decimal += (uint32_t)(remainder * 2);
+    if(decimal >= max_decimal) {
+      decimal = 0;
+      integral++;
+      if(exponent != 0 && integral >= 10) {
+        exponent++;
+        integral = 1;
+      }
+    }
+    while(places > 0 && decimal % 10 == 0) {
+      decimal /= 10;
+      places--;
+    }
+
+    writeInteger(integral);
+    if(places > 0) {
+      char digits[9];
+      for(int i = places - 1; i >= 0; i--) {
+        digits[i] = '0' + decimal % 10;
+        decimal /= 10;
+      }
+      write('.');
+      for(int i = 0; i < places; i++) {
+        write(digits[i]);
+      }
+    }
+    if(exponent != 0) {
+      write('e');
+      if(exponent < 0) {
+        write('-');
+        exponent = -exponent;
+      }
+      writeInteger(exponent);
+    }
+  };
+  void writeString(const char *s) {
+    static const char escapes[] = "\"\"\\\\b\bf\fn\nr\rt\t";
+    write('"');
+    for(; *s; s++) {
+      const char *escape = NULL;
+      for(const char *e = escapes; *e; e += 2) {
+        if(e[1] == *s) {
+          escape = e;
+          break;
+        }
+      }
+      if(escape) {
+        write('\\');
+        write(escape[0]);
+      } else {
+        write(*s);
+      }
+    }
+    write('"');
+  };
+public:
+  H32_Json_Writer(Print *out) : out(out) {};
+
+  void write(char c) {
+    total++;
+    if(out == NULL) {
+      return;
+    }
+    chunk[used++] = c;
+    if(used == sizeof(chunk)) {
+      flush();
+    }
+  };
+  void write(const char *s) {
+    while(*s) {
+      write(*s++);
+    }
+  };
+  /*
+   * Write the rest of the chunk to the Print
+   */
+  void flush() {
+    if(out != NULL && used > 0 && out->write(chunk, used) != used) {
+      failed = true;
+    }
+    used = 0;
+  };
+  /*
+   * @return the number of bytes written so far
+   */
+  size_t length() const { return total; };
+  /*
+   * @return true if the Print did not take all of the flushed bytes
+   */
+  bool hasFailed() const { return failed; };
+
+  void beginObject() { separator(); write('{'); comma = false; };
+  void endObject() { write('}'); comma = true; };
+  void beginArray() { separator(); write('['); comma = false; };
+  void endArray() { write(']'); comma = true; };
+  void key(const char *name) { separator(); writeString(name); write(':'); comma = false; };
+  void value(double number) { separator(); writeNumber(number); comma = true; };
+  void value(uint32_t number) { separator(); writeInteger(number); comma = true; };
+  void value(const char *string) { separator(); writeString(string); comma = true; };
+};
+
+/*
+ * A function writing a json, called once per pass of the writer, with the
+ * data it writes as its context. Unlike a std::function with captures, it
+ * never allocates.
+ */
+typedef struct H32_Json_Function {
+  void (*function)(H32_Json_Writer &json, const void *context);
+  const void *context;
+
+  void operator()(H32_Json_Writer &json) const { function(json, context); };
+} H32_Json_Function;
+
+#endif // H32_JSON_H
@@ -0,0 +1,122 @@
+#ifndef H32_LORA_H
+#define H32_LORA_H
+
+#include <stdint.h>
+
+/*
+ * The parts of the LoRa extension (see Extensions/H32_LoRa_Extension.ino)
+ * that do not need the radio: the time on air of a packet and the duty
+ * cycle of the EU868 band.
+ *
+ * In the EU868 band every sub-band of ETSI EN 300 220 limits the share of
+ * time a device may transmit, e.g. 1% in 868.0 - 868.6 MHz. The duty cycle
+ * is tracked with a bucket of airtime credit that fills at the rate of the
+ * sub-band and holds at most the credit of lora_duty_window. A packet is
+ * only sent if the credit covers its time on air. The bucket is stamped
+ * with the epoch of the RTC, so it continues across power-off.
+ */
+
+const uint16_t lora_duty_none = 10000;     // duty cycles are given in 1/10000
+const uint32_t lora_duty_window = 3600;    // seconds
+const uint8_t lora_preamble = 8;           // symbols
+
+/*
+ * The time on air of a packet with explicit header and CRC in ms, rounded up
+ * (Semtech AN1200.13)
+ * @param coding_rate the denominator of 4/5 to 4/8
+ */
+inline uint32_t lora_airtime(uint8_t length, uint8_t sf, uint32_t bandwidth, uint8_t coding_rate) {
+  // symbol time in µs, the low data rate optimization is used above 16 ms
+  uint32_t symbol = ((uint32_t)1 << sf) * 1000000ULL / bandwidth;
+  uint8_t de = symbol > 16000 ? 1 : 0;
+  int32_t bits = 8 * length - 4 * sf + 28 + 16;
+  int32_t divisor = 4 * (sf - 2 * de);
+  int32_t blocks = bits > 0 ? (bits + divisor - 1) / divisor : 0;
+  uint32_t symbols = 8 + blocks * coding_rate;
+  // the preamble takes 4.25 symbols more than configured
+  uint64_t time = (uint64_t)symbol * (4 * (lora_preamble + symbols) + 17) / 4;
+  return (time + 999) / 1000;
+}
+
+/*
+ * The duty cycle of the EU868 sub-band of the frequency in Hz, in 1/10000.
+ * Outside of 863 - 870 MHz there is none. Between the sub-bands the
+ * strictest one is assumed.
+ */
+inline uint16_t lora_duty_cycle(uint32_t frequency) {
+  if(frequency < 863000000 || frequency > 870000000) {
+    return lora_duty_none;
+  }
+  if(frequency >= 865000000 && frequency <= 868600000) {
+    return 100;     // h1.4 and g1, 1%
+  }
+  if(frequency >= 869400000 && frequency <= 869650000) {
+    return 1000;    // g3, 10%
+  }
+  if(frequency >= 869700000) {
+    return 100;     // g4, 1%
+  }
+  return 10;        // h1.3 and g2, 0.1%
+}
+
+typedef struct H32_Duty_Cycle_State {
+  uint32_t epoch;     // of the last update, 0 if never updated
+  uint32_t credit;    // airtime left, in ms
+} H32_Duty_Cycle_State;
+
+class H32_Duty_Cycle {
+private:
+  H32_Duty_Cycle_State &state;
+  uint16_t ratio;
+public:
+  H32_Duty_Cycle(H32_Duty_Cycle_State &state, uint16_t ratio) : state(state), ratio(ratio) {};
+
+  uint32_t capacity() const {
+    return (uint64_t)lora_duty_window * 1000 * ratio / lora_duty_none;
+  };
+  /*
+   * Add the credit earned since the last update. A new bucket starts full.
+   * If the clock went back (e.g., the RTC lost its time), nothing is added.
+   */
+  void update(uint32_t now) {
+    if(state.epoch == 0) {
+      state.credit = capacity();
+    } else if(now > state.epoch) {
+      uint64_t credit = state.credit + (uint64_t)(now - state.epoch) * 1000 * ratio / lora_duty_none;
+      state.credit = credit < capacity() ? credit : capacity();
+    }
+    state.epoch = now;
+  };
+  bool allows(uint32_t airtime, uint32_t now) {
+    update(now);
+    return ratio >= lora_duty_none || state.credit >= airtime;
+  };
+  /*
+   * Take the airtime of a packet from the credit
+   * @return false if the credit does not cover it, nothing is taken then
+   */
+  bool spend(uint32_t airtime, uint32_t now) {
+    if(!allows(airtime, now)) {
+      return false;
+    }
+    if(ratio < lora_duty_none) {
+      state.credit -= airtime;
+    }
+    return true;
+  };
+  /*
+   * The seconds until the credit covers the airtime
+   */
+  uint32_t wait(uint32_t airtime, uint32_t now) {
+    if(allows(airtime, now)) {
+      return 0;
+    }
+    if(airtime > capacity()) {
+      return UINT32_MAX;
+    }
+    uint32_t rate = 1000UL * ratio;   // ms of credit per 10000 s
+    return ((uint64_t)(airtime - state.credit) * lora_duty_none + rate - 1) / rate;
+  };
+};
+
+#endif // H32_LORA_H
@@ -0,0 +1,362 @@
+#ifndef H32_LOG_H
+#define H32_LOG_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "H32_CRC.h"
+
+/*
+ * The measurement log stores every measurement in fixed-size records so
+ * that nothing is lost while WiFi is unreachable and so that a connection
+ * can be used to send many measurements at once.
+ *
+ * The log is a ring of log_slots records. Every record carries a sequence
+ * number, a CRC and a commit marker that is written last. A record whose
+ * write was interrupted by a power loss therefore never becomes visible.
+ * The sequence number of the last acknowledged (i.e., sent) record is kept
+ * in two alternating headers, so that an interrupted header write always
+ * leaves the previous one intact. Writing the slots round-robin spreads the
+ * wear evenly over the storage.
+ *
+ * The named values refer to their name by its index into a name table that
+ * is stored in the log as well, so a record with all values takes 248
+ * instead of 772 bytes. A name is written (and synced) before the first
+ * record that uses it. Once the table is full, the names that no pending
+ * record uses are replaced.
+ *
+ * The log works on an H32_Log_Storage that simply reads and writes bytes.
+ * This can be a file in LittleFS or the optional EEPROM.
+ */
+
+const uint16_t log_slots = 128;
+const uint8_t log_additional_num = 26;    // all but the core quantities of H32_Measurements.h
+const uint8_t log_name_length = 23;
+const uint8_t log_committed = 0xA5;
+const uint8_t log_uncommitted = 0xFF;
+const uint32_t log_magic = 0x48324C47;
+const uint8_t log_name_none = 0xFF;
+static_assert(log_additional_num <= 32, "the ids of the names have to fit into a mask");
+
+typedef struct H32_Log_Entry {
+  uint8_t id;           // of the name in the name table
+  float value;
+} H32_Log_Entry;
+
+typedef struct H32_Log_Record {
+  uint8_t commit;       // has to be the first byte, see append()
+  uint8_t reserved;
+  uint16_t crc;         // covers everything from seq on
+  uint32_t seq;
+  uint32_t epoch;
+  float batV;
+  float extV;
+  float temperature;
+  float humidity;
+  float batPercentage;
+  float batChargeRate;
+  H32_Log_Entry additional[log_additional_num];
+  uint8_t additional_num;
+
+  uint16_t calculateCRC() const {
+    return crc16(&seq, sizeof(H32_Log_Record) - offsetof(H32_Log_Record, seq));
+  }
+} H32_Log_Record;
+
+typedef struct H32_Log_Name {
+  char name[log_name_length+1];
+  uint16_t crc;
+
+  uint16_t calculateCRC() const {
+    return crc16(name, sizeof(name));
+  }
+  bool isValid() const {
+    return name[0] != 0 && name[log_name_length] == 0 && crc == calculateCRC();
+  }
+} H32_Log_Name;
+
+typedef struct H32_Log_Header {
+  uint32_t magic;
+  uint32_t tail;
+  uint16_t crc;
+
+  uint16_t calculateCRC() const {
+    return crc16(this, offsetof(H32_Log_Header, crc));
+  }
+  bool isValid() const {
+    return magic == log_magic && crc == calculateCRC();
+  }
+} H32_Log_Header;
+
+/*
+ * The storage the log is written to
+ */
+class H32_Log_Storage {
+public:
+  virtual bool read(uint32_t offset, void *data, size_t length) = 0;
+  virtual bool write(uint32_t offset, const void *data, size_t length) = 0;
+  /*
+   * Ensure that everything written so far has reached the storage
+   */
+  virtual bool sync() { return true; };
+};
+
+class H32_Log {
+private:
+  H32_Log_Storage &storage;
+  uint32_t head = 0;      // sequence number of the newest committed record
+  uint32_t tail = 0;      // sequence number of the last acknowledged record
+  uint8_t next_header = 0;
+  char names[log_additional_num][log_name_length+1];   // empty if the entry is free
+  uint32_t claimed = 0;   // the ids given out for the next record
+
+  static uint32_t headerOffset(uint8_t index) {
+    return index * sizeof(H32_Log_Header);
+  };
+  static uint32_t nameOffset(uint8_t id) {
+    return 2 * sizeof(H32_Log_Header) + id * sizeof(H32_Log_Name);
+  };
+  static uint32_t slotOffset(uint32_t seq) {
+    return nameOffset(log_additional_num) + ((seq - 1) % log_slots) * sizeof(H32_Log_Record);
+  };
+  /*
+   * Read the record with the given sequence number. Fails if the slot
+   * has been overwritten or was never committed.
+   */
+  bool readRecord(uint32_t seq, H32_Log_Record &record) {
+    if(!storage.read(slotOffset(seq), &record, sizeof(record))) {
+      return false;
+    }
+    return record.seq == seq && record.commit == log_committed
+        && record.crc == record.calculateCRC();
+  };
+  /*
+   * Recover the tail from the newer of the two headers
+   */
+  void readHeaders() {
+    H32_Log_Header headers[2];
+    tail = 0;
+    next_header = 0;
+    for(uint8_t i = 0; i < 2; i++) {
+      if(storage.read(headerOffset(i), &headers[i], sizeof(H32_Log_Header))
+         && headers[i].isValid() && headers[i].tail >= tail) {
+        tail = headers[i].tail;
+        next_header = 1 - i;
+      }
+    }
+  };
+  void readNames() {
+    for(uint8_t id = 0; id < log_additional_num; id++) {
+      H32_Log_Name entry;
+      bool valid = storage.read(nameOffset(id), &entry, sizeof(entry)) && entry.isValid();
+      strcpy(names[id], valid ? entry.name : "");
+    }
+  };
+  /*
+   * Free the names that neither a pending record nor the next one uses
+   * @return the first free id, log_name_none if all names are used
+   */
+  uint8_t freeNames() {
+    bool used[log_additional_num];
+    for(uint8_t id = 0; id < log_additional_num; id++) {
+      used[id] = claimed & (1UL << id);
+    }
+    H32_Log_Record record;
+    for(uint32_t seq = first(); seq <= head; seq++) {
+      if(readRecord(seq, record)) {
+        for(uint8_t i = 0; i < record.additional_num && i < log_additional_num; i++) {
+          if(record.additional[i].id < log_additional_num) {
+            used[record.additional[i].id] = true;
+          }
+        }
+      }
+    }
+    uint8_t free_id = log_name_none;
+    for(uint8_t id = 0; id < log_additional_num; id++) {
+      if(!used[id]) {
+        names[id][0] = 0;
+        free_id = free_id == log_name_none ? id : free_id;
+      }
+    }
+    return free_id;
+  };
+public:
+  H32_Log(H32_Log_Storage &storage) : storage(storage) {
+    memset(names, 0, sizeof(names));
+  };
+
+  /*
+   * The size of the storage the log needs
+   */
+  static uint32_t storageSize() {
+    return nameOffset(log_additional_num) + log_slots * sizeof(H32_Log_Record);
+  };
+
+  /*
+   * Recover head, tail and the name table from the storage
+   */
+  bool open() {
+    head = 0;
+    readHeaders();
+    readNames();
+    for(uint16_t slot = 0; slot < log_slots; slot++) {
+      H32_Log_Record record;
+      if(!storage.read(slotOffset(slot + 1), &record, sizeof(record))) {
+        return false;
+      }
+      if(record.commit == log_committed && record.crc == record.calculateCRC()
+         && record.seq != 0 && (record.seq - 1) % log_slots == slot && record.seq > head) {
+        head = record.seq;
+      }
+    }
+    if(tail > head) {
+      tail = head;
+    }
+    return true;
+  };
+
+  /*
+   * Like open(), but with the head remembered from the last wake cycle
+   * instead of scanning all slots. The head is only trusted if its record
+   * is there and the following slot does not hold a newer one, otherwise
+   * the slots are scanned.
+   */
+  bool resume(uint32_t known_head) {
+    H32_Log_Record record;
+    if(known_head != 0 && !readRecord(known_head, record)) {
+      return open();
+    }
+    if(!storage.read(slotOffset(known_head + 1), &record, sizeof(record))) {
+      return open();
+    }
+    if(record.commit == log_committed && record.crc == record.calculateCRC()
+       && record.seq > known_head) {
+      return open();
+    }
+    head = known_head;
+    readHeaders();
+    readNames();
+    if(tail > head) {
+      tail = head;
+    }
+    return true;
+  };
+
+  /*
+   * The id of the name in the name table, it is added if it is new
+   * @return log_name_none if the table is full with names of pending records
+   */
+  uint8_t nameId(const char *name) {
+    uint8_t free_id = log_name_none;
+    for(uint8_t id = 0; id < log_additional_num; id++) {
+      if(names[id][0] == 0) {
+        free_id = free_id == log_name_none ? id : free_id;
+      } else if(strncmp(names[id], name, log_name_length) == 0) {
+        claimed |= 1UL << id;
+        return id;
+      }
+    }
+    if(free_id == log_name_none) {
+      free_id = freeNames();
+    }
+    if(free_id == log_name_none) {
+      return log_name_none;
+    }
+    H32_Log_Name entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name, log_name_length);
+    entry.crc = entry.calculateCRC();
+    if(!storage.write(nameOffset(free_id), &entry, sizeof(entry)) || !storage.sync()) {
+      return log_name_none;
+    }
+    strcpy(names[free_id], entry.name);
+    claimed |= 1UL << free_id;
+    return free_id;
+  };
+  /*
+   * The name with the given id, NULL if there is none. A name may be
+   * replaced by the next call of nameId().
+   */
+  const char *name(uint8_t id) const {
+    return id < log_additional_num && names[id][0] != 0 ? names[id] : NULL;
+  };
+
+  /*
+   * Append a record. The sequence number, CRC and commit marker are set here,
+   * the ids of the named values have to come from nameId().
+   * The record is written with the commit marker cleared. Since the marker
+   * is the first byte, an interrupted write always invalidates the slot.
+   * Only then the marker is set. Each of the two writes has to be synced
+   * before the next one, the second one only writes the marker.
+   */
+  bool append(H32_Log_Record &record) {
+    claimed = 0;
+    record.seq = head + 1;
+    record.commit = log_uncommitted;
+    record.reserved = 0;
+    record.crc = record.calculateCRC();
+    uint32_t offset = slotOffset(record.seq);
+    if(!storage.write(offset, &record, sizeof(record)) || !storage.sync()) {
+      return false;
+    }
+    record.commit = log_committed;
+    if(!storage.write(offset, &record.commit, sizeof(record.commit)) || !storage.sync()) {
+      return false;
+    }
+    head = record.seq;
+    return true;
+  };
+
+  /*
+   * The oldest record that has not been acknowledged and is still available
+   */
+  uint32_t first() const {
+    uint32_t oldest = head >= log_slots ? head - log_slots + 1 : 1;
+    return tail + 1 > oldest ? tail + 1 : oldest;
+  };
+  uint32_t pending() const { return head + 1 - first(); };
+  uint32_t getHead() const { return head; };
+  uint32_t getTail() const { return tail; };
+
+  /*
+   * Read up to max_num of the oldest records that have not been acknowledged
+   * @return the number of records read
+   */
+  uint16_t peek(H32_Log_Record *records, uint16_t max_num) {
+    return peek(first(), records, max_num);
+  };
+
+  /*
+   * Like peek(), but starting with the record from (if it has not been acknowledged)
+   */
+  uint16_t peek(uint32_t from, H32_Log_Record *records, uint16_t max_num) {
+    uint16_t num = 0;
+    for(uint32_t seq = from > first() ? from : first(); seq <= head && num < max_num; seq++) {
+      if(readRecord(seq, records[num])) {
+        num++;
+      }
+    }
+    return num;
+  };
+
+  /*
+   * Mark all records up to and including seq as sent
+   */
+  bool acknowledge(uint32_t seq) {
+    if(seq <= tail) {
+      return true;
+    }
+    H32_Log_Header header;
+    header.magic = log_magic;
+    header.tail = seq > head ? head : seq;
+    header.crc = header.calculateCRC();
+    if(!storage.write(headerOffset(next_header), &header, sizeof(header)) || !storage.sync()) {
+      return false;
+    }
+    next_header = 1 - next_header;
+    tail = header.tail;
+    return true;
+  };
+};
+
+#endif // H32_LOG_H
@@ -0,0 +1,277 @@
+#ifndef H32_MQTT_H
+#define H32_MQTT_H
+
+#include <Client.h>
+
+/*
+ * A small MQTT 3.1.1 client that only publishes, but publishes many
+ * messages over a single connection.
+ *
+ * Messages with QoS 1 are pipelined: up to mqtt_window messages may wait
+ * for their PUBACK at the same time, so the round trip to the broker is
+ * paid once per window instead of once per message. drain() waits until
+ * all messages have been acknowledged. disconnect() additionally sends a
+ * DISCONNECT and waits until the broker closes the connection, so that
+ * the H32 can be powered off afterwards without losing anything.
+ *
+ * The client is a Print, so that a payload can be streamed between
+ * beginPublish() and endPublish() (e.g., by the H32_Json_Writer).
+ * Incoming packets other than CONNACK and PUBACK are skipped.
+ */
+
+const uint8_t mqtt_window = 8;
+const uint16_t mqtt_keepalive = 60;     // seconds
+const uint16_t mqtt_timeout = 3000;     // milliseconds
+const uint8_t mqtt_header_size = 160;   // fixed and variable header of a publish
+
+inline uint32_t mqtt_clock() {
+  return millis();
+}
+
+class H32_MQTT : public Print {
+private:
+  Client &client;
+  uint32_t (*clock)();
+  uint16_t next_id = 1;
+  uint16_t inflight[mqtt_window];
+  uint8_t inflight_num = 0;
+  size_t remaining = 0;   // payload bytes still expected by the current publish
+
+  /*
+   * Add the remaining length of a packet to the buffer
+   * @return the number of bytes added
+   */
+  static uint8_t putLength(uint8_t *buffer, uint32_t length) {
+    uint8_t num = 0;
+    do {
+      uint8_t byte = length % 128;
+      length /= 128;
+      buffer[num++] = length > 0 ? byte | 0x80 : byte;
+    } while(length > 0);
+    return num;
+  };
+  static uint16_t putString(uint8_t *buffer, const char *s, uint16_t length) {
+    buffer[0] = length >> 8;
+    buffer[1] = length & 0xFF;
+    memcpy(buffer + 2, s, length);
+    return length + 2;
+  };
+  bool readByte(uint8_t &byte, uint32_t start) {
+    while(!client.available()) {
+      if(!client.connected() || clock() - start > mqtt_timeout) {
+        return false;
+      }
+      delay(1);
+    }
+    byte = client.read();
+    return true;
+  };
+  /*
+   * Read a packet. Only the first size bytes of the payload are stored.
+   * Without wait nothing is read if no data is available.
+   */
+  bool readPacket(uint8_t &type, uint8_t *data, uint8_t size, uint32_t &length, bool wait) {
+    uint32_t start = clock();
+    if(!wait && !client.available()) {
+      return false;
+    }
+    if(!readByte(type, start)) {
+      return false;
+    }
+    length = 0;
+    for(uint8_t shift = 0; shift < 28; shift += 7) {
+      uint8_t byte;
+      if(!readByte(byte, start)) {
+        return false;
+      }
+      length |= (uint32_t)(byte & 0x7F) << shift;
+      if(!(byte & 0x80)) {
+        break;
+      }
+    }
+    for(uint32_t i = 0; i < length; i++) {
+      uint8_t byte;
+      if(!readByte(byte, start)) {
+        return false;
+      }
+      if(i < size) {
+        data[i] = byte;
+      }
+    }
+    return true;
+  };
+  /*
+   * Process the incoming packets
+   * @return true if a packet has been read
+   */
+  bool poll(bool wait) {
+    uint8_t type;
+    uint8_t data[4];
+    uint32_t length;
+    if(!readPacket(type, data, sizeof(data), length, wait)) {
+      return false;
+    }
+    if((type & 0xF0) == 0x40 && length == 2) {
+      uint16_t id = (data[0] << 8) | data[1];
+      for(uint8_t i = 0; i < inflight_num; i++) {
+        if(inflight[i] == id) {
+          inflight[i] = inflight[--inflight_num];
+          break;
+        }
+      }
+    }
+    return true;
+  };
+public:
+  H32_MQTT(Client &client, uint32_t (*clock)() = mqtt_clock) : client(client), clock(clock) {};
+
+  /*
+   * Connect to the broker and wait for the CONNACK. User and password
+   * are only sent if the user is not empty.
+   */
+  bool connect(const char *host, uint16_t port, const char *id, const char *user, const char *passwd) {
+    inflight_num = 0;
+    remaining = 0;
+    if(!client.connect(host, port)) {
+      return false;
+    }
+    bool login = user != NULL && strlen(user) != 0;
+    uint16_t id_length = strlen(id);
+    uint16_t user_length = login ? strlen(user) : 0;
+    uint16_t passwd_length = login ? strlen(passwd) : 0;
+    uint32_t length = 10 + 2 + id_length + (login ? 4 + user_length + passwd_length : 0);
+
+    uint8_t header[15] = {0x10};
+    uint8_t num = 1 + putLength(header + 1, length);
+    num += putString(header + num, "MQTT", 4);
+    header[num++] = 4;                      // protocol level 3.1.1
+    header[num++] = 0x02 | (login ? 0xC0 : 0);  // clean session, user, password
+    header[num++] = mqtt_keepalive >> 8;
+    header[num++] = mqtt_keepalive & 0xFF;
+    client.write(header, num);
+
+    uint8_t string[2];
+    const char *strings[3] = {id, user, passwd};
+    uint16_t lengths[3] = {id_length, user_length, passwd_length};
+    for(int i = 0; i < (login ? 3 : 1); i++) {
+      string[0] = lengths[i] >> 8;
+      string[1] = lengths[i] & 0xFF;
+      client.write(string, 2);
+      client.write((const uint8_t *)strings[i], lengths[i]);
+    }
+
+    uint8_t type;
+    uint8_t data[2];
+    uint32_t ack_length;
+    if(!readPacket(type, data, sizeof(data), ack_length, true)
+       || (type & 0xF0) != 0x20 || ack_length != 2 || data[1] != 0) {
+      client.stop();
+      return false;
+    }
+    return true;
+  };
+
+  bool connected() {
+    return client.connected();
+  };
+
+  /*
+   * Start a message with a payload of the given length. The payload is then
+   * written with the write() functions of Print. With QoS 1 this waits for
+   * an acknowledgement if the window is full.
+   */
+  bool beginPublish(const char *topic, size_t length, uint8_t qos) {
+    while(qos > 0 && inflight_num >= mqtt_window) {
+      if(!poll(true)) {
+        return false;
+      }
+    }
+    uint16_t topic_length = strlen(topic);
+    if(topic_length + 11 > mqtt_header_size) {
+      return false;
+    }
+    uint8_t header[mqtt_header_size] = {(uint8_t)(qos > 0 ? 0x32 : 0x30)};
+    uint8_t num = 1 + putLength(header + 1, 2 + topic_length + (qos > 0 ? 2 : 0) + length);
+    num += putString(header + num, topic, topic_length);
+    if(qos > 0) {
+      uint16_t id = next_id++;
+      if(next_id == 0) {
+        next_id = 1;
+      }
+      header[num++] = id >> 8;
+      header[num++] = id & 0xFF;
+      inflight[inflight_num++] = id;
+    }
+    remaining = length;
+    return client.write(header, num) == num;
+  };
+
+  size_t write(uint8_t byte) {
+    return write(&byte, 1);
+  };
+  size_t write(const uint8_t *buffer, size_t size) {
+    if(size > remaining) {
+      size = remaining;
+    }
+    size_t written = client.write(buffer, size);
+    remaining -= written;
+    return written;
+  };
+
+  /*
+   * End the message and process the acknowledgements that arrived so far
+   * @return false if the payload was not written completely
+   */
+  bool endPublish() {
+    while(poll(false)) {
+      ;
+    }
+    return remaining == 0 && client.connected();
+  };
+
+  bool publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos) {
+    return beginPublish(topic, length, qos) && write(payload, length) == length && endPublish();
+  };
+
+  /*
+   * Wait until all messages with QoS 1 have been acknowledged
+   */
+  bool drain() {
+    while(inflight_num > 0) {
+      if(!poll(true)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  /*
+   * The number of messages waiting for their acknowledgement
+   */
+  uint8_t pending() const { return inflight_num; };
+
+  /*
+   * Wait for the acknowledgements, send the DISCONNECT and close the
+   * connection once the broker has closed its side.
+   * @return false if not all messages have been acknowledged
+   */
+  bool disconnect() {
+    bool result = drain();
+    uint8_t packet[2] = {0xE0, 0x00};
+    client.write(packet, sizeof(packet));
+    // The broker closes the connection after the DISCONNECT, at which
+    // point it has received everything sent before
+    uint32_t start = clock();
+    while(client.connected() && clock() - start < mqtt_timeout) {
+      while(client.available()) {
+        client.read();
+      }
+      delay(1);
+    }
+    client.stop();
+    inflight_num = 0;
+    return result;
+  };
+};
+
+#endif // H32_MQTT_H
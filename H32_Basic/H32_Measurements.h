@@ -1,69 +1,246 @@
 #ifndef H32_MEASUREMENTS_H
 #define H32_MEASUREMENTS_H
 
-#include "H32_Basic.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "H32_Report.h"
 
 /*
  * Forward definitions for the needed functions
  */
+class H32_Measurements;
+bool read_adc();
 double read_bat_voltage();
 #ifdef H32_REV_3
 double read_bat_percentage();
 double read_bat_charge_rate();
 #endif //H32_REV_3
 double read_ext_voltage();
+void analog_collect(H32_Measurements &measurements);
 bool init_sensor();
-float get_temperature();
-float get_humidity();
+bool read_sensor(float *temperature, float *humidity);
+
+/*
+ * The measurements of a wake cycle are kept in a registry of fixed capacity.
+ * Every quantity (e.g., "Temperature") is interned once into a table shared
+ * by all registries and from then on addressed by its id, the index into that
+ * table. The core quantities have fixed ids, extensions intern theirs (e.g.,
+ * in init()) and keep the id. Setting and getting a value is an array access,
+ * the sinks simply iterate over all ids. Nothing is allocated on the heap.
+ *
+ * Values are stored in fixed point with the scale of their quantity, e.g.
+ * voltages in mV, and carry the epoch of the measurement and a quality.
+ * Only values of good quality are sent. The scale is chosen when the quantity
+ * is interned, so that the scaled values fit into 32 bits: the default of 100
+ * allows up to about 2.1e7, large values (e.g. counters) need a scale of 1.
+ * A value that does not fit is not wrapped around but marked as failed.
+ */
+const uint8_t measurement_capacity = 32;
+
+typedef uint8_t H32_Measurement_Id;
+const H32_Measurement_Id measurement_none = 0xFF;
+
+/*
+ * The ids of the core quantities, in the order of the core values of the
+ * binary format (see H32_Codec.h) and of the Thingspeak fields
+ */
+enum H32_Core_Measurement : H32_Measurement_Id {
+  measurement_temperature = 0,
+  measurement_humidity,
+  measurement_bat_v,
+  measurement_ext_v,
+  measurement_bat_percentage,
+  measurement_bat_charge_rate,
+  measurement_core_num,
+};
+
+enum H32_Quality : uint8_t {
+  quality_missing = 0,  // not measured (yet)
+  quality_good,
+  quality_failed,       // the sensor could not be read
+};
+
+typedef struct H32_Quantity {
+  const char *name;     // has to outlive the registry, it is not copied
+  const char *unit;
+  int16_t scale;        // values are stored as value * scale
+  H32_Deadband band;    // for report by exception, a deadband of 0 ignores it
+} H32_Quantity;
+
+typedef struct H32_Measurement {
+  int32_t value;
+  uint32_t epoch;       // 0 until the registry is stamped
+  H32_Quality quality;
+} H32_Measurement;
 
 /*
- * This class contains the data collected by the H32_Basic
+ * This class contains the data collected by the H32_Basic and the extensions
  */
 class H32_Measurements {
 private:
+  static H32_Quantity quantities[measurement_capacity];
+  static uint8_t quantities_num;
+
+  H32_Measurement entries[measurement_capacity] = {};
+  uint32_t epoch = 0;
   bool valid = false;
   bool initSuccess = false;
-  double batV;
-#ifdef H32_REV_3
-  double batPercentage;
-  double batChargeRate;
-#endif //H32_REV_3
-  double extV;
-  double temperature;
-  double humidity;
 protected:
 public:
-  void readMeasurements() {
-    if(!valid) {
-      debug_println("Acquiring Measurements.");
-      batV = read_bat_voltage();
-#ifdef H32_REV_3
-      batPercentage = read_bat_percentage();
-      batChargeRate = read_bat_charge_rate();
-#endif //H32_REV_3
-      extV = read_ext_voltage();
-      if(init_sensor()) {
-        temperature = (int)(get_temperature() * 100 + 0.5) / 100.0;
-        humidity = (int)(get_humidity() * 100 + 0.5) / 100.0;
-        initSuccess = true;
-      } else {
-        debug_println("AHT10 not found. Check your board.");
+  /*
+   * The id of the quantity with the given name, it is added if it is new
+   * @param scale the resolution of the values, e.g. 1000 for 0.001 (at least 1)
+   * @return measurement_none if the table is full
+   */
+  static H32_Measurement_Id intern(const char *name, const char *unit = "", int16_t scale = 100) {
+    for(H32_Measurement_Id id = 0; id < quantities_num; id++) {
+      if(strcmp(quantities[id].name, name) == 0) {
+        return id;
       }
-      valid = true;
     }
+    if(quantities_num >= measurement_capacity) {
+      debug_println("Measurements: too many quantities");
+      return measurement_none;
+    }
+    quantities[quantities_num] = {name, unit, scale < 1 ? (int16_t)1 : scale, {0, 0}};
+    return quantities_num++;
   };
-  double getBatV() { readMeasurements(); return batV;};
+  /*
+   * The number of ids, all ids are smaller
+   */
+  static inline uint8_t count() { return quantities_num; };
+  static inline const H32_Quantity &quantity(H32_Measurement_Id id) { return quantities[id]; };
+  /*
+   * Report the quantity by exception (see H32_Report.h), e.g. right after
+   * interning it. The core quantities are configured in H32_Config instead.
+   * Only values that are set before the decision, i.e. by the acquisition,
+   * can cause a connection. The values the extensions collect after the
+   * connection are only remembered when they are reported.
+   */
+  static void report(H32_Measurement_Id id, float deadband, float hysteresis) {
+    if(id >= measurement_core_num && id < quantities_num) {
+      quantities[id].band = {deadband, hysteresis};
+    }
+  };
+  static inline const char *name(uint8_t id) { return quantities[id].name; };
+
+  void set(H32_Measurement_Id id, double value, uint32_t epoch = 0) {
+    if(id >= quantities_num) {
+      return;
+    }
+    H32_Measurement &entry = entries[id];
+    if(isnan(value)) {
+      entry.quality = quality_failed;
+      return;
+    }
+    double scaled = round(value * quantities[id].scale);
+    if(scaled > INT32_MAX || scaled < INT32_MIN) {
+      debug_print("Measurements: out of range for its scale: ");
+      debug_println(quantities[id].name);
+      entry.quality = quality_failed;
+      return;
+    }
+    entry.value = (int32_t)scaled;
+    entry.epoch = epoch != 0 ? epoch : this->epoch;
+    entry.quality = quality_good;
+  };
+  void fail(H32_Measurement_Id id) {
+    if(id < quantities_num) {
+      entries[id].quality = quality_failed;
+    }
+  };
+  bool has(H32_Measurement_Id id) const {
+    return id < quantities_num && entries[id].quality == quality_good;
+  };
+  /*
+   * @return NAN if there is no good value
+   */
+  double get(H32_Measurement_Id id) const {
+    return has(id) ? (double)entries[id].value / quantities[id].scale : NAN;
+  };
+  const H32_Measurement &getEntry(H32_Measurement_Id id) const { return entries[id]; };
+
+  /*
+   * Set the epoch of all values that don't have one yet, and of the values set later on
+   */
+  void stamp(uint32_t epoch) {
+    this->epoch = epoch;
+    for(H32_Measurement_Id id = 0; id < quantities_num; id++) {
+      if(entries[id].quality == quality_good && entries[id].epoch == 0) {
+        entries[id].epoch = epoch;
+      }
+    }
+  };
+  uint32_t getEpoch() const { return epoch; };
+
+  /*
+   * The measurements are read in two parts, see H32_Executor.h. The ADC
+   * has to be read before WiFi is turned on.
+   */
+  void readVoltages() {
+    debug_println("Acquiring Measurements.");
+    read_adc();
+#ifndef H32_REV_3
+    set(measurement_bat_v, read_bat_voltage());
+#endif //H32_REV_3
+    set(measurement_ext_v, read_ext_voltage());
+    analog_collect(*this);
+  };
+  /*
+   * The fuel gauge is read while the sensor converts
+   */
+  void readSensors() {
+    bool sensor = init_sensor();
 #ifdef H32_REV_3
-  double getBatPercentage() { readMeasurements(); return batPercentage;};
-  double getBatChargeRate() { readMeasurements(); return batChargeRate;};
+    set(measurement_bat_v, read_bat_voltage());
+    set(measurement_bat_percentage, read_bat_percentage());
+    set(measurement_bat_charge_rate, read_bat_charge_rate());
 #endif //H32_REV_3
-  double getExtV() { readMeasurements(); return extV; };
-  double getTemperature() { readMeasurements(); return temperature; };
-  double getHumidity() { readMeasurements(); return humidity; };
-  void reset() { valid = false; };
+    float t, h;
+    if(sensor && read_sensor(&t, &h)) {
+      set(measurement_temperature, t);
+      set(measurement_humidity, h);
+      initSuccess = true;
+    } else {
+      fail(measurement_temperature);
+      fail(measurement_humidity);
+      debug_println("AHT10 not found. Check your board.");
+    }
+    valid = true;
+  };
+  void readMeasurements() {
+    if(!valid) {
+      readVoltages();
+      readSensors();
+    }
+  };
+  double getBatV() { readMeasurements(); return get(measurement_bat_v); };
+  double getBatPercentage() { readMeasurements(); return get(measurement_bat_percentage); };
+  double getBatChargeRate() { readMeasurements(); return get(measurement_bat_charge_rate); };
+  double getExtV() { readMeasurements(); return get(measurement_ext_v); };
+  double getTemperature() { readMeasurements(); return get(measurement_temperature); };
+  double getHumidity() { readMeasurements(); return get(measurement_humidity); };
+  void reset() {
+    valid = false;
+    initSuccess = false;
+    epoch = 0;
+    memset(entries, 0, sizeof(entries));
+  };
   bool isValid() { return valid; };
   bool isInitSuccessful() { return initSuccess; };
 };
+// Out-of-line initialization for non-const static members
+H32_Quantity H32_Measurements::quantities[measurement_capacity] = {
+  {"Temperature", "C", 100},
+  {"Humidity", "% rH", 100},
+  {"Battery Voltage", "V", 1000},
+  {"External Voltage", "V", 1000},
+  {"Battery Percentage", "%", 100},
+  {"Battery Charge Rate", "%/h", 100},
+};
+uint8_t H32_Measurements::quantities_num = measurement_core_num;
 
 
 #endif // H32_MEASUREMENTS_H
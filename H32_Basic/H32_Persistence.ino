@@ -1,25 +1,14 @@
 #include <FS.h>
 #include <LittleFS.h>
 
-#define SERIALIZE_2(doc, name) doc[#name] = (h32_config.name);
-#define SERIALIZE_3(doc, part, name) doc[#part][#name] = (h32_config.part.name);
-
-#define DESERIALIZE_2(doc, name) if(!(doc[#name]).isNull()){ (h32_config.name) = doc[#name]; };
-#define DESERIALIZE_3(doc, part, name) if(!(doc[#part][#name]).isNull()){ (h32_config.part.name) = doc[#part][#name]; };
-
-#define DESERIALIZE_SSID_2(doc, name) if(!(doc[#name]).isNull()){ strncpy(h32_config.name, doc[""#name], SSID_LENGTH); };
-#define DESERIALIZE_TOPIC_3(doc, part, name) if(!(doc[#part][#name]).isNull()){ strncpy(h32_config.part.name, doc[#part][#name], TOPIC_LENGTH); };
-#define DESERIALIZE_NAME_3(doc, part, name) if(!(doc[#part][#name]).isNull()){ strncpy(h32_config.part.name, doc[#part][#name], NAME_LENGTH); };
-#define DESERIALIZE_IP_3(doc, part, name) if(!(doc[#part][#name]).isNull()){ strncpy(h32_config.part.name, doc[#part][#name], IP_ADDR_LENGTH); };
-
-
 #include <Preferences.h>
 Preferences prefs;
 
 /*
- * Read the config object from persistent storage aka NVS using Preferences
+ * Mount LittleFS (formatting it if necessary) and ensure that our
+ * directory exists.
  */
-bool read_config() {
+bool mount_LittleFS() {
   if (!LittleFS.begin(false)) {
     debug_println("Couldn't mount LittleFS. Trying to format.");
     if (!LittleFS.begin(true)) {
@@ -34,49 +23,155 @@ bool read_config() {
   } else {
     debug_println("Coulnd't create H32 config directory");
   }
+  return true;
+}
+
+/*
+ * Read the binary image of the config tables from NVS using Preferences
+ */
+bool read_config_image() {
+  H32_Config_Image header;
+  size_t length = H32_Schema::packedSize();
+  uint8_t *image = new uint8_t[sizeof(header) + length];
+  bool result = false;
+  if (prefs.begin(h32_prefs_key, true)) {
+    result = prefs.getBytes(h32_config_image_key, image, sizeof(header) + length) == sizeof(header) + length;
+    prefs.end();
+  }
+  memcpy(&header, image, sizeof(header));
+  result = result && header.isValid(image + sizeof(header), length);
+  if (result) {
+    H32_Schema::unpack(image + sizeof(header));
+  } else {
+    debug_println("No valid config image");
+  }
+  delete[] image;
+  return result;
+}
+
+/*
+ * Write the binary image of the config tables to NVS using Preferences
+ */
+bool write_config_image() {
+  H32_Config_Image header;
+  size_t length = H32_Schema::packedSize();
+  uint8_t *image = new uint8_t[sizeof(header) + length];
+  H32_Schema::pack(image + sizeof(header));
+  header.seal(image + sizeof(header), length);
+  memcpy(image, &header, sizeof(header));
+  bool result = false;
+  if (prefs.begin(h32_prefs_key, false)) {
+    result = prefs.putBytes(h32_config_image_key, image, sizeof(header) + length) == sizeof(header) + length;
+    prefs.end();
+  }
+  delete[] image;
+  if (!result) {
+    debug_println("Couldn't write the config image");
+  }
+  return result;
+}
+
+/*
+ * The capacity of a json document holding all config tables
+ */
+size_t config_doc_size() {
+  return JSON_OBJECT_SIZE(H32_Schema::jsonMembers()) + H32_Schema::jsonStrings();
+}
+
+/*
+ * Copy the fields of all config tables from (or to) a json document.
+ * Fields with a part are nested in an object of that name.
+ */
+void deserialize_config(JsonDocument &doc) {
+  for (const H32_Schema_Table &table : *H32_Schema::getTables()) {
+    for (uint8_t i = 0; i < table.num; i++) {
+      const H32_Field &field = table.fields[i];
+      if (field.name == NULL) {
+        continue;
+      }
+      JsonVariant value = field.part ? doc[field.part][field.name].as<JsonVariant>() : doc[field.name].as<JsonVariant>();
+      if (value.isNull()) {
+        continue;
+      }
+      uint8_t *member = table.member(field);
+      switch (field.type) {
+        case field_u8:     *(uint8_t *)member = value.as<uint8_t>(); break;
+        case field_i8:
+        case field_choice: *(int8_t *)member = value.as<int8_t>(); break;
+        case field_u16:    *(uint16_t *)member = value.as<uint16_t>(); break;
+        case field_u32:    *(uint32_t *)member = value.as<uint32_t>(); break;
+        case field_double: *(double *)member = value.as<double>(); break;
+        case field_string:
+          if (value.is<const char *>()) {
+            strncpy((char *)member, value.as<const char *>(), field.size - 1);
+            member[field.size - 1] = 0;
+          }
+          break;
+        default: break;
+      }
+    }
+  }
+  H32_Schema::clampChoices();
+}
+
+void serialize_config(JsonDocument &doc) {
+  JsonObject root = doc.to<JsonObject>();
+  for (const H32_Schema_Table &table : *H32_Schema::getTables()) {
+    for (uint8_t i = 0; i < table.num; i++) {
+      const H32_Field &field = table.fields[i];
+      if (field.name == NULL) {
+        continue;
+      }
+      JsonObject object = root;
+      if (field.part) {
+        object = root[field.part];
+        if (object.isNull()) {
+          object = root.createNestedObject(field.part);
+        }
+      }
+      const uint8_t *member = table.member(field);
+      switch (field.type) {
+        case field_u8:     object[field.name] = *(const uint8_t *)member; break;
+        case field_i8:
+        case field_choice: object[field.name] = *(const int8_t *)member; break;
+        case field_u16:    object[field.name] = *(const uint16_t *)member; break;
+        case field_u32:    object[field.name] = *(const uint32_t *)member; break;
+        case field_double: object[field.name] = *(const double *)member; break;
+        case field_string: object[field.name] = (const char *)member; break;
+        default: break;
+      }
+    }
+  }
+}
+
+/*
+ * Read the config tables. The binary image is used if it is valid,
+ * otherwise the json file in LittleFS is parsed and the image written.
+ */
+bool read_config() {
+  if (read_config_image()) {
+    return true;
+  }
+  if (!mount_LittleFS()) {
+    return false;
+  }
   File config_file = LittleFS.open(h32_prefs_path, "r");
   if (!config_file || config_file.isDirectory()) {
     debug_println("Cannot open config file for reading");
     write_config();
     return false;
   }
-  StaticJsonDocument<json_doc_size> doc;
+  DynamicJsonDocument doc(config_doc_size());
   auto error = deserializeJson(doc, config_file);
   if (error) {
-    debug_println("Failed to parse config file");
+    debug_print("Failed to parse config file: ");
+    debug_println(error.c_str());
+    config_file.close();
+    LittleFS.end();
     return false;
   }
 
-  DESERIALIZE_2(doc, version);
-  DESERIALIZE_2(doc, timeout);
-  DESERIALIZE_SSID_2(doc, name);
-  DESERIALIZE_2(doc, led_pin);
-  DESERIALIZE_2(doc, trigger_pin);
-  DESERIALIZE_3(doc, rtc, sleeptime);
-  DESERIALIZE_3(doc, rtc, factor);
-  DESERIALIZE_3(doc, rtc, limit);
-  DESERIALIZE_3(doc, api, type);
-  DESERIALIZE_NAME_3(doc, api, key);
-  DESERIALIZE_NAME_3(doc, api, additional);
-  DESERIALIZE_3(doc, bat_v, coefficient);
-  DESERIALIZE_3(doc, bat_v, constant);
-  DESERIALIZE_3(doc, bat_v, pin);
-  DESERIALIZE_3(doc, bat_v, activation);
-  DESERIALIZE_3(doc, ext_v, coefficient);
-  DESERIALIZE_3(doc, ext_v, constant);
-  DESERIALIZE_3(doc, ext_v, pin);
-  DESERIALIZE_NAME_3(doc, mqtt, server);
-  DESERIALIZE_3(doc, mqtt, port);
-  DESERIALIZE_TOPIC_3(doc, mqtt, topic);
-  DESERIALIZE_NAME_3(doc, mqtt, user);
-  DESERIALIZE_NAME_3(doc, mqtt, passwd);
-  DESERIALIZE_NAME_3(doc, ntp, server);
-  DESERIALIZE_3(doc, ntp, daylightOffset_h);
-  DESERIALIZE_3(doc, ntp, gmtOffset_h);
-  DESERIALIZE_IP_3(doc, static_conf, ip_address);
-  DESERIALIZE_IP_3(doc, static_conf, gateway);
-  DESERIALIZE_IP_3(doc, static_conf, subnet);
-  DESERIALIZE_IP_3(doc, static_conf, dns);
+  deserialize_config(doc);
 
   config_file.close();
   LittleFS.end();
@@ -86,65 +181,36 @@ bool read_config() {
   debug_println();
 #endif // H32_DEBUG
 
+  write_config_image();
   return true;
 }
 
 /*
- * Write the current configuration to NVS using Preferences
+ * Write the current configuration to the json file in LittleFS
+ * and its binary image to NVS
  */
 bool write_config() {
-  if (!LittleFS.begin(false)) {
-    debug_println("Couldn't mount LittleFS. Trying to format.");
-    if (!LittleFS.begin(true)) {
-      debug_println("ERROR: Couldn't format LittleFS. Aborting access.");
-      return false;
-    } else {
-      debug_println("Formating LittleFS successful.");
-    }
+  write_config_image();
+
+  if (!mount_LittleFS()) {
+    return false;
   }
-  if (LittleFS.mkdir(h32_prefs_dir)) {
-    debug_println("H32 config directory created or found");
-  } else {
-    debug_println("Coulnd't create H32 config directory");
+
+  // A truncated file would lose the fields that did not fit
+  DynamicJsonDocument doc(config_doc_size());
+  serialize_config(doc);
+  if (doc.overflowed()) {
+    debug_println("Config does not fit into the json document");
+    LittleFS.end();
+    return false;
   }
 
   File config_file = LittleFS.open(h32_prefs_path, "w");
   if (!config_file) {
     debug_println("Cannot open config file for writing");
+    LittleFS.end();
     return false;
   }
-  StaticJsonDocument<json_doc_size> doc;
-
-  SERIALIZE_2(doc, version);
-  SERIALIZE_2(doc, timeout);
-  SERIALIZE_2(doc, name);
-  SERIALIZE_2(doc, led_pin);
-  SERIALIZE_2(doc, trigger_pin);
-  SERIALIZE_3(doc, rtc, sleeptime);
-  SERIALIZE_3(doc, rtc, factor);
-  SERIALIZE_3(doc, rtc, limit);
-  SERIALIZE_3(doc, api, type);
-  SERIALIZE_3(doc, api, key);
-  SERIALIZE_3(doc, api, additional);
-  SERIALIZE_3(doc, bat_v, coefficient);
-  SERIALIZE_3(doc, bat_v, constant);
-  SERIALIZE_3(doc, bat_v, pin);
-  SERIALIZE_3(doc, bat_v, activation);
-  SERIALIZE_3(doc, ext_v, coefficient);
-  SERIALIZE_3(doc, ext_v, constant);
-  SERIALIZE_3(doc, ext_v, pin);
-  SERIALIZE_3(doc, mqtt, server);
-  SERIALIZE_3(doc, mqtt, port);
-  SERIALIZE_3(doc, mqtt, topic);
-  SERIALIZE_3(doc, mqtt, user);
-  SERIALIZE_3(doc, mqtt, passwd);
-  SERIALIZE_3(doc, ntp, server);
-  SERIALIZE_3(doc, ntp, daylightOffset_h);
-  SERIALIZE_3(doc, ntp, gmtOffset_h);
-  SERIALIZE_3(doc, static_conf, ip_address);
-  SERIALIZE_3(doc, static_conf, gateway);
-  SERIALIZE_3(doc, static_conf, subnet);
-  SERIALIZE_3(doc, static_conf, dns);
 
   serializeJson(doc, config_file);
 #ifdef H32_DEBUG
@@ -156,3 +222,34 @@ bool write_config() {
   LittleFS.end();
   return true;
 }
+
+/*
+ * Read the cache of the last WiFi connection from NVS using Preferences.
+ * The cache is invalidated if it cannot be read.
+ */
+bool read_wifi_cache(H32_WiFi_Cache &cache) {
+  bool result = false;
+  if (prefs.begin(h32_wifi_prefs, true)) {
+    result = prefs.getBytes(h32_wifi_prefs_key, &cache, sizeof(cache)) == sizeof(cache);
+    prefs.end();
+  }
+  if (!result) {
+    cache.invalidate();
+  }
+  return result;
+}
+
+/*
+ * Write the cache of the last WiFi connection to NVS using Preferences
+ */
+bool write_wifi_cache(H32_WiFi_Cache &cache) {
+  bool result = false;
+  if (prefs.begin(h32_wifi_prefs, false)) {
+    result = prefs.putBytes(h32_wifi_prefs_key, &cache, sizeof(cache)) == sizeof(cache);
+    prefs.end();
+  }
+  if (!result) {
+    debug_println("Couldn't write the WiFi cache");
+  }
+  return result;
+}
@@ -0,0 +1,107 @@
+#ifndef H32_POWER_H
+#define H32_POWER_H
+
+#include <math.h>
+
+/*
+ * The power policy adapts the sleep time to the state of charge (SoC) and
+ * the charge rate reported by the fuel gauge:
+ *
+ *   levels     a table of SoC thresholds. Below a threshold the sleep time
+ *              is multiplied with the factor of the level, the lowest
+ *              threshold the SoC is below wins. A threshold of 0 is unused.
+ *   charging   while the charge rate is at least the configured rate, the
+ *              factor is multiplied with the charge factor (e.g., 0.5 to
+ *              report twice as often while the sun shines)
+ *   survival   below the survival SoC the sleep time is at least the survival
+ *              sleep time and the next wake does not turn on the radio. It
+ *              is only left once the SoC has risen by the hysteresis above
+ *              the survival SoC, otherwise the first connection after the
+ *              threshold would drain it below again and the device would
+ *              flip between the modes on every wake.
+ *
+ * Without a SoC (e.g., boards without fuel gauge) the sleep time is not
+ * changed. The decision is reported with the measurements, so that it can
+ * be followed on the server. The engine is plain C++ without any dependency
+ * to the hardware.
+ */
+
+const uint8_t power_level_num = 4;
+
+typedef struct H32_Power_Level {
+  uint8_t soc = 0;        // in %, 0 turns the level off
+  double factor = 1.0;
+} H32_Power_Level;
+
+typedef struct H32_Power_Policy {
+  const H32_Power_Level *levels;
+  uint8_t level_num;
+  double charge_rate;           // in %/h, 0 turns the charge factor off
+  double charge_factor;
+  uint8_t survival_soc;         // in %, 0 turns survival mode off
+  uint32_t survival_sleeptime;  // in seconds
+  uint8_t survival_hysteresis;  // in %, survival mode is left at survival_soc + hysteresis
+} H32_Power_Policy;
+
+enum H32_Power_Mode : uint8_t {
+  power_mode_normal = 0,
+  power_mode_reduced,     // a level applies
+  power_mode_charging,
+  power_mode_survival,
+  power_mode_unknown,     // no state of charge
+};
+
+typedef struct H32_Power_Decision {
+  H32_Power_Mode mode;
+  int8_t level;           // index of the level that applies, -1 if none
+  double factor;
+} H32_Power_Decision;
+
+/*
+ * Decide on the sleep time factor for the SoC and charge rate (NAN if not available)
+ * @param previous the mode of the last decision
+ */
+inline H32_Power_Decision power_decide(const H32_Power_Policy &policy, double soc, double charge_rate,
+                                       H32_Power_Mode previous) {
+  H32_Power_Decision decision = {power_mode_unknown, -1, 1.0};
+  if(isnan(soc)) {
+    return decision;
+  }
+  decision.mode = power_mode_normal;
+  double survival_exit = policy.survival_soc + (previous == power_mode_survival ? policy.survival_hysteresis : 0);
+  if(policy.survival_soc > 0 && soc < survival_exit) {
+    decision.mode = power_mode_survival;
+    return decision;
+  }
+  for(uint8_t index = 0; index < policy.level_num; index++) {
+    const H32_Power_Level &level = policy.levels[index];
+    if(soc < level.soc && (decision.level < 0 || level.soc < policy.levels[decision.level].soc)) {
+      decision.level = index;
+    }
+  }
+  if(decision.level >= 0) {
+    decision.mode = power_mode_reduced;
+    decision.factor = policy.levels[decision.level].factor;
+  }
+  if(policy.charge_rate > 0 && !isnan(charge_rate) && charge_rate >= policy.charge_rate) {
+    decision.mode = power_mode_charging;
+    decision.factor *= policy.charge_factor;
+  }
+  return decision;
+}
+
+/*
+ * The sleep time for the decision, at least one second
+ */
+inline uint32_t power_sleeptime(const H32_Power_Decision &decision, const H32_Power_Policy &policy, uint32_t sleeptime) {
+  if(decision.mode == power_mode_survival) {
+    return sleeptime > policy.survival_sleeptime ? sleeptime : policy.survival_sleeptime;
+  }
+  double result = sleeptime * decision.factor;
+  if(result < 1) {
+    return 1;
+  }
+  return result > UINT32_MAX ? UINT32_MAX : (uint32_t)result;
+}
+
+#endif // H32_POWER_H
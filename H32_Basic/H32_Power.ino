@@ -0,0 +1,68 @@
+/*
+ * The adaptive sleep time (see H32_Power.h). The decision is taken with the
+ * measurements of this wake and kept in the wake state, so that the next
+ * wake knows that it is in survival mode before it would turn on the radio.
+ */
+
+H32_Power_Decision power_decision = {power_mode_unknown, -1, 1.0};
+
+H32_Power_Policy power_policy() {
+  return {h32_config.power_level, power_level_num, h32_config.power.charge_rate,
+          h32_config.power.charge_factor, h32_config.power.survival, h32_config.power.survival_sleeptime,
+          h32_config.power.survival_hysteresis};
+}
+
+/*
+ * The policy is used if any of its parts is turned on
+ */
+bool power_enabled() {
+  for(uint8_t index = 0; index < power_level_num; index++) {
+    if(h32_config.power_level[index].soc != 0) {
+      return true;
+    }
+  }
+  return h32_config.power.survival != 0 || h32_config.power.charge_rate > 0;
+}
+
+/*
+ * Decide on the sleep time and add the decision to the measurements
+ */
+void power_collect(H32_Measurements &measurements) {
+  static H32_Measurement_Id mode_id = H32_Measurements::intern("Power Mode", "", 1);
+  static H32_Measurement_Id factor_id = H32_Measurements::intern("Sleep Time Factor", "", 100);
+
+  if(!power_enabled()) {
+    wake_state_set_power_mode(power_mode_normal);
+    return;
+  }
+  power_decision = power_decide(power_policy(), measurements.get(measurement_bat_percentage),
+                                measurements.get(measurement_bat_charge_rate),
+                                (H32_Power_Mode)wake_state_power_mode());
+  wake_state_set_power_mode(power_decision.mode);
+  if(power_decision.mode == power_mode_unknown) {
+    return;
+  }
+  measurements.set(mode_id, power_decision.mode);
+  measurements.set(factor_id, power_decision.factor);
+
+  debug_print("Power mode ");
+  debug_print(power_decision.mode);
+  debug_print(", level ");
+  debug_print(power_decision.level);
+  debug_print(", factor ");
+  debug_println(power_decision.factor);
+}
+
+/*
+ * In survival mode the radio stays off
+ */
+bool power_survival_mode() {
+  return power_enabled() && wake_state_power_mode() == power_mode_survival;
+}
+
+/*
+ * The sleep time adapted to the state of charge
+ */
+uint32_t power_adapt_sleeptime(uint32_t sleeptime) {
+  return power_sleeptime(power_decision, power_policy(), sleeptime);
+}
@@ -0,0 +1,186 @@
+#ifndef H32_PROFILER_H
+#define H32_PROFILER_H
+
+/*
+ * The profiler records the time spent in each phase of a wake cycle with
+ * microsecond resolution. The profiles of the last cycles are kept in a
+ * small ring that is persisted in LittleFS, since the RTC RAM only holds a
+ * single byte and the ESP32 memory does not survive the power-off.
+ *
+ * The profiler is enabled by defining H32_PROFILE. Otherwise all phase_*
+ * macros compile to nothing, in the same way as the debug_print macros.
+ *
+ * The profiles cannot be batched in memory, so the ring (452 bytes) is
+ * rewritten in LittleFS at the end of every wake cycle. LittleFS writes
+ * copy-on-write and levels the wear over the free blocks of the partition,
+ * so every wake adds about a ninth of a 4 KiB sector erase: at a wake every
+ * 10 minutes 16 erases a day. Spread over the 352 blocks of the 1.4 MB
+ * data partition of the default partition scheme that is one erase per
+ * block in three weeks, far from the 100000 cycles of the flash. Without free blocks (a nearly full partition)
+ * the erases concentrate, so H32_PROFILE is meant for measuring a setup
+ * rather than for devices in the field.
+ */
+
+/*
+ * A wake cycle is split into the following phases. The time the ESP32 spends
+ * in each of them is what we pay for with the battery, so we keep track of it.
+ */
+enum H32_Phase : uint8_t {
+  phase_other = 0,  // boot and everything not covered by another phase
+  phase_config,     // read_config()
+  phase_sensor,     // H32_Measurements::readMeasurements()
+  phase_wifi,       // init_WiFiManager()
+  phase_upload,     // read_and_send_data()
+  phase_alarm,      // RTC_set_alarm()
+  phase_num,
+};
+static const char *const phase_names[] = {
+  "Other",
+  "Config",
+  "Sensor",
+  "WiFi",
+  "Upload",
+  "Alarm",
+};
+
+/*
+ * Average current in mA drawn by the board in each of the phases. These are
+ * estimates taken from the ESP32 datasheet (CPU at 240MHz, radio receiving or
+ * sending) and can be adjusted to the values measured for a specific board.
+ */
+const float phase_current_mA[phase_num] = {
+  50.0,   // other
+  50.0,   // config
+  45.0,   // sensor
+  130.0,  // wifi
+  120.0,  // upload
+  45.0,   // alarm
+};
+
+/*
+ * Convert the time spent in a phase into the charge taken from the battery
+ */
+inline double phase_mAh(H32_Phase phase, uint32_t ms) {
+  return phase_current_mA[phase] * ms / 3600000.0;
+}
+
+const uint8_t profile_ring_size = 16;
+const uint16_t profile_magic = 0x5032;
+const char *profile_path = "/h32_config/profile.bin";
+
+/*
+ * The compact binary record of a single wake cycle
+ */
+typedef struct H32_Profile {
+  uint32_t cycle;
+  uint32_t phase_us[phase_num];
+
+  uint32_t total_us() const {
+    uint32_t total = 0;
+    for(int i = 0; i < phase_num; i++) {
+      total += phase_us[i];
+    }
+    return total;
+  }
+} H32_Profile;
+
+/*
+ * The ring of the last profile_ring_size profiles as it is stored in LittleFS.
+ * "head" is the slot that will be written next.
+ */
+typedef struct H32_Profile_Ring {
+  uint16_t magic = profile_magic;
+  uint8_t head = 0;
+  uint8_t count = 0;
+  H32_Profile profiles[profile_ring_size];
+
+  void push(const H32_Profile &profile) {
+    profiles[head] = profile;
+    head = (head + 1) % profile_ring_size;
+    if(count < profile_ring_size) {
+      count++;
+    }
+  }
+  // index 0 is the newest profile
+  const H32_Profile *get(uint8_t index) const {
+    if(index >= count) {
+      return NULL;
+    }
+    return &profiles[(head + profile_ring_size - 1 - index) % profile_ring_size];
+  }
+  // until the ring is full the next slot follows the profiles
+  bool isValid() const {
+    return magic == profile_magic && head < profile_ring_size && count <= profile_ring_size
+      && (count == profile_ring_size || head == count);
+  }
+  /*
+   * Check the ring after length bytes have been read into it from the file.
+   * A short or invalid ring is replaced by an empty one.
+   * @return false if the ring has been replaced
+   */
+  bool validate(size_t length) {
+    if(length == sizeof(H32_Profile_Ring) && isValid()) {
+      return true;
+    }
+    *this = H32_Profile_Ring();
+    return false;
+  }
+} H32_Profile_Ring;
+
+/*
+ * The profiler itself only needs a clock returning microseconds. This allows
+ * to run it with a fake clock.
+ */
+class H32_Profiler {
+private:
+  uint32_t (*clock)();
+  H32_Phase current = phase_other;
+  uint32_t started = 0;
+public:
+  H32_Profile profile = {};
+
+  H32_Profiler(uint32_t (*clock)()) : clock(clock) {};
+
+  /*
+   * End the current phase and start the given one.
+   * @return the phase that has been ended
+   */
+  H32_Phase enter(H32_Phase next) {
+    uint32_t now = clock();
+    profile.phase_us[current] += now - started;
+    started = now;
+    H32_Phase previous = current;
+    current = next;
+    return previous;
+  };
+  /*
+   * Close the current phase without leaving it
+   */
+  const H32_Profile &finish() {
+    enter(current);
+    return profile;
+  };
+};
+
+#ifdef H32_PROFILE
+/*
+ * micros() counts from the start of the ESP32, so everything before
+ * the first phase change is accounted to phase_other.
+ */
+uint32_t profile_clock() { return micros(); }
+H32_Profiler profiler(profile_clock);
+
+#define phase_next(p) do { profiler.enter(p); } while (0)
+#define phase_begin(p) H32_Phase previous_phase = profiler.enter(p)
+#define phase_end() do { profiler.enter(previous_phase); } while (0)
+#define phase_collect(data) profile_collect(data)
+#define phase_finish() profile_finish()
+#else
+#define phase_next(p)
+#define phase_begin(p)
+#define phase_end()
+#define phase_collect(data)
+#define phase_finish()
+#endif // H32_PROFILE
+
+#endif // H32_PROFILER_H
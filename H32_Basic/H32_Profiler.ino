@@ -0,0 +1,131 @@
+/*
+ * The following functions persist and publish the wake cycle profiles.
+ * They are only compiled if H32_PROFILE is defined (see H32_Profiler.h).
+ */
+#ifdef H32_PROFILE
+
+H32_Profile_Ring profile_ring;
+bool profile_ring_loaded = false;
+
+/*
+ * Load the ring of the last profiles from LittleFS. A missing or
+ * invalid file simply results in an empty ring.
+ */
+void profile_load() {
+  if(profile_ring_loaded) {
+    return;
+  }
+  profile_ring_loaded = true;
+  if(!mount_LittleFS()) {
+    return;
+  }
+  File profile_file = LittleFS.open(profile_path, "r");
+  if(profile_file) {
+    size_t read = profile_file.read((uint8_t *)&profile_ring, sizeof(profile_ring));
+    profile_file.close();
+    if(!profile_ring.validate(read)) {
+      debug_println("Profile ring invalid, starting a new one");
+    }
+  }
+  LittleFS.end();
+}
+
+/*
+ * Write the ring of the last profiles to LittleFS
+ */
+bool profile_store() {
+  if(!mount_LittleFS()) {
+    return false;
+  }
+  File profile_file = LittleFS.open(profile_path, "w");
+  if(!profile_file) {
+    debug_println("Cannot open profile file for writing");
+    LittleFS.end();
+    return false;
+  }
+  size_t written = profile_file.write((uint8_t *)&profile_ring, sizeof(profile_ring));
+  profile_file.close();
+  LittleFS.end();
+  return written == sizeof(profile_ring);
+}
+
+/*
+ * Add a summary of the previous wake cycle to the data that is sent. The
+ * current cycle is not finished before the upload, so we report the last one.
+ */
+void profile_collect(H32_Measurements &measurements) {
+  static char names[phase_num][NAME_LENGTH];
+  static H32_Measurement_Id ids[phase_num];
+  static H32_Measurement_Id total_id = measurement_none;
+
+  profile_load();
+  const H32_Profile *last = profile_ring.get(0);
+  if(last == NULL) {
+    return;
+  }
+  if(total_id == measurement_none) {
+    total_id = H32_Measurements::intern("Profile Awake ms", "ms");
+    for(int i = 0; i < phase_num; i++) {
+      snprintf(names[i], NAME_LENGTH, "Profile %s ms", phase_names[i]);
+      ids[i] = H32_Measurements::intern(names[i], "ms");
+    }
+  }
+  measurements.set(total_id, last->total_us() / 1000.0);
+  for(int i = 0; i < phase_num; i++) {
+    measurements.set(ids[i], last->phase_us[i] / 1000.0);
+  }
+}
+
+/*
+ * Close the profile of the current cycle, print it and add it to the ring
+ */
+void profile_finish() {
+  profile_load();
+  H32_Profile profile = profiler.finish();
+  const H32_Profile *last = profile_ring.get(0);
+  profile.cycle = last == NULL ? 0 : last->cycle + 1;
+
+#ifdef H32_DEBUG
+  double total_mAh = 0;
+  Serial.printf("Cycle %u\n", profile.cycle);
+  debug_println("Phase          us        mAh");
+  for(int i = 0; i < phase_num; i++) {
+    double mAh = phase_mAh((H32_Phase)i, profile.phase_us[i] / 1000);
+    total_mAh += mAh;
+    Serial.printf("%-8s %10u %10.6f\n", phase_names[i], profile.phase_us[i], mAh);
+  }
+  Serial.printf("%-8s %10u %10.6f\n", "Total", profile.total_us(), total_mAh);
+#endif // H32_DEBUG
+
+  profile_ring.push(profile);
+  if(!profile_store()) {
+    debug_println("Storing the profile failed");
+  }
+}
+
+/*
+ * Create an HTML table of the last profiles for the devices page
+ */
+String profile_html() {
+  profile_load();
+  String output = "<h2>Wake Cycle Profiles (ms)</h2><table><tr><th>Cycle</th>";
+  for(int i = 0; i < phase_num; i++) {
+    output += String("<th>") + phase_names[i] + "</th>";
+  }
+  output += "<th>Total</th><th>mAh</th></tr>";
+  for(int index = 0; index < profile_ring.count; index++) {
+    const H32_Profile *profile = profile_ring.get(index);
+    double mAh = 0;
+    output += "<tr><td>" + String(profile->cycle) + "</td>";
+    for(int i = 0; i < phase_num; i++) {
+      mAh += phase_mAh((H32_Phase)i, profile->phase_us[i] / 1000);
+      output += "<td>" + String(profile->phase_us[i] / 1000.0, 1) + "</td>";
+    }
+    output += "<td>" + String(profile->total_us() / 1000.0, 1) + "</td>";
+    output += "<td>" + String(mAh, 4) + "</td></tr>";
+  }
+  output += "</table><hr/>";
+  return output;
+}
+
+#endif // H32_PROFILE
@@ -0,0 +1,250 @@
+#ifndef H32_RTC_H
+#define H32_RTC_H
+
+#include <time.h>
+
+#include "H32_Schedule.h"
+
+/*
+ * The RTC wakes the H32 up, either by its alarm or by its countdown timer.
+ * The functions in H32_RTC.ino only depend on the following backend
+ * interface, which is implemented for each supported chip:
+ *
+ *   load()            read all registers into a cache
+ *   commit()          write the changed registers with a single transaction
+ *   loaded()          true if the cache has been loaded
+ *   reset()           bring the chip into a well-defined state
+ *   time_get(tm*)     read the time from the chip
+ *   time_set(tm*)     write the time to the chip (and start the oscillator)
+ *   now(tm*)          the time at load(), false if the oscillator stopped
+ *   wake_cause()      the rtc_wake_* bits found at load()
+ *   stop()            stop and acknowledge the alarm and the countdown
+ *   alarm_set(tm*)    wake up at the given time
+ *   countdown_set(source, ticks)
+ *                     wake up after ticks of the given countdown clock
+ *                     (ticks <= countdown_max)
+ *   ram_get(i)        a byte of the battery-backed RAM (i < ram_size)
+ *   ram_set(i, v)
+ *
+ * Apart from time_get() and time_set() all functions work on the cache.
+ * countdown_max and alarm_resolution describe the capabilities of the
+ * chip for the scheduler (see H32_Schedule.h).
+ * The backend is selected at compile time (see H32_Basic.h), so there are
+ * no virtual calls.
+ */
+
+enum H32_RTC_Wake : uint8_t {
+  rtc_wake_none      = 0,
+  rtc_wake_alarm     = 1,
+  rtc_wake_countdown = 2,
+};
+
+#if defined(H32_RTC_SIM)
+
+/*
+ * An RTC that only exists in memory. The time is advanced with advance(),
+ * which triggers the alarm and the countdown like the chip would. This
+ * allows to run the wake cycle logic without the hardware. Like the chips
+ * it keeps the broken-down time without a time zone, so it converts with
+ * H32_Schedule.h instead of mktime().
+ */
+class H32_Sim_RTC {
+private:
+  uint32_t clock = 0;
+  uint32_t cached_clock = 0;
+  bool running = false;
+  bool cached = false;
+  uint32_t alarm = 0;
+  uint32_t countdown = 0;
+  uint8_t flags = rtc_wake_none;
+  uint8_t cause = rtc_wake_none;
+  uint8_t ram[16] = {0};
+public:
+  static const uint32_t countdown_max = 65535;
+  static const uint8_t alarm_resolution = 1;
+  static const uint8_t ram_size = sizeof(ram);
+
+  void advance(uint32_t seconds) {
+    if(!running) return;
+    clock += seconds;
+    if(alarm != 0 && clock >= alarm) flags |= rtc_wake_alarm;
+    if(countdown != 0 && clock >= countdown) flags |= rtc_wake_countdown;
+  };
+
+  bool load() {
+    cached = true;
+    cached_clock = clock;
+    cause = flags;
+    return true;
+  };
+  bool commit() { return cached; };
+  bool loaded() { return cached; };
+  bool reset() {
+    alarm = countdown = 0;
+    flags = rtc_wake_none;
+    return true;
+  };
+  bool time_get(tm *now) {
+    schedule_civil(clock, now);
+    return running;
+  };
+  bool time_set(tm *new_time) {
+    clock = schedule_epoch(new_time);
+    running = true;
+    return true;
+  };
+  bool now(tm *now) {
+    schedule_civil(cached_clock, now);
+    return running;
+  };
+  uint8_t wake_cause() { return cause; };
+  void stop() {
+    alarm = countdown = 0;
+    flags = rtc_wake_none;
+  };
+  bool alarm_set(tm *wakeup) {
+    alarm = schedule_epoch(wakeup);
+    return true;
+  };
+  bool countdown_set(H32_Wake_Source source, uint32_t ticks) {
+    if(ticks == 0 || ticks > countdown_max) return false;
+    switch(source) {
+      case wake_by_countdown_64hz: countdown = clock + (ticks + 63) / 64; break;
+      case wake_by_countdown_1hz:  countdown = clock + ticks; break;
+      case wake_by_countdown_1min: countdown = clock + ticks * 60; break;
+      default: return false;
+    }
+    return true;
+  };
+  uint8_t ram_get(uint8_t index) { return ram[index % ram_size]; };
+  void ram_set(uint8_t index, uint8_t value) { ram[index % ram_size] = value; };
+};
+typedef H32_Sim_RTC H32_RTC_Backend;
+
+#elif defined(H32_RTC_RX8010SJ)
+
+#include "RX8010SJ.h"
+
+/*
+ * The Epson RX8010SJ. It has a 16 bit countdown timer, but its alarm only
+ * has a resolution of one minute. An alarm with seconds is rounded up to
+ * the next full minute.
+ */
+class H32_RX8010SJ_RTC {
+private:
+  RX8010SJ chip;
+  uint8_t cause = rtc_wake_none;
+public:
+  static const uint32_t countdown_max = 65535;
+  static const uint8_t alarm_resolution = 60;
+  static const uint8_t ram_size = RX8010SJ_RAM_SIZE;
+
+  bool load() {
+    bool result = chip.cache_load();
+    cause = rtc_wake_none;
+    if(result) {
+      uint8_t flags = chip.cache_flags_get();
+      if(flags & RX8010SJ_REG_AF) cause |= rtc_wake_alarm;
+      if(flags & RX8010SJ_REG_TF) cause |= rtc_wake_countdown;
+    }
+    return result;
+  };
+  bool commit() { return chip.cache_commit(); };
+  bool loaded() { return chip.cache_valid(); };
+  bool reset() { return chip.reset(); };
+  bool time_get(tm *now) { return chip.time_get(now); };
+  bool time_set(tm *new_time) { return chip.time_set(new_time); };
+  bool now(tm *now) { return chip.cache_time_get(now); };
+  uint8_t wake_cause() { return cause; };
+  void stop() {
+    chip.cache_countdown_set(RX8010SJ::CNTDOWN_CLOCK_1HZ, 0, false);
+    chip.cache_alarm_set(-1, -1, -1, false);
+    chip.cache_flags_clear(RX8010SJ_REG_AF | RX8010SJ_REG_TF);
+  };
+  bool alarm_set(tm *wakeup) {
+    tm rounded;
+    schedule_civil((schedule_epoch(wakeup) + alarm_resolution - 1) / alarm_resolution * alarm_resolution, &rounded);
+    return chip.cache_alarm_set(rounded.tm_min, rounded.tm_hour, rounded.tm_mday, true);
+  };
+  bool countdown_set(H32_Wake_Source source, uint32_t ticks) {
+    if(ticks == 0 || ticks > countdown_max) return false;
+    switch(source) {
+      case wake_by_countdown_64hz: return chip.cache_countdown_set(RX8010SJ::CNTDOWN_CLOCK_64HZ, ticks, true);
+      case wake_by_countdown_1hz:  return chip.cache_countdown_set(RX8010SJ::CNTDOWN_CLOCK_1HZ, ticks, true);
+      case wake_by_countdown_1min: return chip.cache_countdown_set(RX8010SJ::CNTDOWN_CLOCK_1PER60HZ, ticks, true);
+      default: return false;
+    }
+  };
+  uint8_t ram_get(uint8_t index) { return chip.cache_ram_get(index); };
+  void ram_set(uint8_t index, uint8_t value) { chip.cache_ram_set(index, value); };
+};
+typedef H32_RX8010SJ_RTC H32_RTC_Backend;
+
+#else
+
+#include "PCF85063A.h"
+
+/*
+ * The NXP PCF85063A of the H32 boards. It has a single byte of RAM, an
+ * 8 bit countdown timer and an alarm with a resolution of one second.
+ */
+class H32_PCF85063A_RTC {
+private:
+  PCF85063A chip;
+  uint8_t cause = rtc_wake_none;
+public:
+  static const uint32_t countdown_max = 255;
+  static const uint8_t alarm_resolution = 1;
+  static const uint8_t ram_size = 1;
+
+  bool load() {
+    bool result = chip.cache_load();
+    cause = rtc_wake_none;
+    if(result) {
+      PCF85063A_Regs regs = chip.cache_ctrl_get();
+      if(PCF85063A_REG_GET(regs, PCF85063A_REG_AF)) cause |= rtc_wake_alarm;
+      if(PCF85063A_REG_GET(regs, PCF85063A_REG_TF)) cause |= rtc_wake_countdown;
+    }
+    return result;
+  };
+  bool commit() { return chip.cache_commit(); };
+  bool loaded() { return chip.cache_valid(); };
+  bool reset() { return chip.reset(); };
+  bool time_get(tm *now) { return chip.time_get(now); };
+  bool time_set(tm *new_time) { return chip.time_set(new_time); };
+  bool now(tm *now) { return chip.cache_time_get(now); };
+  uint8_t wake_cause() { return cause; };
+  void stop() {
+    // stop any countdown
+    chip.cache_countdown_set(false, PCF85063A::CNTDOWN_CLOCK_1HZ, 0, false, false);
+
+    // Writing 1 leaves the flags unchanged, so only the flags
+    // that have been set are cleared
+    PCF85063A_Regs regs = chip.cache_ctrl_get();
+    PCF85063A_Regs new_regs = regs;
+    PCF85063A_REG_SET(new_regs, PCF85063A_REG_AF);
+    PCF85063A_REG_SET(new_regs, PCF85063A_REG_TF);
+    if(PCF85063A_REG_GET(regs, PCF85063A_REG_AF)) PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_AF);
+    if(PCF85063A_REG_GET(regs, PCF85063A_REG_TF)) PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_TF);
+    // Clear the alarm enable bit
+    PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_AIE);
+    chip.cache_ctrl_set(new_regs, false);
+  };
+  bool alarm_set(tm *wakeup) { return chip.cache_alarm_set(wakeup, true); };
+  bool countdown_set(H32_Wake_Source source, uint32_t ticks) {
+    if(ticks == 0 || ticks > countdown_max) return false;
+    switch(source) {
+      case wake_by_countdown_64hz: return chip.cache_countdown_set(true, PCF85063A::CNTDOWN_CLOCK_64HZ, ticks, true, false);
+      case wake_by_countdown_1hz:  return chip.cache_countdown_set(true, PCF85063A::CNTDOWN_CLOCK_1HZ, ticks, true, false);
+      case wake_by_countdown_1min: return chip.cache_countdown_set(true, PCF85063A::CNTDOWN_CLOCK_1PER60HZ, ticks, true, false);
+      default: return false;
+    }
+  };
+  uint8_t ram_get(uint8_t index) { return chip.cache_ram_get(); };
+  void ram_set(uint8_t index, uint8_t value) { chip.cache_ram_set(value); };
+};
+typedef H32_PCF85063A_RTC H32_RTC_Backend;
+
+#endif
+
+#endif // H32_RTC_H
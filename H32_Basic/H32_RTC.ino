@@ -1,12 +1,40 @@
 /*
  * Here we have all functions that communicate with the RTC.
- * We are using the real time clock, the alarm and the one
- * byte of RAM.
+ * We are using the real time clock, the alarm (or the countdown)
+ * and the RAM.
+ *
+ * During a wake cycle all registers are read once (RTC_load()) and the
+ * functions work on the register cache of the rtc object. Changes are
+ * written with a single transaction by RTC_set_alarm() (or RTC_commit()).
+ * The time of the RTC is advanced by millis() since the load.
+ *
+ * The chip is hidden behind the backend selected in H32_Basic.h
+ * (see H32_RTC.h).
  */
 
 
 /* get a real time clock object */
-PCF85063A rtc;
+H32_RTC_Backend rtc;
+uint32_t rtc_loaded = 0;
+
+/*
+ * Read all RTC registers into the cache
+ */
+bool RTC_load() {
+  rtc_loaded = millis();
+  bool result = rtc.load();
+  if(!result) {
+    debug_println("Reading the RTC registers failed");
+  }
+  return result;
+}
+
+/*
+ * Write the changed registers to the RTC
+ */
+bool RTC_commit() {
+  return rtc.commit();
+}
 
 /*
  * We are setting the time as part of the portal mode, when the
@@ -16,8 +44,12 @@ PCF85063A rtc;
  */
 void RTC_set_time(tm *time_info) {
   rtc.reset();
+  RTC_load();
   RTC_stop_and_check();
+  RTC_commit();
   rtc.time_set(time_info);
+  // the cached time is outdated now
+  RTC_load();
   debug_print("Setting the RTC to: ");
   debug_println(time_info, "%H:%M:%S, %B %d %Y");  
 }
@@ -32,121 +64,107 @@ void RTC_get_time(tm *time_info) {
   debug_print("Returning RTC values: ");
   debug_println(time_info, "%H:%M:%S, %B %d %Y");
 }
+
 /*
- * The following function stops any countdown or alarm
- * after checking it. The result is returned.
- * Sooner or later this should be refactored into the class.
+ * The current time of the RTC in seconds since 1970, calculated from
+ * the cached time without reading the RTC again.
+ * @return false if the oscillator of the RTC has been stopped
  */
-PCF85063A_Regs RTC_stop_and_check() {
-  PCF85063A_Regs regs = 0;
-  //PCF85063A_Regs result = 0;
-
-  // Get the registers
-  rtc.ctrl_get(&regs);
-
-  // stop any countdown
-  rtc.countdown_set(false, PCF85063A::CNTDOWN_CLOCK_1HZ, 0, false, false);
-
-  // Clear alarm and countdown bits
-  PCF85063A_Regs new_regs = regs;
-  PCF85063A_REG_SET(new_regs, PCF85063A_REG_AF);
-  PCF85063A_REG_SET(new_regs, PCF85063A_REG_TF);
-
-  // Check for alarms
-  if (PCF85063A_REG_GET(regs, PCF85063A_REG_AF))
-  {
-    //result |= PCF85063A_REG_AF;
-    PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_AF);
-  }
-  // Check for countdown
-  if (PCF85063A_REG_GET(regs, PCF85063A_REG_TF))
-  {
-    //result |= PCF85063A_REG_TF;
-    PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_TF);
+bool RTC_now(uint32_t *now) {
+  if(!rtc.loaded()) {
+    RTC_load();
   }
-  // Clear the alarm enable bit
-  PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_AIE);
+  tm time_info;
+  bool osc_runs = rtc.now(&time_info);
+  *now = schedule_epoch(&time_info) + (millis() - rtc_loaded + 500) / 1000;
+  return osc_runs;
+}
 
-  rtc.ctrl_set(new_regs, false);
+/*
+ * The RTC is set to the local time (see set_rtc()). This function returns
+ * the corresponding UTC epoch by removing the configured NTP offsets.
+ */
+uint32_t RTC_get_epoch() {
+  uint32_t now;
+  RTC_now(&now);
+  return now - (h32_config.ntp.gmtOffset_h + h32_config.ntp.daylightOffset_h) * 3600;
+}
 
-  //result |= regs & 0xFF;
-  //return result;
-  return regs;
+/*
+ * The following function stops any countdown or alarm
+ * after checking it. The rtc_wake_* bits of what has woken
+ * us up are returned. The changes are written with the next commit.
+ */
+uint8_t RTC_stop_and_check() {
+  // Get the registers
+  if(!rtc.loaded()) {
+    RTC_load();
+  }
+  rtc.stop();
+  return rtc.wake_cause();
 }
 
 /*
- * This function takes a sleeptime in seconds, calculates a new
- * alarm time from that and the current time of the RTC, and
- * then sets it.
+ * This function takes a sleeptime in seconds and sets the RTC to
+ * wake us up after it. With an alignment the wake-up is moved to
+ * the next multiple of it on the wall clock (see H32_Schedule.h).
+ * The scheduler chooses between the alarm and the countdown.
  */
-bool RTC_set_alarm(int32_t sleeptime) {
+bool RTC_set_alarm(uint32_t sleeptime, uint32_t align) {
   debug_println("Set Alarm");
   RTC_stop_and_check();
- 
-  tm time_info;
-  tm time_added;
 
   // get current time from RTC
-  bool osc_runs = rtc.time_get(&time_info);
-
-  mktime(&time_info);
+  uint32_t now;
+  bool osc_runs = RTC_now(&now);
 
   // This code is for when I work out how to force the osc to start
   // I think this is done when the time gets set
   if (!osc_runs) {
+    tm time_info;
+    schedule_civil(now, &time_info);
     RTC_set_time(&time_info);
     // Set the RTC clock time here if it's not running
     debug_print("osc not running, so started");
     //rtc.start(); // Replace with the appropriate method to start the RTC oscillator
   }
 
-  // create tm from sleeptime
-  time_added.tm_sec = sleeptime % 60;
-  sleeptime /= 60;
-  time_added.tm_min = sleeptime % 60;
-  sleeptime /= 60;
-  time_added.tm_hour = sleeptime % 24;
-  sleeptime /= 24;
-  // with these divisions the result is sure to fit into an int
-  time_added.tm_mday = sleeptime;
-
-  // add to time_info
-  time_info.tm_sec  += time_added.tm_sec;
-  time_info.tm_min  += time_added.tm_min;
-  time_info.tm_hour += time_added.tm_hour;
-  time_info.tm_mday += time_added.tm_mday;
-  //time_info.tm_mon  += time_added.tm_mon;
-  //time_info.tm_year += time_added.tm_year;
-
-  // normalize
-  mktime(&time_info);
- 
-  // set rtc alarm
+  H32_RTC_Caps caps = { H32_RTC_Backend::countdown_max, H32_RTC_Backend::alarm_resolution };
+  H32_Wake_Plan plan = schedule_plan(now, sleeptime, align, caps);
+
+  tm time_info;
+  schedule_civil(plan.wakeup, &time_info);
   debug_print("Wakeup Time: ");
   debug_println(&time_info, "%H:%M:%S, %B %d %Y");
- 
-  tm timenow;
-  RTC_get_time(&timenow);
-  return rtc.alarm_set(&time_info, true);
+
+  if (plan.source != wake_by_alarm) {
+    debug_print("Countdown: ");
+    debug_println(plan.ticks);
+    return rtc.countdown_set(plan.source, plan.ticks) && RTC_commit();
+  }
+  return rtc.alarm_set(&time_info) && RTC_commit();
 }// end of RTC_set_alarm
 
 /*
  * Get the byte stored in the RTC RAM
  */
 int16_t RTC_get_RAM() {
-  int16_t result = rtc.ram_get();
-  if(result == -1) {
+  if(!rtc.loaded() && !RTC_load()) {
     // If reading the RTC value is unsuccessful we return 0
-    result = 0;
+    return 0;
   }
-  return result;
+  return rtc.ram_get(0);
 }
 
 /*
- * Set the byte stored in the RTC RAM
+ * Set the byte stored in the RTC RAM. It is written with the next commit.
  */
 bool RTC_set_RAM(uint8_t ram) {
-  return rtc.ram_set(ram);
+  if(!rtc.loaded() && !RTC_load()) {
+    return false;
+  }
+  rtc.ram_set(0, ram);
+  return true;
 }
 
 /*
@@ -154,15 +172,47 @@ bool RTC_set_RAM(uint8_t ram) {
  * If 255 keep it there.
  */
 bool RTC_increment_RAM() {
-  int16_t value = rtc.ram_get();
-  if(value == -1) {
+  if(!rtc.loaded() && !RTC_load()) {
     return false;
   }
+  uint8_t value = rtc.ram_get(0);
   if(value < 255) {
-    value +=1;
-    return rtc.ram_set(value);
-  } else {
-    return true;
+    rtc.ram_set(0, value + 1);
   }
+  return true;
 }
 
+/*
+ * Copy a block of the RTC RAM, starting at index. Fails if the RAM
+ * of the RTC is too small.
+ */
+bool RTC_read_RAM(uint8_t index, void *data, uint8_t length) {
+  if(index + length > H32_RTC_Backend::ram_size) {
+    return false;
+  }
+  if(!rtc.loaded() && !RTC_load()) {
+    return false;
+  }
+  uint8_t *bytes = (uint8_t *)data;
+  for(uint8_t i = 0; i < length; i++) {
+    bytes[i] = rtc.ram_get(index + i);
+  }
+  return true;
+}
+
+/*
+ * Set a block of the RTC RAM. It is written with the next commit.
+ */
+bool RTC_write_RAM(uint8_t index, const void *data, uint8_t length) {
+  if(index + length > H32_RTC_Backend::ram_size) {
+    return false;
+  }
+  if(!rtc.loaded() && !RTC_load()) {
+    return false;
+  }
+  const uint8_t *bytes = (const uint8_t *)data;
+  for(uint8_t i = 0; i < length; i++) {
+    rtc.ram_set(index + i, bytes[i]);
+  }
+  return true;
+}
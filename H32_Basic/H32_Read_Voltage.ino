@@ -1,44 +1,201 @@
 /*
- * This function reads a voltage at the given pin with an oversampling
- * of "oversampling" times and removes the highest and lowest value from
- * the result.
- * We the compensate for intrinsic measurement offsets and integral non-linearity
- * by using a coefficient (the factor) and a constant (added to the result) for a 
- * correction.
+ * The voltages are read by the ADC engine (see H32_ADC.h) which samples all
+ * channels in one burst before WiFi is turned on. The samples of each channel
+ * are filtered (by default the mean without the highest and lowest quarter)
+ * and we then compensate for intrinsic measurement offsets and integral
+ * non-linearity by using a coefficient (the factor) and a constant (added
+ * to the result) for a correction.
  */
 
-const uint8_t oversampling = 5;
+#if defined(H32_ADC_CONTINUOUS) && ESP_IDF_VERSION_MAJOR >= 5
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_cali.h>
+#include <esp_adc/adc_cali_scheme.h>
 
-double read_voltage (uint8_t pin, double coefficient, double constant) {
-  
-  uint32_t adc_temp = 0;
-  uint32_t adc_lowest = UINT32_MAX;
-  uint32_t adc_highest = 0;
+const uint32_t adc_sample_freq = 20000;
+const uint32_t adc_read_timeout = 100;  // ms
 
-  // Read the voltage
-  for(int i = 0; i < oversampling + 2; i++) {
-    uint32_t new_val = analogReadMilliVolts(pin);
-    adc_temp += new_val;
-    if(new_val < adc_lowest ) {
-      adc_lowest = new_val;
+/*
+ * Samples ADC1 with the continuous mode, the conversions are written to
+ * memory by DMA. Fails for pins that are not connected to ADC1.
+ */
+class H32_ADC_Continuous : public H32_ADC_Source {
+private:
+  adc_cali_handle_t cali = NULL;
+
+  bool calibration() {
+    if(cali != NULL) {
+      return true;
     }
-    if(new_val > adc_highest) {
-      adc_highest = new_val;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t config = {};
+    config.unit_id = ADC_UNIT_1;
+    config.atten = ADC_ATTEN_DB_12;
+    config.bitwidth = ADC_BITWIDTH_DEFAULT;
+    return adc_cali_create_scheme_curve_fitting(&config, &cali) == ESP_OK;
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_line_fitting_config_t config = {};
+    config.unit_id = ADC_UNIT_1;
+    config.atten = ADC_ATTEN_DB_12;
+    config.bitwidth = ADC_BITWIDTH_DEFAULT;
+    return adc_cali_create_scheme_line_fitting(&config, &cali) == ESP_OK;
+#else
+    return false;
+#endif
+  };
+public:
+  bool sample(const int8_t *pins, uint8_t num, uint16_t *samples, uint16_t count) {
+    adc_digi_pattern_config_t pattern[adc_channel_max] = {};
+    uint8_t channels[adc_channel_max];
+    for(uint8_t c = 0; c < num; c++) {
+      adc_unit_t unit;
+      adc_channel_t channel;
+      if(pins[c] < 0 || adc_continuous_io_to_channel(pins[c], &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) {
+        return false;
+      }
+      channels[c] = channel;
+      pattern[c].atten = ADC_ATTEN_DB_12;
+      pattern[c].channel = channel;
+      pattern[c].unit = ADC_UNIT_1;
+      pattern[c].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+    if(!calibration()) {
+      return false;
+    }
+
+    uint32_t frame_size = num * count * SOC_ADC_DIGI_RESULT_BYTES;
+    frame_size = (frame_size + SOC_ADC_DIGI_DATA_BYTES_PER_CONV - 1) / SOC_ADC_DIGI_DATA_BYTES_PER_CONV * SOC_ADC_DIGI_DATA_BYTES_PER_CONV;
+    adc_continuous_handle_t handle = NULL;
+    adc_continuous_handle_cfg_t handle_config = {};
+    handle_config.max_store_buf_size = 2 * frame_size;
+    handle_config.conv_frame_size = frame_size;
+    if(adc_continuous_new_handle(&handle_config, &handle) != ESP_OK) {
+      return false;
+    }
+    adc_continuous_config_t config = {};
+    config.pattern_num = num;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = adc_sample_freq;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+#else
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+#endif
+
+    // Collect count conversions of each channel, in the order they arrive
+    uint16_t collected[adc_channel_max] = {};
+    uint32_t complete = 0;
+    uint8_t *buffer = new uint8_t[frame_size];
+    bool result = adc_continuous_config(handle, &config) == ESP_OK && adc_continuous_start(handle) == ESP_OK;
+    while(result && complete < num) {
+      uint32_t length = 0;
+      result = adc_continuous_read(handle, buffer, frame_size, &length, adc_read_timeout) == ESP_OK;
+      for(uint32_t i = 0; result && i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *data = (adc_digi_output_data_t *)&buffer[i];
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+        uint8_t channel = data->type1.channel;
+        uint32_t raw = data->type1.data;
+#else
+        uint8_t channel = data->type2.channel;
+        uint32_t raw = data->type2.data;
+#endif
+        for(uint8_t c = 0; c < num; c++) {
+          if(channels[c] == channel && collected[c] < count) {
+            int millivolts = 0;
+            adc_cali_raw_to_voltage(cali, raw, &millivolts);
+            samples[collected[c]++ * num + c] = millivolts;
+            if(collected[c] == count) {
+              complete++;
+            }
+            break;
+          }
+        }
+      }
+    }
+    adc_continuous_stop(handle);
+    adc_continuous_deinit(handle);
+    delete[] buffer;
+    return result;
+  };
+};
+H32_ADC_Continuous adc_continuous;
+#endif // H32_ADC_CONTINUOUS
+
+/*
+ * Samples the pins round-robin with single reads
+ */
+class H32_ADC_Oneshot : public H32_ADC_Source {
+public:
+  bool sample(const int8_t *pins, uint8_t num, uint16_t *samples, uint16_t count) {
+    for(uint16_t i = 0; i < count; i++) {
+      for(uint8_t c = 0; c < num; c++) {
+        samples[i * num + c] = analogReadMilliVolts(pins[c]);
+      }
+    }
+    return true;
+  };
+};
+H32_ADC_Oneshot adc_oneshot;
+
+H32_ADC_Engine adc_engine;
+int8_t adc_bat_channel = -1;
+int8_t adc_ext_channel = -1;
+int8_t adc_analog_channels[analog_channel_num] = {-1, -1, -1, -1};
+
+/*
+ * Sample all voltage channels in one burst
+ */
+bool read_adc() {
+  adc_engine.clear();
+#ifndef H32_REV_3
+  adc_bat_channel = adc_engine.add(h32_config.bat_v.pin, h32_config.bat_v.activation,
+                                   h32_config.bat_v.constant, h32_config.bat_v.coefficient);
+#endif //H32_REV_3
+  adc_ext_channel = adc_engine.add(h32_config.ext_v.pin, 0, h32_config.ext_v.constant, h32_config.ext_v.coefficient);
+  for(uint8_t i = 0; i < analog_channel_num; i++) {
+    H32_Analog_Config &analog = h32_config.analog[i];
+    adc_analog_channels[i] = -1;
+    if(analog.pin > 0 && strlen(analog.name) != 0) {
+      adc_analog_channels[i] = adc_engine.add(analog.pin, analog.activation,
+                                              analog.constant, analog.linear, analog.quadratic, analog.cubic);
     }
   }
-  adc_temp -= adc_lowest + adc_highest;
-  debug_print("ADC Value for pin ");
-  debug_print(pin);
-  debug_print(": ");
-  debug_println(adc_temp / oversampling);
-
-  // adjust the result of the ADC
-  adc_temp = (adc_temp * coefficient) / oversampling + constant * 1000;
-  
-  // Rounding the result to two decimal places
-  double result = ((adc_temp + 5) / 10) / 100.0;
-  debug_print("Voltage for pin ");
-  debug_print(pin);
+
+  // Power the dividers during the burst
+  for(uint8_t c = 0; c < adc_engine.getNum(); c++) {
+    if(adc_engine.getChannel(c).activation != 0) {
+      pin_on(adc_engine.getChannel(c).activation);
+    }
+  }
+
+  uint16_t count = constrain(h32_config.adc.samples, 1, adc_samples_max);
+  bool result = false;
+#if defined(H32_ADC_CONTINUOUS) && ESP_IDF_VERSION_MAJOR >= 5
+  result = adc_engine.acquire(adc_continuous, count, h32_config.adc.filter);
+  if(!result) {
+    debug_println("Continuous ADC not available, using single reads");
+  }
+#endif // H32_ADC_CONTINUOUS
+  if(!result) {
+    result = adc_engine.acquire(adc_oneshot, count, h32_config.adc.filter);
+  }
+
+  for(uint8_t c = 0; c < adc_engine.getNum(); c++) {
+    if(adc_engine.getChannel(c).activation != 0) {
+      pin_off(adc_engine.getChannel(c).activation);
+    }
+  }
+  return result;
+}
+
+/*
+ * The voltage of a channel of the last burst
+ */
+double read_voltage(int8_t channel) {
+  double result = adc_engine.getVolts(channel);
+  debug_print("Voltage of ADC channel ");
+  debug_print(channel);
   debug_print(": ");
   debug_println(result);
   return result;
@@ -46,7 +203,20 @@ double read_voltage (uint8_t pin, double coefficient, double constant) {
 
 
 double read_ext_voltage() {
-  return read_voltage(h32_config.ext_v.pin, h32_config.ext_v.coefficient, h32_config.ext_v.constant);
+  return read_voltage(adc_ext_channel);
+}
+
+/*
+ * Add the voltages of the additional analog channels under their names
+ */
+void analog_collect(H32_Measurements &measurements) {
+  for(uint8_t i = 0; i < analog_channel_num; i++) {
+    if(adc_analog_channels[i] >= 0) {
+      H32_Measurement_Id id = H32_Measurements::intern(h32_config.analog[i].name, "V", 1000);
+      H32_Measurements::report(id, h32_config.analog[i].deadband, h32_config.analog[i].hysteresis);
+      measurements.set(id, read_voltage(adc_analog_channels[i]));
+    }
+  }
 }
 
 
@@ -101,14 +271,7 @@ double read_bat_charge_rate() {
 
 
 double read_bat_voltage() {
- if(h32_config.bat_v.activation != 0) {
-    pin_on(h32_config.bat_v.activation);
-  }
-  double bat_v = read_voltage(h32_config.bat_v.pin, h32_config.bat_v.coefficient, h32_config.bat_v.constant);
-  if(h32_config.bat_v.activation != 0) {
-    pin_off(h32_config.bat_v.activation);
-  }
-  return bat_v;
+  return read_voltage(adc_bat_channel);
 }
 
 
@@ -0,0 +1,100 @@
+#ifndef H32_REPORT_H
+#define H32_REPORT_H
+
+#include <math.h>
+#include <string.h>
+
+#include "H32_WakeState.h"
+
+/*
+ * Report by exception: instead of connecting on every wake, we only connect
+ * if a reading has changed by more than its deadband since it has last been
+ * reported, or if nothing has been reported for the heartbeat interval. The
+ * decision is taken before the radio is turned on, a wake without a report
+ * goes straight back to sleep.
+ *
+ * Each reading has a deadband and a hysteresis. A reading that has been
+ * reported because it left its deadband is moving. While it is moving, it is
+ * already reported when it changes by more than the deadband minus the
+ * hysteresis, so that a steady change is followed closely. It settles when
+ * a report (e.g., the heartbeat) finds it within that smaller band.
+ *
+ *   deadband     the change that is reported, 0 turns the reading off
+ *   hysteresis   0 <= hysteresis <= deadband, 0 uses the deadband throughout
+ *
+ * Besides the core readings every measurement that has a deadband (see
+ * H32_Measurements::report()) takes part, in an extra slot of the wake state.
+ *
+ * The reported values and which readings are moving are kept in the wake
+ * state. The logic is plain C++ without any dependency to the hardware.
+ */
+
+typedef struct H32_Deadband {
+  float deadband;
+  float hysteresis;
+} H32_Deadband;
+
+enum H32_Report_Reason : uint8_t {
+  report_none = 0,    // nothing to report, the radio stays off
+  report_first,       // nothing has been reported so far
+  report_change,      // a reading has left its band
+  report_heartbeat,   // nothing has been reported for the heartbeat interval
+};
+
+/*
+ * The key of the extra slot of a measurement, never 0
+ */
+inline uint16_t report_key(const char *name) {
+  uint16_t key = crc16(name, strlen(name));
+  return key != 0 ? key : 1;
+}
+
+/*
+ * Whether the value has left the band around the reported value
+ */
+inline bool report_exceeds(float value, float reported, bool moving, const H32_Deadband &band) {
+  float hysteresis = band.hysteresis < 0 ? 0 : (band.hysteresis > band.deadband ? band.deadband : band.hysteresis);
+  float width = moving ? band.deadband - hysteresis : band.deadband;
+  float change = fabsf(value - reported);
+  return change > 0 && change >= width;
+}
+
+/*
+ * Decide whether the values (reading_max of them, one per H32_Reading and
+ * extra slot, NAN if not available) have to be reported at now. Failed
+ * readings are never reported, readings that have never been reported are.
+ * If there is a report, the readings that have left their band are marked
+ * as moving in the state.
+ * @param heartbeat the longest time in seconds without a report
+ */
+inline H32_Report_Reason report_decide(H32_Wake_State &state, const float *values,
+                                       const H32_Deadband *bands, uint32_t now, uint32_t heartbeat) {
+  H32_Report_Reason reason = report_none;
+  uint16_t moving = 0;
+  for(uint8_t reading = 0; reading < reading_max; reading++) {
+    float reported = state.getReported((H32_Reading)reading);
+    if(isnan(values[reading]) || bands[reading].deadband <= 0) {
+      continue;
+    }
+    if(isnan(reported)) {
+      reason = report_change;
+    } else if(report_exceeds(values[reading], reported, state.isMoving((H32_Reading)reading), bands[reading])) {
+      moving |= 1 << reading;
+      reason = report_change;
+    }
+  }
+
+  uint32_t last_upload = state.getLastUpload();
+  if(last_upload == 0) {
+    reason = report_first;
+  } else if(reason == report_none && (now < last_upload || now - last_upload >= heartbeat)) {
+    // A clock that has been set back also leads to a report
+    reason = report_heartbeat;
+  }
+  if(reason != report_none) {
+    state.setMoving(moving);
+  }
+  return reason;
+}
+
+#endif // H32_REPORT_H
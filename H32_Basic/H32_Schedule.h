@@ -0,0 +1,154 @@
+#ifndef H32_SCHEDULE_H
+#define H32_SCHEDULE_H
+
+/*
+ * The scheduler decides how the RTC wakes us up. The RTCs offer a countdown
+ * timer with different clocks and an alarm. Which of them is best depends on
+ * the sleep time:
+ *
+ *   countdown 64 Hz    short sleeps, precise to 1/64 s
+ *   countdown 1 Hz     sleeps up to the size of the counter in seconds
+ *   alarm              long sleeps, and sleeps aligned to the wall clock
+ *   countdown 1/60 Hz  sleeps beyond the horizon of the alarm
+ *
+ * The alarm compares second (or minute), hour and day of the month, so it
+ * can only be used for wake-ups less than the shortest month ahead (with a
+ * margin for rounding up to the resolution of the alarm). Sleeps that none
+ * of the mechanisms can reach are shortened to the longest one.
+ *
+ * With an alignment the wake-up is moved to a multiple of the alignment, e.g.,
+ * an alignment of 300 wakes at :00, :05, :10 and so on. All devices with the
+ * same alignment then report at the same time.
+ *
+ * All times are seconds since 1970 of the local time the RTC is set to. The
+ * calculations are plain C++ without any dependency to the hardware or the
+ * time zone settings of the C library.
+ */
+
+const uint32_t schedule_alarm_horizon = 27 * 86400UL;
+
+enum H32_Wake_Source : uint8_t {
+  wake_by_alarm = 0,
+  wake_by_countdown_64hz,
+  wake_by_countdown_1hz,
+  wake_by_countdown_1min,
+};
+
+/*
+ * What the RTC is capable of: the largest value of the countdown counter
+ * (0 if there is no countdown) and the resolution of the alarm in seconds
+ */
+typedef struct H32_RTC_Caps {
+  uint32_t countdown_max;
+  uint8_t alarm_resolution;
+} H32_RTC_Caps;
+
+typedef struct H32_Wake_Plan {
+  H32_Wake_Source source;
+  uint32_t ticks;    // the value of the countdown, if a countdown is used
+  uint32_t wakeup;   // the time of the wake-up
+} H32_Wake_Plan;
+
+/*
+ * Days since 1970-01-01 of a date of the proleptic Gregorian calendar
+ * (see http://howardhinnant.github.io/date_algorithms.html)
+ */
+inline int32_t schedule_days_from_civil(int32_t year, uint8_t month, uint8_t day) {
+  year -= month <= 2;
+  int32_t era = (year >= 0 ? year : year - 399) / 400;
+  uint32_t year_of_era = year - era * 400;
+  uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + (int32_t)day_of_era - 719468;
+}
+
+/*
+ * The seconds since 1970 of a broken-down time. The fields have to be in their
+ * normal ranges, tm_wday, tm_yday and tm_isdst are ignored.
+ */
+inline uint32_t schedule_epoch(const tm *time_info) {
+  int32_t days = schedule_days_from_civil(time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday);
+  return days * 86400UL + time_info->tm_hour * 3600UL + time_info->tm_min * 60UL + time_info->tm_sec;
+}
+
+/*
+ * The broken-down time of seconds since 1970, including tm_wday and tm_yday
+ */
+inline void schedule_civil(uint32_t epoch, tm *time_info) {
+  uint32_t days = epoch / 86400;
+  uint32_t seconds = epoch % 86400;
+  time_info->tm_hour = seconds / 3600;
+  time_info->tm_min = seconds / 60 % 60;
+  time_info->tm_sec = seconds % 60;
+  time_info->tm_wday = (days + 4) % 7;  // 1970-01-01 was a Thursday
+  time_info->tm_isdst = 0;
+
+  int32_t z = days + 719468;
+  int32_t era = z / 146097;
+  uint32_t day_of_era = z - era * 146097;
+  uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+  uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  uint32_t mp = (5 * day_of_year + 2) / 153;
+  uint8_t month = mp < 10 ? mp + 3 : mp - 9;
+  int32_t year = year_of_era + era * 400 + (month <= 2);
+  time_info->tm_mday = day_of_year - (153 * mp + 2) / 5 + 1;
+  time_info->tm_mon = month - 1;
+  time_info->tm_year = year - 1900;
+  time_info->tm_yday = days - schedule_days_from_civil(year, 1, 1);
+}
+
+/*
+ * The first multiple of align that is at least sleeptime - align + 1
+ * seconds after now. With sleeptime == align this is the next boundary,
+ * a larger sleeptime (e.g., due to the backoff) skips boundaries.
+ */
+inline uint32_t schedule_align(uint32_t now, uint32_t sleeptime, uint32_t align) {
+  uint32_t earliest = now + (sleeptime > align ? sleeptime - align : 0);
+  return (earliest / align + 1) * align;
+}
+
+/*
+ * Plan the wake-up after sleeptime seconds (optionally aligned) with the
+ * most precise mechanism the RTC offers for it
+ */
+inline H32_Wake_Plan schedule_plan(uint32_t now, uint32_t sleeptime, uint32_t align, const H32_RTC_Caps &caps) {
+  H32_Wake_Plan plan;
+  uint32_t target = align > 0 ? schedule_align(now, sleeptime, align) : now + sleeptime;
+  uint32_t delta = target > now ? target - now : 1;
+  uint32_t alarm_resolution = caps.alarm_resolution > 0 ? caps.alarm_resolution : 1;
+
+  // Shorten sleeps beyond the reach of the RTC
+  uint32_t horizon = schedule_alarm_horizon;
+  if(caps.countdown_max > horizon / 60) {
+    horizon = caps.countdown_max * 60;
+  }
+  if(delta > horizon) {
+    delta = horizon;
+    align = 0;
+  }
+  plan.wakeup = now + delta;
+
+  // Wall clock aligned wake-ups use the alarm, if it can hit the boundary
+  if(align > 0 && delta <= schedule_alarm_horizon && plan.wakeup % alarm_resolution == 0) {
+    plan.source = wake_by_alarm;
+    plan.ticks = 0;
+  } else if(delta <= caps.countdown_max / 64) {
+    plan.source = wake_by_countdown_64hz;
+    plan.ticks = delta * 64;
+  } else if(delta <= caps.countdown_max) {
+    plan.source = wake_by_countdown_1hz;
+    plan.ticks = delta;
+  } else if(delta <= schedule_alarm_horizon) {
+    // the alarm cannot be earlier than requested, so round up
+    plan.source = wake_by_alarm;
+    plan.ticks = 0;
+    plan.wakeup = (plan.wakeup + alarm_resolution - 1) / alarm_resolution * alarm_resolution;
+  } else {
+    plan.source = wake_by_countdown_1min;
+    plan.ticks = (delta + 59) / 60;
+    plan.wakeup = now + plan.ticks * 60;
+  }
+  return plan;
+}
+
+#endif // H32_SCHEDULE_H
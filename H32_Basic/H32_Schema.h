@@ -0,0 +1,234 @@
+#ifndef H32_SCHEMA_H
+#define H32_SCHEMA_H
+
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+/*
+ * The configuration is described by a table of fields. Each entry names a
+ * member of a config struct, its key in the json file and, if it is shown in
+ * the portal, its id and label. The table is a constant array that is
+ * initialized at compile time, types and sizes are derived from the members.
+ *
+ * From the tables the sketch generates the json and binary (de)serialization
+ * (H32_Persistence.ino) and the portal parameters (H32_WM_Parameter.ino).
+ * Entries without a member only add html to the portal, e.g., headings.
+ *
+ * The table of H32_Config is always the first one. Extensions can register
+ * tables for their own config structs with an H32_Schema_Registration.
+ */
+
+enum H32_Field_Type : uint8_t {
+  field_html = 0,   // portal only, the label is the html
+  field_u8,
+  field_i8,
+  field_u16,
+  field_u32,
+  field_double,
+  field_string,     // char array, size includes the terminating 0
+  field_choice,     // int8_t (or enum of it) selected from a list of options
+};
+
+/*
+ * The field type of a member type. Enums are handled like their
+ * underlying type.
+ */
+template<typename T, typename Enable = void> struct H32_Field_Kind;
+template<> struct H32_Field_Kind<uint8_t>  { static const H32_Field_Type value = field_u8; };
+template<> struct H32_Field_Kind<int8_t>   { static const H32_Field_Type value = field_i8; };
+template<> struct H32_Field_Kind<uint16_t> { static const H32_Field_Type value = field_u16; };
+template<> struct H32_Field_Kind<uint32_t> { static const H32_Field_Type value = field_u32; };
+template<> struct H32_Field_Kind<double>   { static const H32_Field_Type value = field_double; };
+template<size_t N> struct H32_Field_Kind<char[N]> { static const H32_Field_Type value = field_string; };
+template<typename T> struct H32_Field_Kind<T, typename std::enable_if<std::is_enum<T>::value>::type>
+  : H32_Field_Kind<typename std::underlying_type<T>::type> {};
+
+typedef struct H32_Field {
+  H32_Field_Type type;
+  uint16_t offset;              // of the member in the config struct
+  uint8_t size;                 // of the member
+  const char *part;             // json object of the member, NULL on the top level
+  const char *name;             // json key
+  const char *id;               // portal id, NULL if not shown in the portal
+  const char *label;            // portal label (or the html)
+  const char *attributes;       // additional html attributes of the input field
+  const char * const *options;  // the names of the options of a choice
+  uint8_t option_num;
+} H32_Field;
+
+#define H32_MEMBER_TYPE(type, member) decltype(((type *)0)->member)
+
+/*
+ * A member on the top level of the struct, e.g. H32_FIELD_2(H32_Config, name, ...)
+ */
+#define H32_FIELD_2(type, name, id, label, attributes) \
+  { H32_Field_Kind<H32_MEMBER_TYPE(type, name)>::value, offsetof(type, name), sizeof(H32_MEMBER_TYPE(type, name)), \
+    NULL, #name, id, label, attributes, NULL, 0 }
+/*
+ * A member of a nested struct, e.g. H32_FIELD_3(H32_Config, rtc, sleeptime, ...)
+ */
+#define H32_FIELD_3(type, part, name, id, label, attributes) \
+  { H32_Field_Kind<H32_MEMBER_TYPE(type, part.name)>::value, offsetof(type, part.name), sizeof(H32_MEMBER_TYPE(type, part.name)), \
+    #part, #name, id, label, attributes, NULL, 0 }
+/*
+ * A member of the n-th (counting from 1) element of an array of structs,
+ * e.g. H32_FIELD_N(H32_Config, analog, 1, pin, ...) is stored as "analog1"
+ */
+#define H32_FIELD_N(type, part, n, name, id, label, attributes) \
+  { H32_Field_Kind<H32_MEMBER_TYPE(type, part[n - 1].name)>::value, offsetof(type, part[n - 1].name), \
+    sizeof(H32_MEMBER_TYPE(type, part[n - 1].name)), #part #n, #name, id, label, attributes, NULL, 0 }
+/*
+ * A member of a nested struct chosen from a list of names in the portal
+ */
+#define H32_CHOICE_3(type, part, name, id, label, options, option_num) \
+  { field_choice, offsetof(type, part.name), sizeof(H32_MEMBER_TYPE(type, part.name)), \
+    #part, #name, id, label, NULL, options, option_num }
+/*
+ * Html that is only shown in the portal
+ */
+#define H32_HTML(html) \
+  { field_html, 0, 0, NULL, NULL, NULL, html, NULL, NULL, 0 }
+
+#define H32_FIELD_NUM(fields) (sizeof(fields) / sizeof(H32_Field))
+
+/*
+ * A table of fields together with the struct it describes
+ */
+typedef struct H32_Schema_Table {
+  const H32_Field *fields;
+  uint8_t num;
+  void *base;
+
+  uint8_t *member(const H32_Field &field) const {
+    return (uint8_t *)base + field.offset;
+  }
+} H32_Schema_Table;
+
+class H32_Schema {
+private:
+  static std::vector<H32_Schema_Table> *tables;
+public:
+  static void add(const H32_Field *fields, uint8_t num, void *base) {
+    if (tables == NULL) {
+      tables = new std::vector<H32_Schema_Table>();
+    }
+    tables->push_back({fields, num, base});
+  };
+  static inline std::vector<H32_Schema_Table> *getTables() { return tables; };
+
+  /*
+   * The size of all fields when packed into a binary image
+   */
+  static size_t packedSize() {
+    size_t size = 0;
+    for (const H32_Schema_Table &table : *tables) {
+      for (uint8_t i = 0; i < table.num; i++) {
+        size += table.fields[i].size;
+      }
+    }
+    return size;
+  };
+  /*
+   * The number of json members of all fields: the values and the nested
+   * objects they are stored in (counted once per run of fields of a part)
+   */
+  static size_t jsonMembers() {
+    size_t members = 0;
+    for (const H32_Schema_Table &table : *tables) {
+      const char *part = NULL;
+      for (uint8_t i = 0; i < table.num; i++) {
+        const H32_Field &field = table.fields[i];
+        if (field.name == NULL) {
+          continue;
+        }
+        if (field.part != NULL && (part == NULL || strcmp(part, field.part) != 0)) {
+          members++;
+        }
+        part = field.part;
+        members++;
+      }
+    }
+    return members;
+  };
+  /*
+   * The bytes of all keys and string values, including their terminating
+   * zeros, in case they are copied into the json document (e.g. when it is
+   * read from a stream)
+   */
+  static size_t jsonStrings() {
+    size_t size = 0;
+    for (const H32_Schema_Table &table : *tables) {
+      for (uint8_t i = 0; i < table.num; i++) {
+        const H32_Field &field = table.fields[i];
+        if (field.name == NULL) {
+          continue;
+        }
+        size += strlen(field.name) + 1;
+        if (field.part != NULL) {
+          size += strlen(field.part) + 1;
+        }
+        if (field.type == field_string) {
+          size += field.size;
+        }
+      }
+    }
+    return size;
+  };
+  /*
+   * Copy all fields into (or out of) a binary image of packedSize() bytes
+   */
+  static void pack(uint8_t *image) {
+    for (const H32_Schema_Table &table : *tables) {
+      for (uint8_t i = 0; i < table.num; i++) {
+        memcpy(image, table.member(table.fields[i]), table.fields[i].size);
+        image += table.fields[i].size;
+      }
+    }
+  };
+  static void unpack(const uint8_t *image) {
+    for (const H32_Schema_Table &table : *tables) {
+      for (uint8_t i = 0; i < table.num; i++) {
+        memcpy(table.member(table.fields[i]), image, table.fields[i].size);
+        image += table.fields[i].size;
+      }
+    }
+    clampChoices();
+  };
+  /*
+   * The option of a choice field, the first one if the stored value is out
+   * of range (e.g., edited in the json file). It is used as an index.
+   */
+  static int8_t choice(const H32_Schema_Table &table, const H32_Field &field) {
+    int8_t value = *(const int8_t *)table.member(field);
+    return value >= 0 && value < field.option_num ? value : 0;
+  };
+  /*
+   * Set all choice fields that are out of range to their first option
+   */
+  static void clampChoices() {
+    for (const H32_Schema_Table &table : *tables) {
+      for (uint8_t i = 0; i < table.num; i++) {
+        if (table.fields[i].type == field_choice) {
+          *(int8_t *)table.member(table.fields[i]) = choice(table, table.fields[i]);
+        }
+      }
+    }
+  };
+};
+// Out-of-line initialization for non-const static members
+std::vector<H32_Schema_Table> *H32_Schema::tables = NULL;
+
+/*
+ * Registers a table when it is constructed, e.g. as a global of an extension:
+ *   H32_Schema_Registration my_registration(my_fields, H32_FIELD_NUM(my_fields), &my_config);
+ */
+class H32_Schema_Registration {
+public:
+  H32_Schema_Registration(const H32_Field *fields, uint8_t num, void *base) {
+    H32_Schema::add(fields, num, base);
+  };
+};
+
+#endif // H32_SCHEMA_H
@@ -3,68 +3,60 @@
  */
 
 #include "H32_Basic.h"
-#include <AHTxx.h>
+#include "H32_AHT.h"
 
 const uint8_t aht_retries = 3;
+const uint8_t aht_retry_delay = 10;
 
 #ifdef H32_REV_3
-#define H32_AHTX0_I2CADDR AHTXX_ADDRESS_X38
-#define AHT_SENSOR_TYPE AHT2x_SENSOR
+H32_AHT aht(H32_AHT2X_ADDR, H32_AHT::AHT2X);
 #else
-#define H32_AHTX0_I2CADDR AHT10_ADDRESS_X39
-#define AHT_SENSOR_TYPE AHT1x_SENSOR
+H32_AHT aht(H32_AHT1X_ADDR, H32_AHT::AHT1X);
 #endif
 
-
-AHTxx aht(H32_AHTX0_I2CADDR, AHT_SENSOR_TYPE);
-
 /*
  * Try to initialize the AHTxx sensor "aht_retries" times before
- * giving up.
+ * giving up. If successful, the measurement is started and runs
+ * in the background until read_sensor() is called.
  */
 bool init_sensor() {
   debug_println("AHTxx initialization");
 
+  Wire.begin();
   bool result = false;
   for(int i = 0; i < aht_retries; i++) {
-    result = aht.begin();
+    result = aht.begin() && aht.start(h32_config.sensor.samples);
     if(result) {
       debug_println("Found AHT sensor");
       break;
     }
     debug_println("AHT sensor not found");
-//    aht.softReset();
-    delay(100);
+    delay(aht_retry_delay);
   }
   return result;
 }
 
 /*
- * Read the temperature from the sensor
+ * Wait for the measurement started by init_sensor() and read
+ * temperature and humidity
  */
-float get_temperature() {
-  float temperature;
-
-  temperature = aht.readTemperature();
+bool read_sensor(float *temperature, float *humidity) {
+  if(!aht.wait()) {
+    debug_println("AHT measurement failed");
+    return false;
+  }
+  *temperature = aht.temperature();
+  *humidity = aht.humidity();
 
   debug_print("Temperature: ");
-  debug_print(temperature);
+  debug_print(*temperature);
   debug_println(" degrees C");
-
-  return temperature;
-}
-
-/*
- * Read the humidity from the sensor
- */
-float get_humidity() {
-  float humidity;
-  
-  humidity = aht.readHumidity(); ;
-
   debug_print("Humidity: ");
-  debug_print(humidity);
+  debug_print(*humidity);
   debug_println(" % rH");
-
-  return humidity;
+  if(aht.crc_errors() > 0) {
+    debug_print("AHT CRC errors: ");
+    debug_println(aht.crc_errors());
+  }
+  return true;
 }
@@ -0,0 +1,367 @@
+#ifndef H32_TLS_H
+#define H32_TLS_H
+
+#include <string.h>
+#include <Client.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/md.h>
+
+#include "H32_CRC.h"
+
+/*
+ * A TLS client on top of a plain Client (the WiFiClient) using mbedTLS.
+ * In contrast to WiFiClientSecure it keeps the session of a connection
+ * across power-off: after the handshake the session (with its ticket, if
+ * the server issues one) is serialized into an H32_TLS_Session_Store, and
+ * the next wake offers it to the server. If the server accepts it, the
+ * handshake is abbreviated to a single round trip without certificates and
+ * key exchange, otherwise a full handshake takes place and the new session
+ * is stored.
+ *
+ * The server is authenticated by the SHA-256 fingerprint of its certificate
+ * (64 hex digits, separators are ignored). The fingerprint is checked after
+ * every handshake, a resumed session carries the certificate of its full
+ * handshake. Without a valid fingerprint no connection is made, so that the
+ * credentials are never sent to a server that is not authenticated.
+ *
+ * Without TLS enabled all calls are passed to the underlying client, so
+ * that the same client can be used for both.
+ */
+
+const uint16_t tls_timeout = 5000;
+const uint16_t tls_session_max = 3072;   // serialized session, including the certificate
+
+/*
+ * A place the serialized sessions are kept in, one per server
+ */
+class H32_TLS_Session_Store {
+public:
+  /*
+   * @param length the size of data, set to the length of the session
+   */
+  virtual bool load(const char *host, uint16_t port, uint8_t *data, size_t &length) = 0;
+  virtual bool save(const char *host, uint16_t port, const uint8_t *data, size_t length) = 0;
+};
+
+class H32_TLS_Client : public Client {
+private:
+  Client &client;
+  H32_TLS_Session_Store *store = NULL;
+  bool enabled = false;
+  uint8_t fingerprint[32];
+  bool pinned = false;
+  uint32_t (*clock)();
+
+  bool initialized = false;
+  bool established = false;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_ssl_config conf;
+  mbedtls_ssl_context ssl;
+
+  // Statistics of the last handshake
+  uint32_t handshake_sent = 0;
+  uint32_t handshake_received = 0;
+  uint32_t handshake_time = 0;
+  bool handshake_running = false;
+
+  // The serialized session, only allocated during a handshake
+  uint8_t *session_data = NULL;
+  uint16_t session_crc = 0;
+
+  static int bioSend(void *self, const unsigned char *data, size_t length) {
+    H32_TLS_Client *tls = (H32_TLS_Client *)self;
+    size_t written = tls->client.write(data, length);
+    if(written == 0) {
+      return tls->client.connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : 0;
+    }
+    if(tls->handshake_running) {
+      tls->handshake_sent += written;
+    }
+    return written;
+  };
+  static int bioReceive(void *self, unsigned char *data, size_t length) {
+    H32_TLS_Client *tls = (H32_TLS_Client *)self;
+    if(tls->client.available() <= 0) {
+      return tls->client.connected() ? MBEDTLS_ERR_SSL_WANT_READ : 0;
+    }
+    int read = tls->client.read(data, length);
+    if(read <= 0) {
+      return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    if(tls->handshake_running) {
+      tls->handshake_received += read;
+    }
+    return read;
+  };
+
+  bool initialize() {
+    if(initialized) {
+      return true;
+    }
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    mbedtls_ssl_config_init(&conf);
+    if(mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, NULL, 0) != 0
+       || mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+      return false;
+    }
+    // the certificate is checked against the fingerprint
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    initialized = true;
+    return true;
+  };
+
+  static int8_t hexDigit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  /*
+   * Parse the hex digits of the fingerprint
+   * @return false unless there are exactly 32 bytes
+   */
+  bool parse(const char *text) {
+    if(text == NULL) {
+      return false;
+    }
+    uint8_t index = 0;
+    int8_t high = -1;
+    for(const char *c = text; *c; c++) {
+      int8_t digit = hexDigit(*c);
+      if(digit < 0) {
+        continue;
+      }
+      if(high < 0) {
+        high = digit;
+      } else {
+        if(index >= sizeof(fingerprint)) {
+          return false;
+        }
+        fingerprint[index++] = high << 4 | digit;
+        high = -1;
+      }
+    }
+    return index == sizeof(fingerprint) && high < 0;
+  };
+  /*
+   * Compare the certificate of the server with the fingerprint
+   */
+  bool verify() {
+    const mbedtls_x509_crt *certificate = mbedtls_ssl_get_peer_cert(&ssl);
+    if(!pinned || certificate == NULL) {
+      return false;
+    }
+    uint8_t hash[32];
+    if(mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), certificate->raw.p,
+                  certificate->raw.len, hash) != 0) {
+      return false;
+    }
+    return memcmp(hash, fingerprint, sizeof(hash)) == 0;
+  };
+
+  /*
+   * Offer the stored session of the server
+   */
+  void resume(const char *host, uint16_t port) {
+    size_t length = tls_session_max;
+    session_crc = 0;
+    if(store == NULL || !store->load(host, port, session_data, length)) {
+      return;
+    }
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if(mbedtls_ssl_session_load(&session, session_data, length) == 0
+       && mbedtls_ssl_set_session(&ssl, &session) == 0) {
+      session_crc = crc16(session_data, length);
+    }
+    mbedtls_ssl_session_free(&session);
+  };
+  /*
+   * Store the session of the connection, unless it is the one offered
+   */
+  void keep(const char *host, uint16_t port) {
+    if(store == NULL) {
+      return;
+    }
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    size_t length = 0;
+    if(mbedtls_ssl_get_session(&ssl, &session) == 0
+       && mbedtls_ssl_session_save(&session, session_data, tls_session_max, &length) == 0
+       && crc16(session_data, length) != session_crc) {
+      store->save(host, port, session_data, length);
+    }
+    mbedtls_ssl_session_free(&session);
+  };
+
+  bool handshake(const char *host, uint16_t port) {
+    mbedtls_ssl_init(&ssl);
+    if(!initialize() || mbedtls_ssl_setup(&ssl, &conf) != 0
+       || mbedtls_ssl_set_hostname(&ssl, host) != 0) {
+      mbedtls_ssl_free(&ssl);
+      return false;
+    }
+    mbedtls_ssl_set_bio(&ssl, this, bioSend, bioReceive, NULL);
+    session_data = new uint8_t[tls_session_max];
+    resume(host, port);
+
+    handshake_sent = 0;
+    handshake_received = 0;
+    handshake_running = true;
+    uint32_t start = clock();
+    int result;
+    while((result = mbedtls_ssl_handshake(&ssl)) != 0) {
+      if((result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE)
+         || clock() - start > tls_timeout) {
+        break;
+      }
+      delay(1);
+    }
+    handshake_running = false;
+    handshake_time = clock() - start;
+    if(result == 0 && verify()) {
+      established = true;
+      keep(host, port);
+    } else {
+      mbedtls_ssl_free(&ssl);
+    }
+    delete[] session_data;
+    session_data = NULL;
+    return established;
+  };
+public:
+  H32_TLS_Client(Client &client, uint32_t (*clock)() = millis) : client(client), clock(clock) {};
+
+  /*
+   * Use TLS for the next connections, authenticating the server with the
+   * fingerprint of its certificate
+   * @return false if TLS is enabled without a valid fingerprint, the
+   *   connections are refused then
+   */
+  bool setTLS(bool enabled, const char *fingerprint, H32_TLS_Session_Store *store = NULL) {
+    this->enabled = enabled;
+    this->store = store;
+    pinned = parse(fingerprint);
+    return !enabled || pinned;
+  };
+  bool isTLS() const { return enabled; };
+
+  int connect(IPAddress ip, uint16_t port) {
+    if(!enabled) {
+      return client.connect(ip, port);
+    }
+    // the session is stored by host name
+    return connect(ip.toString().c_str(), port);
+  };
+  int connect(const char *host, uint16_t port) {
+    stop();
+    if(enabled && !pinned) {
+      return 0;
+    }
+    if(!client.connect(host, port)) {
+      return 0;
+    }
+    if(enabled && !handshake(host, port)) {
+      client.stop();
+      return 0;
+    }
+    return 1;
+  };
+
+  size_t write(uint8_t data) {
+    return write(&data, 1);
+  };
+  size_t write(const uint8_t *data, size_t length) {
+    if(!enabled) {
+      return client.write(data, length);
+    }
+    if(!established) {
+      return 0;
+    }
+    size_t written = 0;
+    uint32_t start = clock();
+    while(written < length) {
+      int result = mbedtls_ssl_write(&ssl, data + written, length - written);
+      if(result > 0) {
+        written += result;
+      } else if((result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE)
+                || clock() - start > tls_timeout) {
+        break;
+      }
+    }
+    return written;
+  };
+
+  int available() {
+    if(!enabled) {
+      return client.available();
+    }
+    if(!established) {
+      return 0;
+    }
+    // process the records that have arrived
+    if(mbedtls_ssl_get_bytes_avail(&ssl) == 0 && client.available() > 0) {
+      mbedtls_ssl_read(&ssl, NULL, 0);
+    }
+    return mbedtls_ssl_get_bytes_avail(&ssl);
+  };
+  int read() {
+    uint8_t data;
+    return read(&data, 1) == 1 ? data : -1;
+  };
+  int read(uint8_t *data, size_t length) {
+    if(!enabled) {
+      return client.read(data, length);
+    }
+    if(!established || available() <= 0) {
+      return -1;
+    }
+    int result = mbedtls_ssl_read(&ssl, data, length);
+    return result > 0 ? result : -1;
+  };
+  int peek() {
+    if(!enabled) {
+      return client.peek();
+    }
+    // not needed by the users of this client
+    return -1;
+  };
+  void flush() {
+    client.flush();
+  };
+  void stop() {
+    if(established) {
+      mbedtls_ssl_close_notify(&ssl);
+      mbedtls_ssl_free(&ssl);
+      established = false;
+    }
+    client.stop();
+  };
+  uint8_t connected() {
+    if(enabled && !established) {
+      return 0;
+    }
+    return client.connected() || (enabled && mbedtls_ssl_get_bytes_avail(&ssl) > 0);
+  };
+  operator bool() {
+    return connected();
+  };
+
+  /*
+   * A resumed handshake receives a few hundred bytes, a full one the certificates
+   */
+  uint32_t getHandshakeSent() const { return handshake_sent; };
+  uint32_t getHandshakeReceived() const { return handshake_received; };
+  uint32_t getHandshakeTime() const { return handshake_time; };
+};
+
+#endif // H32_TLS_H
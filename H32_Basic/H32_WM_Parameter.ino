@@ -4,160 +4,109 @@
  */
 
 /*
- * Create Parameters reflecting the config struct
+ * The parameters are created from the tables of the config schema (see H32_Schema.h)
+ * the first time the portal needs them. Wake cycles that only measure and upload
+ * neither construct them nor allocate their buffers.
  */
-// Tools -------------------
-String version_str = String(H32_MAJOR) + "." + String(H32_MINOR) + "." + String(H32_PATCH);  
-String header_text = String("<h1>Config page for H32</h1><p>firmware version: ") + version_str + "</p>";
-WiFiManagerParameter header(header_text.c_str());
-WiFiManagerParameter i2c_scan_link("<h1>Tools</h1><p><a href='/i2c_scan' class='D'>Scan I2C Bus</a></p>");
-WiFiManagerParameter rtc_link("<p><a href='/devices' class='D'>Show Device Readings (and set RTC)</a></p><hr/><H1>Settings</H1>");
-// Basic Settings ----------
-WiFiManagerParameter basic_heading("<h2>Basic</h2>");
-WiFiManagerParameter basic_name("basic_name", "Device Name", "", SSID_LENGTH);
-WiFiManagerParameter basic_led_pin("basic_led_pin", "LED Pin<br/>(0 turns off, - is active low, + is active high)", "", U8_LENGTH, "pattern='-?\\d{0,2}'");
-WiFiManagerParameter basic_trigger_pin("basic_trigger_pin", "Additional Trigger Pin<br/>(0 turns off)", "", U8_LENGTH, "pattern='-?\\d{0,2}'");
-WiFiManagerParameter basic_timeout("basic_timeout", "WiFi Connection Timeout", "", U16_LENGTH);
-// RTC Settings
-WiFiManagerParameter rtc_heading("<h2>RTC</h2>");
-WiFiManagerParameter rtc_sleeptime("rtc_sleeptime", "RTC Sleep Time in seconds", "", U32_LENGTH);
-WiFiManagerParameter rtc_factor("rtc_factor", "RTC Backoff Factor", "", DOUBLE_LENGTH);
-WiFiManagerParameter rtc_limit("rtc_limit", "RTC Backoff Limit", "", DOUBLE_LENGTH);
-// Measurements ------------
-WiFiManagerParameter measurement_heading("<h2>Measurements</h2>");
-WiFiManagerParameter measurement_bat_activation("measurement_bat_activation", "Battery Measurement Activation Pin<br/>(0 turns off, - is active low, + is active high)", "", U8_LENGTH, "pattern='-?\\d{0,2}'");
-WiFiManagerParameter measurement_bat_coefficient("measurement_bat_coefficient", "Battery Voltage Compensation Coefficient", "", DOUBLE_LENGTH);
-WiFiManagerParameter measurement_bat_constant("measurement_bat_constant", "Battery Voltage Compensation Constant", "", DOUBLE_LENGTH);
-WiFiManagerParameter measurement_bat_pin("measurement_bat_pin", "Battery Voltage Pin", "", U8_LENGTH, "pattern='\\d{0,2}'");
-WiFiManagerParameter measurement_ext_coefficient("measurement_ext_coefficient", "Ext Voltage Compensation Coefficient", "", DOUBLE_LENGTH);
-WiFiManagerParameter measurement_ext_constant("measurement_ext_constant", "Ext Voltage Compensation Constant", "", DOUBLE_LENGTH, "pattern='[+-]?[.\\d]{0,6}'");
-WiFiManagerParameter measurement_ext_pin("measurement_ext_pin", "Ext Voltage Pin", "", U8_LENGTH, "pattern='\\d{0,2}'");
-// API Keys ----------------
-WiFiManagerParameter api_heading("<h2>Service API Keys</h2>");
-WiFiManagerParameter *api_type; // will be created dynamically
-String api_type_str;
-WiFiManagerParameter api_type_display("api_type_display", "<br/> <br/>", "", NAME_LENGTH, "readonly", WFM_LABEL_AFTER);
-WiFiManagerParameter api_key("api_key", "API Key", "", NAME_LENGTH);
-WiFiManagerParameter api_additional("api_additional", "API Additional Value", "", NAME_LENGTH);
-// MQTT Settings -----------
-WiFiManagerParameter mqtt_heading("<h2>MQTT</h2>");
-WiFiManagerParameter mqtt_server("mqtt_server", "MQTT Server", "", NAME_LENGTH);
-WiFiManagerParameter mqtt_port("mqtt_port", "MQTT Port", "", U16_LENGTH, "pattern='\\d{0,5}'");
-WiFiManagerParameter mqtt_topic("mqtt_topic", "MQTT Topic", "", TOPIC_LENGTH);
-WiFiManagerParameter mqtt_user("mqtt_user", "MQTT User", "", NAME_LENGTH);
-WiFiManagerParameter mqtt_password("mqtt_password", "MQTT Password", "", NAME_LENGTH);
-// NTP Settings -----------
-WiFiManagerParameter ntp_heading("<h2>NTP</h2>");
-WiFiManagerParameter ntp_server("ntp_server", "NTP Server", "", NAME_LENGTH);
-WiFiManagerParameter ntp_daylight_offset("ntp_daylight_offset", "NTP Daylight Offset", "", U8_LENGTH, "pattern='\\d{0,2}'");
-WiFiManagerParameter ntp_timezone_offset("ntp_timezone_offset", "NTP Timezone Offset", "", U8_LENGTH, "pattern='\\d{0,2}'");
-// Static IP Settings -----------
-WiFiManagerParameter static_ip_heading("<h2>Static IP Settings</h2>");
-WiFiManagerParameter static_ip_address("static_ip_address", "IP Address", "", IP_ADDR_LENGTH, "pattern='^((25[0-5]|(2[0-4]|1\\d|[1-9]|)\\d)\\.?\\b){4}$'");
-WiFiManagerParameter static_gateway("static_gateway", "Gateway", "", IP_ADDR_LENGTH, "pattern='^((25[0-5]|(2[0-4]|1\\d|[1-9]|)\\d)\\.?\\b){4}$'");
-WiFiManagerParameter static_subnet("static_subnet", "Subnet", "", IP_ADDR_LENGTH, "pattern='^((25[0-5]|(2[0-4]|1\\d|[1-9]|)\\d)\\.?\\b){4}$'");
-WiFiManagerParameter static_dns("static_dns", "DNS Server", "", IP_ADDR_LENGTH, "pattern='^((25[0-5]|(2[0-4]|1\\d|[1-9]|)\\d)\\.?\\b){4}$'");
-
+std::vector<WiFiManagerParameter *> *portal_params = NULL;  // one per field of all tables, NULL if not shown
+std::deque<String> *portal_html = NULL;    // the html built at runtime, the parameters only keep its pointer
+std::deque<WiFiManagerParameter> *portal_text = NULL;   // the parameters that only show html
 
 /*
- * Add parameters to WifiManager and set their values to the ones in the config struct
+ * The length of the input field of a config field
  */
-void add_parameters() {
-  // Header
-  wm.addParameter(&header);
-  // Tools
-  wm.addParameter(&i2c_scan_link);
-  wm.addParameter(&rtc_link);
-
-  // Basic Settings
-  wm.addParameter(&basic_heading);
-  wm.addParameter(&basic_name);
-  basic_name.setValue(h32_config.name, SSID_LENGTH);
-  wm.addParameter(&basic_led_pin);
-  basic_led_pin.setValue(String(h32_config.led_pin).c_str(), U8_LENGTH);
-  wm.addParameter(&basic_trigger_pin);
-  basic_trigger_pin.setValue(String(h32_config.trigger_pin).c_str(), U8_LENGTH);
-  wm.addParameter(&basic_timeout);
-  basic_timeout.setValue(String(h32_config.timeout).c_str(), U16_LENGTH);
-
-  // RTC Settings
-  wm.addParameter(&rtc_heading);
-  wm.addParameter(&rtc_sleeptime);
-  rtc_sleeptime.setValue(String(h32_config.rtc.sleeptime).c_str(), U32_LENGTH);
-  wm.addParameter(&rtc_factor);
-  rtc_factor.setValue(String(h32_config.rtc.factor).c_str(), DOUBLE_LENGTH);
-  wm.addParameter(&rtc_limit);
-  rtc_limit.setValue(String(h32_config.rtc.limit).c_str(), DOUBLE_LENGTH);
-
-  // Measurement Settings
-  wm.addParameter(&measurement_heading);
-  wm.addParameter(&measurement_bat_activation);
-  measurement_bat_activation.setValue(String(h32_config.bat_v.activation).c_str(), U8_LENGTH);
-  wm.addParameter(&measurement_bat_coefficient);
-  measurement_bat_coefficient.setValue(String(h32_config.bat_v.coefficient).c_str(), DOUBLE_LENGTH);
-  wm.addParameter(&measurement_bat_constant);
-  measurement_bat_constant.setValue(String(h32_config.bat_v.constant).c_str(), DOUBLE_LENGTH);
-  wm.addParameter(&measurement_bat_pin);
-  measurement_bat_pin.setValue(String(h32_config.bat_v.pin).c_str(), U8_LENGTH);
-  wm.addParameter(&measurement_ext_coefficient);
-  measurement_ext_coefficient.setValue(String(h32_config.ext_v.coefficient).c_str(), DOUBLE_LENGTH);
-  wm.addParameter(&measurement_ext_constant);
-  measurement_ext_constant.setValue(String(h32_config.ext_v.constant).c_str(), DOUBLE_LENGTH);
-  wm.addParameter(&measurement_ext_pin);
-  measurement_ext_pin.setValue(String(h32_config.ext_v.pin).c_str(), U8_LENGTH);
-
-  // API Settings
-  wm.addParameter(&api_heading);
+int portal_length(const H32_Field &field) {
+  switch (field.type) {
+    case field_u16:    return U16_LENGTH;
+    case field_u32:    return U32_LENGTH;
+    case field_double: return DOUBLE_LENGTH;
+    case field_string: return field.size - 1;
+    default:           return U8_LENGTH;
+  }
+}
 
-  String api_type_pre = "<label for='api_type_id'>Service Type (Choose from Dropdown, current value below)</label><br/><select id='api_type_id' name='api_type_id'>";
-  api_type_str += api_type_pre + "<option value='-1' selected>Don't Change</option>";
-  for(int i = 0; i < apitype_num; i++) {
-    api_type_str += "<option value='" + String(i) + "'>" + apitype_names[i] + "</option>";
+/*
+ * The value of a config field as shown in the portal
+ */
+String portal_value(const H32_Schema_Table &table, const H32_Field &field) {
+  const uint8_t *member = table.member(field);
+  switch (field.type) {
+    case field_u8:     return String(*(const uint8_t *)member);
+    case field_i8:     return String(*(const int8_t *)member);
+    case field_u16:    return String(*(const uint16_t *)member);
+    case field_u32:    return String(*(const uint32_t *)member);
+    case field_double: return String(*(const double *)member);
+    case field_string: return String((const char *)member);
+    case field_choice: return String("Current Value: ") + field.options[H32_Schema::choice(table, field)];
+    default:           return String();
   }
-  api_type_str += "</select>";
-  api_type = new WiFiManagerParameter(api_type_str.c_str());
-  wm.addParameter(api_type);
-  wm.addParameter(&api_type_display);
-  api_type_display.setValue((String("Current Value: ") + apitype_names[h32_config.api.type]).c_str(), NAME_LENGTH);
-  
-  wm.addParameter(&api_key);
-  api_key.setValue(h32_config.api.key, NAME_LENGTH);
+}
 
-  wm.addParameter(&api_additional);
-  api_additional.setValue(h32_config.api.additional, NAME_LENGTH);
+/*
+ * Add a parameter that only shows html. A deque keeps its elements in place,
+ * so WiFiManager can point to them.
+ */
+void add_text(const char *html) {
+  portal_text->emplace_back(html);
+  wm.addParameter(&portal_text->back());
+}
 
-  // MQTT
-  wm.addParameter(&mqtt_heading);
-  wm.addParameter(&mqtt_server);
-  mqtt_server.setValue(h32_config.mqtt.server, NAME_LENGTH);
-  wm.addParameter(&mqtt_port);
-  mqtt_port.setValue(String(h32_config.mqtt.port).c_str(), U16_LENGTH);  
-  wm.addParameter(&mqtt_topic);
-  mqtt_topic.setValue(h32_config.mqtt.topic, TOPIC_LENGTH);
-  wm.addParameter(&mqtt_user);
-  mqtt_user.setValue(h32_config.mqtt.user, NAME_LENGTH);
-  wm.addParameter(&mqtt_password);
-  mqtt_password.setValue(h32_config.mqtt.passwd, NAME_LENGTH);
+/*
+ * A choice is a dropdown followed by a readonly field showing the current value.
+ * The dropdown is named <id>_id and keeps the value unless another one is chosen.
+ */
+WiFiManagerParameter *add_choice(const H32_Field &field) {
+  String select = "<label for='";
+  select += String(field.id) + "_id'>" + field.label + "</label><br/><select id='" + field.id + "_id' name='" + field.id + "_id'>";
+  select += "<option value='-1' selected>Don't Change</option>";
+  for (int i = 0; i < field.option_num; i++) {
+    select += "<option value='" + String(i) + "'>" + field.options[i] + "</option>";
+  }
+  select += "</select>";
+  portal_html->push_back(select);
+  add_text(portal_html->back().c_str());
+  return new WiFiManagerParameter(field.id, "<br/> <br/>", "", NAME_LENGTH, "readonly", WFM_LABEL_AFTER);
+}
 
-  // NTP
-  wm.addParameter(&ntp_heading);
-  wm.addParameter(&ntp_server);
-  ntp_server.setValue(h32_config.ntp.server, NAME_LENGTH);
-  wm.addParameter(&ntp_timezone_offset);
-  ntp_timezone_offset.setValue(String(h32_config.ntp.gmtOffset_h).c_str(), U8_LENGTH);
-  wm.addParameter(&ntp_daylight_offset);
-  ntp_daylight_offset.setValue(String(h32_config.ntp.daylightOffset_h).c_str(), U8_LENGTH);
+/*
+ * Add parameters to WifiManager and set their values to the ones in the config tables
+ */
+void add_parameters() {
+  if (portal_params != NULL) {
+    return;
+  }
+  portal_params = new std::vector<WiFiManagerParameter *>();
+  portal_html = new std::deque<String>();
+  portal_text = new std::deque<WiFiManagerParameter>();
 
-  // Static IP Address
-  wm.addParameter(&static_ip_heading);
-  wm.addParameter(&static_ip_address);
-  static_ip_address.setValue(h32_config.static_conf.ip_address, IP_ADDR_LENGTH);
-  wm.addParameter(&static_gateway);
-  static_gateway.setValue(h32_config.static_conf.gateway, IP_ADDR_LENGTH);
-  wm.addParameter(&static_subnet);
-  static_subnet.setValue(h32_config.static_conf.subnet, IP_ADDR_LENGTH);
-  wm.addParameter(&static_dns);
-  static_dns.setValue(h32_config.static_conf.dns, IP_ADDR_LENGTH);
+  // Header
+  String header_text = "<h1>Config page for H32</h1><p>firmware version: ";
+  header_text += String(H32_MAJOR) + "." + String(H32_MINOR) + "." + String(H32_PATCH) + "</p>";
+  portal_html->push_back(header_text);
+  add_text(portal_html->back().c_str());
+  // Tools
+  add_text("<h1>Tools</h1><p><a href='/i2c_scan' class='D'>Scan I2C Bus</a></p>");
+  add_text("<p><a href='/devices' class='D'>Show Device Readings (and set RTC)</a></p><hr/><H1>Settings</H1>");
+
+  // Settings
+  for (const H32_Schema_Table &table : *H32_Schema::getTables()) {
+    for (uint8_t i = 0; i < table.num; i++) {
+      const H32_Field &field = table.fields[i];
+      WiFiManagerParameter *wmp = NULL;
+      if (field.type == field_html) {
+        add_text(field.label);
+      } else if (field.id != NULL) {
+        if (field.type == field_choice) {
+          wmp = add_choice(field);
+        } else {
+          wmp = new WiFiManagerParameter(field.id, field.label, "", portal_length(field), field.attributes);
+        }
+        wm.addParameter(wmp);
+        wmp->setValue(portal_value(table, field).c_str(), wmp->getValueLength());
+      }
+      portal_params->push_back(wmp);
+    }
+  }
 }
 
 /*
@@ -165,61 +114,20 @@ void add_parameters() {
  */
 void saveParamsCallback () {
   debug_println("Save Params Callback");
+  if (portal_params == NULL) {
+    return;
+  }
 
-  // Basic Settings
-  retrieve_from_form(h32_config.name, &basic_name, SSID_LENGTH);
-  retrieve_from_form(&h32_config.led_pin, &basic_led_pin);
-  retrieve_from_form(&h32_config.trigger_pin, &basic_trigger_pin);
-  retrieve_from_form(&h32_config.timeout, &basic_timeout);
-
-  // RTC Settings
-  retrieve_from_form(&h32_config.rtc.sleeptime, &rtc_sleeptime);
-  retrieve_from_form(&h32_config.rtc.factor, &rtc_factor);
-  retrieve_from_form(&h32_config.rtc.limit, &rtc_limit);
-
-  // Measurement Settings
-  retrieve_from_form(&h32_config.bat_v.activation, &measurement_bat_activation);
-  retrieve_from_form(&h32_config.bat_v.coefficient, &measurement_bat_coefficient);
-  retrieve_from_form(&h32_config.bat_v.constant, &measurement_bat_constant);
-  retrieve_from_form(&h32_config.bat_v.pin, &measurement_bat_pin);
-
-  retrieve_from_form(&h32_config.ext_v.coefficient, &measurement_ext_coefficient);  
-  retrieve_from_form(&h32_config.ext_v.constant, &measurement_ext_constant);
-  retrieve_from_form(&h32_config.ext_v.pin, &measurement_ext_pin);
-
-  // API Settings
-  if(wm.server->hasArg("api_type_id")) {
-    String value = wm.server->arg("api_type_id");
-    APIType api_type_val = (APIType)atoi(value.c_str());
-    if(api_type_val != -1) {
-      h32_config.api.type = api_type_val;
-      api_type_display.setValue(apitype_names[h32_config.api.type], NAME_LENGTH);
+  size_t index = 0;
+  for (const H32_Schema_Table &table : *H32_Schema::getTables()) {
+    for (uint8_t i = 0; i < table.num; i++, index++) {
+      WiFiManagerParameter *wmp = (*portal_params)[index];
+      if (wmp != NULL) {
+        retrieve_from_form(table, table.fields[i], wmp);
+      }
     }
-    debug_print("API Type: ");
-    debug_println(h32_config.api.type);
   }
 
-  retrieve_from_form(h32_config.api.key, &api_key, NAME_LENGTH);
-  retrieve_from_form(h32_config.api.additional, &api_additional, NAME_LENGTH);
-
-  // MQTT
-  retrieve_from_form(h32_config.mqtt.server, &mqtt_server, NAME_LENGTH);
-  retrieve_from_form(&h32_config.mqtt.port, &mqtt_port);
-  retrieve_from_form(h32_config.mqtt.topic, &mqtt_topic, TOPIC_LENGTH);
-  retrieve_from_form(h32_config.mqtt.user, &mqtt_user, NAME_LENGTH);    
-  retrieve_from_form(h32_config.mqtt.passwd, &mqtt_password, NAME_LENGTH);
-
-  // NTP
-  retrieve_from_form(h32_config.ntp.server, &ntp_server, NAME_LENGTH);
-  retrieve_from_form(&h32_config.ntp.gmtOffset_h, &ntp_timezone_offset);
-  retrieve_from_form(&h32_config.ntp.daylightOffset_h, &ntp_daylight_offset);
-
-  // Static IP
-  retrieve_from_form(h32_config.static_conf.ip_address, &static_ip_address, IP_ADDR_LENGTH);
-  retrieve_from_form(h32_config.static_conf.gateway, &static_gateway, IP_ADDR_LENGTH);
-  retrieve_from_form(h32_config.static_conf.subnet, &static_subnet, IP_ADDR_LENGTH);
-  retrieve_from_form(h32_config.static_conf.dns, &static_dns, IP_ADDR_LENGTH);
-
   write_config();
 }
 /*
@@ -252,33 +160,34 @@ void saveConfigCallback () {
   debug_println("End of Config Callback");
 }
 
-void retrieve_from_form(char *config_val, WiFiManagerParameter *wmp, int length) {  
-  strncpy(config_val, wmp->getValue(), length);
-  debug_print(wmp->getLabel());
-  debug_print(" (c*): ");
-  debug_println(config_val);
-}
-void retrieve_from_form(double *config_val, WiFiManagerParameter *wmp) {
-  *config_val = atof(wmp->getValue());
-  debug_print(wmp->getLabel());
-  debug_print(" (d): ");
-  debug_println(*config_val);
-}
-void retrieve_from_form(int8_t *config_val, WiFiManagerParameter *wmp) {
-  *config_val = atoi(wmp->getValue());
-  debug_print(wmp->getLabel());
-  debug_print(" (i8): ");
-  debug_println(*config_val);
-}
-void retrieve_from_form(uint16_t *config_val, WiFiManagerParameter *wmp) {
-  *config_val = atoi(wmp->getValue());
-  debug_print(wmp->getLabel());
-  debug_print(" (i16): ");
-  debug_println(*config_val);    
-}
-void retrieve_from_form(uint32_t *config_val, WiFiManagerParameter *wmp) {
-  *config_val = atol(wmp->getValue());
-  debug_print(wmp->getLabel());
-  debug_print(" (i32): ");
-  debug_println(*config_val);  
+/*
+ * Store the value of a parameter in its config field
+ */
+void retrieve_from_form(const H32_Schema_Table &table, const H32_Field &field, WiFiManagerParameter *wmp) {
+  uint8_t *member = table.member(field);
+  const char *value = wmp->getValue();
+  switch (field.type) {
+    case field_u8:     *(uint8_t *)member = atoi(value); break;
+    case field_i8:     *(int8_t *)member = atoi(value); break;
+    case field_u16:    *(uint16_t *)member = atoi(value); break;
+    case field_u32:    *(uint32_t *)member = atol(value); break;
+    case field_double: *(double *)member = atof(value); break;
+    case field_string:
+      strncpy((char *)member, value, field.size - 1);
+      member[field.size - 1] = 0;
+      break;
+    case field_choice:
+      if (wm.server->hasArg(String(field.id) + "_id")) {
+        int choice = atoi(wm.server->arg(String(field.id) + "_id").c_str());
+        if (choice >= 0 && choice < field.option_num) {
+          *(int8_t *)member = choice;
+        }
+        wmp->setValue(portal_value(table, field).c_str(), wmp->getValueLength());
+      }
+      break;
+    default: break;
+  }
+  debug_print(field.label);
+  debug_print(": ");
+  debug_println(portal_value(table, field));
 }
@@ -0,0 +1,258 @@
+#ifndef H32_WAKESTATE_H
+#define H32_WAKESTATE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "H32_CRC.h"
+#include "H32_Dispatch.h"
+
+/*
+ * The wake state is everything a wake cycle wants to know about the previous
+ * ones: the time of the last successful upload, the head of the measurement
+ * log (so that the log does not have to be scanned),
+ * how far each sink got in the log (see H32_Dispatch.h) and the readings
+ * that have been reported last (see H32_Report.h).
+ *
+ * The state is kept in two places. The header (generation and last upload)
+ * is stored in the RAM of the RTC, if the RTC has enough of it, since that is
+ * written anyway with the alarm. The complete state is additionally written
+ * to a shadow in flash. Both copies carry a version and a CRC. When loading:
+ *
+ *   - if both are valid, the shadow is used
+ *   - if the shadow is stale (its write was lost), the newer header of the
+ *     RTC replaces the one of the shadow
+ *   - if only one of them is valid, it is used
+ *   - otherwise the state starts from scratch
+ *
+ * The shadow is only written when its content has changed, which saves the
+ * flash. Every such write increments the generation of the state, the copy
+ * with the higher generation is the newer one. The wake cycles themselves
+ * are not counted: with the PCF85063A, whose single byte of RAM is taken by
+ * the failed connections counter, this would cost a write of the shadow in
+ * every cycle. (The ESP32 is powered off between the cycles, so its RTC
+ * memory is lost.)
+ *
+ * The logic only depends on the H32_Wake_Storage interface, the sketch
+ * implements it for the RTC RAM and for NVS (see H32_WakeState.ino).
+ */
+
+const uint8_t wake_state_version = 5;
+
+/*
+ * The readings remembered between wake cycles
+ */
+enum H32_Reading : uint8_t {
+  reading_batV = 0,
+  reading_extV,
+  reading_temperature,
+  reading_humidity,
+  reading_batPercentage,
+  reading_num,
+};
+
+/*
+ * The other measurements that are reported by exception (e.g., the named
+ * analog channels and the values of the extensions) are remembered in extra
+ * slots following the readings. A slot belongs to the measurement whose name
+ * has the key (see report_key()), since the ids are assigned anew on every
+ * wake.
+ */
+const uint8_t reading_extra_num = 8;
+const uint8_t reading_max = reading_num + reading_extra_num;
+
+/*
+ * The part of the state that is kept in the RTC RAM (12 bytes)
+ */
+typedef struct H32_Wake_Header {
+  uint8_t version = 0;
+  uint8_t reserved = 0;
+  uint16_t crc = 0;
+  uint32_t generation = 0;    // number of writes of the shadow
+  uint32_t last_upload = 0;   // epoch of the last successful upload, 0 if none
+
+  uint16_t calculateCRC() const {
+    return crc16(&generation, sizeof(H32_Wake_Header) - offsetof(H32_Wake_Header, generation));
+  }
+  bool isValid() const {
+    return version == wake_state_version && crc == calculateCRC();
+  }
+  void seal() {
+    version = wake_state_version;
+    reserved = 0;
+    crc = calculateCRC();
+  }
+} H32_Wake_Header;
+
+/*
+ * The complete state as stored in the shadow
+ */
+typedef struct H32_Wake_State {
+  H32_Wake_Header header;
+  uint32_t log_head = 0;      // sequence number of the newest log record
+  uint32_t sink_tail[sink_max] = {};  // sequence number of the last record sent to each sink
+  float reported[reading_num] = {NAN, NAN, NAN, NAN, NAN};
+  float extra_reported[reading_extra_num] = {};
+  uint16_t extra_key[reading_extra_num] = {};   // 0 if the slot is free
+  uint16_t moving = 0;        // bit per reading (and extra slot) that has left its deadband
+  uint8_t power_mode = 0;     // of the last wake, see H32_Power.h
+  uint8_t reserved[3] = {};   // no padding, the state is compared and checked bytewise
+  uint16_t crc = 0;
+
+  uint16_t calculateCRC() const {
+    return crc16(this, offsetof(H32_Wake_State, crc));
+  }
+  bool isValid() const {
+    return header.isValid() && crc == calculateCRC();
+  }
+  void seal() {
+    header.seal();
+    crc = calculateCRC();
+  }
+
+  uint32_t getGeneration() const { return header.generation; };
+  uint32_t getLastUpload() const { return header.last_upload; };
+  void setLastUpload(uint32_t epoch) { header.last_upload = epoch; };
+  float getReported(H32_Reading reading) const {
+    return reading < reading_num ? reported[reading] : extra_reported[reading - reading_num];
+  };
+  void setReported(H32_Reading reading, float value) {
+    if(reading < reading_num) {
+      reported[reading] = value;
+    } else {
+      extra_reported[reading - reading_num] = value;
+    }
+  };
+  bool isMoving(H32_Reading reading) const { return moving & (1 << reading); };
+  void setMoving(uint16_t readings) { moving = readings; };
+
+  /*
+   * The reading of the extra slot with the key. A new key takes a free
+   * slot, which starts as never reported.
+   * @return reading_max if all slots are taken
+   */
+  H32_Reading extraReading(uint16_t key) {
+    uint8_t free = reading_extra_num;
+    for(uint8_t slot = 0; slot < reading_extra_num; slot++) {
+      if(extra_key[slot] == key) {
+        return (H32_Reading)(reading_num + slot);
+      }
+      if(extra_key[slot] == 0 && free == reading_extra_num) {
+        free = slot;
+      }
+    }
+    if(free == reading_extra_num) {
+      return (H32_Reading)reading_max;
+    }
+    extra_key[free] = key;
+    extra_reported[free] = NAN;
+    moving &= ~(1 << (reading_num + free));
+    return (H32_Reading)(reading_num + free);
+  };
+  /*
+   * Free the extra slots that are not among the readings (bit per reading),
+   * e.g., of a channel that has been renamed or turned off
+   */
+  void keepExtra(uint16_t readings) {
+    for(uint8_t slot = 0; slot < reading_extra_num; slot++) {
+      if(!(readings & (1 << (reading_num + slot)))) {
+        extra_key[slot] = 0;
+        extra_reported[slot] = 0;
+        moving &= ~(1 << (reading_num + slot));
+      }
+    }
+  };
+} H32_Wake_State;
+static_assert(sizeof(H32_Wake_State) == offsetof(H32_Wake_State, crc) + sizeof(uint16_t), "the state has no padding");
+static_assert(reading_max <= 16, "the moving readings have to fit into a mask");
+
+/*
+ * A place the state (or its header) can be stored in
+ */
+class H32_Wake_Storage {
+public:
+  virtual bool read(void *data, size_t length) = 0;
+  virtual bool write(const void *data, size_t length) = 0;
+};
+
+class H32_Wake_Store {
+private:
+  H32_Wake_Storage &rtc;
+  H32_Wake_Storage &shadow;
+  H32_Wake_State stored;      // the content of the shadow
+  bool stored_valid = false;
+
+  /*
+   * @return true if the state differs from the shadow in more than the generation
+   */
+  bool changed(const H32_Wake_State &state) const {
+    if(!stored_valid) {
+      return true;
+    }
+    H32_Wake_State compared = state;
+    compared.header.generation = stored.header.generation;
+    compared.seal();
+    return memcmp(&compared, &stored, sizeof(stored)) != 0;
+  };
+public:
+  enum Source : uint8_t {
+    from_none   = 0,
+    from_rtc    = 1,
+    from_shadow = 2,
+  };
+
+  H32_Wake_Store(H32_Wake_Storage &rtc, H32_Wake_Storage &shadow) : rtc(rtc), shadow(shadow) {};
+
+  /*
+   * Load the state, recovering from a corrupt or stale copy as described above
+   * @return the copies the state has been taken from (Source bits)
+   */
+  uint8_t load(H32_Wake_State &state) {
+    H32_Wake_Header header;
+    bool rtc_valid = rtc.read(&header, sizeof(header)) && header.isValid();
+    bool shadow_valid = shadow.read(&state, sizeof(state)) && state.isValid();
+    stored_valid = shadow_valid;
+
+    uint8_t source = from_none;
+    if(rtc_valid) {
+      source |= from_rtc;
+    }
+    if(shadow_valid) {
+      source |= from_shadow;
+      stored = state;
+    } else {
+      state = H32_Wake_State();
+    }
+    // The RTC is written last, a newer header there means the shadow is stale
+    if(rtc_valid && (!shadow_valid || header.generation > state.header.generation)) {
+      state.header = header;
+    }
+    return source;
+  };
+
+  /*
+   * Store the header in the RTC and the state in the shadow, if it has changed.
+   * A changed state gets the next generation.
+   * @return false if neither could be written
+   */
+  bool store(H32_Wake_State &state) {
+    bool has_changed = changed(state);
+    if(has_changed) {
+      state.header.generation++;
+    }
+    state.seal();
+    bool rtc_written = rtc.write(&state.header, sizeof(state.header));
+    if(!has_changed) {
+      return true;
+    }
+    bool shadow_written = shadow.write(&state, sizeof(state));
+    if(shadow_written) {
+      stored = state;
+      stored_valid = true;
+    }
+    return rtc_written || shadow_written;
+  };
+};
+
+#endif // H32_WAKESTATE_H
@@ -0,0 +1,197 @@
+/*
+ * The wake state (see H32_WakeState.h). Its header is stored in the
+ * RTC RAM after the failed connections counter, the shadow in NVS.
+ * NVS is used instead of a file since it does not have to be mounted.
+ */
+
+const uint8_t wake_state_rtc_index = 1;  // index 0 is the failed connections counter
+
+class H32_Wake_RTC : public H32_Wake_Storage {
+public:
+  bool read(void *data, size_t length) {
+    return RTC_read_RAM(wake_state_rtc_index, data, length);
+  };
+  /*
+   * The RAM is written to the RTC with the next commit, i.e., with the alarm
+   */
+  bool write(const void *data, size_t length) {
+    return RTC_write_RAM(wake_state_rtc_index, data, length);
+  };
+};
+
+class H32_Wake_NVS : public H32_Wake_Storage {
+public:
+  bool read(void *data, size_t length) {
+    bool result = false;
+    if (prefs.begin(h32_wake_prefs, true)) {
+      result = prefs.getBytes(h32_wake_prefs_key, data, length) == length;
+      prefs.end();
+    }
+    return result;
+  };
+  bool write(const void *data, size_t length) {
+    bool result = false;
+    if (prefs.begin(h32_wake_prefs, false)) {
+      result = prefs.putBytes(h32_wake_prefs_key, data, length) == length;
+      prefs.end();
+    }
+    return result;
+  };
+};
+
+H32_Wake_RTC wake_rtc;
+H32_Wake_NVS wake_nvs;
+H32_Wake_Store wake_store(wake_rtc, wake_nvs);
+H32_Wake_State wake_state;
+uint8_t wake_state_source = H32_Wake_Store::from_none;
+
+/*
+ * Load the wake state at the start of a wake cycle
+ */
+void wake_state_begin() {
+  wake_state_source = wake_store.load(wake_state);
+
+  debug_print("Wake state ");
+  debug_print(wake_state.getGeneration());
+  debug_print(" from");
+  debug_print(wake_state_source & H32_Wake_Store::from_rtc ? " RTC" : "");
+  debug_println(wake_state_source & H32_Wake_Store::from_shadow ? " NVS" : " -");
+}
+
+/*
+ * Store the wake state, the RTC part is written with the alarm
+ */
+bool wake_state_end() {
+  bool result = wake_store.store(wake_state);
+  if (!result) {
+    debug_println("Couldn't store the wake state");
+  }
+  return result;
+}
+
+/*
+ * The log head is only known if the shadow has been valid
+ */
+bool wake_state_log_known() {
+  return wake_state_source & H32_Wake_Store::from_shadow;
+}
+
+uint32_t wake_state_log_head() {
+  return wake_state.log_head;
+}
+
+void wake_state_set_log_head(uint32_t head) {
+  wake_state.log_head = head;
+}
+
+/*
+ * The last record of the log each sink has got (see H32_Dispatch.ino)
+ */
+uint32_t wake_state_sink_tail(uint8_t sink) {
+  return wake_state.sink_tail[sink];
+}
+
+void wake_state_set_sink_tail(uint8_t sink, uint32_t seq) {
+  wake_state.sink_tail[sink] = seq;
+}
+
+/*
+ * The power mode decided in the last wake (see H32_Power.h)
+ */
+uint8_t wake_state_power_mode() {
+  return wake_state.power_mode;
+}
+
+void wake_state_set_power_mode(uint8_t mode) {
+  wake_state.power_mode = mode;
+}
+
+/*
+ * The measurements of the readings remembered in the wake state
+ */
+const H32_Measurement_Id wake_state_readings[reading_num] = {
+  measurement_bat_v,
+  measurement_ext_v,
+  measurement_temperature,
+  measurement_humidity,
+  measurement_bat_percentage,
+};
+
+/*
+ * The values of all readings and their bands: the core readings, then the
+ * other measurements that have a deadband in the extra slots of the wake
+ * state. The slots of measurements that are gone are freed.
+ */
+void report_values(H32_Measurements &measurements, float *values, H32_Deadband *bands) {
+  const H32_Deadband core_bands[reading_num] = {
+    {(float)h32_config.report.bat_v, (float)h32_config.report.bat_v_hysteresis},
+    {(float)h32_config.report.ext_v, (float)h32_config.report.ext_v_hysteresis},
+    {(float)h32_config.report.temperature, (float)h32_config.report.temperature_hysteresis},
+    {(float)h32_config.report.humidity, (float)h32_config.report.humidity_hysteresis},
+    {(float)h32_config.report.bat_percentage, (float)h32_config.report.bat_percentage_hysteresis},
+  };
+  for (uint8_t reading = 0; reading < reading_max; reading++) {
+    values[reading] = reading < reading_num ? measurements.get(wake_state_readings[reading]) : NAN;
+    bands[reading] = reading < reading_num ? core_bands[reading] : H32_Deadband{0, 0};
+  }
+  uint16_t used = 0;
+  for (H32_Measurement_Id id = measurement_core_num; id < H32_Measurements::count(); id++) {
+    const H32_Quantity &quantity = H32_Measurements::quantity(id);
+    if (quantity.band.deadband <= 0) {
+      continue;
+    }
+    H32_Reading reading = wake_state.extraReading(report_key(quantity.name));
+    if (reading >= reading_max) {
+      debug_print("Report: no slot left for ");
+      debug_println(quantity.name);
+      continue;
+    }
+    values[reading] = measurements.get(id);
+    bands[reading] = quantity.band;
+    used |= 1 << reading;
+  }
+  wake_state.keepExtra(used);
+}
+
+/*
+ * Remember the time of a successful upload and the readings that have been sent.
+ * Only report by exception needs them, without it they would only cause
+ * writes of the shadow.
+ */
+void wake_state_uploaded(H32_Measurements &measurements) {
+  if (!report_enabled()) {
+    return;
+  }
+  wake_state.setLastUpload(RTC_get_epoch());
+  float values[reading_max];
+  H32_Deadband bands[reading_max];
+  report_values(measurements, values, bands);
+  for (uint8_t reading = 0; reading < reading_max; reading++) {
+    if (!isnan(values[reading])) {
+      wake_state.setReported((H32_Reading)reading, values[reading]);
+    }
+  }
+}
+
+/*
+ * Report by exception (see H32_Report.h) is used if a heartbeat is configured
+ */
+bool report_enabled() {
+  return h32_config.report.heartbeat != 0;
+}
+
+/*
+ * Decide whether the measurements have to be reported, i.e., whether we connect
+ */
+bool report_due(H32_Measurements &measurements) {
+  float values[reading_max];
+  H32_Deadband bands[reading_max];
+  report_values(measurements, values, bands);
+  H32_Report_Reason reason = report_decide(wake_state, values, bands, RTC_get_epoch(),
+                                           h32_config.report.heartbeat * 60UL);
+
+  static const char *reasons[] = {"none", "first", "change", "heartbeat"};
+  debug_print("Report: ");
+  debug_println(reasons[reason]);
+  return reason != report_none;
+}
@@ -95,18 +95,18 @@ void handle_devices() {
   }
 
   output += "<h2>Measurements</h2>";
-  output += "<p>Battery Voltage: ";
-  output += String(m.getBatV()) + "V</p>";
-
-#ifdef H32_REV_3
-  output += "<p>Battery Percentage: ";
-  output += String(m.getBatPercentage()) + "%</p>";
-  output += "<p>Battery Charge Rate: ";
-  output += String(m.getBatChargeRate()) + "%/h</p><hr/>";
-#endif // H32_REV_3
-
-  output += "<p>Ext Voltage: ";
-  output += String(m.getExtV()) + "V</p><hr/>";
+  for(H32_Measurement_Id id = measurement_bat_v; id < H32_Measurements::count(); id++) {
+    if(m.has(id)) {
+      const H32_Quantity &quantity = H32_Measurements::quantity(id);
+      output += "<p>" + String(quantity.name) + ": " + String(m.get(id)) + quantity.unit + "</p>";
+    }
+  }
+  output += "<hr/>";
+
+#ifdef H32_PROFILE
+  output += profile_html();
+#endif // H32_PROFILE
+
   output += footer;
   wm.server->send(200, "text/html", output);
 }
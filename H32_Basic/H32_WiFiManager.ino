@@ -52,20 +52,49 @@ int init_WiFiManager() {
   // Set the custom menu
   wm.setMenu(menu);
   
-  // Add Parameters
-  add_parameters();
+  // The parameters are only needed if the captive portal may be opened
+  if(!wm.getWiFiIsSaved()) {
+    add_parameters();
+  }
+
+  H32_WiFi_Cache wifi_cache;
+  H32_FastConnect fast(wifi_cache);
+  bool res = false;
 
   // if we already have WiFi data we won't start the portal
   // even if we cannot connect
   if(wm.getWiFiIsSaved()) {
     debug_println("Found a saved AP");
     wm.setEnableConfigPortal(false);
-    wm.setConnectTimeout(h32_config.timeout);
+    wm.setConnectTimeout(budget_wifi_timeout(h32_config.timeout));
+
+    // First try to directly connect to the last access point
+    if(h32_config.fast_connect) {
+      read_wifi_cache(wifi_cache);
+      res = fast_connect(fast, wifi_cache);
+    }
+  }
+
+  // Now we try to connect, the captive portal may take any time
+  if(!res) {
+    if(!wm.getWiFiIsSaved()) {
+      budget_watchdog_stop();
+    }
+    res = wm.autoConnect(h32_config.name, ap_passwd); // password protected ap
+    fast.fullResult(res);
+  }
+
+  // Remember the access point for the next wake and persist the
+  // cache if anything (including the miss counter) has changed
+  if(h32_config.fast_connect) {
+    if(res) {
+      remember_connection(fast);
+    }
+    if(fast.cacheChanged()) {
+      write_wifi_cache(wifi_cache);
+    }
   }
 
-  // Now we try to connect
-  bool res;
-  res = wm.autoConnect(h32_config.name, ap_passwd); // password protected ap
   if(!res) {
       debug_print("Failed to connect to ");
       debug_println(wm.getWiFiSSID(true));
@@ -78,6 +107,75 @@ int init_WiFiManager() {
 }
 
 
+/*
+ * Try to associate directly with the access point of the last connection,
+ * skipping the scan. If no static IP is configured, the cached lease is used
+ * while it is fresh, so that DHCP is skipped as well. On failure the WiFi is
+ * reset so that the normal connection can be tried.
+ */
+bool fast_connect(H32_FastConnect &fast, H32_WiFi_Cache &cache) {
+  String ssid = wm.getWiFiSSID(true);
+  if(fast.begin(ssid.c_str()) != H32_FastConnect::fc_fast) {
+    debug_println("No valid fast reconnect data");
+    return false;
+  }
+  String pass = wm.getWiFiPass(true);
+  debug_print("Fast reconnect on channel ");
+  debug_println(cache.channel);
+
+  IPAddress _ip, _gw, _sn, _dns;
+  if (fast.useLease(RTC_get_epoch())) {
+    _ip = cache.ip;
+    _gw = cache.gateway;
+    _sn = cache.subnet;
+    _dns = cache.dns;
+  }
+  if (strlen(h32_config.static_conf.ip_address) != 0) {
+    _ip.fromString(h32_config.static_conf.ip_address);
+    _gw.fromString(h32_config.static_conf.gateway);
+    _sn.fromString(h32_config.static_conf.subnet);
+    _dns.fromString(h32_config.static_conf.dns);
+  }
+  if ((uint32_t)_ip != 0) {
+    WiFi.config(_ip, _gw, _sn, _dns);
+  }
+
+  // Don't store BSSID and channel with the credentials
+  WiFi.persistent(false);
+  WiFi.begin(ssid.c_str(), pass.c_str(), cache.channel, cache.bssid, true);
+  uint32_t start = millis();
+  while(fast.poll(WiFi.isConnected(), millis() - start) == H32_FastConnect::fc_fast) {
+    delay(10);
+  }
+  WiFi.persistent(true);
+
+  if(fast.getState() == H32_FastConnect::fc_connected) {
+    debug_print("Fast reconnect took ms: ");
+    debug_println(millis() - start);
+    return true;
+  }
+
+  debug_println("Fast reconnect failed");
+  WiFi.disconnect();
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  return false;
+}
+
+/*
+ * Store access point and lease of the current connection in the cache.
+ * A static configuration is not cached since it is part of the config.
+ */
+void remember_connection(H32_FastConnect &fast) {
+  bool dhcp = strlen(h32_config.static_conf.ip_address) == 0;
+  fast.remember(WiFi.SSID().c_str(), WiFi.BSSID(), WiFi.channel(),
+                dhcp ? (uint32_t)WiFi.localIP() : 0,
+                dhcp ? (uint32_t)WiFi.gatewayIP() : 0,
+                dhcp ? (uint32_t)WiFi.subnetMask() : 0,
+                dhcp ? (uint32_t)WiFi.dnsIP() : 0,
+                RTC_get_epoch());
+}
+
+
 /*
  * Create the name of the device, the string "H32-" followed by the device ID
  */
@@ -91,6 +189,7 @@ void create_AP_Name(char *ssid) {
  */
 bool start_Portal() {
     bool res;
+    add_parameters();
     wm.setEnableConfigPortal(true);
     wm.setConnectTimeout(0);
 
@@ -70,7 +70,7 @@ static bool i2c_write(uint8_t reg, uint8_t bytes, uint8_t *out)
   wret += Wire.write(out, bytes);
 
   if (Wire.endTransmission() != 0 ||
-      wret != (bytes+1))
+      wret != (size_t)bytes + 1)
   {
     return false;
   }
@@ -92,6 +92,7 @@ PCF85063A::bcd_encode(uint8_t dec)
 
 PCF85063A::PCF85063A()
 {
+  cached = false;
   Wire.begin();
 }
 
@@ -179,6 +180,27 @@ PCF85063A::clkout_freq_set(uint16_t freq)
   return this->ctrl_set(regs, true);
 }
 
+/* Encode the countdown timer value and mode registers */
+static bool countdown_encode(uint8_t *timer_reg,
+                             bool enable,
+                             PCF85063A::CountdownSrcClock source_clock,
+                             uint8_t value,
+                             bool int_enable,
+                             bool int_pulse)
+{
+  if (source_clock < 0 || source_clock > 3)
+    return false;
+
+  timer_reg[1] = 0;
+  if (enable) timer_reg[1] |= PCF85063A_REG_TE;
+  if (int_enable) timer_reg[1] |= PCF85063A_REG_TIE;
+  if (int_pulse) timer_reg[1] |= PCF85063A_REG_TI_TP;
+  timer_reg[1] |= source_clock << 3;
+  timer_reg[0] = value;
+
+  return true;
+}
+
 bool
 PCF85063A::countdown_set(bool enable,
                          CountdownSrcClock source_clock,
@@ -196,11 +218,7 @@ PCF85063A::countdown_set(bool enable,
     return false;
 
   /* Reconfigure timer */
-  if (enable) timer_reg[1] |= PCF85063A_REG_TE;
-  if (int_enable) timer_reg[1] |= PCF85063A_REG_TIE;
-  if (int_pulse) timer_reg[1] |= PCF85063A_REG_TI_TP;
-  timer_reg[1] |= source_clock << 3;
-  timer_reg[0] = value;
+  countdown_encode(timer_reg, enable, source_clock, value, int_enable, int_pulse);
 
   return i2c_write(REG_COUNTDOWN_TIMER_VALUE_ADDR, 2, timer_reg);
 }
@@ -216,12 +234,11 @@ PCF85063A::alarm_set(tm *nt, bool enable_int) {
   return alarm_set(nt->tm_sec, nt->tm_min, nt->tm_hour, nt->tm_mday, nt->tm_wday, enable_int);
 }
 
+/* Encode the alarm registers, -1 disables the respective alarm */
 bool
-PCF85063A::alarm_set(int second, int minute, int hour, int day,
-                     int weekday, bool enable_int)
+PCF85063A::alarm_encode(uint8_t *buf, int second, int minute, int hour,
+                        int day, int weekday)
 {
-  uint8_t buf[5];
-
   if ((second < 0 || second > 59) && second != -1) return false;
   if ((minute < 0 || minute > 59) && minute != -1) return false;
   if ((hour < 0 || hour > 23) && hour != -1) return false;
@@ -234,6 +251,18 @@ PCF85063A::alarm_set(int second, int minute, int hour, int day,
   buf[3] = day < 0 ? 0x80 : bcd_encode(day);
   buf[4] = weekday < 0 ? 0x80 : bcd_encode(weekday);
 
+  return true;
+}
+
+bool
+PCF85063A::alarm_set(int second, int minute, int hour, int day,
+                     int weekday, bool enable_int)
+{
+  uint8_t buf[5];
+
+  if (!alarm_encode(buf, second, minute, hour, day, weekday))
+    return false;
+
   if(enable_int) {
     PCF85063A_Regs regs = 0;
     ctrl_get(&regs);
@@ -263,7 +292,6 @@ bool
 PCF85063A::ctrl_set(PCF85063A_Regs regs, bool mask_alarms)
 {
   uint8_t buf[2];
-  int wrsz;
 
   if (mask_alarms)
     regs &= ~(PCF85063A_REG_AF | PCF85063A_REG_TF);
@@ -291,3 +319,105 @@ PCF85063A::ram_set(uint8_t ram)
 {
   return i2c_write(REG_RAM_ADDR, sizeof(ram), &ram);
 }
+
+bool
+PCF85063A::cache_load()
+{
+  cached = i2c_read(REG_CTRL1_ADDR, sizeof(cache), cache);
+  return cached;
+}
+
+bool
+PCF85063A::cache_commit()
+{
+  uint8_t buf[PCF85063A_REG_NUM - (REG_ALARM_ADDR - REG_TIME_DATE_ADDR)];
+  uint8_t tail = PCF85063A_REG_NUM - REG_ALARM_ADDR;
+
+  if (!cached)
+    return false;
+
+  /* Alarm and timer registers, then (after the wrap around)
+   * control, offset and RAM registers */
+  memcpy(buf, cache + REG_ALARM_ADDR, tail);
+  memcpy(buf + tail, cache, REG_TIME_DATE_ADDR);
+
+  return i2c_write(REG_ALARM_ADDR, sizeof(buf), buf);
+}
+
+bool
+PCF85063A::cache_valid()
+{
+  return cached;
+}
+
+bool
+PCF85063A::cache_time_get(tm *now)
+{
+  uint8_t *buf = cache + REG_TIME_DATE_ADDR;
+
+  now->tm_sec   = bcd_decode(buf[0] & ~0x80);
+  now->tm_min   = bcd_decode(buf[1] & ~0x80);
+  now->tm_hour  = bcd_decode(buf[2] & ~0xC0); /* 24h clock */
+  now->tm_mday  = bcd_decode(buf[3] & ~0xC0);
+  now->tm_wday  = bcd_decode(buf[4] & ~0xF8);
+  now->tm_mon   = bcd_decode(buf[5] & ~0xE0) - 1; // struct tm stores 0-11
+  now->tm_year  = bcd_decode(buf[6]) + 100;       // struct tm stores from 1900 onward, we assume 20xx
+
+  return cached && !(buf[0] & 0x80);
+}
+
+PCF85063A_Regs
+PCF85063A::cache_ctrl_get()
+{
+  return cache[REG_CTRL1_ADDR] | ((uint16_t)cache[REG_CTRL2_ADDR]) << 8;
+}
+
+void
+PCF85063A::cache_ctrl_set(PCF85063A_Regs regs, bool mask_alarms)
+{
+  if (mask_alarms)
+    regs &= ~(PCF85063A_REG_AF | PCF85063A_REG_TF);
+
+  cache[REG_CTRL1_ADDR] = regs & 0xFF;
+  cache[REG_CTRL2_ADDR] = regs >> 8;
+}
+
+uint8_t
+PCF85063A::cache_ram_get()
+{
+  return cache[REG_RAM_ADDR];
+}
+
+void
+PCF85063A::cache_ram_set(uint8_t ram)
+{
+  cache[REG_RAM_ADDR] = ram;
+}
+
+bool
+PCF85063A::cache_alarm_set(tm *nt, bool enable_int)
+{
+  if (!alarm_encode(cache + REG_ALARM_ADDR, nt->tm_sec, nt->tm_min,
+                    nt->tm_hour, nt->tm_mday, nt->tm_wday))
+    return false;
+
+  if (enable_int)
+  {
+    PCF85063A_Regs regs = cache_ctrl_get();
+    PCF85063A_REG_SET(regs, PCF85063A_REG_AIE);
+    cache_ctrl_set(regs, true);
+  }
+
+  return true;
+}
+
+bool
+PCF85063A::cache_countdown_set(bool enable,
+                               CountdownSrcClock source_clock,
+                               uint8_t value,
+                               bool int_enable,
+                               bool int_pulse)
+{
+  return countdown_encode(cache + REG_COUNTDOWN_TIMER_VALUE_ADDR, enable,
+                          source_clock, value, int_enable, int_pulse);
+}
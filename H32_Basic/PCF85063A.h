@@ -61,6 +61,10 @@ typedef uint16_t PCF85063A_Regs;
 #define PCF85063A_REG_SET(regs, reg) do { (regs) |= (reg); } while(0)
 #define PCF85063A_REG_CLEAR(regs, reg) do { (regs) &= ~(reg); } while(0)
 
+/* Number of registers from control register 1 (00h) to the
+ * timer mode register (11h) */
+#define PCF85063A_REG_NUM               18
+
 class PCF85063A
 {
   private:
@@ -82,6 +86,18 @@ class PCF85063A
      */
     uint8_t bcd_encode(uint8_t dec);
 
+    /**
+     * Encode the alarm registers
+     *
+     * @return  True if the given parameters were valid
+     */
+    bool alarm_encode(uint8_t *buf, int second, int minute, int hour,
+                      int day, int weekday);
+
+    /* Shadow copy of all registers, see cache_load() */
+    uint8_t cache[PCF85063A_REG_NUM];
+    bool cached;
+
   public:
     enum CountdownSrcClock { CNTDOWN_CLOCK_4096HZ   = 0,
                              CNTDOWN_CLOCK_64HZ     = 1,
@@ -263,6 +279,58 @@ class PCF85063A
      */
     bool ram_set(uint8_t ram);
 
+    /*
+     * The following functions work on a shadow copy of the registers.
+     * All registers are read with a single auto-incrementing read
+     * and all changes are written back with a single write, instead
+     * of one transaction (or two) per function call.
+     */
+
+    /**
+     * Read all registers (control, offset, RAM, time, alarm and
+     * timer) into the cache.
+     *
+     * @return  True if the registers were read successfully
+     */
+    bool cache_load();
+
+    /**
+     * Write the cached control, offset, RAM, alarm and timer
+     * registers. The write starts at the alarm registers and wraps
+     * around from the timer mode register (11h) to control register 1
+     * (00h). The time registers are thus never written, since that
+     * would set the clock to the time of cache_load().
+     *
+     * @return  True if the registers were written successfully
+     */
+    bool cache_commit();
+
+    /**
+     * @return  True if the cache has been loaded
+     */
+    bool cache_valid();
+
+    /**
+     * Get the time at cache_load().
+     *
+     * @param   now     Cached time is written here
+     *
+     * @return  True if clock source integrity was
+     *          guaranteed
+     */
+    bool cache_time_get(tm *now);
+
+    /**
+     * Same as ctrl_get(), ctrl_set(), ram_get(), ram_set(),
+     * alarm_set() and countdown_set(), but on the cache.
+     */
+    PCF85063A_Regs cache_ctrl_get();
+    void cache_ctrl_set(PCF85063A_Regs regs, bool mask_alarms);
+    uint8_t cache_ram_get();
+    void cache_ram_set(uint8_t ram);
+    bool cache_alarm_set(tm *nt, bool enable_int);
+    bool cache_countdown_set(bool enable, CountdownSrcClock source_clock,
+                             uint8_t value, bool int_enable, bool int_pulse);
 };
 
 #endif
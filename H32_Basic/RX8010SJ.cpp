@@ -24,16 +24,22 @@
 
 #include "RX8010SJ.h"
 
-#define REG_CTRL1_ADDR                   0x00
-#define REG_CTRL2_ADDR                   0x01
-#define REG_OFFSET_ADDR                  0x02
-#define REG_RAM_ADDR                     0x03
-#define REG_TIME_DATE_ADDR               0x04
-#define REG_ALARM_ADDR                   0x0B
-#define REG_COUNTDOWN_TIMER_VALUE_ADDR   0x10
-#define REG_COUNTDOWN_TIMER_MODE_ADDR    0x11
-
-#define I2C_ADDR                         0x51
+#define REG_TIME_DATE_ADDR               0x10
+#define REG_RESERVED_17_ADDR             0x17
+#define REG_ALARM_ADDR                   0x18
+#define REG_TIMER_ADDR                   0x1B
+#define REG_EXT_ADDR                     0x1D
+#define REG_FLAG_ADDR                    0x1E
+#define REG_CTRL_ADDR                    0x1F
+#define REG_RAM_ADDR                     0x20
+#define REG_RESERVED_30_ADDR             0x30
+#define REG_RESERVED_31_ADDR             0x31
+#define REG_IRQ_ADDR                     0x32
+
+#define I2C_ADDR                         0x32
+
+/* The index of a register in the cache */
+#define CACHE(reg)                       ((reg) - REG_TIME_DATE_ADDR)
 
 static bool i2c_read(uint8_t reg, uint8_t bytes, uint8_t *in)
 {
@@ -92,202 +98,217 @@ RX8010SJ::bcd_encode(uint8_t dec)
 
 RX8010SJ::RX8010SJ()
 {
+  cached = false;
+  timer_restart = false;
   Wire.begin();
 }
 
+bool
+RX8010SJ::reset()
+{
+  uint8_t value;
+
+  value = 0xD8;
+  if (!i2c_write(REG_RESERVED_17_ADDR, 1, &value))
+    return false;
+
+  value = 0x00;
+  if (!i2c_write(REG_RESERVED_30_ADDR, 1, &value))
+    return false;
+
+  value = 0x08;
+  if (!i2c_write(REG_RESERVED_31_ADDR, 1, &value))
+    return false;
+
+  value = 0x00;
+  return i2c_write(REG_IRQ_ADDR, 1, &value);
+}
+
 bool
 RX8010SJ::time_get(tm *now)
 {
   uint8_t buf[7];
+  uint8_t flags;
 
-  if (!i2c_read(REG_TIME_DATE_ADDR, sizeof(buf), buf))
+  if (!i2c_read(REG_TIME_DATE_ADDR, sizeof(buf), buf) ||
+      !i2c_read(REG_FLAG_ADDR, 1, &flags))
     return false;
 
-  now->tm_sec   = bcd_decode(buf[0] & ~0x80);
-  now->tm_min   = bcd_decode(buf[1] & ~0x80);
-  now->tm_hour  = bcd_decode(buf[2] & ~0xC0); /* 24h clock */
-  now->tm_mday  = bcd_decode(buf[3] & ~0xC0);
-  now->tm_wday  = bcd_decode(buf[4] & ~0xF8);
-  now->tm_mon   = bcd_decode(buf[5] & ~0xE0) - 1; // struct tm stores 0-11
+  now->tm_sec   = bcd_decode(buf[0] & 0x7F);
+  now->tm_min   = bcd_decode(buf[1] & 0x7F);
+  now->tm_hour  = bcd_decode(buf[2] & 0x3F);
+  now->tm_wday  = __builtin_ctz(buf[3] | 0x80) & 0x07;
+  now->tm_mday  = bcd_decode(buf[4] & 0x3F);
+  now->tm_mon   = bcd_decode(buf[5] & 0x1F) - 1; // struct tm stores 0-11
   now->tm_year  = bcd_decode(buf[6]) + 100;       // struct tm stores from 1900 onward, we assume 20xx
 
-  return !(buf[0] & 0x80);
+  return !(flags & RX8010SJ_REG_VLF);
 }
 
 bool
 RX8010SJ::time_set(tm *new_time)
 {
   uint8_t buf[7];
+  uint8_t ctrl;
+  uint8_t flags;
+
+  if (!i2c_read(REG_CTRL_ADDR, 1, &ctrl))
+    return false;
+
+  /* Stop the clock while the time is written */
+  ctrl |= RX8010SJ_REG_STOP;
+  if (!i2c_write(REG_CTRL_ADDR, 1, &ctrl))
+    return false;
 
   buf[0] = bcd_encode(new_time->tm_sec);
   buf[1] = bcd_encode(new_time->tm_min);
   buf[2] = bcd_encode(new_time->tm_hour);
-  buf[3] = bcd_encode(new_time->tm_mday);
-  buf[4] = bcd_encode(new_time->tm_wday);
+  buf[3] = 1 << (new_time->tm_wday % 7);
+  buf[4] = bcd_encode(new_time->tm_mday);
   buf[5] = bcd_encode(new_time->tm_mon + 1);      // the chips stores from 1-12
   buf[6] = bcd_encode(new_time->tm_year - 100);   // the chip only stores the last two digits, we assume 20xx
 
-  return i2c_write(REG_TIME_DATE_ADDR, sizeof(buf), buf);
+  if (!i2c_write(REG_TIME_DATE_ADDR, sizeof(buf), buf))
+    return false;
+
+  /* Clear VLF, the time is valid from now on */
+  if (!i2c_read(REG_FLAG_ADDR, 1, &flags))
+    return false;
+  flags &= ~RX8010SJ_REG_VLF;
+  if (!i2c_write(REG_FLAG_ADDR, 1, &flags))
+    return false;
+
+  ctrl &= ~RX8010SJ_REG_STOP;
+  return i2c_write(REG_CTRL_ADDR, 1, &ctrl);
 }
 
 bool
-RX8010SJ::reset()
+RX8010SJ::cache_load()
 {
-  uint8_t buf = 0x58;
-  return i2c_write(REG_CTRL1_ADDR, 1, &buf);
+  cached = i2c_read(REG_TIME_DATE_ADDR, sizeof(cache), cache);
+  timer_restart = false;
+  return cached;
 }
 
 bool
-RX8010SJ::stop(bool stopped)
+RX8010SJ::cache_commit()
 {
-  PCF85063A_Regs regs;
-
-  if (!this->ctrl_get(&regs))
+  if (!cached)
     return false;
 
-  if (stopped) PCF85063A_REG_SET(regs, PCF85063A_REG_STOP);
-  else         PCF85063A_REG_CLEAR(regs, PCF85063A_REG_STOP);
+  /* The counter is only reloaded on a rising edge of TE */
+  if (timer_restart && (cache[CACHE(REG_EXT_ADDR)] & RX8010SJ_REG_TE))
+  {
+    uint8_t ext = cache[CACHE(REG_EXT_ADDR)] & ~RX8010SJ_REG_TE;
+    if (!i2c_write(REG_EXT_ADDR, 1, &ext))
+      return false;
+    timer_restart = false;
+  }
 
-  return this->ctrl_set(regs, true);
+  /* Alarm, timer, extension, flag, control and the user RAM */
+  return i2c_write(REG_ALARM_ADDR, REG_RESERVED_30_ADDR - REG_ALARM_ADDR,
+                   cache + CACHE(REG_ALARM_ADDR));
 }
 
 bool
-RX8010SJ::clkout_freq_set(uint16_t freq)
+RX8010SJ::cache_valid()
 {
-  uint8_t COF;
-  PCF85063A_Regs regs;
-
-  switch (freq)
-  {
-    case 0:     COF = 7; break;
-    case 1:     COF = 6; break;
-    case 1024:  COF = 5; break;
-    case 2048:  COF = 4; break;
-    case 4096:  COF = 3; break;
-    case 8192:  COF = 2; break;
-    case 16384: COF = 1; break;
-    case 32768: COF = 0; break;
-    default: return false;
-  }
-
-  if (!this->ctrl_get(&regs))
-    return false;
-
-  PCF85063A_REG_CLEAR(regs, PCF85063A_REG_COF);
-  regs |= ((uint16_t)COF) << 8;
-
-  return this->ctrl_set(regs, true);
+  return cached;
 }
 
 bool
-RX8010SJ::countdown_set(bool enable,
-                         CountdownSrcClock source_clock,
-                         uint8_t value,
-                         bool int_enable,
-                         bool int_pulse)
+RX8010SJ::cache_time_get(tm *now)
 {
-  uint8_t timer_reg[2] = {0};
-
-  if (source_clock < 0 || source_clock > 3)
-    return false;
+  uint8_t *buf = cache + CACHE(REG_TIME_DATE_ADDR);
+
+  now->tm_sec   = bcd_decode(buf[0] & 0x7F);
+  now->tm_min   = bcd_decode(buf[1] & 0x7F);
+  now->tm_hour  = bcd_decode(buf[2] & 0x3F);
+  now->tm_wday  = __builtin_ctz(buf[3] | 0x80) & 0x07;
+  now->tm_mday  = bcd_decode(buf[4] & 0x3F);
+  now->tm_mon   = bcd_decode(buf[5] & 0x1F) - 1; // struct tm stores 0-11
+  now->tm_year  = bcd_decode(buf[6]) + 100;       // struct tm stores from 1900 onward, we assume 20xx
 
-  /* First disable the countdown timer */
-  if (!i2c_write(REG_COUNTDOWN_TIMER_MODE_ADDR, 1, timer_reg+1))
-    return false;
+  return cached && !(cache[CACHE(REG_FLAG_ADDR)] & RX8010SJ_REG_VLF);
+}
 
-  /* Reconfigure timer */
-  if (enable) timer_reg[1] |= PCF85063A_REG_TE;
-  if (int_enable) timer_reg[1] |= PCF85063A_REG_TIE;
-  if (int_pulse) timer_reg[1] |= PCF85063A_REG_TI_TP;
-  timer_reg[1] |= source_clock << 3;
-  timer_reg[0] = value;
+uint8_t
+RX8010SJ::cache_flags_get()
+{
+  return cache[CACHE(REG_FLAG_ADDR)];
+}
 
-  return i2c_write(REG_COUNTDOWN_TIMER_VALUE_ADDR, 2, timer_reg);
+void
+RX8010SJ::cache_flags_clear(uint8_t flags)
+{
+  cache[CACHE(REG_FLAG_ADDR)] &= ~flags;
 }
 
-bool
-RX8010SJ::countdown_get(uint8_t *value)
+uint8_t
+RX8010SJ::cache_ctrl_get()
 {
-  return i2c_read(REG_COUNTDOWN_TIMER_VALUE_ADDR, 1, value);
+  return cache[CACHE(REG_CTRL_ADDR)];
 }
 
-bool
-RX8010SJ::alarm_set(tm *nt, bool enable_int) {
-  return alarm_set(nt->tm_sec, nt->tm_min, nt->tm_hour, nt->tm_mday, nt->tm_wday, enable_int);
+void
+RX8010SJ::cache_ctrl_set(uint8_t ctrl)
+{
+  cache[CACHE(REG_CTRL_ADDR)] = ctrl;
 }
 
 bool
-RX8010SJ::alarm_set(int second, int minute, int hour, int day,
-                     int weekday, bool enable_int)
+RX8010SJ::cache_alarm_set(int minute, int hour, int day, bool enable_int)
 {
-  uint8_t buf[5];
+  uint8_t *buf = cache + CACHE(REG_ALARM_ADDR);
 
-  if ((second < 0 || second > 59) && second != -1) return false;
   if ((minute < 0 || minute > 59) && minute != -1) return false;
   if ((hour < 0 || hour > 23) && hour != -1) return false;
-  if ((day < 0 || day > 31) && day != -1) return false;
-  if ((weekday < 0 || weekday > 6) && weekday != -1) return false;
-
-  buf[0] = second < 0 ? 0x80 : bcd_encode(second);
-  buf[1] = minute < 0 ? 0x80 : bcd_encode(minute);
-  buf[2] = hour < 0 ? 0x80 : bcd_encode(hour);
-  buf[3] = day < 0 ? 0x80 : bcd_encode(day);
-  buf[4] = weekday < 0 ? 0x80 : bcd_encode(weekday);
-
-  if(enable_int) {
-    PCF85063A_Regs regs = 0;
-    ctrl_get(&regs);
-  
-    PCF85063A_REG_SET(regs, PCF85063A_REG_AIE);
-    ctrl_set(regs, true);    
-  }
-  
-  return i2c_write(REG_ALARM_ADDR, sizeof(buf), buf);
-}
-
-bool
-RX8010SJ::ctrl_get(PCF85063A_Regs *regs)
-{
-  uint8_t buf[2];
+  if ((day < 1 || day > 31) && day != -1) return false;
 
-  if (!i2c_read(REG_CTRL1_ADDR, sizeof(buf), buf))
-    return false;
+  buf[0] = minute < 0 ? RX8010SJ_REG_AE : bcd_encode(minute);
+  buf[1] = hour < 0 ? RX8010SJ_REG_AE : bcd_encode(hour);
+  buf[2] = day < 0 ? RX8010SJ_REG_AE : bcd_encode(day);
 
-  *regs = buf[0];
-  *regs |= ((uint16_t)buf[1]) << 8;
+  /* day of the month instead of the weekday */
+  cache[CACHE(REG_EXT_ADDR)] |= RX8010SJ_REG_WADA;
+  cache[CACHE(REG_FLAG_ADDR)] &= ~RX8010SJ_REG_AF;
+  if (enable_int) cache[CACHE(REG_CTRL_ADDR)] |= RX8010SJ_REG_AIE;
+  else            cache[CACHE(REG_CTRL_ADDR)] &= ~RX8010SJ_REG_AIE;
 
   return true;
 }
 
 bool
-RX8010SJ::ctrl_set(PCF85063A_Regs regs, bool mask_alarms)
+RX8010SJ::cache_countdown_set(CountdownSrcClock source_clock,
+                              uint16_t value, bool int_enable)
 {
-  uint8_t buf[2];
-  int wrsz;
+  uint8_t *ext = cache + CACHE(REG_EXT_ADDR);
 
-  if (mask_alarms)
-    regs &= ~(PCF85063A_REG_AF | PCF85063A_REG_TF);
+  if (source_clock < 0 || source_clock > 4)
+    return false;
 
-  buf[0] = regs & 0xFF;
-  buf[1] = regs >> 8;
+  cache[CACHE(REG_TIMER_ADDR)] = value & 0xFF;
+  cache[CACHE(REG_TIMER_ADDR) + 1] = value >> 8;
 
-  return i2c_write(REG_CTRL1_ADDR, sizeof(buf), buf);
-}
+  *ext = (*ext & ~(RX8010SJ_REG_TSEL | RX8010SJ_REG_TE)) | source_clock;
+  if (value != 0) *ext |= RX8010SJ_REG_TE;
 
-int16_t
-RX8010SJ::ram_get()
-{
-  uint8_t ram = 0;
+  cache[CACHE(REG_FLAG_ADDR)] &= ~RX8010SJ_REG_TF;
+  if (int_enable && value != 0) cache[CACHE(REG_CTRL_ADDR)] |= RX8010SJ_REG_TIE;
+  else                          cache[CACHE(REG_CTRL_ADDR)] &= ~RX8010SJ_REG_TIE;
 
-  if(!i2c_read(REG_RAM_ADDR, sizeof(ram), &ram)) {
-    return -1;
-  }
+  timer_restart = true;
+  return true;
+}
 
-  return ram;
+uint8_t
+RX8010SJ::cache_ram_get(uint8_t index)
+{
+  return cache[CACHE(REG_RAM_ADDR) + index % RX8010SJ_RAM_SIZE];
 }
 
-bool
-RX8010SJ::ram_set(uint8_t ram)
+void
+RX8010SJ::cache_ram_set(uint8_t index, uint8_t value)
 {
-  return i2c_write(REG_RAM_ADDR, sizeof(ram), &ram);
+  cache[CACHE(REG_RAM_ADDR) + index % RX8010SJ_RAM_SIZE] = value;
 }
@@ -26,37 +26,34 @@
 #include <time.h>
 #include <Wire.h>
 
-/* See https://www.nxp.com/docs/en/data-sheet/PCF85063A.pdf for a
- * description of the registers */
-
-/* Type for holding PCF85063A control registers 1 and 2 */
-typedef uint16_t PCF85063A_Regs;
-
-/* Control register 1 */
-#define PCF85063A_REG_EXT_TEST          (uint16_t)0x0080
-#define PCF85063A_REG_STOP              (uint16_t)0x0020
-#define PCF85063A_REG_SR                (uint16_t)0x0010
-#define PCF85063A_REG_CIE               (uint16_t)0x0004
-#define PCF85063A_REG_12_24             (uint16_t)0x0002
-#define PCF85063A_REG_CAP_SEL           (uint16_t)0x0001
-
-/* Control register 2 */
-#define PCF85063A_REG_AIE               (uint16_t)0x8000
-#define PCF85063A_REG_AF                (uint16_t)0x4000
-#define PCF85063A_REG_MI                (uint16_t)0x2000
-#define PCF85063A_REG_HMI               (uint16_t)0x1000
-#define PCF85063A_REG_TF                (uint16_t)0x0800
-#define PCF85063A_REG_COF               (uint16_t)0x0700
-
-/* Timer mode register - not part of PCF85063A_Regs */
-#define PCF85063A_REG_TCF               (uint16_t)0x08
-#define PCF85063A_REG_TE                (uint16_t)0x04
-#define PCF85063A_REG_TIE               (uint16_t)0x02
-#define PCF85063A_REG_TI_TP             (uint16_t)0x01
-
-#define PCF85063A_REG_GET(regs, reg) (!!((regs) & (reg)))
-#define PCF85063A_REG_SET(regs, reg) do { (regs) |= (reg); } while(0)
-#define PCF85063A_REG_CLEAR(regs, reg) do { (regs) &= ~(reg); } while(0)
+/* See the Epson RX8010SJ application manual for a description
+ * of the registers. All registers from the time (10h) to the end
+ * of the user RAM (2Fh) are kept in a cache, which is read and
+ * written with a single transaction, in the same way as in the
+ * PCF85063A driver. */
+
+/* Extension register (1Dh) */
+#define RX8010SJ_REG_TSEL               (uint8_t)0x07
+#define RX8010SJ_REG_WADA               (uint8_t)0x08
+#define RX8010SJ_REG_TE                 (uint8_t)0x10
+
+/* Flag register (1Eh) */
+#define RX8010SJ_REG_VLF                (uint8_t)0x02
+#define RX8010SJ_REG_AF                 (uint8_t)0x08
+#define RX8010SJ_REG_TF                 (uint8_t)0x10
+#define RX8010SJ_REG_UF                 (uint8_t)0x20
+
+/* Control register (1Fh) */
+#define RX8010SJ_REG_AIE                (uint8_t)0x08
+#define RX8010SJ_REG_TIE                (uint8_t)0x10
+#define RX8010SJ_REG_UIE                (uint8_t)0x20
+#define RX8010SJ_REG_STOP               (uint8_t)0x40
+
+/* Alarm registers, a set AE bit ignores the field */
+#define RX8010SJ_REG_AE                 (uint8_t)0x80
+
+#define RX8010SJ_RAM_SIZE               16
+#define RX8010SJ_CACHE_SIZE             (0x30 - 0x10)
 
 class RX8010SJ
 {
@@ -79,26 +76,42 @@ class RX8010SJ
      */
     uint8_t bcd_encode(uint8_t dec);
 
+    /* Shadow copy of the registers 10h to 2Fh, see cache_load() */
+    uint8_t cache[RX8010SJ_CACHE_SIZE];
+    bool cached;
+    bool timer_restart;
+
   public:
     enum CountdownSrcClock { CNTDOWN_CLOCK_4096HZ   = 0,
                              CNTDOWN_CLOCK_64HZ     = 1,
                              CNTDOWN_CLOCK_1HZ      = 2,
-                             CNTDOWN_CLOCK_1PER60HZ = 3 };
+                             CNTDOWN_CLOCK_1PER60HZ = 3,
+                             CNTDOWN_CLOCK_1PER3600HZ = 4 };
 
     RX8010SJ();
 
+    /**
+     * Initialize the reserved registers as required by the
+     * application manual. This is needed after a loss of
+     * power, i.e., if the VLF flag is set.
+     *
+     * @return  True if the registers were written successfully
+     */
+    bool reset();
+
     /**
      * Get current time of the RTC.
      *
      * @param   now     Current time is written here
      *
      * @return  True if clock source integrity was
-     *          guaranteed
+     *          guaranteed (VLF not set)
      */
     bool time_get(tm *now);
 
     /**
-     * Set current time of the RTC.
+     * Set current time of the RTC. The clock is stopped while
+     * the time is written and the VLF flag is cleared.
      *
      * @param   new_time      New time to set
      *
@@ -107,159 +120,76 @@ class RX8010SJ
     bool time_set(tm *new_time);
 
     /**
-     * Reset the RTC.
-     * NXP recommends doing this after powering on.
+     * Read all registers (time, alarm, timer, extension, flag,
+     * control and user RAM) into the cache.
      *
-     * @return  True if clock was reset successfully
+     * @return  True if the registers were read successfully
      */
-    bool reset();
+    bool cache_load();
 
     /**
-     * Stop/resume the RTC.
+     * Write the cached alarm, timer, extension, flag, control and
+     * user RAM registers. The time registers are never written.
+     * If the timer has been reconfigured, it is stopped first,
+     * since the counter must only be written with TE cleared.
      *
-     * @param  stopped  Whether the clock should be stopped
-     *                  or running
-     *
-     * @return  True if stop state was set successfully
+     * @return  True if the registers were written successfully
      */
-    bool stop(bool stopped);
+    bool cache_commit();
 
     /**
-     * Set the output frequency of the CLKOUT pin or disable
-     * it.
-     *
-     * Valid frequencies (in Hz) are: 0 (drive CLKOUT to
-     * high-Z), 1, 10, 1024, 2048, 4096, 8192, 16384, 32768.
-     *
-     * @param   freq    CLKOUT square wave frequency
-     *
-     * @return  True if the given frequency was valid
+     * @return  True if the cache has been loaded
      */
-    bool clkout_freq_set(uint16_t freq);
+    bool cache_valid();
 
     /**
-     * Configure the countdown timer.
-     * When the timer expires, the control register will
-     * be modified and an interrupt is generated, if enabled.
-     *
-     * The countdown period becomes: value / f, where f is
-     * the frequency selected by the source_clock parameter.
-     *
-     * Setting value to 0 stops the timer.
+     * Get the time at cache_load().
      *
-     * Calling this function will reset the countdown timer,
-     * so the next interrupt after the call will occur after
-     * the configured period (1/f).
-     *
-     * @param   enable        Enable (or disable) countdown timer
-     * @param   source_clock  Source clock selection
-     * @param   value         Countdown timer value
-     * @param   int_enable    Enable interrupts when timer expires
-     * @param   int_pulse     Interrupt generates a pulse. Otherwise,
-     *                        the interrupt line follows TF flag in control
-     *                        register 2
-     *
-     * @return  True if setting up countdown timer succeeded
+     * @return  True if clock source integrity was
+     *          guaranteed
      */
-    bool countdown_set(bool enable, CountdownSrcClock source_clock,
-                       uint8_t value, bool int_enable, bool int_pulse);
+    bool cache_time_get(tm *now);
 
     /**
-     * Get the current countdown timer value.
-     *
-     * @param   value  Countdown timer value out (see countdown_set()
-     *                 comments for interpreting this)
-     *
-     * @return  True if value was read successfully
+     * The flag register (VLF, AF, TF, UF) at cache_load(). Flags are
+     * cleared with cache_flags_clear().
      */
-    bool countdown_get(uint8_t *value);
+    uint8_t cache_flags_get();
+    void cache_flags_clear(uint8_t flags);
 
     /**
-     * Configure alarm.
-     *
-     * When the alarm triggers, the control register will be
-     * modified and an interrupt is generated, if enabled.
-     *
-     * The alarm triggers when all enabled (not -1) variables
-     * match the current time.
-     *
-     * @param   second    Second (0-59) on which the alarm should
-     *                    trigger. Set to -1 to ignore seconds.
-     *
-     * @param   minute    Minute (0-59) on which the alarm should
-     *                    trigger. Set to -1 to ignore minutes.
-     *
-     * @param   hour      Hour (0-23) on which the alarm should
-     *                    trigger. Set to -1 to ignore hours.
-     *
-     * @param   day       Day (0-31) on which the alarm should
-     *                    trigger. Set to -1 to ignore days.
-     *
-     * @param   weekday   Weekday (0-6) on which the alarm should
-     *                    trigger. Set to -1 to ignore weekdays.
-     *
-     * @param   int_pulse Interrupt generates a signal on the INT pin.
-     *                    The interrupt line follows AF flag in control
-     *                    register 2
-     *
-     * @return  True if the given parameters were valid
+     * Get and set the control register (AIE, TIE, UIE, STOP).
      */
-    bool alarm_set(int second, int minute, int hour, int day, int weekday, bool enable_int);
+    uint8_t cache_ctrl_get();
+    void cache_ctrl_set(uint8_t ctrl);
 
     /**
-     * Configure alarm.
-     *
-     * When the alarm triggers, the control register will be
-     * modified and an interrupt is generated, if enabled.
-     *
-     * The alarm triggers when all enabled (not -1) variables
-     * match the current time.
-     *
-     * @param   new_time      New alarm time to set
+     * Configure the alarm. The RX8010SJ has no alarm for seconds,
+     * the alarm triggers when minute, hour and day of the month match.
      *
-     * @param   int_pulse Interrupt generates a signal on the INT pin.
-     *                    The interrupt line follows AF flag in control
-     *                    register 2
+     * @param   minute    Minute (0-59), -1 ignores minutes
+     * @param   hour      Hour (0-23), -1 ignores hours
+     * @param   day       Day (1-31), -1 ignores days
+     * @param   enable_int  Enable the interrupt
      *
      * @return  True if the given parameters were valid
      */
-    bool alarm_set(tm *nt, bool enable_int);
+    bool cache_alarm_set(int minute, int hour, int day, bool enable_int);
 
     /**
-     * Read control registers.
+     * Configure the countdown timer. The period is value / f with the
+     * frequency selected by source_clock. A value of 0 stops the timer.
      *
-     * @param   regs    Buffer for reading registers
-     *
-     * @return  True if registers were read successfully
-     */
-    bool ctrl_get(PCF85063A_Regs *regs);
-
-    /**
-     * Write control registers.
-     *
-     * @param   regs        Register buffer
-     * @param   mask_alarms Set AF/TF bits high. Their state will not be
-     *                      affected as a result, so you can handle pending
-     *                      alarms later
-     *
-     * @return  True if registers were written successfully
+     * @return  True if the parameters were valid
      */
-    bool ctrl_set(PCF85063A_Regs regs, bool mask_alarms);
+    bool cache_countdown_set(CountdownSrcClock source_clock,
+                             uint16_t value, bool int_enable);
 
     /**
-     * Read RAM register.
-     *
-     * @return  Ram contents if read successfully, -1 otherwise
-     */
-    int16_t ram_get();
-
-    /**
-     * Write RAM register.
-     *
-     * @return  True if registers were written successfully
+     * Get and set a byte of the user RAM.
      */
-    bool ram_set(uint8_t ram);
-
+    uint8_t cache_ram_get(uint8_t index);
+    void cache_ram_set(uint8_t index, uint8_t value);
 };
 
 #endif
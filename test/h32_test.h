@@ -0,0 +1,25 @@
+#ifndef H32_TEST_H
+#define H32_TEST_H
+
+#include "Arduino.h"
+
+/*
+ * Every test is a program of its own, run by ctest. A failed check is
+ * printed and the program fails at the end, the other checks still run.
+ */
+
+static int h32_test_failures = 0;
+
+#define H32_CHECK(condition) do { \
+    if(!(condition)) { \
+      h32_test_failures++; \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+    } \
+  } while (0)
+
+inline int h32_test_end() {
+  printf(h32_test_failures == 0 ? "passed\n" : "%d checks failed\n", h32_test_failures);
+  return h32_test_failures == 0 ? 0 : 1;
+}
+
+#endif // H32_TEST_H
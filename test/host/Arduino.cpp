@@ -0,0 +1,20 @@
+#include <vector>
+
+#include "Arduino.h"
+
+uint64_t host_time_us = 0;
+
+size_t Print::printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  if(length <= 0) {
+    return 0;
+  }
+  std::vector<char> text(length + 1);
+  va_start(args, format);
+  vsnprintf(text.data(), text.size(), format, args);
+  va_end(args);
+  return write((const uint8_t *)text.data(), length);
+}
@@ -0,0 +1,40 @@
+#ifndef H32_HOST_ARDUINO_H
+#define H32_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+/*
+ * The parts of the Arduino core used by the hardware-free modules of the
+ * sketch, for the host tests. The time is virtual: it only advances with
+ * delay(), so every run takes the same (simulated) time.
+ */
+
+extern uint64_t host_time_us;
+
+inline uint32_t micros() { return (uint32_t)host_time_us; }
+inline uint32_t millis() { return (uint32_t)(host_time_us / 1000); }
+inline void delay(uint32_t ms) { host_time_us += ms * 1000ULL; }
+
+/*
+ * The output of the json writer and of the clients (see Client.h)
+ */
+class Print {
+public:
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  virtual size_t write(uint8_t byte) { return write(&byte, 1); };
+  /*
+   * Like the one of the ESP32 core, the formatted text is passed to a
+   * single write()
+   */
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+#define debug_print(...)
+#define debug_println(...)
+
+#endif // H32_HOST_ARDUINO_H
@@ -0,0 +1,80 @@
+#ifndef H32_HOST_CLIENT_H
+#define H32_HOST_CLIENT_H
+
+#include <string>
+
+#include "Arduino.h"
+
+/*
+ * Stream and Client of the Arduino core, for the stand-ins of the network
+ * in the host tests. Reading with a timeout works on the virtual clock:
+ * if no byte is available, the whole timeout passes.
+ */
+class Stream : public Print {
+protected:
+  uint32_t timeout = 1000;
+
+  int timedRead() {
+    int c = read();
+    if(c < 0) {
+      delay(timeout);
+    }
+    return c;
+  };
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {};
+
+  void setTimeout(uint32_t timeout) { this->timeout = timeout; };
+  size_t readBytes(uint8_t *buffer, size_t length) {
+    size_t count = 0;
+    while(count < length) {
+      int c = timedRead();
+      if(c < 0) {
+        break;
+      }
+      buffer[count++] = c;
+    }
+    return count;
+  };
+  size_t readBytesUntil(char terminator, char *buffer, size_t length) {
+    size_t count = 0;
+    while(count < length) {
+      int c = timedRead();
+      if(c < 0 || c == terminator) {
+        break;
+      }
+      buffer[count++] = c;
+    }
+    return count;
+  };
+};
+
+class IPAddress {
+private:
+  uint8_t bytes[4];
+public:
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {};
+  std::string toString() const {
+    return std::to_string(bytes[0]) + "." + std::to_string(bytes[1]) + "."
+         + std::to_string(bytes[2]) + "." + std::to_string(bytes[3]);
+  };
+};
+
+class Client : public Stream {
+public:
+  using Print::write;
+  /*
+   * The stand-ins are connected by host name
+   */
+  virtual int connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); };
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual int read(uint8_t *buffer, size_t size) = 0;
+  using Stream::read;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+};
+
+#endif // H32_HOST_CLIENT_H
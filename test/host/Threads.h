@@ -0,0 +1,69 @@
+#ifndef HOST_THREADS_H
+#define HOST_THREADS_H
+
+/*
+ * H32_Executor and H32_Event with std::thread, as a replacement of the
+ * FreeRTOS ones of H32_Acquisition.ino. Like a binary semaphore the event
+ * is consumed by waiting for it, like a task the thread is detached.
+ */
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "H32_Executor.h"
+
+class Thread_Event : public H32_Event {
+private:
+  std::mutex mutex;
+  std::condition_variable signal;
+  bool is_set = false;
+public:
+  void set() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_set = true;
+    signal.notify_all();
+  };
+  void wait() override {
+    std::unique_lock<std::mutex> lock(mutex);
+    signal.wait(lock, [this] { return is_set; });
+    is_set = false;
+  };
+  bool waitFor(uint32_t milliseconds) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!signal.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return is_set; })) {
+      return false;
+    }
+    is_set = false;
+    return true;
+  };
+};
+
+/*
+ * Runs every function in a thread of its own. An executor that is not
+ * available fails like xTaskCreate() without memory.
+ */
+class Thread_Executor : public H32_Executor {
+public:
+  bool available = true;
+  uint32_t started = 0;
+
+  bool run(void (*function)(void *), void *arg) override {
+    if(!available) {
+      return false;
+    }
+    started++;
+    std::thread(function, arg).detach();
+    return true;
+  };
+};
+
+/*
+ * Milliseconds of the real clock, for code that runs in threads
+ */
+inline uint32_t thread_clock() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif // HOST_THREADS_H
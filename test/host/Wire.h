@@ -0,0 +1,140 @@
+#ifndef H32_HOST_WIRE_H
+#define H32_HOST_WIRE_H
+
+#include "Arduino.h"
+
+/*
+ * Another device on the fake bus, see TwoWire::attach(). It gets the bytes
+ * of a write and fills the bytes of a read, both return the number of
+ * bytes acknowledged.
+ */
+class Host_I2C_Device {
+public:
+  virtual uint8_t receive(const uint8_t *data, uint8_t length) = 0;
+  virtual uint8_t transmit(uint8_t *data, uint8_t length) = 0;
+};
+
+/*
+ * A fake I2C bus with an AHT10/AHT20 behind it, on the level of its
+ * commands and status byte. A measurement takes conversion_ms of the
+ * virtual time, reading it earlier returns the busy status. The result
+ * carries the CRC of the AHT2x, the next "corrupt" results a wrong one.
+ * A device attached to another address takes its place for that address.
+ * Every write (endTransmission) and read (requestFrom) is counted as a
+ * transaction.
+ */
+class TwoWire {
+private:
+  Host_I2C_Device *device = NULL;
+  uint8_t device_address = 0;
+  uint8_t address = 0;
+  uint8_t sent[32];
+  uint8_t sent_num = 0;
+  uint8_t received[32];
+  uint8_t received_num = 0;
+  uint8_t received_pos = 0;
+  bool measuring = false;
+  uint32_t measure_start = 0;
+
+  static uint8_t crc8(const uint8_t *data, uint8_t length) {
+    uint8_t crc = 0xFF;
+    for(uint8_t i = 0; i < length; i++) {
+      crc ^= data[i];
+      for(uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+      }
+    }
+    return crc;
+  };
+public:
+  bool present = true;
+  bool calibrated = false;
+  uint8_t corrupt = 0;
+  uint32_t conversion_ms = 80;
+  uint32_t raw_humidity = 0x80000;      // 50 %rH
+  uint32_t raw_temperature = 0x66666;   // 30 °C
+  uint16_t triggers = 0;
+  uint32_t transactions = 0;
+
+  void attach(uint8_t address, Host_I2C_Device *device) {
+    device_address = address;
+    this->device = device;
+  };
+  void begin() {};
+  void beginTransmission(uint8_t address) {
+    this->address = address;
+    sent_num = 0;
+  };
+  size_t write(uint8_t data) {
+    if(sent_num >= sizeof(sent)) {
+      return 0;
+    }
+    sent[sent_num++] = data;
+    return 1;
+  };
+  size_t write(const uint8_t *data, size_t length) {
+    size_t num = 0;
+    while(num < length && write(data[num]) == 1) {
+      num++;
+    }
+    return num;
+  };
+  uint8_t endTransmission() {
+    transactions++;
+    if(device != NULL && address == device_address) {
+      return device->receive(sent, sent_num) == sent_num ? 0 : 3;
+    }
+    if(!present) {
+      return 2;   // NACK of the address
+    }
+    if(sent_num > 0 && (sent[0] == 0xBE || sent[0] == 0xE1)) {
+      calibrated = true;
+    }
+    if(sent_num > 0 && sent[0] == 0xAC) {
+      measuring = true;
+      measure_start = millis();
+      triggers++;
+    }
+    return 0;
+  };
+  uint8_t requestFrom(uint8_t address, uint8_t length) {
+    transactions++;
+    received_num = 0;
+    received_pos = 0;
+    if(device != NULL && address == device_address) {
+      received_num = device->transmit(received, length < sizeof(received) ? length : sizeof(received));
+      return received_num;
+    }
+    if(!present) {
+      return 0;
+    }
+    bool busy = measuring && millis() - measure_start < conversion_ms;
+    uint8_t data[7] = {
+      (uint8_t)((busy ? 0x80 : 0) | (calibrated ? 0x08 : 0)),
+      (uint8_t)(raw_humidity >> 12),
+      (uint8_t)(raw_humidity >> 4),
+      (uint8_t)((raw_humidity & 0x0F) << 4 | raw_temperature >> 16),
+      (uint8_t)(raw_temperature >> 8),
+      (uint8_t)raw_temperature,
+      0,
+    };
+    data[6] = crc8(data, 6);
+    if(!busy && length == 7 && corrupt > 0) {
+      corrupt--;
+      data[6] ^= 1;
+    }
+    received_num = length < sizeof(data) ? length : sizeof(data);
+    memcpy(received, data, received_num);
+    return received_num;
+  };
+  int available() {
+    return received_num - received_pos;
+  };
+  int read() {
+    return received_pos < received_num ? received[received_pos++] : -1;
+  };
+};
+
+extern TwoWire Wire;
+
+#endif // H32_HOST_WIRE_H
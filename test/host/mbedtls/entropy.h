@@ -0,0 +1,20 @@
+#ifndef H32_HOST_MBEDTLS_ENTROPY_H
+#define H32_HOST_MBEDTLS_ENTROPY_H
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * No entropy is needed by the stand-in of ssl.h
+ */
+typedef struct mbedtls_entropy_context {
+  int unused;
+} mbedtls_entropy_context;
+
+inline void mbedtls_entropy_init(mbedtls_entropy_context *ctx) {}
+inline int mbedtls_entropy_func(void *data, unsigned char *output, size_t len) {
+  memset(output, 0, len);
+  return 0;
+}
+
+#endif // H32_HOST_MBEDTLS_ENTROPY_H
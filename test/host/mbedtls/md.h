@@ -0,0 +1,32 @@
+#ifndef H32_HOST_MBEDTLS_MD_H
+#define H32_HOST_MBEDTLS_MD_H
+
+#include <stddef.h>
+#include <openssl/sha.h>
+
+/*
+ * SHA-256 by OpenSSL, for the fingerprint of the certificate
+ */
+typedef enum {
+  MBEDTLS_MD_NONE = 0,
+  MBEDTLS_MD_SHA256 = 6,
+} mbedtls_md_type_t;
+
+typedef struct mbedtls_md_info_t {
+  mbedtls_md_type_t type;
+} mbedtls_md_info_t;
+
+inline const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type) {
+  static const mbedtls_md_info_t sha256 = {MBEDTLS_MD_SHA256};
+  return type == MBEDTLS_MD_SHA256 ? &sha256 : NULL;
+}
+
+inline int mbedtls_md(const mbedtls_md_info_t *info, const unsigned char *input, size_t ilen, unsigned char *output) {
+  if(info == NULL) {
+    return -0x5100;
+  }
+  SHA256(input, ilen, output);
+  return 0;
+}
+
+#endif // H32_HOST_MBEDTLS_MD_H
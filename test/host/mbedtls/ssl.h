@@ -0,0 +1,381 @@
+#ifndef H32_HOST_MBEDTLS_SSL_H
+#define H32_HOST_MBEDTLS_SSL_H
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A stand-in for the parts of mbedTLS used by H32_TLS.h, for the host
+ * tests. It is not TLS and has no cryptography: the records have the
+ * framing of TLS, and the handshakes have the flights and about the sizes
+ * of TLS 1.2 with ECDHE-RSA, a chain of two certificates and session
+ * tickets. A full handshake takes two round trips, a resumed one a single
+ * one. The certificate of the server is opaque bytes.
+ *
+ * The server side is up to the test, with the framing below.
+ */
+
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+#define MBEDTLS_ERR_SSL_WANT_READ -0x6900
+#define MBEDTLS_ERR_SSL_WANT_WRITE -0x6880
+#define MBEDTLS_ERR_SSL_CONN_EOF -0x7280
+#define MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY -0x7880
+#define MBEDTLS_ERR_SSL_BAD_INPUT_DATA -0x7100
+#define MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL -0x6A00
+#define MBEDTLS_ERR_SSL_UNEXPECTED_MESSAGE -0x7700
+
+#define MBEDTLS_SSL_IS_CLIENT 0
+#define MBEDTLS_SSL_TRANSPORT_STREAM 0
+#define MBEDTLS_SSL_PRESET_DEFAULT 0
+#define MBEDTLS_SSL_VERIFY_NONE 0
+#define MBEDTLS_SSL_SESSION_TICKETS_ENABLED 1
+
+/*
+ * The framing, shared with the server of the test
+ */
+enum Stand_In_Record : uint8_t {
+  record_change_cipher = 20,
+  record_alert = 21,
+  record_handshake = 22,
+  record_application = 23,
+};
+
+enum Stand_In_Message : uint8_t {
+  message_client_hello = 1,
+  message_server_hello = 2,
+  message_session_ticket = 4,
+  message_certificate = 11,
+  message_key_exchange = 12,
+  message_hello_done = 14,
+  message_client_key_exchange = 16,
+  message_finished = 20,
+};
+
+const size_t stand_in_header = 5;
+const size_t stand_in_client_hello = 180;     // without the ticket
+const size_t stand_in_server_hello = 90;
+const size_t stand_in_intermediate = 1100;    // sent along with the certificate
+const size_t stand_in_key_exchange = 330;
+const size_t stand_in_client_key_exchange = 70;
+const size_t stand_in_finished = 40;
+const size_t stand_in_overhead = 24;          // nonce and tag of an encrypted record
+
+inline void stand_in_record(std::string &out, uint8_t type, const std::string &payload) {
+  out += (char)type;
+  out += "\x03\x03";
+  out += (char)(payload.size() >> 8);
+  out += (char)(payload.size() & 0xFF);
+  out += payload;
+}
+
+/*
+ * A handshake message: its type followed by its body, padded to its size
+ */
+inline std::string stand_in_message(uint8_t type, const std::string &body, size_t size) {
+  std::string message(1, (char)type);
+  message += body;
+  if(message.size() < size) {
+    message.append(size - message.size(), '\0');
+  }
+  return message;
+}
+
+/*
+ * Take the next complete record from the received bytes
+ */
+inline bool stand_in_next(std::string &in, uint8_t &type, std::string &payload) {
+  if(in.size() < stand_in_header) {
+    return false;
+  }
+  size_t length = ((uint8_t)in[3] << 8) | (uint8_t)in[4];
+  if(in.size() < stand_in_header + length) {
+    return false;
+  }
+  type = in[0];
+  payload = in.substr(stand_in_header, length);
+  in.erase(0, stand_in_header + length);
+  return true;
+}
+
+/*
+ * A length-prefixed field of a message body
+ */
+inline std::string stand_in_field(const std::string &value) {
+  return std::string(1, (char)(value.size() >> 8)) + (char)(value.size() & 0xFF) + value;
+}
+
+inline std::string stand_in_field_at(const std::string &body, size_t &position) {
+  if(position + 2 > body.size()) {
+    return "";
+  }
+  size_t length = ((uint8_t)body[position] << 8) | (uint8_t)body[position + 1];
+  std::string value = body.substr(position + 2, length);
+  position += 2 + length;
+  return value;
+}
+
+typedef struct mbedtls_x509_buf {
+  const unsigned char *p;
+  size_t len;
+} mbedtls_x509_buf;
+
+typedef struct mbedtls_x509_crt {
+  mbedtls_x509_buf raw;
+  std::string data;
+
+  mbedtls_x509_crt() : raw{NULL, 0} {};
+  mbedtls_x509_crt(const mbedtls_x509_crt &other) { *this = other; };
+  mbedtls_x509_crt &operator=(const mbedtls_x509_crt &other) {
+    data = other.data;
+    raw = {(const unsigned char *)data.data(), data.size()};
+    return *this;
+  };
+} mbedtls_x509_crt;
+
+typedef struct mbedtls_ssl_session {
+  std::string ticket;
+  mbedtls_x509_crt peer;
+} mbedtls_ssl_session;
+
+typedef struct mbedtls_ssl_config {
+  int tickets;
+} mbedtls_ssl_config;
+
+typedef int mbedtls_ssl_send_t(void *bio, const unsigned char *data, size_t length);
+typedef int mbedtls_ssl_recv_t(void *bio, unsigned char *data, size_t length);
+typedef int mbedtls_ssl_recv_timeout_t(void *bio, unsigned char *data, size_t length, uint32_t timeout);
+
+enum Stand_In_State : uint8_t {
+  state_hello = 0,      // the ClientHello is to be sent
+  state_server_hello,   // waiting for the first flight of the server
+  state_server_finished,  // waiting for the Finished of the server
+  state_client_finished,  // the Finished is to be sent
+  state_established,
+};
+
+typedef struct mbedtls_ssl_context {
+  const mbedtls_ssl_config *conf = NULL;
+  void *bio = NULL;
+  mbedtls_ssl_send_t *send = NULL;
+  mbedtls_ssl_recv_t *receive = NULL;
+  std::string hostname;
+  mbedtls_ssl_session session;
+  Stand_In_State state = state_hello;
+  std::string out;      // not sent yet
+  std::string in;       // not a complete record yet
+  std::string plain;    // application data not read yet
+} mbedtls_ssl_context;
+
+inline void mbedtls_ssl_config_init(mbedtls_ssl_config *conf) { *conf = mbedtls_ssl_config(); }
+inline int mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset) {
+  return 0;
+}
+inline void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode) {}
+inline void mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng) {}
+inline void mbedtls_ssl_conf_session_tickets(mbedtls_ssl_config *conf, int use_tickets) { conf->tickets = use_tickets; }
+
+inline void mbedtls_ssl_init(mbedtls_ssl_context *ssl) { *ssl = mbedtls_ssl_context(); }
+inline void mbedtls_ssl_free(mbedtls_ssl_context *ssl) { *ssl = mbedtls_ssl_context(); }
+inline int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf) {
+  ssl->conf = conf;
+  return 0;
+}
+inline int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname) {
+  ssl->hostname = hostname;
+  return 0;
+}
+inline void mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *bio, mbedtls_ssl_send_t *send,
+                                mbedtls_ssl_recv_t *receive, mbedtls_ssl_recv_timeout_t *receive_timeout) {
+  ssl->bio = bio;
+  ssl->send = send;
+  ssl->receive = receive;
+}
+
+inline void mbedtls_ssl_session_init(mbedtls_ssl_session *session) { *session = mbedtls_ssl_session(); }
+inline void mbedtls_ssl_session_free(mbedtls_ssl_session *session) { *session = mbedtls_ssl_session(); }
+inline int mbedtls_ssl_session_save(const mbedtls_ssl_session *session, unsigned char *buf, size_t buf_len, size_t *olen) {
+  std::string data = stand_in_field(session->ticket) + stand_in_field(session->peer.data);
+  *olen = data.size();
+  if(data.size() > buf_len) {
+    return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+  }
+  memcpy(buf, data.data(), data.size());
+  return 0;
+}
+inline int mbedtls_ssl_session_load(mbedtls_ssl_session *session, const unsigned char *buf, size_t len) {
+  std::string data((const char *)buf, len);
+  size_t position = 0;
+  session->ticket = stand_in_field_at(data, position);
+  mbedtls_x509_crt peer;
+  peer.data = stand_in_field_at(data, position);
+  session->peer = peer;
+  return position == len && !session->ticket.empty() ? 0 : MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+}
+inline int mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session) {
+  ssl->session = *session;
+  return 0;
+}
+inline int mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session) {
+  if(ssl->state != state_established) {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  *session = ssl->session;
+  return 0;
+}
+inline const mbedtls_x509_crt *mbedtls_ssl_get_peer_cert(const mbedtls_ssl_context *ssl) {
+  return ssl->session.peer.data.empty() ? NULL : &ssl->session.peer;
+}
+
+/*
+ * Send what is pending
+ */
+inline int stand_in_flush(mbedtls_ssl_context *ssl) {
+  while(!ssl->out.empty()) {
+    int sent = ssl->send(ssl->bio, (const unsigned char *)ssl->out.data(), ssl->out.size());
+    if(sent < 0) {
+      return sent;
+    }
+    if(sent == 0) {
+      return MBEDTLS_ERR_SSL_CONN_EOF;
+    }
+    ssl->out.erase(0, sent);
+  }
+  return 0;
+}
+
+/*
+ * Receive what has arrived and take the next complete record
+ * @return 0 with a record, else WANT_READ or an error
+ */
+inline int stand_in_receive(mbedtls_ssl_context *ssl, uint8_t &type, std::string &payload) {
+  while(!stand_in_next(ssl->in, type, payload)) {
+    unsigned char buffer[512];
+    int received = ssl->receive(ssl->bio, buffer, sizeof(buffer));
+    if(received < 0) {
+      return received;
+    }
+    if(received == 0) {
+      return MBEDTLS_ERR_SSL_CONN_EOF;
+    }
+    ssl->in.append((const char *)buffer, received);
+  }
+  return 0;
+}
+
+inline int mbedtls_ssl_handshake(mbedtls_ssl_context *ssl) {
+  for(;;) {
+    int result = stand_in_flush(ssl);
+    if(result != 0) {
+      return result;
+    }
+    if(ssl->state == state_hello) {
+      // the stored ticket, if any, is offered
+      std::string ticket = ssl->conf->tickets ? ssl->session.ticket : "";
+      std::string body = stand_in_field(ssl->hostname) + stand_in_field(ticket);
+      stand_in_record(ssl->out, record_handshake,
+                      stand_in_message(message_client_hello, body, stand_in_client_hello + ticket.size()));
+      ssl->state = state_server_hello;
+      continue;
+    }
+    if(ssl->state == state_client_finished) {
+      ssl->state = state_established;
+      continue;
+    }
+    if(ssl->state == state_established) {
+      return 0;
+    }
+    uint8_t type;
+    std::string payload;
+    result = stand_in_receive(ssl, type, payload);
+    if(result != 0) {
+      return result;
+    }
+    if(type == record_change_cipher) {
+      continue;
+    }
+    if(type != record_handshake || payload.empty()) {
+      return MBEDTLS_ERR_SSL_UNEXPECTED_MESSAGE;
+    }
+    size_t position = 1;
+    switch((uint8_t)payload[0]) {
+      case message_server_hello:
+        // a new session unless the offered one is resumed
+        if(payload.size() < 2 || payload[1] == 0) {
+          ssl->session = mbedtls_ssl_session();
+        }
+        break;
+      case message_certificate: {
+        mbedtls_x509_crt peer;
+        peer.data = stand_in_field_at(payload, position);
+        ssl->session.peer = peer;
+        break;
+      }
+      case message_session_ticket:
+        ssl->session.ticket = stand_in_field_at(payload, position);
+        break;
+      case message_hello_done:
+        // full handshake: the key exchange and the Finished of the client
+        stand_in_record(ssl->out, record_handshake,
+                        stand_in_message(message_client_key_exchange, "", stand_in_client_key_exchange));
+        stand_in_record(ssl->out, record_change_cipher, std::string(1, '\1'));
+        stand_in_record(ssl->out, record_handshake, stand_in_message(message_finished, "", stand_in_finished));
+        ssl->state = state_server_finished;
+        break;
+      case message_finished:
+        if(ssl->state == state_server_hello) {
+          // resumed: the Finished of the client follows
+          stand_in_record(ssl->out, record_change_cipher, std::string(1, '\1'));
+          stand_in_record(ssl->out, record_handshake, stand_in_message(message_finished, "", stand_in_finished));
+        }
+        ssl->state = state_client_finished;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+inline size_t mbedtls_ssl_get_bytes_avail(const mbedtls_ssl_context *ssl) { return ssl->plain.size(); }
+
+inline int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len) {
+  while(ssl->plain.empty()) {
+    uint8_t type;
+    std::string payload;
+    int result = stand_in_receive(ssl, type, payload);
+    if(result != 0) {
+      return result;
+    }
+    if(type == record_alert) {
+      return MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+    }
+    if(type == record_application && payload.size() >= stand_in_overhead) {
+      ssl->plain += payload.substr(stand_in_overhead);
+    }
+  }
+  size_t length = len < ssl->plain.size() ? len : ssl->plain.size();
+  if(length > 0) {
+    memcpy(buf, ssl->plain.data(), length);
+    ssl->plain.erase(0, length);
+  }
+  return length;
+}
+
+inline int mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len) {
+  if(ssl->state != state_established) {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  size_t length = len < 16384 ? len : 16384;
+  stand_in_record(ssl->out, record_application, std::string(stand_in_overhead, '\0') + std::string((const char *)buf, length));
+  int result = stand_in_flush(ssl);
+  return result == 0 ? (int)length : result;
+}
+
+inline int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl) {
+  stand_in_record(ssl->out, record_alert, std::string("\1\0", 2));
+  return stand_in_flush(ssl);
+}
+
+#endif // H32_HOST_MBEDTLS_SSL_H
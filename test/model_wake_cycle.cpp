@@ -0,0 +1,164 @@
+/*
+ * A model of the awake time and the charge of each phase of a wake cycle.
+ * This is not a measurement: none of the phase code of the sketch runs
+ * here. Every phase simply takes the duration assumed below, only the AHT
+ * conversion (the driver on the fake bus) and the decisions of the fast
+ * connection are the real code. The model shows how the choices of these
+ * two modules (a cached lease, oversampling) move the total of the charge
+ * estimate of H32_Profiler.h. The real numbers come from the profiler on a
+ * board (see the profile page of the portal), the assumptions below should
+ * be replaced by them. The first scenario is the baseline the others are
+ * compared with.
+ */
+#include "h32_test.h"
+
+const uint8_t SSID_LENGTH = 33;
+
+#include "H32_Profiler.h"
+#include "H32_FastConnect.h"
+#include "H32_AHT.h"
+
+// Assumed durations of the steps that need the ESP32
+const uint32_t sim_boot_ms = 120;
+const uint32_t sim_config_ms = 15;        // the config image from NVS
+const uint32_t sim_adc_ms = 10;           // one burst of all channels
+const uint32_t sim_scan_ms = 2200;        // scan, association and DHCP of the WiFiManager
+const uint32_t sim_associate_ms = 250;    // association with a known access point
+const uint32_t sim_dhcp_ms = 500;
+const uint32_t sim_upload_ms = 600;
+const uint32_t sim_alarm_ms = 5;
+
+const uint32_t sim_epoch = 1700000000;
+const uint8_t sim_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+typedef struct Scenario {
+  const char *name;
+  bool cached;          // a connection has been remembered
+  uint32_t lease_age;   // seconds
+  bool moved;           // the access point has moved to another channel
+  uint8_t samples;      // of the AHT
+} Scenario;
+
+const Scenario scenarios[] = {
+  {"full connect", false, 0, false, 1},
+  {"cached lease", true, 60, false, 1},
+  {"expired lease", true, 2 * fast_connect_lease, false, 1},
+  {"moved AP", true, 60, true, 1},
+  {"4 samples", true, 60, false, 4},
+};
+const uint8_t scenario_num = sizeof(scenarios) / sizeof(scenarios[0]);
+
+uint32_t sim_clock() {
+  return micros();
+}
+
+/*
+ * The WiFi phase of init_WiFiManager(): the fast connection if there is a
+ * cached one, otherwise (or if it misses) the full one
+ */
+void simulate_wifi(const Scenario &scenario) {
+  H32_WiFi_Cache cache;
+  if(scenario.cached) {
+    H32_FastConnect previous(cache);
+    previous.begin("h32");
+    previous.fullResult(true);
+    previous.remember("h32", sim_bssid, 6, 0x0A00A8C0, 0x0100A8C0, 0x00FFFFFF, 0x0100A8C0,
+                      sim_epoch - scenario.lease_age);
+  }
+
+  H32_FastConnect fast(cache);
+  if(fast.begin("h32") == H32_FastConnect::fc_fast) {
+    uint32_t connect_ms = sim_associate_ms + (fast.useLease(sim_epoch) ? 0 : sim_dhcp_ms);
+    uint32_t start = millis();
+    while(fast.poll(!scenario.moved && millis() - start >= connect_ms,
+                    millis() - start) == H32_FastConnect::fc_fast) {
+      delay(10);
+    }
+  }
+  if(fast.getState() == H32_FastConnect::fc_full) {
+    delay(sim_scan_ms);
+    fast.fullResult(true);
+  }
+}
+
+H32_Profile simulate(const Scenario &scenario) {
+  host_time_us = 0;
+  H32_Profiler profiler(sim_clock);
+  delay(sim_boot_ms);
+
+  profiler.enter(phase_config);
+  delay(sim_config_ms);
+
+  profiler.enter(phase_sensor);
+  delay(sim_adc_ms);
+  Wire.calibrated = true;
+  H32_AHT aht(H32_AHT2X_ADDR, H32_AHT::AHT2X);
+  H32_CHECK(aht.begin() && aht.start(scenario.samples) && aht.wait());
+
+  profiler.enter(phase_wifi);
+  simulate_wifi(scenario);
+
+  profiler.enter(phase_upload);
+  delay(sim_upload_ms);
+
+  profiler.enter(phase_alarm);
+  delay(sim_alarm_ms);
+
+  profiler.enter(phase_other);
+  return profiler.finish();
+}
+
+double profile_mAh(const H32_Profile &profile) {
+  double mAh = 0;
+  for(int i = 0; i < phase_num; i++) {
+    mAh += phase_mAh((H32_Phase)i, profile.phase_us[i] / 1000);
+  }
+  return mAh;
+}
+
+int main() {
+  H32_Profile profiles[scenario_num];
+  for(uint8_t s = 0; s < scenario_num; s++) {
+    profiles[s] = simulate(scenarios[s]);
+  }
+
+  printf("%-8s", "ms");
+  for(uint8_t s = 0; s < scenario_num; s++) {
+    printf(" %14s", scenarios[s].name);
+  }
+  printf("\n");
+  for(int i = 0; i < phase_num; i++) {
+    printf("%-8s", phase_names[i]);
+    for(uint8_t s = 0; s < scenario_num; s++) {
+      printf(" %14u", profiles[s].phase_us[i] / 1000);
+    }
+    printf("\n");
+  }
+  printf("%-8s", "Total");
+  for(uint8_t s = 0; s < scenario_num; s++) {
+    printf(" %14u", profiles[s].total_us() / 1000);
+  }
+  printf("\n%-8s", "mAh");
+  for(uint8_t s = 0; s < scenario_num; s++) {
+    printf(" %14.5f", profile_mAh(profiles[s]));
+  }
+  printf("\n%-8s", "vs base");
+  for(uint8_t s = 0; s < scenario_num; s++) {
+    printf(" %13.0f%%", 100.0 * profile_mAh(profiles[s]) / profile_mAh(profiles[0]));
+  }
+  printf("\n");
+
+  const H32_Profile &full = profiles[0], &cached = profiles[1], &expired = profiles[2];
+  const H32_Profile &moved = profiles[3], &oversampled = profiles[4];
+  // a single combined conversion of the AHT
+  H32_CHECK(full.phase_us[phase_sensor] / 1000 >= sim_adc_ms + 80);
+  H32_CHECK(full.phase_us[phase_sensor] / 1000 <= sim_adc_ms + 85);
+  H32_CHECK(oversampled.phase_us[phase_sensor] / 1000 <= sim_adc_ms + 4 * 85);
+  // the fast connection skips the scan, and DHCP while the lease is fresh
+  H32_CHECK(cached.phase_us[phase_wifi] / 1000 <= sim_associate_ms + 10);
+  H32_CHECK(expired.phase_us[phase_wifi] / 1000 <= sim_associate_ms + sim_dhcp_ms + 10);
+  H32_CHECK(profile_mAh(cached) < profile_mAh(expired) && profile_mAh(expired) < profile_mAh(full));
+  // a miss costs the timeout of the fast connection at most
+  H32_CHECK(moved.phase_us[phase_wifi] / 1000 <= sim_scan_ms + fast_connect_timeout_ms + 10);
+  return h32_test_end();
+}
@@ -0,0 +1,99 @@
+/*
+ * The acquisition (H32_Executor.h) with the std::thread executor of
+ * Threads.h and parts that stand in for the ADC and the I2C devices by
+ * their duration. start() returns only after the ADC has been read, the
+ * I2C devices are read while the caller connects to WiFi, and join() waits
+ * for them. The wall time is compared with reading everything first.
+ */
+#include <atomic>
+#include <thread>
+
+#include "h32_test.h"
+#include "Threads.h"
+#include "H32_Executor.h"
+
+typedef struct Parts {
+  uint32_t adc_ms;
+  uint32_t i2c_ms;
+  std::atomic<uint32_t> adc_end{0};
+  std::atomic<uint32_t> i2c_end{0};
+  std::atomic<uint32_t> runs{0};
+  std::thread::id adc_thread;
+  std::thread::id i2c_thread;
+} Parts;
+
+void read_adc(void *arg) {
+  Parts *parts = (Parts *)arg;
+  parts->adc_thread = std::this_thread::get_id();
+  std::this_thread::sleep_for(std::chrono::milliseconds(parts->adc_ms));
+  parts->adc_end = thread_clock();
+}
+
+void read_i2c(void *arg) {
+  Parts *parts = (Parts *)arg;
+  parts->i2c_thread = std::this_thread::get_id();
+  std::this_thread::sleep_for(std::chrono::milliseconds(parts->i2c_ms));
+  parts->i2c_end = thread_clock();
+  parts->runs++;
+}
+
+/*
+ * A wake cycle: acquire, connect to WiFi meanwhile, join
+ * @return its wall time in milliseconds
+ */
+uint32_t wake(H32_Acquisition &acquisition, Parts &parts, uint32_t wifi_ms, bool &concurrent, uint32_t &radio_on) {
+  uint32_t start = thread_clock();
+  concurrent = acquisition.start(&parts);
+  radio_on = thread_clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(wifi_ms));
+  acquisition.join();
+  return thread_clock() - start;
+}
+
+int main() {
+  const uint32_t adc_ms = 20, i2c_ms = 120, wifi_ms = 250;
+  Thread_Executor executor;
+  Thread_Event adc_done, done;
+  H32_Acquisition acquisition(executor, adc_done, done, read_adc, read_i2c);
+
+  // The radio is turned on after the ADC has been read, the I2C devices
+  // are read in the task, and join() waits for them
+  Parts parts;
+  parts.adc_ms = adc_ms;
+  parts.i2c_ms = i2c_ms;
+  bool concurrent;
+  uint32_t radio_on;
+  uint32_t overlapped = wake(acquisition, parts, wifi_ms, concurrent, radio_on);
+  H32_CHECK(concurrent && executor.started == 1 && parts.runs == 1);
+  H32_CHECK(parts.adc_end != 0 && parts.adc_end <= radio_on);
+  H32_CHECK(parts.i2c_end > radio_on);
+  H32_CHECK(parts.adc_thread != std::this_thread::get_id() && parts.i2c_thread == parts.adc_thread);
+
+  // join() waits for a task that takes longer than the connection
+  parts.i2c_ms = wifi_ms + 100;
+  uint32_t start = thread_clock();
+  acquisition.start(&parts);
+  acquisition.join();
+  H32_CHECK(parts.runs == 2 && parts.i2c_end >= start + wifi_ms + 100);
+  // a second join() does not wait for anything
+  start = thread_clock();
+  acquisition.join();
+  H32_CHECK(thread_clock() - start < 10);
+
+  // Without a task both parts are read by start(), join() returns at once
+  Thread_Executor unavailable;
+  unavailable.available = false;
+  H32_Acquisition sequential(unavailable, adc_done, done, read_adc, read_i2c);
+  parts.i2c_ms = i2c_ms;
+  uint32_t one_after_the_other = wake(sequential, parts, wifi_ms, concurrent, radio_on);
+  H32_CHECK(!concurrent && parts.runs == 3);
+  H32_CHECK(parts.adc_thread == std::this_thread::get_id() && parts.i2c_end <= radio_on);
+
+  // Wall time: the I2C devices are hidden behind the WiFi connection
+  printf("ADC %u ms, I2C %u ms, WiFi %u ms: %u ms with the task, %u ms one after the other\n",
+         adc_ms, i2c_ms, wifi_ms, overlapped, one_after_the_other);
+  H32_CHECK(overlapped >= adc_ms + wifi_ms && overlapped < adc_ms + wifi_ms + i2c_ms / 2);
+  H32_CHECK(one_after_the_other >= adc_ms + i2c_ms + wifi_ms);
+
+  return h32_test_end();
+}
@@ -0,0 +1,189 @@
+/*
+ * The filters and the fixed point calibration of the ADC engine (H32_ADC.h)
+ * on noise traces like the ones of a board, and the engine with a fake
+ * source of interleaved samples
+ */
+#include <chrono>
+
+#include "h32_test.h"
+#include "H32_ADC.h"
+
+const uint16_t trace_count = 32;
+const uint32_t speed_rounds = 100000;
+
+/*
+ * A trace of the battery divider at 2000 mV: a few millivolts of noise and,
+ * while the radio transmits, spikes of the supply towards both ends
+ */
+const uint16_t trace_tx[trace_count] = {
+  2001, 1999, 2003, 1998, 2000, 2002, 1740, 2001,
+  1997, 2000, 2004, 1999, 2001, 2310, 2000, 1998,
+  2002, 2000, 1999, 2003, 1701, 2001, 2000, 1998,
+  2002, 1999, 2001, 2000, 2290, 1999, 2002, 2000,
+};
+const uint16_t trace_tx_level = 2000;
+
+/*
+ * The divider without activation pin settling after power-up: the first
+ * samples are low
+ */
+const uint16_t trace_settling[trace_count] = {
+  1210, 1480, 1630, 1702, 1735, 1749, 1753, 1756,
+  1755, 1757, 1756, 1754, 1756, 1757, 1755, 1756,
+  1754, 1756, 1757, 1755, 1756, 1756, 1754, 1757,
+  1755, 1756, 1756, 1755, 1757, 1756, 1754, 1756,
+};
+const uint16_t trace_settling_level = 1756;
+
+uint16_t filtered(H32_ADC_Filter filter, const uint16_t *trace, uint16_t count) {
+  uint16_t samples[adc_samples_max];
+  memcpy(samples, trace, count * sizeof(uint16_t));
+  return adc_filter(filter, samples, count);
+}
+
+uint16_t distance(uint16_t a, uint16_t b) {
+  return a > b ? a - b : b - a;
+}
+
+/*
+ * The calibration in double precision, in millivolts
+ */
+double reference(double c0, double c1, double c2, double c3, uint16_t millivolts) {
+  double x = millivolts / 1000.0;
+  return (c0 + c1 * x + c2 * x * x + c3 * x * x * x) * 1000;
+}
+
+/*
+ * Every channel reads its own level plus the pattern of the trace
+ */
+class Fake_Source : public H32_ADC_Source {
+public:
+  uint16_t level[adc_channel_max];
+  bool fail = false;
+  uint16_t last_count = 0;
+
+  bool sample(const int8_t *pins, uint8_t num, uint16_t *samples, uint16_t count) override {
+    last_count = count;
+    if(fail) {
+      return false;
+    }
+    for(uint16_t i = 0; i < count; i++) {
+      for(uint8_t c = 0; c < num; c++) {
+        samples[i * num + c] = level[c] + trace_tx[i % trace_count] - trace_tx_level;
+      }
+    }
+    return true;
+  };
+};
+
+int main() {
+  // The kernels on small sets
+  uint16_t odd[] = {5, 1, 4, 2, 3};
+  H32_CHECK(adc_median(odd, 5) == 3);
+  H32_CHECK(odd[0] == 1 && odd[4] == 5);
+  uint16_t even[] = {10, 40, 20, 31};
+  H32_CHECK(adc_median(even, 4) == 26);   // (20 + 31) / 2 rounded
+  uint16_t mean[] = {1, 2, 2};
+  H32_CHECK(adc_mean(mean, 3) == 2);
+  H32_CHECK(adc_mean(mean, 0) == 0 && adc_median(mean, 0) == 0);
+  uint16_t trimmed[] = {100, 7, 5, 6, 0, 8};
+  H32_CHECK(adc_trimmed_mean(trimmed, 6, 1) == 7);   // mean of 5, 6, 7, 8 rounded
+  uint16_t few[] = {9, 1, 5};
+  H32_CHECK(adc_trimmed_mean(few, 3, 2) == 5);        // too much trimmed: the median
+  uint16_t sorted[trace_count];
+  memcpy(sorted, trace_tx, sizeof(sorted));
+  adc_sort(sorted, trace_count);
+  for(uint16_t i = 1; i < trace_count; i++) {
+    H32_CHECK(sorted[i - 1] <= sorted[i]);
+  }
+
+  // The spikes of the radio: the mean is pulled away, median and trimmed
+  // mean stay within the noise
+  uint16_t tx_mean = filtered(adc_filter_mean, trace_tx, trace_count);
+  uint16_t tx_median = filtered(adc_filter_median, trace_tx, trace_count);
+  uint16_t tx_trimmed = filtered(adc_filter_trimmed_mean, trace_tx, trace_count);
+  H32_CHECK(distance(tx_median, trace_tx_level) <= 1);
+  H32_CHECK(distance(tx_trimmed, trace_tx_level) <= 1);
+  H32_CHECK(distance(tx_mean, trace_tx_level) > distance(tx_trimmed, trace_tx_level));
+
+  // The settling divider: the low samples are only dropped by the robust filters
+  uint16_t settling_mean = filtered(adc_filter_mean, trace_settling, trace_count);
+  uint16_t settling_median = filtered(adc_filter_median, trace_settling, trace_count);
+  uint16_t settling_trimmed = filtered(adc_filter_trimmed_mean, trace_settling, trace_count);
+  H32_CHECK(distance(settling_median, trace_settling_level) <= 1);
+  H32_CHECK(distance(settling_trimmed, trace_settling_level) <= 1);
+  H32_CHECK(distance(settling_mean, trace_settling_level) > 20);
+  printf("filter      tx spikes  settling\n");
+  printf("mean       %10u %9u\n", tx_mean, settling_mean);
+  printf("median     %10u %9u\n", tx_median, settling_median);
+  printf("trimmed    %10u %9u\n", tx_trimmed, settling_trimmed);
+
+  // The fixed point calibration against double precision over the whole
+  // range of the ADC
+  const double polys[][adc_poly_num] = {
+    {0, 1, 0, 0},
+    {0.12, 2.0, 0, 0},            // a divider of the battery
+    {-0.35, 11.0, 0, 0},          // a divider of the external supply
+    {0.05, 1.9, 0.021, -0.0035},  // fitted to a curve
+    {2.5, -1.2, 0.4, 0.09},
+  };
+  for(const double *c : polys) {
+    H32_ADC_Channel channel;
+    channel.setCalibration(c[0], c[1], c[2], c[3]);
+    double worst = 0;
+    for(uint32_t millivolts = 0; millivolts <= 3300; millivolts++) {
+      double error = fabs(channel.calibrate(millivolts) - reference(c[0], c[1], c[2], c[3], millivolts));
+      worst = error > worst ? error : worst;
+    }
+    H32_CHECK(worst <= 1.0);
+  }
+
+  // The engine separates the interleaved channels
+  H32_ADC_Engine engine;
+  Fake_Source source;
+  const uint16_t levels[] = {2000, 500, 1000, 1500, 2500, 3000};
+  memcpy(source.level, levels, sizeof(levels));
+  H32_CHECK(engine.add(35, -16, 0, 2.0) == 0);
+  H32_CHECK(engine.add(34, 0, 0, 11.0) == 1);
+  for(uint8_t c = 2; c < adc_channel_max; c++) {
+    H32_CHECK(engine.add(30 + c, 0, 0, 1.0) == c);
+  }
+  H32_CHECK(engine.add(39, 0, 0, 1.0) == -1);
+  H32_CHECK(engine.acquire(source, trace_count, adc_filter_trimmed_mean));
+  H32_CHECK(distance(engine.getMillivolts(0), 4000) <= 2);
+  H32_CHECK(distance(engine.getMillivolts(1), 5500) <= 11);
+  for(uint8_t c = 2; c < adc_channel_max; c++) {
+    H32_CHECK(distance(engine.getMillivolts(c), levels[c]) <= 1);
+  }
+  H32_CHECK(fabs(engine.getVolts(0) - 4.0) < 0.006);
+  H32_CHECK(engine.getMillivolts(-1) == 0);
+  // the count is limited to the buffer
+  H32_CHECK(engine.acquire(source, 0, adc_filter_median) && source.last_count == adc_samples_max);
+  H32_CHECK(engine.acquire(source, 1000, adc_filter_median) && source.last_count == adc_samples_max);
+  // a failed source keeps the last results
+  source.fail = true;
+  H32_CHECK(!engine.acquire(source, trace_count, adc_filter_median));
+  H32_CHECK(distance(engine.getMillivolts(0), 4000) <= 2);
+
+  // An index past the channels reads 0
+  source.fail = false;
+  H32_ADC_Engine single;
+  single.add(35, 0, 0, 1.0);
+  H32_CHECK(single.acquire(source, trace_count, adc_filter_median) && single.getMillivolts(1) == 0);
+
+  // Speed of the filters of a channel
+  uint32_t sink = 0;
+  printf("ns per %u samples:", trace_count);
+  const H32_ADC_Filter filters[] = {adc_filter_mean, adc_filter_median, adc_filter_trimmed_mean};
+  for(H32_ADC_Filter filter : filters) {
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t round = 0; round < speed_rounds; round++) {
+      sink += filtered(filter, round % 2 ? trace_tx : trace_settling, trace_count);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf(" %.0f", ns / speed_rounds);
+  }
+  printf(" (%u)\n", sink % 10);
+
+  return h32_test_end();
+}
@@ -0,0 +1,123 @@
+/*
+ * The state machine of the AHT driver (H32_AHT.h) against the fake sensor
+ * of host/Wire.h: calibration, polling, oversampling and the handling of
+ * CRC errors, a busy sensor and a missing one
+ */
+#include "h32_test.h"
+#include "H32_AHT.h"
+
+/*
+ * A sensor as after power-up
+ */
+void reset_sensor() {
+  Wire.present = true;
+  Wire.calibrated = false;
+  Wire.corrupt = 0;
+  Wire.conversion_ms = 80;
+  Wire.raw_humidity = 0x80000;
+  Wire.raw_temperature = 0x66666;
+  Wire.triggers = 0;
+}
+
+/*
+ * Poll every millisecond as the sketch does while it works on other things
+ * @return the time until the state is no longer AHT_CONVERTING
+ */
+uint32_t poll_until_done(H32_AHT &aht) {
+  uint32_t start = millis();
+  while(aht.poll() == H32_AHT::AHT_CONVERTING) {
+    delay(1);
+  }
+  return millis() - start;
+}
+
+int main() {
+  // begin() calibrates the sensor once, without waiting
+  reset_sensor();
+  H32_AHT aht(H32_AHT2X_ADDR, H32_AHT::AHT2X);
+  uint32_t start = millis();
+  H32_CHECK(aht.begin() && Wire.calibrated && millis() == start);
+  H32_CHECK(isnan(aht.temperature()) && isnan(aht.humidity()));
+
+  // A measurement converts for 80 ms, the driver does not read it earlier
+  H32_CHECK(aht.start(1));
+  H32_CHECK(aht.poll() == H32_AHT::AHT_CONVERTING);
+  delay(79);
+  H32_CHECK(aht.poll() == H32_AHT::AHT_CONVERTING);
+  delay(1);
+  H32_CHECK(aht.poll() == H32_AHT::AHT_READY);
+  H32_CHECK(fabsf(aht.temperature() - 30.0f) < 0.01f);
+  H32_CHECK(fabsf(aht.humidity() - 50.0f) < 0.01f);
+  H32_CHECK(aht.crc_errors() == 0 && Wire.triggers == 1);
+  // the result stays until the next start
+  H32_CHECK(aht.poll() == H32_AHT::AHT_READY);
+
+  // A slower sensor is read once it is no longer busy
+  Wire.conversion_ms = 95;
+  H32_CHECK(aht.start(1));
+  uint32_t elapsed = poll_until_done(aht);
+  H32_CHECK(aht.poll() == H32_AHT::AHT_READY && elapsed >= 95 && elapsed <= 96);
+  Wire.conversion_ms = 80;
+
+  // Oversampling: the mean of back-to-back conversions
+  Wire.triggers = 0;
+  H32_CHECK(aht.start(4));
+  elapsed = poll_until_done(aht);
+  H32_CHECK(aht.poll() == H32_AHT::AHT_READY && Wire.triggers == 4);
+  H32_CHECK(elapsed >= 4 * 80 && elapsed <= 4 * 81);
+  H32_CHECK(fabsf(aht.temperature() - 30.0f) < 0.01f);
+  // a changing value is averaged
+  Wire.raw_temperature = 0x40000;   // 0 °C
+  H32_CHECK(aht.start(2));
+  delay(80);
+  aht.poll();
+  Wire.raw_temperature = 0x4CCCD;   // 10 °C
+  H32_CHECK(aht.wait() && fabsf(aht.temperature() - 5.0f) < 0.01f);
+  Wire.raw_temperature = 0x66666;
+  // zero samples measure once
+  Wire.triggers = 0;
+  H32_CHECK(aht.start(0) && aht.wait() && Wire.triggers == 1);
+
+  // A result with a wrong CRC is measured again
+  Wire.triggers = 0;
+  Wire.corrupt = 1;
+  H32_CHECK(aht.start(1) && aht.wait());
+  H32_CHECK(aht.crc_errors() == 1 && Wire.triggers == 2);
+  H32_CHECK(fabsf(aht.humidity() - 50.0f) < 0.01f);
+
+  // Too many in a row are an error without a result
+  Wire.corrupt = 3;
+  H32_CHECK(aht.start(1) && !aht.wait());
+  H32_CHECK(aht.poll() == H32_AHT::AHT_ERROR && aht.crc_errors() == 3);
+  H32_CHECK(isnan(aht.temperature()));
+  // the next measurement starts over
+  H32_CHECK(aht.start(1) && aht.wait() && aht.crc_errors() == 0);
+
+  // A sensor that stays busy is given up after the attempts
+  Wire.conversion_ms = 1000;
+  Wire.triggers = 0;
+  H32_CHECK(aht.start(1));
+  elapsed = poll_until_done(aht);
+  H32_CHECK(aht.poll() == H32_AHT::AHT_ERROR && Wire.triggers == 3);
+  H32_CHECK(elapsed <= 3 * 202);
+  Wire.conversion_ms = 80;
+
+  // A missing sensor
+  reset_sensor();
+  Wire.present = false;
+  H32_AHT missing(H32_AHT2X_ADDR, H32_AHT::AHT2X);
+  H32_CHECK(!missing.begin());
+  H32_CHECK(!missing.start(1) && missing.poll() == H32_AHT::AHT_ERROR && !missing.wait());
+  H32_CHECK(isnan(missing.humidity()));
+
+  // The AHT1x reads 6 bytes without a CRC, corrupt results are not noticed
+  reset_sensor();
+  H32_AHT aht1x(H32_AHT1X_ADDR, H32_AHT::AHT1X);
+  H32_CHECK(aht1x.begin() && Wire.calibrated);
+  Wire.corrupt = 1;
+  H32_CHECK(aht1x.start(1) && aht1x.wait());
+  H32_CHECK(aht1x.crc_errors() == 0 && Wire.corrupt == 1 && Wire.triggers == 1);
+  H32_CHECK(fabsf(aht1x.temperature() - 30.0f) < 0.01f);
+
+  return h32_test_end();
+}
@@ -0,0 +1,195 @@
+/*
+ * The time budget of a wake cycle (H32_Budget.h): the shares of the phases,
+ * the time a phase leaves to the later ones and a clock that wraps. Then a
+ * cycle with the dispatcher and sinks that block: a sink that hangs is
+ * abandoned at the end of the budget, and the measurements are spilled into
+ * the log, to be sent with the next connection.
+ */
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "h32_test.h"
+#include "Threads.h"
+#include "H32_Budget.h"
+#include "H32_Dispatch.h"
+#include "H32_Log.h"
+
+uint32_t fake_now = 0;
+
+uint32_t fake_clock() {
+  return fake_now;
+}
+
+/*
+ * A service that blocks for its latency
+ */
+class Blocking_Sink : public H32_Sink {
+public:
+  uint32_t latency_ms;
+  std::atomic<bool> running{false};
+
+  Blocking_Sink(uint32_t latency_ms) : latency_ms(latency_ms) {};
+
+  bool send(void *job) override {
+    running = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(latency_ms));
+    running = false;
+    return true;
+  };
+};
+
+/*
+ * The log in memory
+ */
+class Memory_Storage : public H32_Log_Storage {
+public:
+  std::vector<uint8_t> image;
+
+  Memory_Storage() : image(H32_Log::storageSize(), log_uncommitted) {};
+
+  bool read(uint32_t offset, void *data, size_t length) override {
+    memcpy(data, &image[offset], length);
+    return true;
+  };
+  bool write(uint32_t offset, const void *data, size_t length) override {
+    memcpy(&image[offset], data, length);
+    return true;
+  };
+  bool sync() override { return true; };
+};
+
+typedef struct Cycle {
+  bool sent;
+  bool spilled;
+  uint32_t upload_ms;
+} Cycle;
+
+/*
+ * A wake cycle: WiFi takes wifi_ms, then the measurements are sent to a
+ * fast sink and the given one. Like setup(), what was not sent in time goes
+ * into the log.
+ */
+Cycle wake(uint32_t total_ms, uint32_t wifi_ms, Blocking_Sink &slow, H32_Log &log) {
+  Thread_Executor executors[2];
+  Thread_Event events[2];
+  Blocking_Sink fast(10);
+  H32_Budget budget(thread_clock);
+  budget.begin(total_ms, thread_clock());
+  budget.setShare(budget_wifi, 50);
+  uint32_t allowed = budget.allow(budget_wifi);
+  std::this_thread::sleep_for(std::chrono::milliseconds(wifi_ms < allowed ? wifi_ms : allowed));
+
+  H32_Dispatcher dispatcher(thread_clock);
+  dispatcher.add(fast, executors[0], events[0], 0);
+  dispatcher.add(slow, executors[1], events[1], 0);
+  dispatcher.setDeadline(budget.deadline(budget_upload));
+  uint32_t start = thread_clock();
+  int job = 0;
+  dispatcher.start(0, &job);
+  dispatcher.start(1, &job);
+  Cycle cycle = {dispatcher.join(), false, thread_clock() - start};
+  if(budget.spill(cycle.sent, false)) {
+    H32_Log_Record record;
+    memset(&record, 0, sizeof(record));
+    record.epoch = 1700000000;
+    record.temperature = 21.5f;
+    cycle.spilled = log.append(record);
+  }
+  // the abandoned sink must not outlive its dispatcher
+  while(slow.running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return cycle;
+}
+
+int main() {
+  // Without a budget everything is allowed
+  {
+    H32_Budget budget(fake_clock);
+    budget.begin(0, 0);
+    H32_CHECK(!budget.isLimited() && !budget.expired() && !budget.spill(false, false));
+    H32_CHECK(budget.allow(budget_wifi) == UINT32_MAX && budget.remaining() == UINT32_MAX);
+  }
+
+  // Every phase gets its share of the total, counted from its start
+  {
+    H32_Budget budget(fake_clock);
+    fake_now = 0;
+    budget.begin(60000, 0);
+    budget.setShare(budget_wifi, 50);
+    budget.setShare(budget_upload, 150);
+    H32_CHECK(budget.allow(budget_wifi) == 30000 && budget.deadline(budget_wifi) == 30000);
+    H32_CHECK(budget.allow(budget_upload) == 60000);
+
+    // WiFi took 10 s of its 30 s: the upload gets the rest of the cycle
+    fake_now = 10000;
+    H32_CHECK(budget.allow(budget_upload) == 50000 && budget.deadline(budget_upload) == 60000);
+    // but not more than its share
+    budget.setShare(budget_upload, 40);
+    H32_CHECK(budget.allow(budget_upload) == 24000 && budget.deadline(budget_upload) == 34000);
+    // WiFi took all of its share: the rest is less than the share
+    fake_now = 45000;
+    H32_CHECK(budget.allow(budget_upload) == 15000 && !budget.expired());
+    fake_now = 60000;
+    H32_CHECK(budget.allow(budget_upload) == 0 && budget.expired() && budget.deadline(budget_upload) == 60000);
+    fake_now = 70000;
+    H32_CHECK(budget.remaining() == 0 && budget.allow(budget_wifi) == 0);
+    // only what has been neither sent nor logged is spilled
+    H32_CHECK(budget.spill(false, false) && !budget.spill(true, false) && !budget.spill(false, true));
+  }
+
+  // The clock wraps during the cycle
+  {
+    H32_Budget budget(fake_clock);
+    uint32_t start = UINT32_MAX - 9999;
+    fake_now = start;
+    budget.begin(60000, start);
+    budget.setShare(budget_wifi, 50);
+    H32_CHECK(budget.remaining() == 60000 && budget.end() == 50000);
+    fake_now = start + 20000;
+    H32_CHECK(fake_now < start && budget.remaining() == 40000 && !budget.expired());
+    H32_CHECK(budget.allow(budget_wifi) == 30000 && budget.deadline(budget_wifi) == fake_now + 30000);
+    H32_Dispatcher dispatcher(fake_clock);
+    dispatcher.setDeadline(budget.deadline(budget_upload));
+    H32_CHECK(!dispatcher.expired());
+    fake_now = budget.end() - 1;
+    H32_CHECK(!dispatcher.expired() && budget.remaining() == 1);
+    fake_now = budget.end();
+    H32_CHECK(dispatcher.expired() && budget.expired());
+    fake_now = budget.end() + 1000;
+    H32_CHECK(budget.remaining() == 0);
+  }
+
+  // A cycle of 400 ms with sinks that block, on the real clock
+  {
+    Memory_Storage storage;
+    H32_Log log(storage);
+    H32_CHECK(log.open());
+
+    // the slow sink fits in the time left by a quick connection
+    Blocking_Sink slow(250);
+    Cycle cycle = wake(400, 50, slow, log);
+    H32_CHECK(cycle.sent && !cycle.spilled && log.pending() == 0);
+    printf("WiFi 50 ms, sinks of 10 and 250 ms: sent after %u ms\n", cycle.upload_ms);
+
+    // a slow connection leaves too little of the budget
+    cycle = wake(400, 200, slow, log);
+    H32_CHECK(!cycle.sent && cycle.spilled && log.pending() == 1);
+    H32_CHECK(cycle.upload_ms >= 190 && cycle.upload_ms < 250);
+    printf("WiFi 200 ms, sinks of 10 and 250 ms: abandoned after %u ms, spilled\n", cycle.upload_ms);
+
+    // a hung sink is abandoned at the end of the budget
+    Blocking_Sink hung(1000);
+    cycle = wake(400, 50, hung, log);
+    H32_CHECK(!cycle.sent && cycle.spilled && log.pending() == 2);
+    H32_CHECK(cycle.upload_ms >= 340 && cycle.upload_ms < 400);
+
+    // the spilled records are read back with the next connection
+    H32_Log reopened(storage);
+    H32_Log_Record records[4];
+    H32_CHECK(reopened.open() && reopened.peek(records, 4) == 2 && records[1].temperature == 21.5f);
+  }
+
+  return h32_test_end();
+}
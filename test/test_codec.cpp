@@ -0,0 +1,245 @@
+/*
+ * The round trip of the binary record format (H32_Codec.h) and its size
+ * and speed compared with the json of the batch upload
+ */
+#include <chrono>
+
+#include "h32_test.h"
+#include "H32_Log.h"
+#include "H32_Codec.h"
+#include "H32_Json.h"
+
+const uint8_t record_num = 12;
+const uint16_t speed_rounds = 10000;
+
+const char *const record_names[] = {"Soil Moisture", "Power Mode"};
+
+const char *record_name(uint8_t id) {
+  return record_names[id];
+}
+
+/*
+ * Records as the backlog stores them, every 10 minutes, with an extension
+ * value and a failed humidity reading
+ */
+void make_records(H32_Log_Record *records, uint8_t num) {
+  memset(records, 0, num * sizeof(H32_Log_Record));
+  for(uint8_t i = 0; i < num; i++) {
+    H32_Log_Record &record = records[i];
+    record.seq = 1000 + i;
+    record.epoch = 1700000000 + 600 * i;
+    record.temperature = 21.37f + 0.13f * i;
+    record.humidity = i == 3 ? NAN : 48.2f - 0.4f * i;
+    record.batV = 4.012f - 0.001f * i;
+    record.extV = i % 2 ? 5.003f : NAN;
+    record.batPercentage = 87.5f - 0.1f * i;
+    record.batChargeRate = -0.42f;
+    record.additional_num = 2;
+    record.additional[0].id = 0;
+    record.additional[0].value = 33.3f + i;
+    record.additional[1].id = 1;
+    record.additional[1].value = 1;
+  }
+}
+
+bool same(float a, float b, float resolution) {
+  return (isnan(a) && isnan(b)) || fabsf(a - b) <= resolution / 2;
+}
+
+/*
+ * The json of the batch upload: every value with its epoch, grouped by name
+ */
+size_t json_length(const H32_Log_Record *records, uint8_t num) {
+  static const char *core_names[codec_core_num] = {
+    "Temperature", "Humidity", "Battery Voltage", "External Voltage",
+    "Battery Percentage", "Battery Charge Rate"
+  };
+  H32_Json_Writer json(NULL);
+  json.beginObject();
+  for(uint8_t field = 0; field < codec_core_num + 2; field++) {
+    json.key(field < codec_core_num ? core_names[field] : record_name(field - codec_core_num));
+    json.beginArray();
+    for(uint8_t i = 0; i < num; i++) {
+      const float core[codec_core_num] = {
+        records[i].temperature, records[i].humidity, records[i].batV,
+        records[i].extV, records[i].batPercentage, records[i].batChargeRate
+      };
+      float value = field < codec_core_num ? core[field] : records[i].additional[field - codec_core_num].value;
+      if(isnan(value)) {
+        continue;
+      }
+      json.beginObject();
+      json.key("value");
+      json.value(round(value * 100) / 100.0);
+      json.key("epoch");
+      json.value(records[i].epoch);
+      json.endObject();
+    }
+    json.endArray();
+  }
+  json.endObject();
+  return json.length();
+}
+
+int main() {
+  H32_Log_Record records[record_num];
+  make_records(records, record_num);
+  uint8_t buffer[512];
+
+  // Round trip of a batch
+  H32_Encoder encoder(buffer, sizeof(buffer));
+  H32_CHECK(encoder.begin(records, record_num, record_name));
+  for(uint8_t i = 0; i < record_num; i++) {
+    H32_CHECK(encoder.add(records[i]));
+  }
+  size_t batch_length = encoder.length();
+
+  H32_Decoder decoder(buffer, batch_length);
+  H32_CHECK(decoder.begin());
+  H32_Log_Record decoded;
+  uint8_t num = 0;
+  while(decoder.next(decoded)) {
+    const H32_Log_Record &record = records[num];
+    H32_CHECK(decoded.seq == record.seq && decoded.epoch == record.epoch);
+    H32_CHECK(same(decoded.temperature, record.temperature, 0.01f));
+    H32_CHECK(same(decoded.humidity, record.humidity, 0.01f));
+    H32_CHECK(same(decoded.batV, record.batV, 0.001f));
+    H32_CHECK(same(decoded.extV, record.extV, 0.001f));
+    H32_CHECK(same(decoded.batPercentage, record.batPercentage, 0.01f));
+    H32_CHECK(same(decoded.batChargeRate, record.batChargeRate, 0.01f));
+    H32_CHECK(decoded.additional_num == 2);
+    H32_CHECK(strcmp(decoder.name(decoded.additional[0].id), "Soil Moisture") == 0);
+    H32_CHECK(same(decoded.additional[0].value, record.additional[0].value, 0.01f));
+    H32_CHECK(strcmp(decoder.name(decoded.additional[1].id), "Power Mode") == 0);
+    num++;
+  }
+  H32_CHECK(num == record_num);
+
+  // The measurements of a wake, without records
+  const char *names[] = {"Soil Moisture"};
+  const float core[codec_core_num] = {21.5f, 55.25f, 3.912f, NAN, NAN, NAN};
+  const float named[] = {12.34f};
+  H32_Encoder single(buffer, sizeof(buffer));
+  H32_CHECK(single.begin(names, 1) && single.add(42, 1700000000, core, named));
+  size_t single_length = single.length();
+  H32_Decoder single_decoder(buffer, single_length);
+  H32_CHECK(single_decoder.begin() && single_decoder.next(decoded));
+  H32_CHECK(decoded.seq == 42 && same(decoded.humidity, 55.25f, 0.01f) && isnan(decoded.extV));
+  H32_CHECK(decoded.additional_num == 1 && same(decoded.additional[0].value, 12.34f, 0.01f));
+  H32_CHECK(!single_decoder.next(decoded));
+
+  // Records with every named value the log can hold, spread over two
+  // records so that the header is their union
+  static char many_names[codec_names_max + 1][log_name_length + 1];
+  static const char *many_pointers[codec_names_max + 1];
+  for(uint8_t i = 0; i <= codec_names_max; i++) {
+    snprintf(many_names[i], sizeof(many_names[i]), "Channel %u", i);
+    many_pointers[i] = many_names[i];
+  }
+  H32_Log_Record many[2];
+  make_records(many, 2);
+  many[0].additional_num = log_additional_num;
+  many[1].additional_num = log_additional_num / 2;
+  for(uint8_t i = 0; i < log_additional_num; i++) {
+    // the second record has the last half of the names, in reverse order
+    many[0].additional[i] = {i, i * 1.5f};
+    if(i < many[1].additional_num) {
+      uint8_t id = log_additional_num - 1 - i;
+      many[1].additional[i] = {id, -id * 0.25f};
+    }
+  }
+  uint8_t large[1024];
+  H32_Encoder all(large, sizeof(large));
+  H32_CHECK(all.begin(many, 2, [](uint8_t id) { return (const char *)many_names[id]; }));
+  H32_CHECK(all.add(many[0]) && all.add(many[1]));
+  H32_Decoder all_decoder(large, all.length());
+  H32_CHECK(all_decoder.begin());
+  for(uint8_t r = 0; r < 2; r++) {
+    H32_CHECK(all_decoder.next(decoded));
+    H32_CHECK(decoded.additional_num == many[r].additional_num);
+    for(uint8_t i = 0; i < many[r].additional_num; i++) {
+      // the decoded values come in the order of the header
+      bool found = false;
+      for(uint8_t j = 0; j < decoded.additional_num; j++) {
+        const char *name = all_decoder.name(decoded.additional[j].id);
+        if(name != NULL && strcmp(name, many_names[many[r].additional[i].id]) == 0) {
+          found = same(decoded.additional[j].value, many[r].additional[i].value, 0.01f);
+        }
+      }
+      H32_CHECK(found);
+    }
+  }
+  H32_CHECK(!all_decoder.next(decoded));
+  H32_Encoder all_names(large, sizeof(large));
+  H32_CHECK(all_names.begin(many_pointers, codec_names_max));
+
+  // One name more fails, instead of leaving a value out
+  H32_Encoder too_many(large, sizeof(large));
+  H32_CHECK(!too_many.begin(many_pointers, codec_names_max + 1) && too_many.length() == 0);
+  H32_Log_Record extra[2];
+  memcpy(extra, many, sizeof(many));
+  extra[1].additional_num = 1;
+  extra[1].additional[0] = {codec_names_max, 1.0f};
+  H32_CHECK(!too_many.begin(extra, 2, [](uint8_t id) { return (const char *)many_names[id]; }));
+  uint8_t too_many_header[] = {codec_version, codec_names_max + 1};
+  H32_Decoder too_many_decoder(too_many_header, sizeof(too_many_header));
+  H32_CHECK(!too_many_decoder.begin());
+
+  // A full buffer keeps the records that fit, all of them decodable
+  uint8_t small[64];
+  H32_Encoder truncated(small, sizeof(small));
+  H32_CHECK(truncated.begin(records, record_num, record_name));
+  uint8_t fitted = 0;
+  while(fitted < record_num && truncated.add(records[fitted])) {
+    fitted++;
+  }
+  H32_CHECK(fitted > 0 && fitted < record_num);
+  H32_Decoder truncated_decoder(small, truncated.length());
+  H32_CHECK(truncated_decoder.begin());
+  num = 0;
+  while(truncated_decoder.next(decoded)) {
+    num++;
+  }
+  H32_CHECK(num == fitted);
+
+  // Invalid messages
+  uint8_t wrong_version[] = {codec_version + 1, 0};
+  H32_Decoder wrong(wrong_version, sizeof(wrong_version));
+  H32_CHECK(!wrong.begin());
+  H32_Decoder cut(buffer, 3);
+  H32_CHECK(!cut.begin());
+
+  // Size compared with the json
+  size_t single_json = json_length(records, 1);
+  size_t batch_json = json_length(records, record_num);
+  printf("bytes      binary     json  ratio\n");
+  printf("single %10zu %8zu %5.1fx\n", single_length, single_json, (double)single_json / single_length);
+  printf("batch  %10zu %8zu %5.1fx\n", batch_length, batch_json, (double)batch_json / batch_length);
+  H32_CHECK(batch_json >= 5 * batch_length);
+
+  // Speed of a batch
+  auto start = std::chrono::steady_clock::now();
+  size_t sink = 0;
+  for(uint16_t round = 0; round < speed_rounds; round++) {
+    H32_Encoder timed(buffer, sizeof(buffer));
+    timed.begin(records, record_num, record_name);
+    for(uint8_t i = 0; i < record_num; i++) {
+      timed.add(records[i]);
+    }
+    H32_Decoder timed_decoder(buffer, timed.length());
+    timed_decoder.begin();
+    while(timed_decoder.next(decoded)) {
+      sink++;
+    }
+  }
+  double codec_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  for(uint16_t round = 0; round < speed_rounds; round++) {
+    sink += json_length(records, record_num);
+  }
+  double json_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  printf("us per batch: encode and decode %.2f, json %.2f (%zu)\n",
+         codec_us / speed_rounds, json_us / speed_rounds, sink % 10);
+
+  return h32_test_end();
+}
@@ -0,0 +1,237 @@
+/*
+ * The configuration tables of H32_Config.h: the binary image in NVS, its
+ * header and the choices that are out of range, and a benchmark of the two
+ * ways a wake reads the configuration, the image with a single NVS read
+ * against the json file in LittleFS.
+ *
+ * The json file is written by the schema like serialize_config() does. With
+ * ArduinoJson (cmake -DARDUINOJSON_DIR=<its checkout>) it is also parsed as
+ * by read_config(), and the parse time is part of the benchmark.
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+
+const uint8_t H32_MAJOR = 1;
+const uint8_t H32_MINOR = 2;
+const uint8_t SSID_LENGTH = 33;
+const uint8_t NAME_LENGTH = 50;
+const uint8_t TOPIC_LENGTH = 100;
+const uint8_t IP_ADDR_LENGTH = 16;
+const uint8_t FINGERPRINT_LENGTH = 95;
+
+#include "h32_test.h"
+#include "H32_Config.h"
+#include "H32_Json.h"
+
+#ifdef H32_TEST_ARDUINOJSON
+#include <ArduinoJson.h>
+#endif // H32_TEST_ARDUINOJSON
+
+H32_Config config;
+H32_Schema_Registration config_registration(h32_config_fields, H32_FIELD_NUM(h32_config_fields), &config);
+
+const uint32_t speed_rounds = 10000;
+
+/*
+ * The NVS entry of the image, counts the reads like Preferences::getBytes()
+ */
+class Fake_NVS {
+public:
+  std::vector<uint8_t> entry;
+  uint32_t reads = 0;
+
+  void put(const uint8_t *data, size_t length) { entry.assign(data, data + length); };
+  size_t get(uint8_t *data, size_t length) {
+    reads++;
+    if(length != entry.size()) {
+      return 0;
+    }
+    memcpy(data, entry.data(), length);
+    return length;
+  };
+};
+
+class Memory_Print : public Print {
+public:
+  std::string text;
+
+  size_t write(const uint8_t *buffer, size_t size) override {
+    text.append((const char *)buffer, size);
+    return size;
+  };
+};
+
+/*
+ * write_config_image()
+ */
+void write_image(Fake_NVS &nvs) {
+  H32_Config_Image header;
+  size_t length = H32_Schema::packedSize();
+  std::vector<uint8_t> image(sizeof(header) + length);
+  H32_Schema::pack(image.data() + sizeof(header));
+  header.seal(image.data() + sizeof(header), length);
+  memcpy(image.data(), &header, sizeof(header));
+  nvs.put(image.data(), image.size());
+}
+
+/*
+ * read_config_image()
+ */
+bool read_image(Fake_NVS &nvs) {
+  H32_Config_Image header;
+  size_t length = H32_Schema::packedSize();
+  uint8_t *image = new uint8_t[sizeof(header) + length];
+  bool result = nvs.get(image, sizeof(header) + length) == sizeof(header) + length;
+  memcpy(&header, image, sizeof(header));
+  result = result && header.isValid(image + sizeof(header), length);
+  if(result) {
+    H32_Schema::unpack(image + sizeof(header));
+  }
+  delete[] image;
+  return result;
+}
+
+/*
+ * The json file, with the members of a part in one nested object
+ */
+std::string config_json() {
+  Memory_Print out;
+  H32_Json_Writer json(&out);
+  json.beginObject();
+  for(const H32_Schema_Table &table : *H32_Schema::getTables()) {
+    const char *part = NULL;
+    for(uint8_t i = 0; i < table.num; i++) {
+      const H32_Field &field = table.fields[i];
+      if(field.name == NULL) {
+        continue;
+      }
+      if(part != NULL && (field.part == NULL || strcmp(part, field.part) != 0)) {
+        json.endObject();
+      }
+      if(field.part != NULL && (part == NULL || strcmp(part, field.part) != 0)) {
+        json.key(field.part);
+        json.beginObject();
+      }
+      part = field.part;
+      json.key(field.name);
+      const uint8_t *member = table.member(field);
+      switch(field.type) {
+        case field_u8:     json.value((uint32_t)*(const uint8_t *)member); break;
+        case field_i8:
+        case field_choice: json.value((double)*(const int8_t *)member); break;
+        case field_u16:    json.value((uint32_t)*(const uint16_t *)member); break;
+        case field_u32:    json.value(*(const uint32_t *)member); break;
+        case field_double: json.value(*(const double *)member); break;
+        case field_string: json.value((const char *)member); break;
+        default: break;
+      }
+    }
+    if(part != NULL) {
+      json.endObject();
+    }
+  }
+  json.endObject();
+  json.flush();
+  return out.text;
+}
+
+int main() {
+  strcpy(config.name, "H32 Garden");
+  strcpy(config.mqtt.server, "broker.example.org");
+  strcpy(config.mqtt.topic, "h32/garden");
+  config.api.type = thingspeak;
+  strcpy(config.api.key, "0123456789ABCDEF");
+  config.rtc.sleeptime = 600;
+  config.analog[0].pin = 35;
+  strcpy(config.analog[0].name, "soil");
+  config.analog[0].linear = 0.00122;
+
+  // The image holds the header and all fields, and restores them
+  Fake_NVS nvs;
+  write_image(nvs);
+  H32_CHECK(nvs.entry.size() == sizeof(H32_Config_Image) + H32_Schema::packedSize());
+  const H32_Config written = config;
+  std::vector<uint8_t> packed(H32_Schema::packedSize());
+  H32_Schema::pack(packed.data());
+  config = H32_Config();
+  H32_CHECK(read_image(nvs) && nvs.reads == 1);
+  std::vector<uint8_t> unpacked(H32_Schema::packedSize());
+  H32_Schema::pack(unpacked.data());
+  H32_CHECK(unpacked == packed && strcmp(config.analog[0].name, "soil") == 0 && config.rtc.sleeptime == 600);
+
+  // A damaged image, one of another firmware or of another size is refused
+  {
+    Fake_NVS damaged = nvs;
+    damaged.entry.back() ^= 0x01;
+    H32_CHECK(!read_image(damaged));
+    damaged = nvs;
+    damaged.entry[0] ^= 0x01;
+    H32_CHECK(!read_image(damaged));
+    damaged = nvs;
+    damaged.entry[2] ^= 0x01;
+    H32_CHECK(!read_image(damaged));
+    damaged = nvs;
+    damaged.entry.pop_back();
+    H32_CHECK(!read_image(damaged));
+  }
+
+  // A choice out of range in a valid image (e.g., taken from the json file
+  // of a firmware with more services) becomes the first option, since it is
+  // used as an index into the options and the function tables
+  {
+    config.api.type = (APIType)7;
+    config.api2.type = (APIType)-3;
+    Fake_NVS stale;
+    write_image(stale);
+    config = written;
+    H32_CHECK(read_image(stale) && config.api.type == none && config.api2.type == none);
+    const H32_Schema_Table &table = H32_Schema::getTables()->front();
+    for(uint8_t i = 0; i < table.num; i++) {
+      if(table.fields[i].type == field_choice) {
+        H32_CHECK(H32_Schema::choice(table, table.fields[i]) == 0);
+      }
+    }
+    config.api.type = iotplotter;
+    H32_Schema::clampChoices();
+    H32_CHECK(config.api.type == iotplotter);
+    config = written;
+  }
+
+  // Benchmark of a wake: the image against the json file
+  std::string json = config_json();
+  H32_CHECK(json.front() == '{' && json.back() == '}' && json.find("\"sleeptime\":600") != std::string::npos);
+  H32_CHECK(json.find("\"analog1\":{\"name\":\"soil\"") != std::string::npos);
+  printf("Config of %u fields: image %zu bytes, json file %zu bytes\n",
+         (unsigned)H32_FIELD_NUM(h32_config_fields), nvs.entry.size(), json.size());
+
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t round = 0; round < speed_rounds; round++) {
+    sink += read_image(nvs);
+  }
+  double image_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / speed_rounds;
+  H32_CHECK(sink == speed_rounds && nvs.reads == 1 + speed_rounds);
+  printf("  image: 1 NVS read of %zu bytes, %.0f ns to check and unpack\n", nvs.entry.size(), image_ns);
+
+#ifdef H32_TEST_ARDUINOJSON
+  // read_config() before the image, on every wake: the whole file and a
+  // document sized by the schema
+  size_t doc_size = JSON_OBJECT_SIZE(H32_Schema::jsonMembers()) + H32_Schema::jsonStrings();
+  sink = 0;
+  start = std::chrono::steady_clock::now();
+  for(uint32_t round = 0; round < speed_rounds; round++) {
+    DynamicJsonDocument doc(doc_size);
+    sink += deserializeJson(doc, json.data(), json.size()) == DeserializationError::Ok;
+    sink += doc["rtc"]["sleeptime"].as<uint32_t>() == 600;
+  }
+  double json_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / speed_rounds;
+  H32_CHECK(sink == 2 * speed_rounds);
+  printf("  json:  mount, open and read of %zu bytes, %.0f ns to parse (%.0fx the image)\n",
+         json.size(), json_ns, json_ns / image_ns);
+#else
+  printf("  json:  mount, open and read of %zu bytes, parse time needs -DARDUINOJSON_DIR\n", json.size());
+#endif // H32_TEST_ARDUINOJSON
+
+  return h32_test_end();
+}
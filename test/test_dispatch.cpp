@@ -0,0 +1,212 @@
+/*
+ * The dispatcher (H32_Dispatch.h) with std::thread and sinks that stand in
+ * for the services by their latency. The sinks share one read-only batch,
+ * each from its own offset, as H32_Dispatch.ino hands it out: the upload
+ * takes as long as the slowest sink, no sink gets a copy, and the batch is
+ * only refilled once no sink is busy, not even an abandoned one.
+ */
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "h32_test.h"
+#include "Threads.h"
+#include "H32_CRC.h"
+#include "H32_Dispatch.h"
+
+typedef struct Record {
+  uint32_t seq;
+  float value;
+} Record;
+
+/*
+ * The job of a sink, its part of the shared batch
+ */
+typedef struct Job {
+  const Record *records;
+  uint16_t num;
+} Job;
+
+/*
+ * A service that answers after its latency, the first attempts may fail
+ */
+class Latency_Sink : public H32_Sink {
+public:
+  uint32_t latency_ms;
+  uint8_t failures = 0;       // of the next attempts
+  std::atomic<uint32_t> running{0};
+  const Record *seen = NULL;
+  uint16_t seen_num = 0;
+  uint32_t last_seq = 0;      // of the records sent
+
+  Latency_Sink(uint32_t latency_ms) : latency_ms(latency_ms) {};
+
+  bool send(void *job) override {
+    running++;
+    Job *part = (Job *)job;
+    seen = part->records;
+    seen_num = part->num;
+    std::this_thread::sleep_for(std::chrono::milliseconds(latency_ms));
+    bool success = failures == 0;
+    if(success) {
+      last_seq = part->records[part->num - 1].seq;
+    } else {
+      failures--;
+    }
+    running--;
+    return success;
+  };
+};
+
+uint32_t checksum(const Record *records, uint16_t num) {
+  return crc16(records, num * sizeof(Record));
+}
+
+int main() {
+  const uint16_t batch_max = 8;
+  Record batch[batch_max];
+  Thread_Executor executors[sink_max];
+  Thread_Event events[sink_max];
+
+  // Three sinks with different latencies and positions in the log send
+  // their parts of one batch at once
+  {
+    Latency_Sink sinks[sink_max] = {Latency_Sink(40), Latency_Sink(80), Latency_Sink(120)};
+    H32_Dispatcher dispatcher(thread_clock);
+    for(uint8_t i = 0; i < sink_max; i++) {
+      H32_CHECK(dispatcher.add(sinks[i], executors[i], events[i], 0) == i);
+    }
+    H32_CHECK(dispatcher.add(sinks[0], executors[0], events[0], 0) == -1);
+    for(uint16_t i = 0; i < batch_max; i++) {
+      batch[i] = {101u + i, i * 0.5f};
+    }
+    uint32_t before = checksum(batch, batch_max);
+    const uint16_t offsets[sink_max] = {0, 3, 5};
+    Job jobs[sink_max];
+    uint32_t start = thread_clock();
+    for(uint8_t i = 0; i < sink_max; i++) {
+      jobs[i] = {batch + offsets[i], (uint16_t)(batch_max - offsets[i])};
+      H32_CHECK(dispatcher.start(i, &jobs[i]));
+    }
+    H32_CHECK(!dispatcher.idle());
+    H32_CHECK(dispatcher.join() && dispatcher.idle());
+    uint32_t elapsed = thread_clock() - start;
+    printf("sinks of 40, 80 and 120 ms: %u ms at once, 240 ms one after the other\n", elapsed);
+    H32_CHECK(elapsed >= 120 && elapsed < 200);
+    for(uint8_t i = 0; i < sink_max; i++) {
+      // the sink read the shared batch itself
+      H32_CHECK(sinks[i].seen == batch + offsets[i] && sinks[i].seen_num == batch_max - offsets[i]);
+      H32_CHECK(dispatcher.getState(i) == sink_sent && sinks[i].last_seq == 108);
+    }
+    H32_CHECK(checksum(batch, batch_max) == before);
+  }
+
+  // Rounds over a log of 30 records, like backlog_round_start(): the
+  // batch starts at the sink furthest behind and is refilled when idle
+  {
+    Latency_Sink sinks[sink_max] = {Latency_Sink(5), Latency_Sink(15), Latency_Sink(10)};
+    H32_Dispatcher dispatcher(thread_clock);
+    for(uint8_t i = 0; i < sink_max; i++) {
+      dispatcher.add(sinks[i], executors[i], events[i], 1);
+    }
+    std::vector<Record> log;
+    for(uint32_t seq = 1; seq <= 30; seq++) {
+      log.push_back({seq, seq * 0.25f});
+    }
+    sinks[0].last_seq = 20;
+    sinks[1].last_seq = 4;
+    sinks[2].last_seq = 12;
+    sinks[2].failures = 1;    // the retry budget covers it
+    uint8_t rounds = 0;
+    while(dispatcher.idle()) {
+      uint32_t from = UINT32_MAX;
+      for(uint8_t i = 0; i < sink_max; i++) {
+        from = sinks[i].last_seq < from ? sinks[i].last_seq + 1 : from;
+      }
+      if(from > log.size()) {
+        break;
+      }
+      uint16_t num = 0;
+      for(uint32_t seq = from; seq <= log.size() && num < batch_max; seq++) {
+        batch[num++] = log[seq - 1];
+      }
+      dispatcher.reset();
+      Job jobs[sink_max];
+      for(uint8_t i = 0; i < sink_max; i++) {
+        uint16_t offset = 0;
+        while(offset < num && batch[offset].seq <= sinks[i].last_seq) {
+          offset++;
+        }
+        if(offset < num) {
+          jobs[i] = {batch + offset, (uint16_t)(num - offset)};
+          H32_CHECK(dispatcher.start(i, &jobs[i]));
+        }
+      }
+      H32_CHECK(dispatcher.join());
+      rounds++;
+    }
+    H32_CHECK(rounds == 4);
+    for(uint8_t i = 0; i < sink_max; i++) {
+      H32_CHECK(sinks[i].last_seq == 30);
+    }
+    H32_CHECK(dispatcher.getAttempts(1) == 1);
+  }
+
+  // A failed attempt is retried within the budget
+  {
+    Latency_Sink retried(1), exhausted(1);
+    retried.failures = 2;
+    exhausted.failures = 2;
+    H32_Dispatcher dispatcher(thread_clock);
+    dispatcher.add(retried, executors[0], events[0], 2);
+    dispatcher.add(exhausted, executors[1], events[1], 1);
+    Job job = {batch, 1};
+    H32_CHECK(dispatcher.start(0, &job) && dispatcher.start(1, &job));
+    H32_CHECK(!dispatcher.join());
+    H32_CHECK(dispatcher.getState(0) == sink_sent && dispatcher.getAttempts(0) == 3);
+    H32_CHECK(dispatcher.getState(1) == sink_failed && dispatcher.getAttempts(1) == 2);
+  }
+
+  // A sink that is too slow is abandoned at the deadline. It keeps reading
+  // the batch, so nothing may be started until it is done.
+  {
+    Latency_Sink fast(10), slow(300);
+    H32_Dispatcher dispatcher(thread_clock);
+    dispatcher.add(fast, executors[0], events[0], 0);
+    dispatcher.add(slow, executors[1], events[1], 0);
+    dispatcher.setDeadline(thread_clock() + 100);
+    Job job = {batch, batch_max};
+    uint32_t start = thread_clock();
+    H32_CHECK(dispatcher.start(0, &job) && dispatcher.start(1, &job));
+    H32_CHECK(!dispatcher.join());
+    uint32_t elapsed = thread_clock() - start;
+    H32_CHECK(elapsed >= 95 && elapsed < 150);
+    H32_CHECK(dispatcher.hasAbandoned() && dispatcher.getState(0) == sink_sent);
+    H32_CHECK(dispatcher.getState(1) == sink_busy && slow.running == 1 && !dispatcher.idle());
+    dispatcher.reset();
+    H32_CHECK(dispatcher.getState(1) == sink_busy && !dispatcher.start(1, &job));
+    // past the deadline nothing starts anymore
+    H32_CHECK(!dispatcher.start(0, &job));
+    while(slow.running != 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    H32_CHECK(dispatcher.idle() && dispatcher.getState(1) == sink_sent);
+  }
+
+  // Without a task the sink runs right away, the tasks are only created
+  // for the sinks that are started
+  {
+    Latency_Sink inline_sink(1), unused(1);
+    Thread_Executor unavailable, counted;
+    unavailable.available = false;
+    H32_Dispatcher dispatcher(thread_clock);
+    dispatcher.add(inline_sink, unavailable, events[0], 0);
+    dispatcher.add(unused, counted, events[1], 0);
+    Job job = {batch, 1};
+    H32_CHECK(dispatcher.start(0, &job) && dispatcher.getState(0) == sink_sent);
+    H32_CHECK(dispatcher.join() && counted.started == 0 && dispatcher.getState(1) == sink_idle);
+  }
+
+  return h32_test_end();
+}
@@ -0,0 +1,153 @@
+/*
+ * The decisions of the fast WiFi connection (H32_FastConnect.h) against a
+ * simulated access point, over several wake cycles with a persisted cache
+ */
+#include "h32_test.h"
+
+const uint8_t SSID_LENGTH = 33;
+
+#include "H32_FastConnect.h"
+
+const uint32_t ip = 0x0A00A8C0, gateway = 0x0100A8C0, subnet = 0x00FFFFFF, dns = 0x0100A8C0;
+const uint32_t full_connect_ms = 2000;   // scan, association and DHCP
+
+/*
+ * The access point: it answers after associate_ms on its channel and BSSID,
+ * unless it only takes associations after a scan
+ */
+typedef struct Access_Point {
+  const char *ssid;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t associate_ms;
+  bool up;
+  bool direct;
+} Access_Point;
+
+/*
+ * One wake cycle as in init_WiFiManager(): the cache is read, the fast
+ * connection is tried and the full connection is the fallback. The cache
+ * is returned as persisted.
+ * @return the state of the connection
+ */
+H32_FastConnect::State wake(H32_WiFi_Cache &stored, const Access_Point &ap, const char *ssid,
+                            uint32_t epoch, bool *lease_used = NULL, uint32_t *elapsed = NULL) {
+  H32_WiFi_Cache cache = stored;
+  H32_FastConnect fast(cache);
+  uint32_t start = millis();
+  bool lease = false;
+  if(fast.begin(ssid) == H32_FastConnect::fc_fast) {
+    lease = fast.useLease(epoch);
+    bool reachable = ap.up && ap.direct && cache.channel == ap.channel && memcmp(cache.bssid, ap.bssid, 6) == 0;
+    uint32_t fast_start = millis();
+    while(fast.poll(reachable && millis() - fast_start >= ap.associate_ms,
+                    millis() - fast_start) == H32_FastConnect::fc_fast) {
+      delay(10);
+    }
+  }
+  if(fast.getState() == H32_FastConnect::fc_full) {
+    delay(full_connect_ms);
+    fast.fullResult(ap.up && strcmp(ap.ssid, ssid) == 0);
+  }
+  if(fast.getState() == H32_FastConnect::fc_connected) {
+    fast.remember(ap.ssid, ap.bssid, ap.channel, ip, gateway, subnet, dns, epoch);
+  }
+  if(fast.cacheChanged()) {
+    stored = cache;
+  }
+  if(lease_used != NULL) {
+    *lease_used = lease;
+  }
+  if(elapsed != NULL) {
+    *elapsed = millis() - start;
+  }
+  return fast.getState();
+}
+
+int main() {
+  Access_Point ap = {"h32", {2, 0, 0, 0, 0, 1}, 6, 300, true, true};
+  H32_WiFi_Cache stored;
+  uint32_t epoch = 1700000000;
+  bool lease;
+  uint32_t elapsed;
+
+  // The first wake has nothing cached
+  H32_CHECK(!stored.isValid());
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+  H32_CHECK(stored.isValid() && stored.channel == 6 && stored.ip == ip && stored.lease_start == epoch);
+
+  // The next wakes associate directly and reuse the lease
+  epoch += 600;
+  H32_WiFi_Cache before = stored;
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+  H32_CHECK(lease && elapsed < 400);
+  // nothing changed, the cache is not written again
+  H32_CHECK(memcmp(&before, &stored, sizeof(stored)) == 0);
+
+  // An expired lease runs DHCP again and starts a new one
+  epoch += fast_connect_lease;
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease) == H32_FastConnect::fc_connected);
+  H32_CHECK(!lease && stored.lease_start == epoch);
+  // a clock that went back does not use the lease either
+  H32_CHECK(wake(stored, ap, "h32", epoch - 100, &lease) == H32_FastConnect::fc_connected && !lease);
+
+  // Another SSID is configured: the full connection
+  H32_CHECK(wake(stored, ap, "other", epoch) == H32_FastConnect::fc_failed);
+
+  // The access point moved to another channel: a miss, then the full
+  // connection, which remembers the new channel and resets the misses
+  ap.channel = 11;
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+  H32_CHECK(elapsed >= fast_connect_timeout_ms && stored.channel == 11 && stored.misses == 0);
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+  H32_CHECK(elapsed < 400);
+
+  // The access point only takes the full connection, which gets a new lease
+  // every time: the misses still add up, then only the full connection is
+  // tried while the lease is kept up to date
+  ap.direct = false;
+  for(uint8_t i = 1; i <= fast_connect_max_misses; i++) {
+    epoch += 600;
+    H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+    H32_CHECK(elapsed >= fast_connect_timeout_ms + full_connect_ms);
+    H32_CHECK(stored.isValid() && stored.misses == i && stored.lease_start == epoch);
+  }
+  epoch += 600;
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+  H32_CHECK(elapsed < fast_connect_timeout_ms + full_connect_ms && stored.lease_start == epoch);
+  H32_CHECK(stored.isValid() && stored.misses == fast_connect_max_misses);
+  // another access point is tried again
+  ap.direct = true;
+  ap.bssid[5] = 2;
+  H32_CHECK(wake(stored, ap, "h32", epoch) == H32_FastConnect::fc_connected && stored.misses == 0);
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_connected);
+  H32_CHECK(elapsed < 400);
+
+  // The access point is down: every wake is a miss, the cache is
+  // invalidated after fast_connect_max_misses of them
+  ap.up = false;
+  for(uint8_t i = 1; i <= fast_connect_max_misses; i++) {
+    H32_CHECK(wake(stored, ap, "h32", epoch) == H32_FastConnect::fc_failed);
+    H32_CHECK(i == fast_connect_max_misses ? !stored.isValid() : stored.misses == i);
+  }
+  // then only the full connection is tried
+  H32_CHECK(wake(stored, ap, "h32", epoch, &lease, &elapsed) == H32_FastConnect::fc_failed);
+  H32_CHECK(elapsed < fast_connect_timeout_ms + full_connect_ms);
+
+  // Back up, the cache is built again
+  ap.up = true;
+  H32_CHECK(wake(stored, ap, "h32", epoch) == H32_FastConnect::fc_connected && stored.isValid());
+
+  // Without a lease (static IP) the address is not cached
+  H32_WiFi_Cache cache;
+  H32_FastConnect fast(cache);
+  fast.begin("h32");
+  fast.fullResult(true);
+  fast.remember("h32", ap.bssid, ap.channel, 0, 0, 0, 0, epoch);
+  H32_CHECK(cache.isValid() && cache.lease_start == 0);
+  H32_FastConnect next(cache);
+  next.begin("h32");
+  H32_CHECK(!next.useLease(epoch));
+
+  return h32_test_end();
+}
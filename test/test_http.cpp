@@ -0,0 +1,289 @@
+/*
+ * The HTTP client (H32_HTTP.h) against a stand-in server that answers on
+ * the virtual clock. A request is only repeated if the server cannot have
+ * processed it, so no failure may lead to a duplicate. The benchmark
+ * compares a kept-alive connection with one connection per request.
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "h32_test.h"
+#include "Client.h"
+#include "H32_HTTP.h"
+
+/*
+ * A server behind a Client. It processes a request once it has got all of
+ * it, a round trip takes rtt_ms of the virtual clock.
+ */
+class Stand_In_Server : public Client {
+public:
+  enum Failure : uint8_t {
+    none,
+    reset,            // the idle connection has been closed, writing fails
+    closed,           // the idle connection has been closed, writing seems to work
+    timeout,          // the request is processed, the response does not come
+    cut,              // the request is processed, the response is cut off
+  };
+  Failure failure = none;   // of the next request
+  bool keep_alive = true;
+  bool chunked = false;
+  bool refuse = false;
+  uint32_t rtt_ms = 40;
+
+  uint32_t connects = 0;
+  uint32_t processed = 0;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  std::vector<std::string> bodies;
+
+private:
+  bool open = false;
+  bool discard = false;     // the connection is gone, the request is lost
+  std::string request;
+  std::string response;
+  size_t position = 0;
+
+  void respond() {
+    std::string body = "{\"status\":\"ok\",\"entries\":" + std::to_string(processed) + "}";
+    std::string head = "HTTP/1.1 200 OK\r\nServer: stand-in\r\n";
+    head += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if(chunked) {
+      char size[16];
+      snprintf(size, sizeof(size), "%zx\r\n", body.size());
+      response += head + "Transfer-Encoding: chunked\r\n\r\n" + size + body + "\r\n0\r\n\r\n";
+    } else {
+      response += head + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+    if(!keep_alive) {
+      open = false;
+    }
+  };
+  /*
+   * Process the request once it is complete
+   */
+  void receive() {
+    size_t end = request.find("\r\n\r\n");
+    if(end == std::string::npos) {
+      return;
+    }
+    size_t length = 0;
+    size_t header = request.find("Content-Length: ");
+    if(header != std::string::npos && header < end) {
+      length = atol(request.c_str() + header + 16);
+    }
+    if(request.size() < end + 4 + length) {
+      return;
+    }
+    delay(rtt_ms);
+    if(discard) {
+      discard = false;
+      open = false;
+      request.clear();
+      return;
+    }
+    processed++;
+    bodies.push_back(request.substr(end + 4, length));
+    request.clear();
+    Failure current = failure;
+    failure = none;
+    if(current == timeout) {
+      return;
+    }
+    respond();
+    if(current == cut) {
+      response.resize(position + 5);
+      open = false;
+    }
+  };
+public:
+  int connect(const char *host, uint16_t port) override {
+    delay(rtt_ms);
+    if(refuse) {
+      return 0;
+    }
+    connects++;
+    open = true;
+    discard = false;
+    request.clear();
+    response.clear();
+    position = 0;
+    return 1;
+  };
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if(!open) {
+      return 0;
+    }
+    if(request.empty() && failure == reset) {
+      failure = none;
+      open = false;
+      return 0;
+    }
+    if(request.empty() && failure == closed) {
+      failure = none;
+      discard = true;
+    }
+    request.append((const char *)buffer, size);
+    bytes_in += size;
+    receive();
+    return size;
+  };
+  int available() override { return response.size() - position; };
+  int read() override {
+    if(position >= response.size()) {
+      return -1;
+    }
+    bytes_out++;
+    return (uint8_t)response[position++];
+  };
+  int read(uint8_t *buffer, size_t size) override {
+    size_t count = 0;
+    while(count < size && position < response.size()) {
+      buffer[count++] = read();
+    }
+    return count;
+  };
+  int peek() override { return position < response.size() ? (uint8_t)response[position] : -1; };
+  void stop() override {
+    open = false;
+    response.clear();
+    position = 0;
+    request.clear();
+  };
+  uint8_t connected() override { return open || available() > 0; };
+};
+
+const uint8_t batch_values = 8;
+
+/*
+ * A batch as the backlog sends it
+ */
+void write_batch(H32_Json_Writer &json, const void *context) {
+  json.beginObject();
+  json.key("data");
+  json.beginArray();
+  for(uint8_t i = 0; i < batch_values; i++) {
+    json.beginObject();
+    json.key("value");
+    json.value(21.5 + i * 0.25);
+    json.key("epoch");
+    json.value((uint32_t)(1700000000 + i * 600));
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+}
+
+int post(H32_HTTP &http) {
+  return http.post("/update.json", "", "application/json", {write_batch, NULL});
+}
+
+/*
+ * The reused connection fails in the given way on the next request
+ * @return the status of that request
+ */
+int reused_fails(Stand_In_Server::Failure failure, Stand_In_Server &server) {
+  H32_HTTP http(server, "api.example.com");
+  H32_CHECK(post(http) == 200 && server.connects == 1);
+  server.failure = failure;
+  return post(http);
+}
+
+/*
+ * Post requests and report the virtual time, the connections and the bytes
+ */
+void bench(const char *name, Stand_In_Server &server, uint16_t posts, uint16_t idle_close = 0) {
+  H32_HTTP http(server, "api.example.com");
+  host_time_us = 0;
+  auto start = std::chrono::steady_clock::now();
+  uint16_t ok = 0;
+  for(uint16_t i = 0; i < posts; i++) {
+    if(idle_close != 0 && i % idle_close == idle_close - 1) {
+      server.failure = Stand_In_Server::closed;
+    }
+    ok += post(http) == 200;
+  }
+  double host_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  H32_CHECK(ok == posts && server.processed == posts);
+  printf("%-22s %4u %6.1f ms %8.1f %9.1f %9.2f\n", name, server.connects,
+         (double)millis() / posts, (double)server.bytes_in / posts, (double)server.bytes_out / posts, host_us / posts);
+}
+
+int main() {
+  // Requests share the connection, the response body is skipped
+  for(int chunked = 0; chunked < 2; chunked++) {
+    Stand_In_Server server;
+    server.chunked = chunked;
+    H32_HTTP http(server, "api.example.com");
+    for(int i = 0; i < 3; i++) {
+      H32_CHECK(post(http) == 200);
+    }
+    H32_CHECK(server.connects == 1 && server.processed == 3 && http.getRequests() == 3);
+    H32_Json_Writer expected(NULL);
+    write_batch(expected, NULL);
+    H32_CHECK(server.bodies.size() == 3 && server.bodies[2].size() == expected.length());
+  }
+
+  // The server closes the connection after every response
+  {
+    Stand_In_Server server;
+    server.keep_alive = false;
+    H32_HTTP http(server, "api.example.com");
+    H32_CHECK(post(http) == 200 && post(http) == 200);
+    H32_CHECK(server.connects == 2 && server.processed == 2);
+  }
+
+  // The idle connection has been closed by the server: the request cannot
+  // have been processed and is repeated on a new connection
+  {
+    Stand_In_Server server;
+    H32_CHECK(reused_fails(Stand_In_Server::reset, server) == 200);
+    H32_CHECK(server.connects == 2 && server.processed == 2);
+  }
+  {
+    Stand_In_Server server;
+    uint64_t start = host_time_us;
+    H32_CHECK(reused_fails(Stand_In_Server::closed, server) == 200);
+    H32_CHECK(server.connects == 2 && server.processed == 2);
+    // the close is noticed without waiting for the timeout
+    H32_CHECK(host_time_us - start < http_timeout * 1000ULL);
+  }
+
+  // The request may have been processed: no repetition, the connection is
+  // closed so that a late response cannot be taken for the next one
+  {
+    Stand_In_Server server;
+    uint64_t start = host_time_us;
+    H32_CHECK(reused_fails(Stand_In_Server::timeout, server) == -1);
+    H32_CHECK(server.connects == 1 && server.processed == 2);
+    H32_CHECK(host_time_us - start < 2 * http_timeout * 1000ULL);
+    H32_HTTP http(server, "api.example.com");
+    H32_CHECK(post(http) == 200 && server.connects == 2 && server.processed == 3);
+  }
+  {
+    Stand_In_Server server;
+    H32_CHECK(reused_fails(Stand_In_Server::cut, server) == -1);
+    H32_CHECK(server.connects == 1 && server.processed == 2);
+  }
+
+  // A new connection is not tried again
+  {
+    Stand_In_Server server;
+    server.failure = Stand_In_Server::reset;
+    H32_HTTP http(server, "api.example.com");
+    H32_CHECK(post(http) == -1 && server.connects == 1 && server.processed == 0);
+    server.refuse = true;
+    H32_CHECK(post(http) == -1 && server.connects == 1);
+  }
+
+  // Benchmark: a backlog of 50 batches with a round trip of 40 ms
+  printf("%-22s %4s %9s %8s %9s %9s\n", "50 posts", "conn", "per post", "bytes in", "bytes out", "host us");
+  Stand_In_Server kept, closing, idle;
+  closing.keep_alive = false;
+  bench("keep-alive", kept, 50);
+  bench("connection per post", closing, 50);
+  bench("idle close every 10", idle, 50, 10);
+  H32_CHECK(kept.connects == 1 && closing.connects == 50 && idle.connects == 6);
+
+  return h32_test_end();
+}
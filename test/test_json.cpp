@@ -0,0 +1,381 @@
+/*
+ * The streaming json writer (H32_Json.h): its numbers and strings, output
+ * that does not depend on the chunks, and a benchmark of the bytes copied
+ * and of the peak stack against serializing into a buffer first.
+ *
+ * With ArduinoJson (cmake -DARDUINOJSON_DIR=<its checkout>) the output is
+ * compared byte by byte with the one of serializeJson(), and the benchmark
+ * includes the document the sketch used before.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "h32_test.h"
+#include "H32_Json.h"
+
+#ifdef H32_TEST_ARDUINOJSON
+#include <ArduinoJson.h>
+#endif // H32_TEST_ARDUINOJSON
+
+/*
+ * Keeps what it gets and counts the writes, optionally takes only a part
+ */
+class Memory_Print : public Print {
+public:
+  std::string text;
+  uint32_t writes = 0;
+  size_t largest = 0;
+  size_t accept = SIZE_MAX;   // of the bytes written
+
+  size_t write(const uint8_t *buffer, size_t size) override {
+    size_t taken = size < accept ? size : accept;
+    accept -= taken;
+    text.append((const char *)buffer, taken);
+    writes++;
+    largest = size > largest ? size : largest;
+    return taken;
+  };
+};
+
+std::string json_value(double value) {
+  Memory_Print out;
+  H32_Json_Writer json(&out);
+  json.value(value);
+  json.flush();
+  return out.text;
+}
+
+std::string json_string(const char *value) {
+  Memory_Print out;
+  H32_Json_Writer json(&out);
+  json.value(value);
+  json.flush();
+  return out.text;
+}
+
+/*
+ * A record of the log with the core values, as the batches send it
+ */
+typedef struct Record {
+  uint32_t epoch;
+  float values[6];
+} Record;
+
+const char *names[6] = {"Temperature", "Humidity", "Battery Voltage", "External Voltage",
+                        "Battery Percentage", "Battery Charge Rate"};
+
+std::vector<Record> make_records(uint16_t num) {
+  std::vector<Record> records(num);
+  for(uint16_t i = 0; i < num; i++) {
+    records[i] = {1700000000u + i * 600u, {21.37f + i * 0.11f, 48.2f - i * 0.3f, 3.912f, 0.0f, 87.0f - i, -0.25f}};
+  }
+  return records;
+}
+
+typedef struct Batch {
+  const Record *records;
+  uint16_t num;
+} Batch;
+
+/*
+ * The IOTPlotter batch: the values grouped by name, each with its epoch
+ */
+void write_batch(H32_Json_Writer &json, const void *context) {
+  const Batch *batch = (const Batch *)context;
+  json.beginObject();
+  json.key("data");
+  json.beginObject();
+  for(uint8_t field = 0; field < 6; field++) {
+    json.key(names[field]);
+    json.beginArray();
+    for(uint16_t i = 0; i < batch->num; i++) {
+      json.beginObject();
+      json.key("value");
+      json.value(round(batch->records[i].values[field] * 100) / 100.0);
+      json.key("epoch");
+      json.value(batch->records[i].epoch);
+      json.endObject();
+    }
+    json.endArray();
+  }
+  json.endObject();
+  json.endObject();
+}
+
+#ifdef H32_TEST_ARDUINOJSON
+/*
+ * The same batch as a document, as the sketch built it before the writer
+ */
+template<typename Document> void fill_document(Document &doc, const Batch *batch) {
+  JsonObject data = doc.createNestedObject("data");
+  for(uint8_t field = 0; field < 6; field++) {
+    JsonArray values = data.createNestedArray(names[field]);
+    for(uint16_t i = 0; i < batch->num; i++) {
+      JsonObject entry = values.createNestedObject();
+      entry["value"] = round(batch->records[i].values[field] * 100) / 100.0;
+      entry["epoch"] = batch->records[i].epoch;
+    }
+  }
+}
+
+std::string arduinojson_value(double value) {
+  StaticJsonDocument<64> doc;
+  doc.set(value);
+  std::string text;
+  serializeJson(doc, text);
+  return text;
+}
+#endif // H32_TEST_ARDUINOJSON
+
+/*
+ * The peak stack of a function, from a thread with a painted stack. The
+ * part used by the thread itself is measured with an empty function and
+ * left out.
+ */
+const size_t paint_size = 256 * 1024;
+const uint8_t paint = 0xa5;
+
+typedef struct Job {
+  void (*function)(void *);
+  void *arg;
+} Job;
+
+void *run_job(void *arg) {
+  Job *job = (Job *)arg;
+  job->function(job->arg);
+  return NULL;
+}
+
+size_t painted_stack(void (*function)(void *), void *arg) {
+  uint8_t *stack = (uint8_t *)aligned_alloc(4096, paint_size);
+  memset(stack, paint, paint_size);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, paint_size);
+  Job job = {function, arg};
+  pthread_t thread;
+  pthread_create(&thread, &attr, run_job, &job);
+  pthread_join(thread, NULL);
+  pthread_attr_destroy(&attr);
+  size_t untouched = 0;
+  while(untouched < paint_size && stack[untouched] == paint) {
+    untouched++;
+  }
+  free(stack);
+  return paint_size - untouched;
+}
+
+void nothing(void *arg) {}
+
+size_t peak_stack(void (*function)(void *), void *arg) {
+  return painted_stack(function, arg) - painted_stack(nothing, NULL);
+}
+
+typedef struct Run {
+  const Batch *batch;
+  Memory_Print out;
+  bool complete;
+} Run;
+
+/*
+ * Count, then stream, like H32_HTTP::post() and mqtt_publish_json()
+ */
+void run_streamed(void *arg) {
+  Run *run = (Run *)arg;
+  H32_Json_Writer counter(NULL);
+  write_batch(counter, run->batch);
+  H32_Json_Writer json(&run->out);
+  write_batch(json, run->batch);
+  json.flush();
+  run->complete = json.length() == counter.length();
+}
+
+const size_t buffer_size = 1024;   // json_doc_size of the sketch
+
+/*
+ * Serialize into a buffer, then write it
+ */
+class Buffer_Print : public Print {
+public:
+  char *buffer;
+  size_t used = 0;
+  Buffer_Print(char *buffer) : buffer(buffer) {};
+  size_t write(const uint8_t *data, size_t size) override {
+    size_t taken = size < buffer_size - used ? size : buffer_size - used;
+    memcpy(buffer + used, data, taken);
+    used += taken;
+    return taken;
+  };
+};
+
+void run_buffered(void *arg) {
+  Run *run = (Run *)arg;
+  char buffer[buffer_size];
+  Buffer_Print into(buffer);
+  H32_Json_Writer json(&into);
+  write_batch(json, run->batch);
+  json.flush();
+  run->out.write((const uint8_t *)buffer, into.used);
+  run->complete = !json.hasFailed();
+}
+
+#ifdef H32_TEST_ARDUINOJSON
+void run_document(void *arg) {
+  Run *run = (Run *)arg;
+  StaticJsonDocument<buffer_size> doc;
+  fill_document(doc, run->batch);
+  char buffer[buffer_size];
+  size_t length = serializeJson(doc, buffer, sizeof(buffer));
+  run->out.write((const uint8_t *)buffer, length);
+  run->complete = !doc.overflowed() && length < sizeof(buffer) - 1;
+}
+#endif // H32_TEST_ARDUINOJSON
+
+int main() {
+  // Numbers: integral, decimal and exponent, at most 9 decimal places
+  H32_CHECK(json_value(0) == "0");
+  H32_CHECK(json_value(21.5) == "21.5");
+  H32_CHECK(json_value(-3.25) == "-3.25");
+  H32_CHECK(json_value(0.1) == "0.1");
+  H32_CHECK(json_value(3.912) == "3.912");
+  H32_CHECK(json_value(9999999) == "9999999");
+  H32_CHECK(json_value(1e7) == "1e7");
+  H32_CHECK(json_value(123456789) == "1.23456789e8");
+  H32_CHECK(json_value(1.5e-6) == "1.5e-6");
+  H32_CHECK(json_value(NAN) == "null" && json_value(INFINITY) == "null" && json_value(-INFINITY) == "null");
+  {
+    Memory_Print out;
+    H32_Json_Writer json(&out);
+    json.value((uint32_t)UINT32_MAX);
+    json.flush();
+    H32_CHECK(out.text == "4294967295");
+  }
+
+  // Every number reads back within the precision of the format: 9 decimal
+  // places between 1e-5 and 1, else 9 significant digits
+  srand(1);
+  uint32_t worst = 0;
+  for(int i = 0; i < 200000; i++) {
+    double magnitude = pow(10, rand() % 24 - 12);
+    double value = (rand() / (double)RAND_MAX - 0.5) * magnitude;
+    std::string text = json_value(value);
+    double back = strtod(text.c_str(), NULL);
+    bool places = fabs(value) > 1e-5 && fabs(value) < 1;
+    double error = places ? fabs(back - value) / 1e-9 : fabs((back - value) / value) / 1e-8;
+    if(error > 1) {
+      worst++;
+      if(worst < 5) {
+        printf("%.17g written as %s\n", value, text.c_str());
+      }
+    }
+  }
+  H32_CHECK(worst == 0);
+
+  // Strings are escaped
+  H32_CHECK(json_string("a\"b\\c") == "\"a\\\"b\\\\c\"");
+  H32_CHECK(json_string("\b\f\n\r\t") == "\"\\b\\f\\n\\r\\t\"");
+  H32_CHECK(json_string("Battery Voltage") == "\"Battery Voltage\"");
+
+  // The counting pass gives the length of the written one, the output is
+  // the same whatever the chunks, and no write exceeds a chunk
+  {
+    std::vector<Record> records = make_records(16);
+    Batch batch = {records.data(), 16};
+    H32_Json_Writer counter(NULL);
+    write_batch(counter, &batch);
+    Memory_Print out;
+    H32_Json_Writer json(&out);
+    write_batch(json, &batch);
+    json.flush();
+    H32_CHECK(out.text.size() == counter.length() && json.length() == counter.length());
+    H32_CHECK(out.largest == json_chunk_size && !json.hasFailed());
+    H32_CHECK(out.text.compare(0, 33, "{\"data\":{\"Temperature\":[{\"value\":") == 0);
+    H32_CHECK(out.text.compare(out.text.size() - 4, 4, "}]}}") == 0);
+    Batch single = {records.data(), 1};
+    Memory_Print one;
+    H32_Json_Writer small(&one);
+    write_batch(small, &single);
+    small.flush();
+    H32_CHECK(one.text == "{\"data\":{"
+                         "\"Temperature\":[{\"value\":21.37,\"epoch\":1700000000}],"
+                         "\"Humidity\":[{\"value\":48.2,\"epoch\":1700000000}],"
+                         "\"Battery Voltage\":[{\"value\":3.91,\"epoch\":1700000000}],"
+                         "\"External Voltage\":[{\"value\":0,\"epoch\":1700000000}],"
+                         "\"Battery Percentage\":[{\"value\":87,\"epoch\":1700000000}],"
+                         "\"Battery Charge Rate\":[{\"value\":-0.25,\"epoch\":1700000000}]}}");
+    H32_CHECK(one.writes == (one.text.size() + json_chunk_size - 1) / json_chunk_size);
+
+    // A Print that does not take everything is noticed
+    Memory_Print partial;
+    partial.accept = 100;
+    H32_Json_Writer failing(&partial);
+    write_batch(failing, &batch);
+    failing.flush();
+    H32_CHECK(failing.hasFailed() && partial.text.size() == 100);
+  }
+
+#ifdef H32_TEST_ARDUINOJSON
+  // Byte for byte the output of serializeJson()
+  {
+    srand(2);
+    uint32_t different = 0;
+    for(int i = 0; i < 200000; i++) {
+      double magnitude = pow(10, rand() % 24 - 12);
+      double value = i < 100000 ? round((rand() / (double)RAND_MAX - 0.5) * 20000) / 100.0
+                                : (rand() / (double)RAND_MAX - 0.5) * magnitude;
+      if(json_value(value) != arduinojson_value(value)) {
+        different++;
+        if(different < 5) {
+          printf("%.17g: %s, ArduinoJson %s\n", value, json_value(value).c_str(), arduinojson_value(value).c_str());
+        }
+      }
+    }
+    H32_CHECK(different == 0);
+    for(uint16_t num = 1; num <= 8; num++) {
+      std::vector<Record> records = make_records(num);
+      Batch batch = {records.data(), num};
+      DynamicJsonDocument doc(16384);
+      fill_document(doc, &batch);
+      std::string expected;
+      serializeJson(doc, expected);
+      Memory_Print out;
+      H32_Json_Writer json(&out);
+      write_batch(json, &batch);
+      json.flush();
+      H32_CHECK(out.text == expected);
+    }
+  }
+#endif // H32_TEST_ARDUINOJSON
+
+  // Benchmark: bytes copied (into the chunk or buffer, then to the Print)
+  // and peak stack for batches of the IOTPlotter format
+  printf("records  bytes | streamed: copied writes stack | buffered: copied stack");
+#ifdef H32_TEST_ARDUINOJSON
+  printf(" | document: stack");
+#endif // H32_TEST_ARDUINOJSON
+  printf("\n");
+  const uint16_t sizes[] = {1, 4, 8, 32};
+  for(uint16_t num : sizes) {
+    std::vector<Record> records = make_records(num);
+    Batch batch = {records.data(), num};
+    Run streamed = {&batch, Memory_Print(), false};
+    size_t streamed_stack = peak_stack(run_streamed, &streamed);
+    Run buffered = {&batch, Memory_Print(), false};
+    size_t buffered_stack = peak_stack(run_buffered, &buffered);
+    size_t bytes = streamed.out.text.size();
+    H32_CHECK(streamed.complete && streamed_stack < 1024);
+    H32_CHECK(buffered.complete == (bytes <= buffer_size));
+    printf("%7u %6zu | %15zu %6u %5zu | %16zu %5zu%s", num, bytes, bytes, streamed.out.writes, streamed_stack,
+           buffered.out.text.size() * 2, buffered_stack, buffered.complete ? "" : " truncated");
+#ifdef H32_TEST_ARDUINOJSON
+    Run document = {&batch, Memory_Print(), false};
+    size_t document_stack = peak_stack(run_document, &document);
+    printf(" | %5zu%s", document_stack, document.complete ? "" : " truncated");
+#endif // H32_TEST_ARDUINOJSON
+    printf("\n");
+  }
+
+  return h32_test_end();
+}
@@ -0,0 +1,243 @@
+/*
+ * Power loss while the measurement log (H32_Log.h) is written: every
+ * append() and acknowledge() is cut after each possible number of bytes,
+ * with the rest of the interrupted write either untouched or garbage. After
+ * the reboot open() and resume() have to recover a log in which every
+ * pending record is intact and no acknowledged record is pending again.
+ */
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "h32_test.h"
+#include "H32_Log.h"
+
+/*
+ * The storage in memory. Every byte reaches it when it is written, the
+ * power is lost once budget bytes have been written.
+ */
+class Memory_Storage : public H32_Log_Storage {
+public:
+  std::vector<uint8_t> image;
+  int64_t budget = -1;      // unlimited
+  bool garbage = false;     // the rest of the interrupted write
+  uint32_t written = 0;
+  uint32_t syncs = 0;
+
+  Memory_Storage() : image(H32_Log::storageSize(), log_uncommitted) {};
+
+  bool read(uint32_t offset, void *data, size_t length) override {
+    if(offset + length > image.size()) {
+      return false;
+    }
+    memcpy(data, &image[offset], length);
+    return true;
+  };
+  bool write(uint32_t offset, const void *data, size_t length) override {
+    const uint8_t *bytes = (const uint8_t *)data;
+    if(offset + length > image.size()) {
+      return false;
+    }
+    for(size_t i = 0; i < length; i++) {
+      if(budget == 0) {
+        for(; garbage && i < length; i++) {
+          image[offset + i] = bytes[i] ^ 0x5A;
+        }
+        return false;
+      }
+      image[offset + i] = bytes[i];
+      written++;
+      budget -= budget > 0 ? 1 : 0;
+    }
+    return true;
+  };
+  bool sync() override {
+    if(budget == 0) {
+      return false;
+    }
+    syncs++;
+    return true;
+  };
+};
+
+typedef std::vector<std::string> Names;
+std::map<uint32_t, Names> expected;   // the names of the records by sequence number
+
+float value_of(uint32_t seq, uint8_t index) {
+  return seq * 10.0f + index;
+}
+
+/*
+ * Append a record with values of the names, as backlog_record() does
+ */
+bool append(H32_Log &log, const Names &names) {
+  H32_Log_Record record;
+  memset(&record, 0, sizeof(record));
+  uint32_t seq = log.getHead() + 1;
+  record.epoch = 1700000000 + seq * 600;
+  record.temperature = seq * 0.25f;
+  record.humidity = NAN;
+  expected[seq] = names;
+  for(uint8_t i = 0; i < names.size(); i++) {
+    uint8_t id = log.nameId(names[i].c_str());
+    if(id == log_name_none) {
+      return false;
+    }
+    record.additional[record.additional_num].id = id;
+    record.additional[record.additional_num++].value = value_of(seq, i);
+  }
+  return log.append(record);
+}
+
+/*
+ * All pending records can be read and are the ones that have been appended
+ */
+bool pending_intact(H32_Log &log) {
+  static H32_Log_Record records[log_slots];
+  uint16_t num = log.peek(records, log_slots);
+  bool intact = num == log.pending();
+  for(uint16_t i = 0; i < num && intact; i++) {
+    const H32_Log_Record &record = records[i];
+    const Names &names = expected[record.seq];
+    intact = record.seq > log.getTail() && record.seq <= log.getHead()
+          && record.epoch == 1700000000 + record.seq * 600
+          && record.temperature == record.seq * 0.25f && isnan(record.humidity)
+          && record.additional_num == names.size();
+    for(uint8_t j = 0; j < record.additional_num && intact; j++) {
+      const char *name = log.name(record.additional[j].id);
+      intact = name != NULL && names[j] == name && record.additional[j].value == value_of(record.seq, j);
+    }
+  }
+  return intact;
+}
+
+/*
+ * Run the operation on copies of the storage with the power lost after
+ * every possible number of bytes, then reboot and check the recovered log
+ */
+void cut_everywhere(const Memory_Storage &base, const char *what, std::function<bool(H32_Log &)> operation,
+                    uint32_t acknowledged = 0) {
+  Memory_Storage probe = base;
+  H32_Log probe_log(probe);
+  H32_CHECK(probe_log.open());
+  probe.written = 0;
+  probe.syncs = 0;
+  H32_CHECK(operation(probe_log));
+  uint32_t total = probe.written;
+  uint32_t failures = h32_test_failures;
+
+  for(int garbage = 0; garbage < 2; garbage++) {
+    for(uint32_t cut = 0; cut <= total; cut++) {
+      Memory_Storage storage = base;
+      H32_Log log(storage);
+      log.open();
+      uint32_t old_head = log.getHead(), old_tail = log.getTail();
+      storage.budget = cut;
+      storage.garbage = garbage;
+      bool done = operation(log);
+      H32_CHECK(!done);
+      storage.budget = -1;
+
+      H32_Log rebooted(storage);
+      H32_CHECK(rebooted.open());
+      if(acknowledged == 0) {
+        // a record is visible completely or not at all
+        H32_CHECK(rebooted.getHead() == old_head || rebooted.getHead() == old_head + 1);
+        H32_CHECK(rebooted.getTail() == old_tail);
+      } else {
+        H32_CHECK(rebooted.getHead() == old_head);
+        H32_CHECK(rebooted.getTail() == old_tail || rebooted.getTail() == acknowledged);
+      }
+      H32_CHECK(pending_intact(rebooted));
+
+      // the wake state only knows the head of a completed append
+      H32_Log resumed(storage);
+      H32_CHECK(resumed.resume(old_head));
+      H32_CHECK(resumed.getHead() == rebooted.getHead() && resumed.getTail() == rebooted.getTail());
+
+      // and the log can be written again
+      H32_CHECK(append(rebooted, {"Soil Moisture", "Recovered"}) && pending_intact(rebooted));
+      H32_Log again(storage);
+      H32_CHECK(again.open() && again.getHead() == rebooted.getHead() && pending_intact(again));
+    }
+  }
+  printf("%-34s %4u bytes, %u syncs: %s\n", what, total, probe.syncs,
+         failures == (uint32_t)h32_test_failures ? "recovered at every cut" : "FAILED");
+}
+
+int main() {
+  printf("record %zu bytes, name %zu bytes, storage %u bytes\n",
+         sizeof(H32_Log_Record), sizeof(H32_Log_Name), H32_Log::storageSize());
+  H32_CHECK(sizeof(H32_Log_Record) <= 256);
+
+  // Some records of which the first ones have been sent
+  Memory_Storage base;
+  H32_Log log(base);
+  H32_CHECK(log.open() && log.getHead() == 0 && log.pending() == 0);
+  for(int i = 0; i < 10; i++) {
+    H32_CHECK(append(log, {"Soil Moisture", "Power Mode"}));
+  }
+  // both headers hold a tail
+  H32_CHECK(log.acknowledge(2) && log.acknowledge(4) && log.pending() == 6 && pending_intact(log));
+
+  cut_everywhere(base, "append", [](H32_Log &log) {
+    return append(log, {"Soil Moisture", "Power Mode"});
+  });
+  cut_everywhere(base, "append with a new name", [](H32_Log &log) {
+    return append(log, {"Power Mode", "Channel 1", "Soil Moisture"});
+  });
+  cut_everywhere(base, "acknowledge", [](H32_Log &log) {
+    return log.acknowledge(8);
+  }, 8);
+  cut_everywhere(base, "acknowledge all", [](H32_Log &log) {
+    return log.acknowledge(100);
+  }, 10);
+
+  // The ring has wrapped: the next record overwrites the oldest slot
+  Memory_Storage wrapped;
+  H32_Log wrapped_log(wrapped);
+  wrapped_log.open();
+  for(int i = 0; i < log_slots + 5; i++) {
+    H32_CHECK(append(wrapped_log, {i % 2 ? "Soil Moisture" : "Power Mode"}));
+  }
+  H32_CHECK(wrapped_log.pending() == log_slots && pending_intact(wrapped_log));
+  H32_CHECK(wrapped_log.acknowledge(wrapped_log.getHead() - 3) && wrapped_log.pending() == 3);
+  cut_everywhere(wrapped, "append over the oldest slot", [](H32_Log &log) {
+    return append(log, {"Soil Moisture"});
+  });
+
+  // The name table is full, the names of sent records are replaced. Name 0
+  // is used by a pending record, name 1 by the record being appended.
+  Memory_Storage full;
+  H32_Log full_log(full);
+  full_log.open();
+  char name[log_name_length + 1];
+  for(int i = 0; i < log_additional_num; i++) {
+    snprintf(name, sizeof(name), "Name %d", i);
+    H32_CHECK(append(full_log, {name}));
+  }
+  H32_CHECK(full_log.acknowledge(full_log.getHead()));
+  H32_CHECK(append(full_log, {"Name 0"}));
+  cut_everywhere(full, "append with a replaced name", [](H32_Log &log) {
+    return append(log, {"Name 1", "New Name"});
+  });
+  H32_Log replaced(full);
+  replaced.open();
+  H32_CHECK(append(replaced, {"Name 1", "New Name"}) && pending_intact(replaced));
+  H32_CHECK(replaced.nameId("Name 2") != log_name_none);
+
+  // A full table of names of pending records cannot take another one
+  Memory_Storage pending;
+  H32_Log pending_log(pending);
+  pending_log.open();
+  for(int i = 0; i < log_additional_num; i++) {
+    snprintf(name, sizeof(name), "Name %d", i);
+    H32_CHECK(append(pending_log, {name}));
+  }
+  H32_CHECK(pending_log.nameId("Another Name") == log_name_none);
+  H32_CHECK(pending_log.nameId("Name 7") != log_name_none);
+  H32_CHECK(pending_log.acknowledge(1) && pending_log.nameId("Another Name") == 0);
+
+  return h32_test_end();
+}
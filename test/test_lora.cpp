@@ -0,0 +1,145 @@
+/*
+ * The parts of the LoRa extension without the radio (H32_LoRa.h): the time
+ * on air against the formula of Semtech AN1200.13, computed in floating
+ * point, and the airtime credit of the duty cycle across wake cycles.
+ */
+#include <math.h>
+
+#include "h32_test.h"
+#include "H32_LoRa.h"
+
+/*
+ * AN1200.13 as written there, with explicit header and CRC:
+ *   T_sym = 2^SF / BW
+ *   n_payload = 8 + max(ceil((8 PL - 4 SF + 28 + 16) / (4 (SF - 2 DE))) (CR + 4), 0)
+ *   T_packet = (n_preamble + 4.25 + n_payload) T_sym
+ * with DE (low data rate optimization) on for symbols longer than 16 ms
+ */
+double semtech_airtime(uint8_t length, uint8_t sf, uint32_t bandwidth, uint8_t coding_rate, bool &de) {
+  double symbol = pow(2, sf) / bandwidth * 1000;
+  de = symbol > 16;
+  double blocks = ceil((8.0 * length - 4 * sf + 28 + 16) / (4 * (sf - 2 * (de ? 1 : 0))));
+  double payload = 8 + fmax(blocks * coding_rate, 0);
+  return (lora_preamble + 4.25 + payload) * symbol;
+}
+
+int main() {
+  // Single packets, the exact time in ms from the formula
+  H32_CHECK(lora_airtime(51, 7, 125000, 5) == 103);     // 102.656
+  H32_CHECK(lora_airtime(51, 10, 125000, 5) == 617);    // 616.448
+  H32_CHECK(lora_airtime(0, 7, 125000, 5) == 26);       // 25.856
+  H32_CHECK(lora_airtime(242, 7, 125000, 5) == 380);    // 379.136
+  H32_CHECK(lora_airtime(51, 7, 500000, 5) == 26);      // 25.664
+  // SF11 and SF12 at 125 kHz and SF12 at 250 kHz with the low data rate
+  // optimization, without it SF11 would take 1150.976 ms
+  H32_CHECK(lora_airtime(51, 11, 125000, 5) == 1315);   // 1314.816
+  H32_CHECK(lora_airtime(12, 11, 125000, 8) == 725);    // 724.992
+  H32_CHECK(lora_airtime(51, 12, 125000, 5) == 2466);   // 2465.792
+  H32_CHECK(lora_airtime(12, 12, 125000, 5) == 1156);   // 1155.072
+  H32_CHECK(lora_airtime(20, 12, 250000, 5) == 660);    // 659.456
+
+  // Every length, spreading factor, bandwidth and coding rate
+  const uint32_t bandwidths[] = {62500, 125000, 250000, 500000};
+  uint32_t compared = 0, optimized = 0;
+  for(uint8_t sf = 7; sf <= 12; sf++) {
+    for(uint32_t bandwidth : bandwidths) {
+      for(uint8_t coding_rate = 5; coding_rate <= 8; coding_rate++) {
+        for(uint16_t length = 0; length <= 255; length++) {
+          bool de;
+          double reference = semtech_airtime(length, sf, bandwidth, coding_rate, de);
+          uint32_t airtime = lora_airtime(length, sf, bandwidth, coding_rate);
+          if(airtime != (uint32_t)ceil(reference - 1e-9)) {
+            printf("SF%u %u Hz 4/%u %u bytes: %u ms, %.3f ms by the formula\n",
+                   sf, bandwidth, coding_rate, length, airtime, reference);
+            H32_CHECK(false);
+          }
+          compared++;
+          optimized += de ? 1 : 0;
+        }
+      }
+    }
+  }
+  H32_CHECK(optimized > 0 && optimized < compared);
+  printf("airtime of %u packets as by AN1200.13, %u with low data rate optimization\n", compared, optimized);
+
+  // The sub-bands of EU868
+  H32_CHECK(lora_duty_cycle(868100000) == 100);
+  H32_CHECK(lora_duty_cycle(868700000) == 10);
+  H32_CHECK(lora_duty_cycle(869525000) == 1000);
+  H32_CHECK(lora_duty_cycle(869800000) == 100);
+  H32_CHECK(lora_duty_cycle(915000000) == lora_duty_none);
+
+  // A new bucket starts full: 1% of an hour is 36 s
+  {
+    H32_Duty_Cycle_State state = {0, 0};
+    H32_Duty_Cycle duty(state, 100);
+    uint32_t epoch = 1700000000;
+    H32_CHECK(duty.capacity() == 36000);
+    H32_CHECK(duty.spend(2466, epoch) && state.credit == 36000 - 2466 && state.epoch == epoch);
+
+    // the credit is spent by packets of SF12 in the same second
+    uint32_t sent = 1;
+    while(duty.spend(2466, epoch)) {
+      sent++;
+    }
+    H32_CHECK(sent == 14 && state.credit == 36000 - 14 * 2466);
+    // a vetoed packet takes nothing
+    uint32_t left = state.credit;
+    H32_CHECK(!duty.spend(2466, epoch) && state.credit == left);
+    // 1% refills 10 ms per second: the next packet after the missing credit
+    uint32_t wait = duty.wait(2466, epoch);
+    H32_CHECK(wait == (2466 - left + 9) / 10);
+    H32_CHECK(!duty.spend(2466, epoch + wait - 1));
+    H32_CHECK(duty.spend(2466, epoch + wait) && state.credit < 10);
+
+    // Across wake cycles: the state is stored and restored, as by the
+    // extension, and the credit of the time in between is added
+    H32_Duty_Cycle_State stored = state;
+    uint32_t now = epoch + wait;
+    for(uint8_t cycle = 0; cycle < 10; cycle++) {
+      now += 600;
+      H32_Duty_Cycle_State restored = stored;
+      H32_Duty_Cycle wake(restored, 100);
+      H32_CHECK(wake.spend(1315, now));
+      stored = restored;
+    }
+    // 10 cycles of 10 minutes earned 60 s, but the bucket holds 36 s
+    H32_CHECK(stored.credit == 36000 - 1315);
+
+    // A vetoed packet is not stored: the next wake adds the same credit
+    // again from the stored epoch
+    H32_Duty_Cycle_State empty = {now, 1000};
+    H32_Duty_Cycle_State vetoed = empty;
+    H32_Duty_Cycle first(vetoed, 100);
+    H32_CHECK(!first.spend(2466, now + 100) && vetoed.credit == 2000 && vetoed.epoch == now + 100);
+    H32_Duty_Cycle_State restored = empty;
+    H32_Duty_Cycle second(restored, 100);
+    H32_CHECK(second.spend(2466, now + 200) && restored.credit == 3000 - 2466);
+
+    // the clock went back: nothing is added, the epoch follows the clock
+    H32_Duty_Cycle_State back = {now, 500};
+    H32_Duty_Cycle behind(back, 100);
+    H32_CHECK(!behind.spend(1315, now - 3600) && back.credit == 500 && back.epoch == now - 3600);
+    H32_CHECK(behind.spend(1315, now - 3600 + 82) && back.credit == 500 + 820 - 1315);
+  }
+
+  // A packet longer than the bucket never fits, 0.1% holds 3.6 s
+  {
+    H32_Duty_Cycle_State state = {0, 0};
+    H32_Duty_Cycle duty(state, 10);
+    H32_CHECK(duty.capacity() == 3600 && duty.wait(4000, 1700000000) == UINT32_MAX);
+    H32_CHECK(duty.spend(2466, 1700000000) && duty.wait(2466, 1700000000) == 1332);
+  }
+
+  // Without a duty cycle nothing is counted
+  {
+    H32_Duty_Cycle_State state = {0, 0};
+    H32_Duty_Cycle duty(state, lora_duty_none);
+    for(uint8_t i = 0; i < 100; i++) {
+      H32_CHECK(duty.spend(2466, 1700000000));
+    }
+    H32_CHECK(duty.wait(2466, 1700000000) == 0);
+  }
+
+  return h32_test_end();
+}
@@ -0,0 +1,255 @@
+/*
+ * The measurement registry of H32_Measurements.h: interning by name, its
+ * capacity, the fixed point values and their scale, the quality and the
+ * stamp. Then a benchmark of the heap allocations of a wake cycle, the
+ * registry against the map of pointers to names that was passed by value
+ * before.
+ */
+#include <new>
+#include <stdlib.h>
+#include <unordered_map>
+
+#include "h32_test.h"
+#include "H32_Measurements.h"
+#include "H32_Json.h"
+
+/*
+ * Every allocation on the heap is counted
+ */
+uint32_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *memory = malloc(size ? size : 1);
+  if(memory == NULL) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
+/*
+ * The sensors of the board, as read by the sketch
+ */
+char analog_name[] = "Soil Moisture";
+bool sensor_present = true;
+
+bool read_adc() { return true; }
+double read_bat_voltage() { return 3.912; }
+double read_ext_voltage() { return 4.98; }
+void analog_collect(H32_Measurements &measurements) {
+  measurements.set(H32_Measurements::intern(analog_name, "V", 1000), 1.2345);
+}
+bool init_sensor() { return sensor_present; }
+bool read_sensor(float *temperature, float *humidity) {
+  *temperature = 21.456;
+  *humidity = 48.5;
+  return true;
+}
+
+/*
+ * The output of the sinks, it does not allocate
+ */
+class Buffer_Print : public Print {
+public:
+  char text[1024];
+  size_t length = 0;
+
+  size_t write(const uint8_t *buffer, size_t size) override {
+    size_t taken = size < sizeof(text) - length ? size : sizeof(text) - length;
+    memcpy(text + length, buffer, taken);
+    length += taken;
+    return taken;
+  };
+};
+
+/*
+ * A wake cycle: measure, an extension adds its value, stamp with the RTC,
+ * then the sinks iterate over the values
+ */
+uint32_t registry_wake(H32_Measurements &measurements, H32_Measurement_Id extension, Buffer_Print &out) {
+  measurements.reset();
+  measurements.readMeasurements();
+  measurements.set(extension, 1013.25);
+  measurements.stamp(1792252800);
+
+  // the Thingspeak fields
+  double fields[measurement_core_num];
+  for(H32_Measurement_Id id = 0; id < measurement_core_num; id++) {
+    fields[id] = measurements.get(id);
+  }
+  // the json of IOTPlotter and MQTT
+  out.length = 0;
+  H32_Json_Writer json(&out);
+  json.beginObject();
+  for(H32_Measurement_Id id = 0; id < H32_Measurements::count(); id++) {
+    if(measurements.has(id)) {
+      json.key(H32_Measurements::name(id));
+      json.value(measurements.get(id));
+    }
+  }
+  json.endObject();
+  json.flush();
+  return !isnan(fields[measurement_temperature]);
+}
+
+/*
+ * The same before the registry: the extensions put their values into a map
+ * keyed by the pointer to the name, which was passed to read_and_send_data()
+ * by value
+ */
+typedef std::unordered_map<char *, double> Map_Values;
+char pressure_name[] = "Pressure";
+
+uint32_t map_send(Map_Values values, Buffer_Print &out) {
+  out.length = 0;
+  H32_Json_Writer json(&out);
+  json.beginObject();
+  for(auto &value : values) {
+    json.key(value.first);
+    json.value(value.second);
+  }
+  json.endObject();
+  json.flush();
+  return values.size();
+}
+
+uint32_t map_wake(Buffer_Print &out) {
+  Map_Values values;
+  values[analog_name] = 1.2345;
+  values[pressure_name] = 1013.25;
+  return map_send(values, out);
+}
+
+int main() {
+  // The core quantities have their fixed ids
+  H32_CHECK(H32_Measurements::count() == measurement_core_num);
+  H32_CHECK(strcmp(H32_Measurements::name(measurement_bat_v), "Battery Voltage") == 0);
+  H32_CHECK(H32_Measurements::intern("Humidity") == measurement_humidity);
+
+  // A name is interned once, by its content and not by its pointer
+  char copy[] = "Soil Moisture";
+  H32_Measurement_Id soil = H32_Measurements::intern(analog_name, "V", 1000);
+  H32_CHECK(soil == measurement_core_num && H32_Measurements::intern(copy) == soil);
+  H32_CHECK(H32_Measurements::count() == measurement_core_num + 1);
+  H32_CHECK(H32_Measurements::quantity(soil).scale == 1000 && strcmp(H32_Measurements::quantity(soil).unit, "V") == 0);
+
+  // Values are fixed point with the scale of their quantity
+  {
+    H32_Measurements measurements;
+    H32_CHECK(!measurements.has(measurement_temperature) && isnan(measurements.get(measurement_temperature)));
+    measurements.set(measurement_temperature, 21.456);
+    H32_CHECK(measurements.getEntry(measurement_temperature).value == 2146);
+    H32_CHECK(measurements.get(measurement_temperature) == 21.46);
+    measurements.set(measurement_bat_v, -0.0014);
+    H32_CHECK(measurements.getEntry(measurement_bat_v).value == -1 && measurements.get(measurement_bat_v) == -0.001);
+
+    // a value that does not fit into 32 bits with its scale is marked as
+    // failed and not wrapped around, the last good one is not sent
+    measurements.set(measurement_humidity, 2.1e7);
+    H32_CHECK(measurements.has(measurement_humidity) && measurements.getEntry(measurement_humidity).value == 2100000000);
+    measurements.set(measurement_humidity, 2.2e7);
+    H32_CHECK(!measurements.has(measurement_humidity) && measurements.getEntry(measurement_humidity).quality == quality_failed);
+    measurements.set(measurement_humidity, -2.2e7);
+    H32_CHECK(!measurements.has(measurement_humidity) && isnan(measurements.get(measurement_humidity)));
+    // a counter with a scale of 1 fits, a scale below 1 is taken as 1
+    H32_Measurement_Id counter = H32_Measurements::intern("Pulses", "", 1);
+    H32_Measurement_Id clamped = H32_Measurements::intern("Rain", "mm", 0);
+    H32_CHECK(H32_Measurements::quantity(clamped).scale == 1);
+    measurements.set(counter, 2e9);
+    H32_CHECK(measurements.has(counter) && measurements.get(counter) == 2e9);
+    measurements.set(counter, 3e9);
+    H32_CHECK(measurements.getEntry(counter).quality == quality_failed);
+
+    // NAN and a failed sensor, unknown ids are ignored
+    measurements.set(measurement_ext_v, NAN);
+    H32_CHECK(measurements.getEntry(measurement_ext_v).quality == quality_failed);
+    measurements.set(soil, 1.5);
+    measurements.fail(soil);
+    H32_CHECK(!measurements.has(soil));
+    measurements.set(measurement_capacity - 1, 1.0);
+    measurements.set(measurement_none, 1.0);
+    measurements.fail(measurement_none);
+    H32_CHECK(!measurements.has(measurement_capacity - 1) && !measurements.has(measurement_none));
+  }
+
+  // The stamp sets the epoch of the values that have none, and of the
+  // values set later on. Values with their own epoch keep it.
+  {
+    H32_Measurements measurements;
+    measurements.set(measurement_temperature, 20.0);
+    measurements.set(measurement_humidity, 50.0, 1792252000);
+    measurements.fail(measurement_ext_v);
+    H32_CHECK(measurements.getEntry(measurement_temperature).epoch == 0 && measurements.getEpoch() == 0);
+    measurements.stamp(1792252800);
+    H32_CHECK(measurements.getEpoch() == 1792252800);
+    H32_CHECK(measurements.getEntry(measurement_temperature).epoch == 1792252800);
+    H32_CHECK(measurements.getEntry(measurement_humidity).epoch == 1792252000);
+    H32_CHECK(measurements.getEntry(measurement_ext_v).epoch == 0);
+    measurements.set(measurement_bat_v, 3.9);
+    H32_CHECK(measurements.getEntry(measurement_bat_v).epoch == 1792252800);
+    // a stamp at a later time does not change the epochs already set
+    measurements.stamp(1792253400);
+    H32_CHECK(measurements.getEntry(measurement_temperature).epoch == 1792252800);
+    measurements.reset();
+    H32_CHECK(measurements.getEpoch() == 0 && !measurements.has(measurement_temperature) && !measurements.isValid());
+  }
+
+  // The measurements of the board, the sensor is read once
+  {
+    H32_Measurements measurements;
+    H32_CHECK(measurements.getTemperature() == 21.46 && measurements.isValid() && measurements.isInitSuccessful());
+    H32_CHECK(measurements.getBatV() == 3.912 && measurements.getExtV() == 4.98 && measurements.get(soil) == 1.235);
+    sensor_present = false;
+    measurements.reset();
+    H32_CHECK(isnan(measurements.getHumidity()) && !measurements.isInitSuccessful());
+    H32_CHECK(measurements.getEntry(measurement_humidity).quality == quality_failed);
+    sensor_present = true;
+  }
+
+  // Heap allocations of a wake cycle. The registry lives on the stack, the
+  // quantities are interned once.
+  {
+    Buffer_Print out;
+    H32_Measurements measurements;
+    H32_Measurement_Id pressure = H32_Measurements::intern(pressure_name, "hPa", 100);
+    registry_wake(measurements, pressure, out);
+    const uint32_t wakes = 100;
+    allocations = 0;
+    uint32_t good = 0;
+    for(uint32_t wake = 0; wake < wakes; wake++) {
+      good += registry_wake(measurements, pressure, out);
+    }
+    uint32_t registry = allocations;
+    H32_CHECK(good == wakes && memmem(out.text, out.length, "\"Pressure\":1013.25", 18) != NULL);
+    H32_CHECK(memmem(out.text, out.length, "\"Soil Moisture\":1.235", 21) != NULL);
+
+    allocations = 0;
+    for(uint32_t wake = 0; wake < wakes; wake++) {
+      good += map_wake(out);
+    }
+    uint32_t map = allocations;
+    printf("Heap allocations per wake: %.1f with the registry, %.1f with the map\n",
+           (double)registry / wakes, (double)map / wakes);
+    H32_CHECK(registry == 0 && map > 0);
+    printf("Registry of %u values: %zu bytes on the stack\n", measurement_capacity, sizeof(H32_Measurements));
+  }
+
+  // The table of quantities is full at its capacity
+  while(H32_Measurements::count() < measurement_capacity) {
+    static char names[measurement_capacity][8];
+    char *name = names[H32_Measurements::count()];
+    snprintf(name, sizeof(names[0]), "q%u", H32_Measurements::count());
+    H32_CHECK(H32_Measurements::intern(name) == H32_Measurements::count() - 1);
+  }
+  H32_CHECK(H32_Measurements::intern("One too many") == measurement_none);
+  H32_CHECK(H32_Measurements::intern(analog_name) == soil && H32_Measurements::count() == measurement_capacity);
+  {
+    H32_Measurements measurements;
+    measurements.set(measurement_capacity - 1, 1.0);
+    H32_CHECK(measurements.has(measurement_capacity - 1));
+  }
+
+  return h32_test_end();
+}
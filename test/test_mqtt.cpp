@@ -0,0 +1,361 @@
+/*
+ * The MQTT client (H32_MQTT.h) against a fake broker that answers after a
+ * round trip of the virtual clock: the CONNECT, the window of messages
+ * with QoS 1 waiting for their PUBACK, the matching of the PUBACKs by
+ * their id and the DISCONNECT handshake. The benchmark compares the
+ * window with waiting for every PUBACK.
+ */
+#include <chrono>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "h32_test.h"
+#include "Client.h"
+#include "H32_MQTT.h"
+
+/*
+ * A broker behind a Client. Its packets arrive rtt_ms after the packet
+ * they answer has been sent completely.
+ */
+class Fake_Broker : public Client {
+public:
+  typedef struct Message {
+    std::string topic;
+    std::string payload;
+    uint8_t qos;
+    uint16_t id;
+    uint64_t time_us;   // of its arrival
+  } Message;
+
+  uint32_t rtt_ms = 50;
+  uint8_t connack_code = 0;
+  uint8_t hold = 0;               // PUBACKs held back and sent in reverse order
+  std::set<uint16_t> lost;        // ids without PUBACK
+  bool close_on_disconnect = true;
+
+  uint32_t connects = 0;
+  uint32_t disconnects = 0;
+  uint64_t bytes_in = 0;
+  std::string connect_packet;
+  std::vector<Message> messages;
+
+private:
+  typedef struct Packet {
+    uint64_t ready_us;
+    std::string bytes;
+  } Packet;
+
+  bool open = false;
+  uint64_t close_us = UINT64_MAX;
+  std::string in;
+  std::deque<Packet> out;
+  std::vector<uint16_t> held;
+
+  void send(const std::string &bytes) {
+    out.push_back({host_time_us + rtt_ms * 1000ULL, bytes});
+  };
+  void puback(uint16_t id) {
+    send(std::string{'\x40', '\x02', (char)(id >> 8), (char)(id & 0xFF)});
+  };
+  /*
+   * Handle the complete packets received so far
+   */
+  void receive() {
+    while(in.size() >= 2) {
+      uint32_t length = 0;
+      size_t position = 1;
+      for(uint8_t shift = 0; ; shift += 7) {
+        if(position >= in.size()) {
+          return;
+        }
+        uint8_t byte = in[position++];
+        length |= (uint32_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+          break;
+        }
+      }
+      if(in.size() < position + length) {
+        return;
+      }
+      uint8_t type = in[0];
+      std::string body = in.substr(position, length);
+      in.erase(0, position + length);
+      if(type == 0x10) {
+        connects++;
+        connect_packet = body;
+        send(std::string{'\x20', '\x02', '\x00', (char)connack_code});
+      } else if((type & 0xF0) == 0x30) {
+        uint8_t qos = (type >> 1) & 3;
+        uint16_t topic_length = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+        Message message = {body.substr(2, topic_length), "", qos, 0, host_time_us};
+        size_t payload = 2 + topic_length;
+        if(qos > 0) {
+          message.id = ((uint8_t)body[payload] << 8) | (uint8_t)body[payload + 1];
+          payload += 2;
+        }
+        message.payload = body.substr(payload);
+        messages.push_back(message);
+        if(qos == 0 || lost.count(message.id) != 0) {
+          continue;
+        }
+        if(hold == 0) {
+          puback(message.id);
+          continue;
+        }
+        held.push_back(message.id);
+        if(held.size() == hold) {
+          for(auto id = held.rbegin(); id != held.rend(); id++) {
+            puback(*id);
+          }
+          held.clear();
+        }
+      } else if(type == 0xE0) {
+        disconnects++;
+        if(close_on_disconnect) {
+          close_us = host_time_us + rtt_ms * 500ULL;
+        }
+      }
+    }
+  };
+  bool closed() const { return !open || host_time_us >= close_us; };
+public:
+  /*
+   * Send a packet that is not asked for, e.g. a PUBACK with a wrong id
+   */
+  void inject(const std::string &bytes) { out.push_back({host_time_us, bytes}); };
+
+  int connect(const char *host, uint16_t port) override {
+    delay(rtt_ms);
+    open = true;
+    close_us = UINT64_MAX;
+    in.clear();
+    out.clear();
+    held.clear();
+    return 1;
+  };
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if(closed()) {
+      return 0;
+    }
+    in.append((const char *)buffer, size);
+    bytes_in += size;
+    receive();
+    return size;
+  };
+  int available() override {
+    int num = 0;
+    for(const Packet &packet : out) {
+      if(packet.ready_us > host_time_us) {
+        break;
+      }
+      num += packet.bytes.size();
+    }
+    return num;
+  };
+  int read() override {
+    if(available() == 0) {
+      return -1;
+    }
+    uint8_t byte = out.front().bytes[0];
+    out.front().bytes.erase(0, 1);
+    if(out.front().bytes.empty()) {
+      out.pop_front();
+    }
+    return byte;
+  };
+  int read(uint8_t *buffer, size_t size) override {
+    size_t count = 0;
+    while(count < size && available() > 0) {
+      buffer[count++] = read();
+    }
+    return count;
+  };
+  int peek() override { return available() > 0 ? (uint8_t)out.front().bytes[0] : -1; };
+  void stop() override {
+    open = false;
+    out.clear();
+  };
+  uint8_t connected() override { return !closed() || available() > 0; };
+};
+
+bool connect(H32_MQTT &mqtt, const char *user = "", const char *passwd = "") {
+  return mqtt.connect("broker.example.com", 1883, "h32-test", user, passwd);
+}
+
+bool publish(H32_MQTT &mqtt, uint16_t i, uint8_t qos) {
+  char payload[32];
+  int length = snprintf(payload, sizeof(payload), "{\"value\":%u}", i);
+  return mqtt.publish("h32/test", (const uint8_t *)payload, length, qos);
+}
+
+/*
+ * Publish messages with QoS 1 and disconnect
+ * @return the virtual milliseconds it took
+ */
+uint32_t bench(Fake_Broker &broker, uint16_t num, bool window) {
+  H32_MQTT mqtt(broker);
+  host_time_us = 0;
+  H32_CHECK(connect(mqtt));
+  for(uint16_t i = 0; i < num; i++) {
+    H32_CHECK(publish(mqtt, i, 1));
+    if(!window) {
+      H32_CHECK(mqtt.drain());
+    }
+  }
+  H32_CHECK(mqtt.disconnect());
+  H32_CHECK(broker.messages.size() == num);
+  return millis();
+}
+
+int main() {
+  // The CONNECT with and without login, a refused CONNACK
+  {
+    Fake_Broker broker;
+    H32_MQTT mqtt(broker);
+    H32_CHECK(connect(mqtt) && mqtt.connected() && broker.connects == 1);
+    const std::string expected = std::string("\x00\x04MQTT\x04\x02\x00\x3c\x00\x08h32-test", 20);
+    H32_CHECK(broker.connect_packet == expected);
+    H32_CHECK(mqtt.disconnect());
+    H32_CHECK(connect(mqtt, "user", "secret"));
+    H32_CHECK(broker.connect_packet[7] == (char)0xC2);
+    H32_CHECK(broker.connect_packet.compare(20, 14, std::string("\x00\x04user\x00\x06secret", 14)) == 0);
+    H32_CHECK(mqtt.disconnect());
+    broker.connack_code = 5;
+    H32_CHECK(!connect(mqtt) && !mqtt.connected());
+  }
+
+  // QoS 0 is not acknowledged and does not wait
+  {
+    Fake_Broker broker;
+    H32_MQTT mqtt(broker);
+    connect(mqtt);
+    uint64_t start = host_time_us;
+    for(uint16_t i = 0; i < 20; i++) {
+      H32_CHECK(publish(mqtt, i, 0));
+    }
+    H32_CHECK(host_time_us == start && mqtt.pending() == 0);
+    H32_CHECK(broker.messages.size() == 20 && broker.messages[19].payload == "{\"value\":19}");
+    H32_CHECK(broker.messages[3].qos == 0 && broker.messages[3].id == 0);
+  }
+
+  // With QoS 1 the window fills before the first PUBACK is back, the next
+  // message waits for it
+  {
+    Fake_Broker broker;
+    H32_MQTT mqtt(broker);
+    connect(mqtt);
+    uint64_t start = host_time_us;
+    uint8_t most = 0;
+    for(uint16_t i = 0; i < 3 * mqtt_window; i++) {
+      H32_CHECK(publish(mqtt, i, 1));
+      most = mqtt.pending() > most ? mqtt.pending() : most;
+    }
+    H32_CHECK(most == mqtt_window);
+    for(uint16_t i = 0; i < mqtt_window; i++) {
+      H32_CHECK(broker.messages[i].time_us == start);
+    }
+    H32_CHECK(broker.messages[mqtt_window].time_us >= start + broker.rtt_ms * 1000ULL);
+    std::set<uint16_t> ids;
+    for(const Fake_Broker::Message &message : broker.messages) {
+      H32_CHECK(message.qos == 1 && message.id != 0);
+      ids.insert(message.id);
+    }
+    H32_CHECK(ids.size() == broker.messages.size());
+    H32_CHECK(mqtt.drain() && mqtt.pending() == 0);
+  }
+
+  // PUBACKs are matched by their id, whatever their order; one with an
+  // unknown id does not count
+  {
+    Fake_Broker broker;
+    broker.hold = 5;
+    H32_MQTT mqtt(broker);
+    connect(mqtt);
+    for(uint16_t i = 0; i < 20; i++) {
+      H32_CHECK(publish(mqtt, i, 1));
+    }
+    H32_CHECK(mqtt.drain() && mqtt.pending() == 0);
+
+    Fake_Broker lossy;
+    H32_MQTT lost(lossy);
+    connect(lost);
+    lossy.lost.insert(3);
+    for(uint16_t i = 0; i < 5; i++) {
+      publish(lost, i, 1);
+    }
+    lossy.inject(std::string("\x40\x02\x00\x63", 4));
+    uint64_t start = host_time_us;
+    H32_CHECK(!lost.drain() && lost.pending() == 1);
+    H32_CHECK(host_time_us - start >= mqtt_timeout * 1000ULL);
+    // the disconnect reports it, but still closes the connection
+    H32_CHECK(!lost.disconnect() && lossy.disconnects == 1 && !lost.connected());
+  }
+
+  // The ids never become 0 when they wrap
+  {
+    Fake_Broker broker;
+    broker.rtt_ms = 0;
+    H32_MQTT mqtt(broker);
+    connect(mqtt);
+    bool zero = false;
+    for(uint32_t i = 0; i < 65540; i++) {
+      publish(mqtt, i, 1);
+      zero = zero || broker.messages.back().id == 0;
+      broker.messages.clear();
+    }
+    H32_CHECK(!zero && mqtt.drain());
+  }
+
+  // A streamed payload has to be written completely
+  {
+    Fake_Broker broker;
+    H32_MQTT mqtt(broker);
+    connect(mqtt);
+    H32_CHECK(mqtt.beginPublish("h32/stream", 10, 1));
+    H32_CHECK(mqtt.write((const uint8_t *)"0123456789abc", 13) == 10);
+    H32_CHECK(mqtt.endPublish() && broker.messages.back().payload == "0123456789");
+    H32_CHECK(mqtt.beginPublish("h32/stream", 10, 1));
+    mqtt.write((const uint8_t *)"01234", 5);
+    H32_CHECK(!mqtt.endPublish());
+  }
+
+  // The DISCONNECT follows the last PUBACK, the connection is closed once
+  // the broker has closed it, or after the timeout
+  {
+    Fake_Broker broker;
+    H32_MQTT mqtt(broker);
+    connect(mqtt);
+    for(uint16_t i = 0; i < 3; i++) {
+      publish(mqtt, i, 1);
+    }
+    uint64_t start = host_time_us;
+    H32_CHECK(mqtt.disconnect() && broker.disconnects == 1 && mqtt.pending() == 0);
+    uint64_t took = host_time_us - start;
+    H32_CHECK(took >= broker.rtt_ms * 1500ULL && took < mqtt_timeout * 1000ULL);
+
+    Fake_Broker lingering;
+    lingering.close_on_disconnect = false;
+    H32_MQTT slow(lingering);
+    connect(slow);
+    publish(slow, 0, 1);
+    start = host_time_us;
+    H32_CHECK(slow.disconnect() && lingering.disconnects == 1 && !slow.connected());
+    H32_CHECK(host_time_us - start >= mqtt_timeout * 1000ULL);
+  }
+
+  // Benchmark: 200 messages with QoS 1, a round trip of 50 ms
+  const uint16_t num = 200;
+  Fake_Broker windowed, waiting;
+  auto start = std::chrono::steady_clock::now();
+  uint32_t window_ms = bench(windowed, num, true);
+  double host_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  uint32_t wait_ms = bench(waiting, num, false);
+  printf("%u messages, round trip 50 ms: window of %u %u ms (%.0f msgs/s), one at a time %u ms (%.0f msgs/s), "
+         "%.2f host us per message\n", num, mqtt_window, window_ms, num * 1000.0 / window_ms,
+         wait_ms, num * 1000.0 / wait_ms, host_us / num);
+  H32_CHECK(window_ms * 4 < wait_ms);
+
+  return h32_test_end();
+}
@@ -0,0 +1,220 @@
+/*
+ * The register cache of the PCF85063A driver (PCF85063A.cpp) on a fake
+ * I2C bus. A wake cycle through the cache of the H32_RTC.h backend is
+ * compared with the same cycle through the direct functions, as the
+ * sketch did it before the cache: both have to leave the chip in the same
+ * state, the cache with a fraction of the bus transactions.
+ */
+#include "h32_test.h"
+#include "Wire.h"
+#include "H32_RTC.h"
+
+/*
+ * The registers 00h to 11h of the chip. The register pointer increments
+ * with every byte and rolls over from 11h to 00h. The alarm and timer
+ * flags are only cleared by writing 0, writing 1 leaves them unchanged.
+ */
+class Fake_PCF85063A : public Host_I2C_Device {
+public:
+  uint8_t regs[PCF85063A_REG_NUM];
+  uint8_t pointer = 0;
+  uint8_t last_write = 0;   // the first register of the last write
+  uint8_t last_length = 0;  // and the number of registers
+
+  Fake_PCF85063A() {
+    memset(regs, 0, sizeof(regs));
+    // alarms disabled
+    memset(regs + 0x0B, 0x80, 5);
+  };
+  uint8_t receive(const uint8_t *data, uint8_t length) override {
+    if(length == 0 || data[0] >= PCF85063A_REG_NUM) {
+      return 0;
+    }
+    pointer = data[0];
+    if(length > 1) {
+      last_write = pointer;
+      last_length = length - 1;
+    }
+    for(uint8_t i = 1; i < length; i++) {
+      uint8_t value = data[i];
+      if(pointer == 0x01) {
+        // AF and TF
+        uint8_t flags = 0x48;
+        value = (value & ~flags) | (value & regs[pointer] & flags);
+      }
+      regs[pointer] = value;
+      pointer = (pointer + 1) % PCF85063A_REG_NUM;
+    }
+    return length;
+  };
+  uint8_t transmit(uint8_t *data, uint8_t length) override {
+    for(uint8_t i = 0; i < length; i++) {
+      data[i] = regs[pointer];
+      pointer = (pointer + 1) % PCF85063A_REG_NUM;
+    }
+    return length;
+  };
+
+  /*
+   * The chip woke the H32 with its alarm at 12:00:00 on 17 October 2026
+   */
+  void woken(uint8_t ram) {
+    const uint8_t time[7] = {0x00, 0x00, 0x12, 0x17, 0x06, 0x10, 0x26};
+    memcpy(regs + 0x04, time, sizeof(time));
+    regs[0x01] = 0xC0;   // AIE, AF
+    regs[0x03] = ram;
+    const uint8_t alarm[5] = {0x00, 0x00, 0x12, 0x80, 0x80};
+    memcpy(regs + 0x0B, alarm, sizeof(alarm));
+  };
+};
+
+tm wake_time(uint32_t seconds) {
+  tm time_info = {};
+  time_info.tm_year = 126;
+  time_info.tm_mon = 9;
+  time_info.tm_mday = 17;
+  time_info.tm_hour = 12;
+  time_info.tm_sec = seconds;
+  time_info.tm_isdst = 0;
+  mktime(&time_info);
+  return time_info;
+}
+
+/*
+ * RTC_stop_and_check() before the cache
+ */
+void direct_stop_and_check(PCF85063A &chip) {
+  PCF85063A_Regs regs = 0;
+  chip.ctrl_get(&regs);
+  chip.countdown_set(false, PCF85063A::CNTDOWN_CLOCK_1HZ, 0, false, false);
+  PCF85063A_Regs new_regs = regs;
+  PCF85063A_REG_SET(new_regs, PCF85063A_REG_AF);
+  PCF85063A_REG_SET(new_regs, PCF85063A_REG_TF);
+  if(PCF85063A_REG_GET(regs, PCF85063A_REG_AF)) PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_AF);
+  if(PCF85063A_REG_GET(regs, PCF85063A_REG_TF)) PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_TF);
+  PCF85063A_REG_CLEAR(new_regs, PCF85063A_REG_AIE);
+  chip.ctrl_set(new_regs, false);
+}
+
+/*
+ * RTC_set_alarm() before the cache: it stopped the alarm again, read the
+ * time, set the alarm and read the time once more
+ */
+void direct_set_alarm(PCF85063A &chip, uint32_t sleeptime) {
+  direct_stop_and_check(chip);
+  tm time_info;
+  chip.time_get(&time_info);
+  tm wakeup = wake_time(sleeptime);
+  chip.time_get(&time_info);
+  chip.alarm_set(&wakeup, true);
+}
+
+/*
+ * A wake cycle that failed to connect: check the wake cause, set the
+ * fallback alarm, get the time for the measurements, count the failed
+ * connection in the RAM and set the next alarm
+ */
+void direct_wake(PCF85063A &chip) {
+  direct_stop_and_check(chip);
+  direct_set_alarm(chip, 3600);
+  tm time_info;
+  chip.time_get(&time_info);
+  chip.ram_get();
+  chip.ram_set(chip.ram_get() + 1);
+  direct_set_alarm(chip, 600);
+}
+
+/*
+ * The same with the cache, as by H32_RTC.ino
+ */
+uint8_t cached_wake(H32_PCF85063A_RTC &rtc) {
+  rtc.load();
+  rtc.stop();
+  uint8_t cause = rtc.wake_cause();
+  tm wakeup = wake_time(3600);
+  rtc.alarm_set(&wakeup);
+  rtc.commit();
+  tm time_info;
+  rtc.now(&time_info);
+  rtc.ram_set(0, rtc.ram_get(0) + 1);
+  wakeup = wake_time(600);
+  rtc.alarm_set(&wakeup);
+  rtc.commit();
+  return cause;
+}
+
+int main() {
+  Fake_PCF85063A direct_chip;
+  Wire.attach(0x51, &direct_chip);
+  PCF85063A chip;
+  direct_chip.woken(3);
+  Wire.transactions = 0;
+  direct_wake(chip);
+  uint32_t direct = Wire.transactions;
+
+  Fake_PCF85063A cached_chip;
+  Wire.attach(0x51, &cached_chip);
+  H32_PCF85063A_RTC rtc;
+  cached_chip.woken(3);
+  Wire.transactions = 0;
+  H32_CHECK(cached_wake(rtc) == rtc_wake_alarm);
+  uint32_t cached = Wire.transactions;
+
+  // The same registers, with the alarm at 12:10:00, its interrupt enabled,
+  // the flag cleared and the RAM incremented
+  H32_CHECK(memcmp(direct_chip.regs, cached_chip.regs, sizeof(cached_chip.regs)) == 0);
+  H32_CHECK(cached_chip.regs[0x01] == 0x80 && cached_chip.regs[0x03] == 4);
+  H32_CHECK(cached_chip.regs[0x0B] == 0x00 && cached_chip.regs[0x0C] == 0x10 && cached_chip.regs[0x0D] == 0x12);
+  H32_CHECK((cached_chip.regs[0x11] & PCF85063A_REG_TE) == 0);
+
+  // one read of all registers (pointer and data) and a write per commit
+  printf("I2C transactions of a wake cycle: %u direct, %u with the cache\n", direct, cached);
+  H32_CHECK(direct == 38 && cached == 4);
+
+  // A commit writes the alarm, timer, control, offset and RAM registers in
+  // one transaction across the roll-over, but never the time, which went
+  // on since the load
+  {
+    Fake_PCF85063A fake;
+    fake.woken(0);
+    Wire.attach(0x51, &fake);
+    PCF85063A chip;
+    H32_CHECK(!chip.cache_valid() && !chip.cache_commit());
+    Wire.transactions = 0;
+    H32_CHECK(chip.cache_load() && chip.cache_valid() && Wire.transactions == 2);
+    tm time_info;
+    H32_CHECK(chip.cache_time_get(&time_info) && time_info.tm_hour == 12 && time_info.tm_mday == 17);
+    fake.regs[0x04] = 0x07;
+    chip.cache_ram_set(0xA5);
+    H32_CHECK(chip.cache_countdown_set(true, PCF85063A::CNTDOWN_CLOCK_1HZ, 200, true, false));
+    Wire.transactions = 0;
+    H32_CHECK(chip.cache_commit() && Wire.transactions == 1);
+    H32_CHECK(fake.last_write == 0x0B && fake.last_length == PCF85063A_REG_NUM - 7);
+    H32_CHECK(fake.regs[0x04] == 0x07 && fake.regs[0x03] == 0xA5);
+    H32_CHECK(fake.regs[0x10] == 200 && fake.regs[0x11] == (PCF85063A_REG_TE | PCF85063A_REG_TIE | 2 << 3));
+  }
+
+  // The flags acknowledged by stop() are cleared by the commit, a flag
+  // raised after the load is kept
+  {
+    Fake_PCF85063A fake;
+    fake.woken(0);
+    Wire.attach(0x51, &fake);
+    H32_PCF85063A_RTC rtc;
+    H32_CHECK(rtc.load());
+    rtc.stop();
+    fake.regs[0x01] |= 0x08;
+    H32_CHECK(rtc.commit() && fake.regs[0x01] == 0x08);
+  }
+
+  // Without the chip the cache stays invalid
+  {
+    Wire.attach(0x52, NULL);
+    Wire.present = false;
+    PCF85063A missing;
+    H32_CHECK(!missing.cache_load() && !missing.cache_valid() && !missing.cache_commit());
+    Wire.present = true;
+  }
+
+  return h32_test_end();
+}
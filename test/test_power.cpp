@@ -0,0 +1,199 @@
+/*
+ * The power policy of H32_Power.h: the levels, the charge factor and the
+ * survival mode with its hysteresis. Then six weeks of a solar powered
+ * H32 with a synthetic battery: a sunny week, two overcast ones, a dark
+ * one and the recovery. The policy is compared with a fixed sleep time,
+ * and survival mode with a hysteresis with one without.
+ */
+#include "h32_test.h"
+#include "H32_Power.h"
+
+const H32_Power_Level levels[power_level_num] = {{50, 2.0}, {25, 4.0}, {0, 1.0}, {0, 1.0}};
+
+H32_Power_Policy make_policy(uint8_t survival_hysteresis) {
+  return {levels, power_level_num, 1.0, 0.5, 10, 3600, survival_hysteresis};
+}
+
+/*
+ * The battery and the load of the board. A wake with the radio takes 2 s
+ * at 120 mA, one in survival mode 0.2 s at 40 mA.
+ */
+const double capacity_mAh = 100.0;
+const double sleep_mA = 0.015;
+const double radio_wake_mAh = 2.0 * 120.0 / 3600;
+const double quiet_wake_mAh = 0.2 * 40.0 / 3600;
+const uint32_t sleeptime = 600;
+const uint32_t weeks = 6;
+
+/*
+ * The peak current of the solar panel on each day, from 7:00 to 19:00
+ */
+double sun_peak_mA(uint32_t day) {
+  static const double week_peak[weeks] = {8.0, 0.25, 0.3, 0.0, 0.2, 6.0};
+  // a little variation from day to day
+  static const double day_factor[7] = {1.0, 0.8, 1.2, 0.9, 1.1, 0.7, 1.3};
+  return week_peak[day / 7] * day_factor[day % 7];
+}
+
+double solar_mA(uint32_t t) {
+  double hour = (t % 86400) / 3600.0;
+  if(hour < 7 || hour >= 19) {
+    return 0;
+  }
+  return sun_peak_mA(t / 86400) * sin(M_PI * (hour - 7) / 12);
+}
+
+typedef struct Simulation {
+  uint32_t wakes = 0;
+  uint32_t connections = 0;
+  uint32_t survival_entries = 0;
+  double lowest_exit = 100;     // the SoC survival mode has been left at
+  uint32_t empty_minutes = 0;   // the battery was empty, the H32 is off
+  double min_soc = 100;
+  uint32_t longest_sleep = 0;
+  uint32_t shortest_sleep = UINT32_MAX;
+} Simulation;
+
+/*
+ * Wake, decide and sleep for six weeks. The decision of a wake keeps the
+ * radio of the next wake off in survival mode, as by power_survival_mode().
+ * Without a policy the sleep time is fixed.
+ */
+Simulation simulate(const H32_Power_Policy *policy, bool print) {
+  Simulation sim;
+  double charge = capacity_mAh * 0.8;
+  H32_Power_Mode mode = power_mode_normal;
+  uint32_t t = 0;
+  uint32_t week = 0;
+  uint32_t week_connections = 0;
+  double week_min = 100;
+  while(t < weeks * 7 * 86400) {
+    double soc = 100 * charge / capacity_mAh;
+    if(t / (7 * 86400) != week) {
+      if(print) {
+        printf("  week %u: %4u connections, SoC %4.1f %% at least, %4.1f %% at the end\n",
+               week + 1, week_connections, week_min, soc);
+      }
+      week = t / (7 * 86400);
+      week_connections = 0;
+      week_min = 100;
+    }
+    if(charge > 0) {
+      // the gauge reports the rate of the net current
+      double charge_rate = 100 * (solar_mA(t) - sleep_mA) / capacity_mAh;
+      bool radio = mode != power_mode_survival;
+      charge -= radio ? radio_wake_mAh : quiet_wake_mAh;
+      sim.wakes++;
+      sim.connections += radio;
+      week_connections += radio;
+      H32_Power_Mode previous = mode;
+      uint32_t sleep = sleeptime;
+      if(policy != NULL) {
+        H32_Power_Decision decision = power_decide(*policy, soc, charge_rate, previous);
+        mode = decision.mode;
+        sleep = power_sleeptime(decision, *policy, sleeptime);
+      }
+      sim.survival_entries += mode == power_mode_survival && previous != power_mode_survival;
+      if(previous == power_mode_survival && mode != power_mode_survival) {
+        sim.lowest_exit = soc < sim.lowest_exit ? soc : sim.lowest_exit;
+      }
+      sim.longest_sleep = sleep > sim.longest_sleep ? sleep : sim.longest_sleep;
+      sim.shortest_sleep = sleep < sim.shortest_sleep ? sleep : sim.shortest_sleep;
+      for(uint32_t end = t + sleep; t < end; t += 60) {
+        charge += (solar_mA(t) - sleep_mA) / 60;
+        charge = charge > capacity_mAh ? capacity_mAh : charge;
+      }
+    } else {
+      // off until the sun has charged it again
+      sim.empty_minutes++;
+      mode = power_mode_normal;
+      charge += solar_mA(t) / 60;
+      t += 60;
+    }
+    charge = charge < 0 ? 0 : charge;
+    soc = 100 * charge / capacity_mAh;
+    sim.min_soc = soc < sim.min_soc ? soc : sim.min_soc;
+    week_min = soc < week_min ? soc : week_min;
+  }
+  if(print) {
+    printf("  week %u: %4u connections, SoC %4.1f %% at least, %4.1f %% at the end\n",
+           week + 1, week_connections, week_min, 100 * charge / capacity_mAh);
+  }
+  return sim;
+}
+
+int main() {
+  // The lowest threshold the SoC is below wins
+  {
+    H32_Power_Policy policy = make_policy(5);
+    H32_Power_Decision decision = power_decide(policy, 80, 0, power_mode_normal);
+    H32_CHECK(decision.mode == power_mode_normal && decision.level == -1 && decision.factor == 1.0);
+    decision = power_decide(policy, 40, 0, power_mode_normal);
+    H32_CHECK(decision.mode == power_mode_reduced && decision.level == 0 && decision.factor == 2.0);
+    decision = power_decide(policy, 20, 0, power_mode_reduced);
+    H32_CHECK(decision.mode == power_mode_reduced && decision.level == 1 && decision.factor == 4.0);
+    H32_CHECK(power_sleeptime(decision, policy, 600) == 2400);
+
+    // charging shortens the sleep time
+    decision = power_decide(policy, 20, 1.5, power_mode_reduced);
+    H32_CHECK(decision.mode == power_mode_charging && decision.factor == 2.0);
+    decision = power_decide(policy, 80, 1.0, power_mode_normal);
+    H32_CHECK(decision.mode == power_mode_charging && power_sleeptime(decision, policy, 600) == 300);
+    decision = power_decide(policy, 80, NAN, power_mode_normal);
+    H32_CHECK(decision.mode == power_mode_normal);
+
+    // without a SoC nothing changes
+    decision = power_decide(policy, NAN, 1.5, power_mode_survival);
+    H32_CHECK(decision.mode == power_mode_unknown && power_sleeptime(decision, policy, 600) == 600);
+  }
+
+  // Survival mode is entered below its SoC and only left at the SoC plus
+  // the hysteresis, even while charging
+  {
+    H32_Power_Policy policy = make_policy(5);
+    H32_Power_Decision decision = power_decide(policy, 9.9, 0, power_mode_reduced);
+    H32_CHECK(decision.mode == power_mode_survival && power_sleeptime(decision, policy, 600) == 3600);
+    H32_CHECK(power_sleeptime(decision, policy, 7200) == 7200);
+    H32_CHECK(power_decide(policy, 10, 0, power_mode_reduced).mode == power_mode_reduced);
+    H32_CHECK(power_decide(policy, 10, 0, power_mode_survival).mode == power_mode_survival);
+    H32_CHECK(power_decide(policy, 14.9, 2.0, power_mode_survival).mode == power_mode_survival);
+    H32_CHECK(power_decide(policy, 15, 2.0, power_mode_survival).mode == power_mode_charging);
+    H32_CHECK(power_decide(policy, 15, 0, power_mode_survival).mode == power_mode_reduced);
+
+    // a hysteresis of 0 leaves it at the threshold, a survival SoC of 0 turns it off
+    policy = make_policy(0);
+    H32_CHECK(power_decide(policy, 10, 0, power_mode_survival).mode == power_mode_reduced);
+    policy.survival_soc = 0;
+    policy.survival_hysteresis = 5;
+    H32_CHECK(power_decide(policy, 3, 0, power_mode_survival).mode == power_mode_reduced);
+  }
+
+  // Six weeks of solar power
+  const H32_Power_Policy with_hysteresis = make_policy(5);
+  const H32_Power_Policy without_hysteresis = make_policy(0);
+  printf("Six weeks with the policy:\n");
+  Simulation policy = simulate(&with_hysteresis, true);
+  Simulation flipping = simulate(&without_hysteresis, false);
+  Simulation fixed = simulate(NULL, false);
+  printf("Policy:          %5u wakes, %5u connections, sleep %u - %u s, SoC at least %.1f %%, %u min empty\n",
+         policy.wakes, policy.connections, policy.shortest_sleep, policy.longest_sleep, policy.min_soc, policy.empty_minutes);
+  printf("Fixed sleep:     %5u wakes, %5u connections, SoC at least %.1f %%, %u min empty\n",
+         fixed.wakes, fixed.connections, fixed.min_soc, fixed.empty_minutes);
+  printf("Survival mode entered %u times with a hysteresis of %u %%, %u times without\n",
+         policy.survival_entries, with_hysteresis.survival_hysteresis, flipping.survival_entries);
+
+  // The policy keeps the H32 alive through the dark week, a fixed sleep
+  // time does not
+  H32_CHECK(policy.empty_minutes == 0 && policy.min_soc > 0);
+  H32_CHECK(fixed.empty_minutes > 0 && fixed.min_soc == 0);
+  // it sleeps longer when the battery is low, shorter while charging
+  H32_CHECK(policy.longest_sleep == with_hysteresis.survival_sleeptime && policy.shortest_sleep == sleeptime / 2);
+  // Without a hysteresis survival mode is left as soon as the SoC touches
+  // the threshold in the weak sun of week 5, and entered again after a few
+  // connections
+  H32_CHECK(policy.survival_entries >= 1 && flipping.survival_entries >= 5 * policy.survival_entries);
+  H32_CHECK(policy.lowest_exit >= 15 && flipping.lowest_exit < 10.1);
+  H32_CHECK(flipping.empty_minutes == 0);
+
+  return h32_test_end();
+}
@@ -0,0 +1,125 @@
+/*
+ * The profiler of H32_Profiler.h with a fake clock: the sums of the phases,
+ * nested phases and a clock that wraps, then the ring of the last profiles
+ * as it is stored in LittleFS, when it wraps and when the file is corrupt.
+ */
+#include "h32_test.h"
+#include "H32_Profiler.h"
+
+uint32_t fake_us = 0;
+
+uint32_t fake_clock() {
+  return fake_us;
+}
+
+H32_Profile make_profile(uint32_t cycle) {
+  H32_Profile profile = {};
+  profile.cycle = cycle;
+  for(int i = 0; i < phase_num; i++) {
+    profile.phase_us[i] = cycle * 1000 + i;
+  }
+  return profile;
+}
+
+int main() {
+  // Every microsecond goes to exactly one phase
+  {
+    fake_us = 0;
+    H32_Profiler profiler(fake_clock);
+    fake_us = 1500;
+    H32_CHECK(profiler.enter(phase_config) == phase_other);
+    fake_us += 2000;
+    profiler.enter(phase_sensor);
+    fake_us += 30000;
+    profiler.enter(phase_wifi);
+    fake_us += 400000;
+    // a phase inside another one, as with phase_begin() and phase_end()
+    H32_Phase previous = profiler.enter(phase_upload);
+    fake_us += 120000;
+    H32_CHECK(profiler.enter(previous) == phase_upload);
+    fake_us += 100000;
+    profiler.enter(phase_alarm);
+    fake_us += 5000;
+    const H32_Profile &profile = profiler.finish();
+    H32_CHECK(profile.phase_us[phase_other] == 1500 && profile.phase_us[phase_config] == 2000);
+    H32_CHECK(profile.phase_us[phase_sensor] == 30000 && profile.phase_us[phase_wifi] == 500000);
+    H32_CHECK(profile.phase_us[phase_upload] == 120000 && profile.phase_us[phase_alarm] == 5000);
+    H32_CHECK(profile.total_us() == fake_us);
+    // a phase entered again adds up
+    fake_us += 7000;
+    profiler.enter(phase_sensor);
+    H32_CHECK(profiler.profile.phase_us[phase_alarm] == 12000 && profiler.profile.total_us() == fake_us);
+  }
+
+  // micros() wraps after 71 minutes
+  {
+    fake_us = UINT32_MAX - 999;
+    H32_Profiler profiler(fake_clock);
+    profiler.enter(phase_wifi);
+    fake_us += 3000;
+    profiler.enter(phase_upload);
+    H32_CHECK(fake_us == 2000 && profiler.profile.phase_us[phase_wifi] == 3000);
+  }
+
+  // The charge of a phase, 130 mA for an hour of WiFi
+  H32_CHECK(phase_mAh(phase_wifi, 3600000) == 130.0);
+
+  // The ring keeps the last profile_ring_size profiles, the newest first
+  {
+    H32_Profile_Ring ring;
+    H32_CHECK(ring.isValid() && ring.count == 0 && ring.get(0) == NULL);
+    for(uint32_t cycle = 0; cycle < 5; cycle++) {
+      ring.push(make_profile(cycle));
+    }
+    H32_CHECK(ring.count == 5 && ring.get(0)->cycle == 4 && ring.get(4)->cycle == 0 && ring.get(5) == NULL);
+    for(uint32_t cycle = 5; cycle < 40; cycle++) {
+      ring.push(make_profile(cycle));
+      H32_CHECK(ring.isValid() && ring.get(0)->cycle == cycle);
+    }
+    H32_CHECK(ring.count == profile_ring_size && ring.head == 40 % profile_ring_size);
+    for(uint8_t i = 0; i < profile_ring_size; i++) {
+      H32_CHECK(ring.get(i)->cycle == 39u - i && ring.get(i)->phase_us[phase_alarm] == (39u - i) * 1000 + phase_alarm);
+    }
+    H32_CHECK(ring.get(profile_ring_size) == NULL);
+
+    // the image of the file is read back unchanged
+    H32_Profile_Ring read;
+    memcpy(&read, &ring, sizeof(ring));
+    H32_CHECK(read.validate(sizeof(read)) && memcmp(&read, &ring, sizeof(ring)) == 0);
+  }
+
+  // A corrupt file gives an empty ring, which is used further
+  {
+    H32_Profile_Ring ring;
+    for(uint32_t cycle = 0; cycle < 3; cycle++) {
+      ring.push(make_profile(cycle));
+    }
+    const H32_Profile_Ring stored = ring;
+    uint8_t *bytes = (uint8_t *)&ring;
+
+    // an interrupted write
+    H32_CHECK(!ring.validate(sizeof(ring) - 1) && ring.count == 0 && ring.isValid());
+    H32_CHECK(!ring.validate(0) && ring.count == 0);
+    // another file or format
+    ring = stored;
+    bytes[0] ^= 0xFF;
+    H32_CHECK(!ring.validate(sizeof(ring)) && ring.count == 0);
+    // head or count out of range
+    ring = stored;
+    ring.head = profile_ring_size;
+    H32_CHECK(!ring.validate(sizeof(ring)) && ring.count == 0);
+    ring = stored;
+    ring.count = profile_ring_size + 1;
+    H32_CHECK(!ring.validate(sizeof(ring)) && ring.count == 0);
+    // head and count do not fit together: get() would return slots that
+    // were never written
+    ring = stored;
+    ring.count = 7;
+    H32_CHECK(!ring.validate(sizeof(ring)) && ring.count == 0);
+    // after the reset the next profile is the first one
+    ring.push(make_profile(9));
+    H32_CHECK(ring.count == 1 && ring.get(0)->cycle == 9 && ring.get(1) == NULL);
+  }
+
+  return h32_test_end();
+}
@@ -0,0 +1,231 @@
+/*
+ * Report by exception (H32_Report.h) over time series, with the wake state
+ * updated like the sketch does after an upload: the deadband and the
+ * hysteresis of a moving reading, settling, the heartbeat, a clock that
+ * goes back and the extra slots of the other measurements. Then a day of
+ * recorded indoor readings, where every wake without a report has to be
+ * within the bands of the last report.
+ */
+#include "h32_test.h"
+#include "H32_Report.h"
+
+const uint32_t day_start = 1792195200;   // 2026-10-17 00:00:00 UTC
+
+/*
+ * A wake: decide and, if there is a report, remember what has been sent
+ */
+H32_Report_Reason wake(H32_Wake_State &state, const float *values, const H32_Deadband *bands,
+                       uint32_t now, uint32_t heartbeat) {
+  H32_Report_Reason reason = report_decide(state, values, bands, now, heartbeat);
+  if(reason != report_none) {
+    state.setLastUpload(now);
+    for(uint8_t reading = 0; reading < reading_max; reading++) {
+      if(!isnan(values[reading])) {
+        state.setReported((H32_Reading)reading, values[reading]);
+      }
+    }
+  }
+  return reason;
+}
+
+/*
+ * All readings missing and ignored, but the one given
+ */
+void only(H32_Reading reading, float value, H32_Deadband band, float *values, H32_Deadband *bands) {
+  for(uint8_t i = 0; i < reading_max; i++) {
+    values[i] = NAN;
+    bands[i] = {0, 0};
+  }
+  values[reading] = value;
+  bands[reading] = band;
+}
+
+/*
+ * The temperature and the humidity of a room every 30 minutes over a day,
+ * with the heating starting in the morning and a window opened at noon
+ */
+const float recorded_temperature[48] = {
+  19.62, 19.58, 19.55, 19.51, 19.49, 19.46, 19.44, 19.41, 19.40, 19.38, 19.37, 19.35,
+  19.52, 19.88, 20.31, 20.72, 21.04, 21.22, 21.31, 21.35, 21.38, 21.36, 21.40, 21.37,
+  20.12, 19.64, 20.05, 20.58, 20.91, 21.10, 21.21, 21.27, 21.30, 21.33, 21.31, 21.34,
+  21.30, 21.32, 21.29, 21.31, 21.10, 20.84, 20.55, 20.31, 20.12, 19.98, 19.86, 19.77,
+};
+const float recorded_humidity[48] = {
+  52.1, 52.2, 52.1, 52.3, 52.4, 52.3, 52.4, 52.5, 52.4, 52.5, 52.6, 52.5,
+  52.0, 51.2, 50.1, 49.0, 48.2, 47.9, 47.6, 47.5, 47.6, 47.4, 47.5, 47.4,
+  55.8, 58.1, 54.0, 50.9, 49.3, 48.5, 48.1, 47.9, 47.8, 47.8, 47.7, 47.8,
+  47.8, 47.7, 47.9, 47.8, 48.3, 49.0, 49.8, 50.5, 51.0, 51.4, 51.7, 51.9,
+};
+
+int main() {
+  // The first wake reports, a change of exactly the deadband too. While
+  // the reading moves, a change of the deadband minus the hysteresis is
+  // reported.
+  {
+    H32_Wake_State state;
+    float values[reading_max];
+    H32_Deadband bands[reading_max];
+    const H32_Deadband band = {0.5, 0.25};
+    uint32_t now = day_start;
+    only(reading_temperature, 20.0, band, values, bands);
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_first && !state.isMoving(reading_temperature));
+
+    // a ramp of 0.125 per wake
+    uint32_t reports = 0;
+    for(uint8_t step = 1; step <= 12; step++) {
+      now += 60;
+      values[reading_temperature] = 20.0 + step * 0.125;
+      H32_Report_Reason reason = wake(state, values, bands, now, 3600);
+      bool expected = step == 4 || (step > 4 && step % 2 == 0);
+      H32_CHECK((reason == report_change) == expected && (reason == report_none) == !expected);
+      reports += reason != report_none;
+    }
+    H32_CHECK(reports == 5 && state.isMoving(reading_temperature) && state.getReported(reading_temperature) == 21.5);
+
+    // it stops, a change within the smaller band is still reported while
+    // it is moving
+    now += 60;
+    values[reading_temperature] = 21.5;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_none && state.isMoving(reading_temperature));
+
+    // the heartbeat finds it within the band, it has settled
+    now += 3600;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_heartbeat && !state.isMoving(reading_temperature));
+    now += 60;
+    values[reading_temperature] = 21.75;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_none);
+    now += 60;
+    values[reading_temperature] = 21.0;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_change && state.isMoving(reading_temperature));
+  }
+
+  // A hysteresis larger than the deadband is taken as the deadband, a
+  // negative one as 0
+  {
+    H32_CHECK(report_exceeds(20.01, 20.0, true, {0.5, 0.75}) && !report_exceeds(20.0, 20.0, true, {0.5, 0.75}));
+    H32_CHECK(!report_exceeds(20.25, 20.0, true, {0.5, -1}) && report_exceeds(20.5, 20.0, true, {0.5, -1}));
+    H32_CHECK(report_exceeds(19.5, 20.0, false, {0.5, 0.25}) && !report_exceeds(19.75, 20.0, false, {0.5, 0.25}));
+  }
+
+  // Without a change the heartbeat reports, every sixth wake of 10 minutes
+  {
+    H32_Wake_State state;
+    float values[reading_max];
+    H32_Deadband bands[reading_max];
+    only(reading_humidity, 50.0, {2.0, 1.0}, values, bands);
+    uint32_t now = day_start;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_first);
+    for(uint8_t i = 1; i <= 24; i++) {
+      now += 600;
+      H32_Report_Reason reason = wake(state, values, bands, now, 3600);
+      H32_CHECK(reason == (i % 6 == 0 ? report_heartbeat : report_none));
+    }
+    H32_CHECK(state.getLastUpload() == day_start + 4 * 3600);
+
+    // the RTC has been set back, e.g., after it lost its time
+    now = day_start - 86400;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_heartbeat && state.getLastUpload() == now);
+    now += 600;
+    H32_CHECK(wake(state, values, bands, now, 3600) == report_none);
+  }
+
+  // Failed readings never cause a report, ignored ones neither. A reading
+  // that has never been reported does.
+  {
+    H32_Wake_State state;
+    float values[reading_max];
+    H32_Deadband bands[reading_max];
+    only(reading_temperature, 20.0, {0.5, 0.25}, values, bands);
+    H32_CHECK(wake(state, values, bands, day_start, 3600) == report_first);
+    values[reading_temperature] = NAN;
+    values[reading_batV] = 3.9;
+    H32_CHECK(wake(state, values, bands, day_start + 60, 3600) == report_none);
+    H32_CHECK(state.getReported(reading_temperature) == 20.0 && isnan(state.getReported(reading_batV)));
+    bands[reading_batV] = {0.05, 0};
+    H32_CHECK(wake(state, values, bands, day_start + 120, 3600) == report_change);
+    H32_CHECK(state.getReported(reading_batV) == 3.9f && !state.isMoving(reading_batV));
+  }
+
+  // The other measurements are reported in the extra slots, found by the
+  // key of their name
+  {
+    H32_Wake_State state;
+    uint16_t soil = report_key("Soil Moisture");
+    uint16_t tank = report_key("Tank Level");
+    H32_CHECK(soil != 0 && tank != 0 && soil != tank);
+    H32_Reading soil_reading = state.extraReading(soil);
+    H32_Reading tank_reading = state.extraReading(tank);
+    H32_CHECK(soil_reading == reading_num && tank_reading == reading_num + 1);
+    H32_CHECK(state.extraReading(soil) == soil_reading && isnan(state.getReported(soil_reading)));
+
+    float values[reading_max];
+    H32_Deadband bands[reading_max];
+    only(soil_reading, 1.25, {0.1, 0.05}, values, bands);
+    values[tank_reading] = 0.5;
+    bands[tank_reading] = {0.25, 0};
+    H32_CHECK(wake(state, values, bands, day_start, 3600) == report_first);
+    H32_CHECK(state.getReported(soil_reading) == 1.25 && state.getReported(tank_reading) == 0.5);
+    values[soil_reading] = 1.125;
+    H32_CHECK(wake(state, values, bands, day_start + 60, 3600) == report_change && state.isMoving(soil_reading));
+    H32_CHECK(state.getReported(tank_reading) == 0.5 && state.getReported(soil_reading) == 1.125);
+
+    // the soil channel is renamed: its slot is freed, the new name starts
+    // as never reported and causes a report
+    state.keepExtra(1 << tank_reading);
+    H32_CHECK(!state.isMoving(soil_reading));
+    H32_Reading renamed = state.extraReading(report_key("Soil"));
+    H32_CHECK(renamed == soil_reading && isnan(state.getReported(renamed)));
+    only(tank_reading, 0.5, {0.25, 0}, values, bands);
+    values[renamed] = 1.125;
+    bands[renamed] = {0.1, 0.05};
+    H32_CHECK(wake(state, values, bands, day_start + 120, 3600) == report_change);
+
+    // all slots taken
+    for(uint8_t slot = 2; slot < reading_extra_num; slot++) {
+      H32_CHECK(state.extraReading(1000 + slot) == reading_num + slot);
+    }
+    H32_CHECK(state.extraReading(999) == reading_max && state.extraReading(tank) == tank_reading);
+  }
+
+  // A recorded day, a wake every 30 minutes. Every wake without a report
+  // is within the bands of the last one, and the heartbeat of 3 hours is
+  // kept.
+  {
+    H32_Wake_State state;
+    float values[reading_max];
+    H32_Deadband bands[reading_max];
+    only(reading_temperature, NAN, {0.2, 0.1}, values, bands);
+    bands[reading_humidity] = {2.0, 1.0};
+    const uint32_t heartbeat = 3 * 3600;
+    uint32_t reports = 0;
+    uint32_t changes = 0;
+    uint32_t longest = 0;
+    for(uint8_t i = 0; i < 48; i++) {
+      uint32_t now = day_start + i * 1800;
+      uint32_t last = state.getLastUpload();
+      bool moving[2] = {state.isMoving(reading_temperature), state.isMoving(reading_humidity)};
+      values[reading_temperature] = recorded_temperature[i];
+      values[reading_humidity] = recorded_humidity[i];
+      H32_Report_Reason reason = wake(state, values, bands, now, heartbeat);
+      if(reason == report_none) {
+        for(uint8_t r = 0; r < 2; r++) {
+          H32_Reading reading = r == 0 ? reading_temperature : reading_humidity;
+          float width = moving[r] ? bands[reading].deadband - bands[reading].hysteresis : bands[reading].deadband;
+          H32_CHECK(fabsf(values[reading] - state.getReported(reading)) < width);
+        }
+        H32_CHECK(now - state.getLastUpload() < heartbeat);
+      } else {
+        reports++;
+        changes += reason == report_change;
+        if(last != 0) {
+          longest = now - last > longest ? now - last : longest;
+        }
+      }
+    }
+    printf("Recorded day: %u reports (%u changes) in 48 wakes, at most %u minutes apart\n",
+           reports, changes, longest / 60);
+    H32_CHECK(reports < 48 && changes > 0 && longest <= heartbeat);
+  }
+
+  return h32_test_end();
+}
@@ -0,0 +1,129 @@
+/*
+ * The RTC interface of H32_RTC.h with the simulated backend. Wake cycles
+ * as by H32_RTC.ino: load the registers, take the wake cause, stop the
+ * wake-up, plan the next one with the capabilities of the backend and
+ * commit it. The simulated time then runs until the RTC wakes the H32.
+ * The wake cause has to tell the countdown from the alarm, the wake-up
+ * may not be early, and the RAM has to survive the cycles.
+ */
+#include <stdlib.h>
+
+#define H32_RTC_SIM
+#include "h32_test.h"
+#include "H32_RTC.h"
+
+const H32_RTC_Caps caps = {H32_RTC_Backend::countdown_max, H32_RTC_Backend::alarm_resolution};
+
+typedef struct Cycle {
+  uint8_t cause;        // of the wake-up that started the cycle
+  H32_Wake_Plan plan;   // of the next wake-up
+  uint32_t woken;       // the time of the next wake-up
+} Cycle;
+
+/*
+ * A wake cycle that counts itself in the RAM and sleeps for sleeptime,
+ * then the sleep until the RTC wakes us up (at most two days)
+ */
+Cycle wake_cycle(H32_RTC_Backend &rtc, uint32_t sleeptime, uint32_t align) {
+  Cycle cycle;
+  H32_CHECK(rtc.load() && rtc.loaded());
+  cycle.cause = rtc.wake_cause();
+  rtc.stop();
+  rtc.ram_set(0, rtc.ram_get(0) + 1);
+  tm time_info;
+  H32_CHECK(rtc.now(&time_info));
+  uint32_t now = schedule_epoch(&time_info);
+  cycle.plan = schedule_plan(now, sleeptime, align, caps);
+  if(cycle.plan.source == wake_by_alarm) {
+    schedule_civil(cycle.plan.wakeup, &time_info);
+    H32_CHECK(rtc.alarm_set(&time_info));
+  } else {
+    H32_CHECK(rtc.countdown_set(cycle.plan.source, cycle.plan.ticks));
+  }
+  H32_CHECK(rtc.commit());
+
+  // asleep
+  for(uint32_t slept = 0; slept < 2 * 86400; slept++) {
+    rtc.advance(1);
+    H32_CHECK(rtc.load());
+    if(rtc.wake_cause() != rtc_wake_none) {
+      break;
+    }
+  }
+  H32_CHECK(rtc.time_get(&time_info));
+  cycle.woken = schedule_epoch(&time_info);
+  return cycle;
+}
+
+int main() {
+  // The simulation does not depend on the time zone of the C library
+  setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+  tzset();
+
+  H32_RTC_Backend rtc;
+  tm time_info;
+
+  // Before the time is set the oscillator does not run
+  H32_CHECK(!rtc.loaded() && rtc.load() && !rtc.now(&time_info) && !rtc.time_get(&time_info));
+
+  // 2026-10-17 11:58:20, on a Saturday
+  uint32_t start = schedule_days_from_civil(2026, 10, 17) * 86400UL + 11 * 3600 + 58 * 60 + 20;
+  schedule_civil(start, &time_info);
+  H32_CHECK(rtc.time_set(&time_info) && rtc.load() && rtc.now(&time_info));
+  H32_CHECK(schedule_epoch(&time_info) == start && rtc.wake_cause() == rtc_wake_none);
+
+  // A short sleep uses the 64 Hz countdown
+  Cycle cycle = wake_cycle(rtc, 10, 0);
+  H32_CHECK(cycle.cause == rtc_wake_none && cycle.plan.source == wake_by_countdown_64hz);
+  H32_CHECK(cycle.woken == start + 10);
+
+  // The countdown woke us, the next wake-up is aligned to 5 minutes by
+  // the alarm
+  cycle = wake_cycle(rtc, 300, 300);
+  H32_CHECK(cycle.cause == rtc_wake_countdown && cycle.plan.source == wake_by_alarm);
+  H32_CHECK(cycle.woken == cycle.plan.wakeup && cycle.woken % 300 == 0 && cycle.woken > start + 10);
+  schedule_civil(cycle.woken, &time_info);
+  H32_CHECK(time_info.tm_hour == 12 && time_info.tm_min == 0 && time_info.tm_sec == 0);
+
+  // An aligned wake-up every 5 minutes for a day, the alarm wakes us at
+  // the boundaries, and the RAM counts the cycles
+  H32_CHECK(rtc.ram_get(0) == 2);
+  rtc.ram_set(rtc.ram_size - 1, 0xA5);
+  uint32_t previous = cycle.woken;
+  for(uint16_t i = 0; i < 288; i++) {
+    cycle = wake_cycle(rtc, 300, 300);
+    H32_CHECK(cycle.cause == rtc_wake_alarm && cycle.woken == previous + 300);
+    previous = cycle.woken;
+  }
+  H32_CHECK(rtc.load() && rtc.ram_get(0) == (uint8_t)(2 + 288) && rtc.ram_get(rtc.ram_size - 1) == 0xA5);
+
+  // The 1 Hz countdown up to its limit, beyond it the alarm
+  uint32_t before = previous;
+  cycle = wake_cycle(rtc, H32_RTC_Backend::countdown_max, 0);
+  H32_CHECK(cycle.cause == rtc_wake_alarm && cycle.plan.source == wake_by_countdown_1hz);
+  H32_CHECK(cycle.woken == before + H32_RTC_Backend::countdown_max);
+  before = cycle.woken;
+  cycle = wake_cycle(rtc, H32_RTC_Backend::countdown_max + 1, 0);
+  H32_CHECK(cycle.cause == rtc_wake_countdown && cycle.plan.source == wake_by_alarm);
+  H32_CHECK(cycle.woken == before + H32_RTC_Backend::countdown_max + 1);
+
+  // stop() acknowledges the wake-up and disarms the RTC
+  H32_CHECK(rtc.load() && rtc.wake_cause() == rtc_wake_alarm);
+  rtc.stop();
+  H32_CHECK(rtc.commit());
+  rtc.advance(3 * 86400);
+  H32_CHECK(rtc.load() && rtc.wake_cause() == rtc_wake_none);
+
+  // Countdowns out of range are refused
+  H32_CHECK(!rtc.countdown_set(wake_by_countdown_1hz, 0));
+  H32_CHECK(!rtc.countdown_set(wake_by_countdown_1hz, H32_RTC_Backend::countdown_max + 1));
+  H32_CHECK(!rtc.countdown_set(wake_by_alarm, 10));
+
+  // reset() disarms the RTC, the time goes on
+  rtc.countdown_set(wake_by_countdown_1hz, 5);
+  H32_CHECK(rtc.reset());
+  rtc.advance(10);
+  H32_CHECK(rtc.load() && rtc.wake_cause() == rtc_wake_none && rtc.now(&time_info));
+
+  return h32_test_end();
+}
@@ -0,0 +1,177 @@
+/*
+ * The calendar arithmetic and the wake-up planning of H32_Schedule.h:
+ * schedule_civil() and schedule_epoch() against gmtime() and timegm() for
+ * every day the RTC can hold, and schedule_plan() with the capabilities of
+ * the PCF85063A and the RX8010SJ around month and year boundaries. No
+ * wake-up may come before its target, and an alarm may not match an
+ * earlier day of the month.
+ */
+#include <time.h>
+#include <vector>
+
+#include "h32_test.h"
+#include "H32_Schedule.h"
+
+const H32_RTC_Caps caps_pcf85063a = {255, 1};
+const H32_RTC_Caps caps_rx8010sj = {65535, 60};
+
+bool same_tm(const tm &a, const tm &b) {
+  return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday
+      && a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec
+      && a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday;
+}
+
+/*
+ * Both directions against the C library for one epoch
+ */
+bool civil_matches(uint32_t epoch) {
+  time_t t = epoch;
+  tm expected, actual;
+  gmtime_r(&t, &expected);
+  schedule_civil(epoch, &actual);
+  return same_tm(expected, actual) && schedule_epoch(&expected) == epoch
+      && (uint32_t)timegm(&actual) == epoch;
+}
+
+/*
+ * The first time after now at which an alarm set to the day of the month,
+ * hour, minute and second (or minute only) of wakeup matches
+ */
+uint32_t first_match(uint32_t now, uint32_t wakeup) {
+  time_t t = wakeup;
+  tm target;
+  gmtime_r(&t, &target);
+  uint32_t time_of_day = wakeup % 86400;
+  for(uint32_t day = now / 86400; day <= wakeup / 86400; day++) {
+    uint32_t candidate = day * 86400 + time_of_day;
+    t = candidate;
+    tm found;
+    gmtime_r(&t, &found);
+    if(candidate > now && found.tm_mday == target.tm_mday) {
+      return candidate;
+    }
+  }
+  return 0;
+}
+
+/*
+ * The epochs of the first of every month of the given years
+ */
+std::vector<uint32_t> month_starts(int from, int to) {
+  std::vector<uint32_t> starts;
+  for(int year = from; year <= to; year++) {
+    for(int month = 0; month < 12; month++) {
+      tm time_info = {};
+      time_info.tm_year = year - 1900;
+      time_info.tm_mon = month;
+      time_info.tm_mday = 1;
+      starts.push_back(timegm(&time_info));
+    }
+  }
+  return starts;
+}
+
+/*
+ * Plan every combination and check it against the target
+ */
+bool check_plans(const char *chip, const H32_RTC_Caps &caps) {
+  static const uint32_t sleeptimes[] = {
+    1, 2, 59, 60, 61, 254, 255, 256, 1023, 1024, 1025, 3600, 65535, 65536, 86400,
+    27 * 86400 - 1, 27 * 86400, 27 * 86400 + 1, 28 * 86400, 31 * 86400,
+    65535 * 60, 65535 * 60 + 1, 100000000,
+  };
+  static const uint32_t aligns[] = {0, 1, 60, 300, 900, 3600, 86400};
+  static const uint32_t before[] = {1, 30, 59, 3600, 3 * 86400 + 17};
+  uint32_t horizon = caps.countdown_max * 60 > schedule_alarm_horizon ? caps.countdown_max * 60 : schedule_alarm_horizon;
+  uint32_t plans = 0, sources[4] = {0};
+  uint32_t failures = h32_test_failures;
+
+  for(uint32_t start : month_starts(1999, 2030)) {
+    for(uint32_t offset : before) {
+      uint32_t now = start - offset;
+      for(uint32_t sleeptime : sleeptimes) {
+        for(uint32_t align : aligns) {
+          H32_Wake_Plan plan = schedule_plan(now, sleeptime, align, caps);
+          plans++;
+          sources[plan.source]++;
+          uint32_t target = align > 0 ? schedule_align(now, sleeptime, align) : now + sleeptime;
+          bool shortened = target - now > horizon;
+          if(shortened) {
+            target = now + horizon;
+          }
+          uint32_t slack = plan.source == wake_by_alarm ? caps.alarm_resolution
+                         : plan.source == wake_by_countdown_1min ? 60 : 1;
+          // never before the target, and late by less than the resolution
+          H32_CHECK(plan.wakeup >= target && plan.wakeup < target + slack);
+          H32_CHECK(plan.wakeup > now);
+          if(align > 0 && !shortened && slack == 1) {
+            H32_CHECK(plan.wakeup % align == 0);
+          }
+          switch(plan.source) {
+          case wake_by_alarm:
+            H32_CHECK(plan.ticks == 0 && plan.wakeup % caps.alarm_resolution == 0);
+            H32_CHECK(first_match(now, plan.wakeup) == plan.wakeup);
+            break;
+          case wake_by_countdown_64hz:
+            H32_CHECK(plan.ticks > 0 && plan.ticks <= caps.countdown_max && plan.ticks % 64 == 0);
+            H32_CHECK(plan.wakeup == now + plan.ticks / 64);
+            break;
+          case wake_by_countdown_1hz:
+            H32_CHECK(plan.ticks > 0 && plan.ticks <= caps.countdown_max);
+            H32_CHECK(plan.wakeup == now + plan.ticks);
+            break;
+          case wake_by_countdown_1min:
+            H32_CHECK(plan.ticks > 0 && plan.ticks <= caps.countdown_max);
+            H32_CHECK(plan.wakeup == now + plan.ticks * 60);
+            break;
+          }
+        }
+      }
+    }
+  }
+  printf("%-10s %7u plans: alarm %u, 64 Hz %u, 1 Hz %u, 1/60 Hz %u: %s\n", chip, plans,
+         sources[wake_by_alarm], sources[wake_by_countdown_64hz], sources[wake_by_countdown_1hz],
+         sources[wake_by_countdown_1min], failures == (uint32_t)h32_test_failures ? "ok" : "FAILED");
+  return failures == (uint32_t)h32_test_failures;
+}
+
+int main() {
+  // Every day up to the end of 32 bits, at its first and last second
+  uint32_t days = 0;
+  for(uint64_t day = 0; day * 86400 + 86399 <= UINT32_MAX; day++, days++) {
+    H32_CHECK(civil_matches(day * 86400) && civil_matches(day * 86400 + 86399));
+  }
+  // Every second of some month and year boundaries, including leap days
+  for(uint32_t start : month_starts(1999, 2001)) {
+    for(uint32_t epoch = start - 3600; epoch < start + 3600; epoch++) {
+      H32_CHECK(civil_matches(epoch));
+    }
+  }
+  H32_CHECK(civil_matches(951782400));    // 2000-02-29
+  H32_CHECK(civil_matches(UINT32_MAX));   // 2106-02-07 06:28:15
+  printf("civil time matches the C library on %u days\n", days);
+
+  // Some plans by hand: the 8 bit countdown of the PCF85063A
+  H32_Wake_Plan plan = schedule_plan(1700000000, 3, 0, caps_pcf85063a);
+  H32_CHECK(plan.source == wake_by_countdown_64hz && plan.ticks == 192);
+  plan = schedule_plan(1700000000, 200, 0, caps_pcf85063a);
+  H32_CHECK(plan.source == wake_by_countdown_1hz && plan.ticks == 200);
+  plan = schedule_plan(1700000000, 600, 0, caps_pcf85063a);
+  H32_CHECK(plan.source == wake_by_alarm && plan.wakeup == 1700000600);
+  // the alarm of the RX8010SJ rounds up to the full minute
+  plan = schedule_plan(1700000000, 70010, 0, caps_rx8010sj);
+  H32_CHECK(plan.source == wake_by_alarm && plan.wakeup == 1700070060);
+  // and is used for an aligned wake-up on a full minute
+  plan = schedule_plan(1700000000, 300, 300, caps_rx8010sj);
+  H32_CHECK(plan.source == wake_by_alarm && plan.wakeup == 1700000100);
+  // beyond the alarm the 1/60 Hz countdown of the RX8010SJ takes over,
+  // the PCF85063A is shortened to the alarm horizon
+  plan = schedule_plan(1700000000, 40 * 86400, 0, caps_rx8010sj);
+  H32_CHECK(plan.source == wake_by_countdown_1min && plan.ticks == 40 * 1440);
+  plan = schedule_plan(1700000000, 40 * 86400, 0, caps_pcf85063a);
+  H32_CHECK(plan.source == wake_by_alarm && plan.wakeup == 1700000000 + schedule_alarm_horizon);
+
+  check_plans("PCF85063A", caps_pcf85063a);
+  check_plans("RX8010SJ", caps_rx8010sj);
+  return h32_test_end();
+}
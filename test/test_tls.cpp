@@ -0,0 +1,329 @@
+/*
+ * The TLS client (H32_TLS.h) on the stand-in of mbedTLS in host/mbedtls,
+ * against a server that answers its flights one round trip later on the
+ * virtual clock. It counts the bytes and round trips of a full and of a
+ * resumed handshake, checks that a session is only stored when it changed,
+ * and that a server whose certificate does not match the fingerprint never
+ * gets any application data.
+ */
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+#include "h32_test.h"
+#include "Client.h"
+#include "H32_TLS.h"
+
+/*
+ * A TLS server behind a Client, see host/mbedtls/ssl.h for the framing
+ */
+class Stand_In_TLS_Server : public Client {
+public:
+  uint32_t rtt_ms = 80;
+  std::string certificate;
+  bool tickets = true;      // issues session tickets
+  bool rotate = false;      // a new ticket with every resumption
+  bool plain = false;       // without TLS
+
+  uint32_t connects = 0;
+  uint32_t full = 0;
+  uint32_t resumed = 0;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  std::string application;  // received
+  std::string hostname;     // of the last ClientHello
+
+private:
+  typedef struct Flight {
+    uint64_t ready_us;
+    std::string bytes;
+  } Flight;
+
+  bool open = false;
+  std::string in;
+  std::deque<Flight> out;
+  std::set<std::string> issued;
+  uint32_t next_ticket = 1;
+  bool awaiting = false;    // the Finished of the client in a full handshake
+
+  std::string ticket() {
+    std::string ticket = "ticket-" + std::to_string(next_ticket++);
+    ticket.resize(160, '\0');
+    issued.insert(ticket);
+    std::string flight;
+    stand_in_record(flight, record_handshake, stand_in_message(message_session_ticket, stand_in_field(ticket), 0));
+    return flight;
+  };
+  std::string finished() {
+    std::string flight;
+    stand_in_record(flight, record_change_cipher, std::string(1, '\1'));
+    stand_in_record(flight, record_handshake, stand_in_message(message_finished, "", stand_in_finished));
+    return flight;
+  };
+  void send(const std::string &flight) {
+    out.push_back({host_time_us + rtt_ms * 1000ULL, flight});
+  };
+  void receive() {
+    uint8_t type;
+    std::string payload;
+    while(stand_in_next(in, type, payload)) {
+      if(type == record_application) {
+        application += payload.substr(stand_in_overhead);
+        // echoed back
+        std::string record;
+        stand_in_record(record, record_application, payload);
+        send(record);
+        continue;
+      }
+      if(type != record_handshake || payload.empty()) {
+        continue;
+      }
+      size_t position = 1;
+      if(payload[0] == message_client_hello) {
+        hostname = stand_in_field_at(payload, position);
+        std::string offered = stand_in_field_at(payload, position);
+        std::string flight;
+        if(tickets && issued.count(offered) != 0) {
+          resumed++;
+          stand_in_record(flight, record_handshake, stand_in_message(message_server_hello, "\1", stand_in_server_hello));
+          if(rotate) {
+            issued.erase(offered);
+            flight += ticket();
+          }
+        } else {
+          full++;
+          stand_in_record(flight, record_handshake, stand_in_message(message_server_hello, std::string(1, '\0'), stand_in_server_hello));
+          stand_in_record(flight, record_handshake, stand_in_message(message_certificate, stand_in_field(certificate),
+                                                                     certificate.size() + 3 + stand_in_intermediate));
+          stand_in_record(flight, record_handshake, stand_in_message(message_key_exchange, "", stand_in_key_exchange));
+          stand_in_record(flight, record_handshake, stand_in_message(message_hello_done, "", 4));
+          send(flight);
+          awaiting = true;
+          continue;
+        }
+        send(flight + finished());
+      } else if(payload[0] == message_finished && awaiting) {
+        // the Finished of a full handshake
+        send((tickets ? ticket() : "") + finished());
+        awaiting = false;
+      }
+    }
+  };
+public:
+  int connect(const char *host, uint16_t port) override {
+    delay(rtt_ms);
+    connects++;
+    open = true;
+    in.clear();
+    out.clear();
+    awaiting = false;
+    return 1;
+  };
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if(!open) {
+      return 0;
+    }
+    bytes_in += size;
+    if(plain) {
+      application.append((const char *)buffer, size);
+      return size;
+    }
+    in.append((const char *)buffer, size);
+    receive();
+    return size;
+  };
+  int available() override {
+    int num = 0;
+    for(const Flight &flight : out) {
+      if(flight.ready_us > host_time_us) {
+        break;
+      }
+      num += flight.bytes.size();
+    }
+    return num;
+  };
+  int read(uint8_t *buffer, size_t size) override {
+    size_t count = 0;
+    while(count < size && available() > 0) {
+      buffer[count++] = out.front().bytes[0];
+      out.front().bytes.erase(0, 1);
+      if(out.front().bytes.empty()) {
+        out.pop_front();
+      }
+    }
+    bytes_out += count;
+    return count;
+  };
+  int read() override {
+    uint8_t byte;
+    return read(&byte, 1) == 1 ? byte : -1;
+  };
+  int peek() override { return available() > 0 ? (uint8_t)out.front().bytes[0] : -1; };
+  void stop() override {
+    open = false;
+    out.clear();
+  };
+  uint8_t connected() override { return open; };
+};
+
+/*
+ * The sessions in memory, as H32_TLS_NVS keeps them in NVS
+ */
+class Memory_Session_Store : public H32_TLS_Session_Store {
+public:
+  std::map<std::string, std::string> sessions;
+  uint32_t saves = 0;
+
+  static std::string key(const char *host, uint16_t port) { return std::string(host) + ":" + std::to_string(port); };
+  bool load(const char *host, uint16_t port, uint8_t *data, size_t &length) override {
+    auto session = sessions.find(key(host, port));
+    if(session == sessions.end() || session->second.size() > length) {
+      return false;
+    }
+    length = session->second.size();
+    memcpy(data, session->second.data(), length);
+    return true;
+  };
+  bool save(const char *host, uint16_t port, const uint8_t *data, size_t length) override {
+    sessions[key(host, port)] = std::string((const char *)data, length);
+    saves++;
+    return true;
+  };
+};
+
+const char *host = "api.example.com";
+
+std::string fingerprint_of(const std::string &certificate) {
+  uint8_t hash[32];
+  SHA256((const uint8_t *)certificate.data(), certificate.size(), hash);
+  std::string text;
+  char digits[4];
+  for(uint8_t i = 0; i < sizeof(hash); i++) {
+    snprintf(digits, sizeof(digits), i == 0 ? "%02X" : ":%02X", hash[i]);
+    text += digits;
+  }
+  return text;
+}
+
+std::string make_certificate(uint8_t seed) {
+  std::string certificate(1200, '\0');
+  for(size_t i = 0; i < certificate.size(); i++) {
+    certificate[i] = (char)(i * 31 + seed);
+  }
+  return certificate;
+}
+
+typedef struct Handshake {
+  bool connected;
+  uint32_t sent;
+  uint32_t received;
+  uint32_t time_ms;
+} Handshake;
+
+/*
+ * Connect, send a request and read the answer, close
+ */
+Handshake connect(H32_TLS_Client &tls, Stand_In_TLS_Server &server) {
+  Handshake result = {tls.connect(host, 443) == 1, 0, 0, 0};
+  result.sent = tls.getHandshakeSent();
+  result.received = tls.getHandshakeReceived();
+  result.time_ms = tls.getHandshakeTime();
+  if(result.connected) {
+    const char *request = "POST /update HTTP/1.1\r\napi-key: secret\r\n\r\n";
+    H32_CHECK(tls.write((const uint8_t *)request, strlen(request)) == strlen(request));
+    delay(server.rtt_ms);
+    char answer[64] = {0};
+    H32_CHECK(tls.available() == (int)strlen(request));
+    H32_CHECK(tls.read((uint8_t *)answer, sizeof(answer) - 1) == (int)strlen(request));
+    H32_CHECK(strcmp(answer, request) == 0);
+  }
+  tls.stop();
+  return result;
+}
+
+int main() {
+  std::string certificate = make_certificate(1);
+  std::string fingerprint = fingerprint_of(certificate);
+  Memory_Session_Store store;
+
+  // The first connection takes a full handshake and stores its session,
+  // the next ones resume it in a single round trip
+  Stand_In_TLS_Server server;
+  server.certificate = certificate;
+  H32_TLS_Client tls(server);
+  H32_CHECK(tls.setTLS(true, fingerprint.c_str(), &store));
+  Handshake full = connect(tls, server);
+  H32_CHECK(full.connected && server.full == 1 && store.saves == 1 && server.hostname == host);
+  H32_CHECK(full.time_ms >= 2 * server.rtt_ms && full.time_ms < 3 * server.rtt_ms);
+  H32_CHECK(full.received > certificate.size() + stand_in_intermediate);
+  Handshake resumed = connect(tls, server);
+  H32_CHECK(resumed.connected && server.resumed == 1 && server.full == 1);
+  H32_CHECK(resumed.time_ms >= server.rtt_ms && resumed.time_ms < 2 * server.rtt_ms);
+  H32_CHECK(resumed.received < 300);
+  // the same session is not written again
+  H32_CHECK(store.saves == 1);
+  H32_CHECK(server.application.find("api-key: secret") != std::string::npos);
+
+  printf("round trip %u ms      sent  received  round trips\n", server.rtt_ms);
+  printf("full handshake     %6u %9u %12u\n", full.sent, full.received, full.time_ms / server.rtt_ms);
+  printf("resumed handshake  %6u %9u %12u\n", resumed.sent, resumed.received, resumed.time_ms / server.rtt_ms);
+
+  // A new ticket with the resumption is stored
+  server.rotate = true;
+  H32_CHECK(connect(tls, server).connected && server.resumed == 2 && store.saves == 2);
+  server.rotate = false;
+
+  // The server forgot its tickets: a full handshake, the new session is stored
+  Stand_In_TLS_Server restarted;
+  restarted.certificate = certificate;
+  H32_TLS_Client again(restarted);
+  again.setTLS(true, fingerprint.c_str(), &store);
+  H32_CHECK(connect(again, restarted).connected && restarted.full == 1 && store.saves == 3);
+  H32_CHECK(connect(again, restarted).connected && restarted.resumed == 1 && store.saves == 3);
+
+  // Another certificate: the connection is refused before any application
+  // data, no session is stored
+  {
+    Stand_In_TLS_Server impostor;
+    impostor.certificate = make_certificate(2);
+    Memory_Session_Store empty;
+    H32_TLS_Client pinned(impostor);
+    pinned.setTLS(true, fingerprint.c_str(), &empty);
+    H32_CHECK(!connect(pinned, impostor).connected && impostor.full == 1);
+    H32_CHECK(impostor.application.empty() && empty.saves == 0 && !pinned.connected());
+    H32_CHECK(pinned.write((const uint8_t *)"secret", 6) == 0 && impostor.application.empty());
+  }
+  // A resumed session carries the certificate of its full handshake, the
+  // changed fingerprint is checked against it
+  {
+    H32_TLS_Client repinned(restarted);
+    repinned.setTLS(true, fingerprint_of(make_certificate(3)).c_str(), &store);
+    size_t application = restarted.application.size();
+    H32_CHECK(!connect(repinned, restarted).connected && restarted.resumed == 2);
+    H32_CHECK(restarted.application.size() == application);
+  }
+
+  // Without a valid fingerprint no connection is made
+  {
+    Stand_In_TLS_Server unused;
+    unused.certificate = certificate;
+    H32_TLS_Client unpinned(unused);
+    H32_CHECK(!unpinned.setTLS(true, "AB:CD", &store));
+    H32_CHECK(!unpinned.setTLS(true, (fingerprint + "00").c_str(), &store));
+    H32_CHECK(unpinned.connect(host, 443) == 0 && unused.connects == 0);
+  }
+
+  // Without TLS the calls go to the plain client
+  {
+    Stand_In_TLS_Server server;
+    server.plain = true;
+    H32_TLS_Client passthrough(server);
+    H32_CHECK(passthrough.setTLS(false, "", NULL) && !passthrough.isTLS());
+    H32_CHECK(passthrough.connect(IPAddress(192, 168, 1, 2), 80) == 1 && server.connects == 1);
+    passthrough.write((const uint8_t *)"GET", 3);
+    H32_CHECK(server.application == "GET" && passthrough.getHandshakeReceived() == 0);
+  }
+
+  return h32_test_end();
+}
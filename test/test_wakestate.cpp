@@ -0,0 +1,165 @@
+/*
+ * Loading and storing the wake state (H32_WakeState.h) with an RTC and a
+ * shadow in memory: a corrupt copy of either, a stale shadow whose write
+ * was lost, and the PCF85063A whose RAM cannot take the header.
+ */
+#include <vector>
+
+#include "h32_test.h"
+#include "H32_WakeState.h"
+
+/*
+ * A copy of the state in memory. A storage of size 0 has no room for it,
+ * like the RAM of the PCF85063A.
+ */
+class Memory_Wake_Storage : public H32_Wake_Storage {
+public:
+  std::vector<uint8_t> image;
+  size_t size;
+  bool fail = false;        // the next writes are lost
+  uint32_t writes = 0;
+
+  Memory_Wake_Storage(size_t size) : image(size, 0xFF), size(size) {};
+
+  bool read(void *data, size_t length) override {
+    if(length > size) {
+      return false;
+    }
+    memcpy(data, image.data(), length);
+    return true;
+  };
+  bool write(const void *data, size_t length) override {
+    if(length > size || fail) {
+      return false;
+    }
+    memcpy(image.data(), data, length);
+    writes++;
+    return true;
+  };
+};
+
+bool same_content(const H32_Wake_State &a, const H32_Wake_State &b) {
+  return a.getLastUpload() == b.getLastUpload() && a.log_head == b.log_head
+      && memcmp(a.sink_tail, b.sink_tail, sizeof(a.sink_tail)) == 0
+      && a.power_mode == b.power_mode && a.moving == b.moving
+      && memcmp(a.reported, b.reported, sizeof(a.reported)) == 0;
+}
+
+/*
+ * A wake cycle: load the state, change it and store it
+ */
+uint8_t wake(Memory_Wake_Storage &rtc, Memory_Wake_Storage &shadow, H32_Wake_State &state,
+             uint32_t log_head, uint32_t last_upload) {
+  H32_Wake_Store store(rtc, shadow);
+  uint8_t source = store.load(state);
+  state.log_head = log_head;
+  state.setLastUpload(last_upload);
+  H32_CHECK(store.store(state) || (rtc.fail && shadow.fail));
+  return source;
+}
+
+int main() {
+  const uint8_t both = H32_Wake_Store::from_rtc | H32_Wake_Store::from_shadow;
+
+  // From scratch, then every cycle sees the state of the previous one
+  Memory_Wake_Storage rtc(sizeof(H32_Wake_Header)), shadow(sizeof(H32_Wake_State));
+  H32_Wake_State state;
+  H32_CHECK(wake(rtc, shadow, state, 10, 1700000000) == H32_Wake_Store::from_none);
+  H32_CHECK(state.getGeneration() == 1 && shadow.writes == 1);
+  H32_CHECK(wake(rtc, shadow, state, 11, 1700000600) == both);
+  H32_CHECK(state.getGeneration() == 2 && shadow.writes == 2);
+  H32_Wake_State expected = state;
+
+  // A cycle without a change does not write the shadow
+  H32_CHECK(wake(rtc, shadow, state, 11, 1700000600) == both);
+  H32_CHECK(state.getGeneration() == 2 && shadow.writes == 2);
+
+  // A corrupt RTC copy: the shadow has everything (the reserved byte is
+  // not covered by the CRC, the header stays valid)
+  for(size_t i = 0; i < sizeof(H32_Wake_Header); i++) {
+    Memory_Wake_Storage broken = rtc;
+    broken.image[i] ^= 0x10;
+    H32_Wake_Store store(broken, shadow);
+    H32_Wake_State loaded;
+    uint8_t source = store.load(loaded);
+    H32_CHECK(source == (i == offsetof(H32_Wake_Header, reserved) ? both : H32_Wake_Store::from_shadow));
+    H32_CHECK(same_content(loaded, expected) && loaded.getGeneration() == 2);
+  }
+
+  // A corrupt shadow: only the header of the RTC survives, the next store
+  // rewrites the shadow with a newer generation
+  for(size_t i = 0; i < sizeof(H32_Wake_State); i++) {
+    Memory_Wake_Storage rtc_copy = rtc, broken = shadow;
+    broken.image[i] ^= 0x10;
+    H32_Wake_Store store(rtc_copy, broken);
+    H32_Wake_State loaded;
+    H32_CHECK(store.load(loaded) == H32_Wake_Store::from_rtc);
+    H32_CHECK(loaded.getLastUpload() == 1700000600 && loaded.getGeneration() == 2);
+    H32_CHECK(loaded.log_head == 0 && isnan(loaded.getReported(reading_batV)));
+    loaded.log_head = 11;
+    H32_CHECK(store.store(loaded) && broken.writes == shadow.writes + 1);
+    H32_Wake_State reloaded;
+    H32_CHECK(H32_Wake_Store(rtc_copy, broken).load(reloaded) == both);
+    H32_CHECK(same_content(reloaded, expected) && reloaded.getGeneration() == 3);
+  }
+
+  // Both corrupt: from scratch
+  {
+    Memory_Wake_Storage rtc_copy = rtc, broken = shadow;
+    rtc_copy.image[5] ^= 1;
+    broken.image[9] ^= 1;
+    H32_Wake_State loaded;
+    H32_CHECK(H32_Wake_Store(rtc_copy, broken).load(loaded) == H32_Wake_Store::from_none);
+    H32_CHECK(same_content(loaded, H32_Wake_State()) && loaded.getGeneration() == 0);
+  }
+
+  // A stale shadow: its write is lost, the newer header of the RTC wins
+  // and the rest comes from the old shadow
+  {
+    Memory_Wake_Storage rtc_copy = rtc, stale = shadow;
+    H32_Wake_State written;
+    stale.fail = true;
+    wake(rtc_copy, stale, written, 12, 1700001200);
+    H32_CHECK(written.getGeneration() == 3);
+    stale.fail = false;
+    H32_Wake_State loaded;
+    H32_CHECK(H32_Wake_Store(rtc_copy, stale).load(loaded) == both);
+    H32_CHECK(loaded.getLastUpload() == 1700001200 && loaded.getGeneration() == 3);
+    H32_CHECK(loaded.log_head == 11);
+    // the next store brings the shadow up to date
+    H32_Wake_State next;
+    wake(rtc_copy, stale, next, 12, 1700001200);
+    H32_CHECK(next.getGeneration() == 4);
+    H32_CHECK(H32_Wake_Store(rtc_copy, stale).load(loaded) == both);
+    H32_CHECK(loaded.log_head == 12 && loaded.getGeneration() == 4);
+  }
+
+  // A lost write of the RTC: the shadow is newer and wins
+  {
+    Memory_Wake_Storage old_rtc = rtc, shadow_copy = shadow;
+    H32_Wake_State written;
+    old_rtc.fail = true;
+    wake(old_rtc, shadow_copy, written, 13, 1700001800);
+    old_rtc.fail = false;
+    H32_Wake_State loaded;
+    H32_CHECK(H32_Wake_Store(old_rtc, shadow_copy).load(loaded) == both);
+    H32_CHECK(loaded.getLastUpload() == 1700001800 && loaded.log_head == 13 && loaded.getGeneration() == 3);
+  }
+
+  // The PCF85063A has no room for the header: the shadow alone holds the
+  // state and is only written when it changes
+  Memory_Wake_Storage pcf(0), nvs(sizeof(H32_Wake_State));
+  H32_Wake_State pcf_state;
+  H32_CHECK(wake(pcf, nvs, pcf_state, 1, 1700000000) == H32_Wake_Store::from_none);
+  for(int i = 0; i < 10; i++) {
+    H32_CHECK(wake(pcf, nvs, pcf_state, 1, 1700000000) == H32_Wake_Store::from_shadow);
+  }
+  H32_CHECK(nvs.writes == 1 && pcf_state.getGeneration() == 1);
+  H32_CHECK(wake(pcf, nvs, pcf_state, 2, 1700000000) == H32_Wake_Store::from_shadow);
+  H32_CHECK(nvs.writes == 2 && pcf_state.getGeneration() == 2);
+  H32_Wake_State pcf_loaded;
+  H32_CHECK(H32_Wake_Store(pcf, nvs).load(pcf_loaded) == H32_Wake_Store::from_shadow);
+  H32_CHECK(pcf_loaded.log_head == 2);
+
+  return h32_test_end();
+}